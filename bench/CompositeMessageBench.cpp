@@ -0,0 +1,694 @@
+#include "composite_message.h"
+
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/benchmark/catch_benchmark.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/**
+ * Each benchmark processes a fixed number of elements, so time of iteration
+ * divided by element count (or message size) gives ns/element (or bytes/s).
+ * Sizes are included in benchmark names, so results of different versions
+ * can be compared from machine-readable output (-r xml or -r JSON)
+ */
+static const uint32_t VALUE_COUNT = 1024;
+static const uint32_t ARRAY_ITEMS = 4096;
+static const uint32_t STRING_COUNT = 256;
+static const char *STRING = "temperature/sensor";
+
+static void reverseBytes(uint8_t *data, uint32_t size) {
+    std::reverse(data, data + size);
+}
+
+/**
+ * Message with single array of 'itemSize' items and VALUE_COUNT values
+ * of the same size stored in inverse endianness, as it would be received
+ * from other platform
+ */
+static std::vector<uint8_t> getInverseMessage(uint8_t itemSize) {
+    std::vector<uint8_t> items(ARRAY_ITEMS * itemSize);
+    for (uint32_t i = 0; i < items.size(); ++i) {
+        items[i] = (uint8_t) (i * 31);
+    }
+
+    std::vector<uint8_t> buffer(cmSizeofArray(itemSize, ARRAY_ITEMS) +
+                                VALUE_COUNT * (1 + itemSize) + CM_SIZEOF_MARK);
+    auto writer = cmGetWriter(buffer.data(), buffer.size());
+    cmWriteTypedArray(&writer, CM_TYPE_UINT, itemSize, items.data(), ARRAY_ITEMS);
+    for (uint32_t i = 0; i < VALUE_COUNT; ++i) {
+        uint64_t value = i;
+        if (itemSize == 1) {
+            cmWriteU8(&writer, (uint8_t) value);
+        } else if (itemSize == 2) {
+            cmWriteU16(&writer, (uint16_t) value);
+        } else if (itemSize == 4) {
+            cmWriteU32(&writer, (uint32_t) value);
+        } else {
+            cmWriteU64(&writer, value);
+        }
+    }
+    REQUIRE(writer.firstError == CM_ERROR_NONE);
+    REQUIRE(writer.usedSize == buffer.size());
+
+    if (itemSize > 1) {
+        std::swap(buffer[0], buffer[1]);
+        reverseBytes(&buffer[3], sizeof(uint32_t));
+        uint8_t *d = &buffer[7];
+        for (uint32_t i = 0; i < ARRAY_ITEMS + VALUE_COUNT; ++i) {
+            if (i >= ARRAY_ITEMS) {
+                // skip flag of value
+                ++d;
+            }
+            reverseBytes(d, itemSize);
+            d += itemSize;
+        }
+    }
+    return buffer;
+}
+
+TEST_CASE("Scalar values", "[bench][scalar]") {
+    std::vector<uint8_t> buffer(VALUE_COUNT * CM_SIZEOF_D + CM_SIZEOF_MARK);
+
+    BENCHMARK("write 1024 u32") {
+        auto writer = cmGetWriter(buffer.data(), buffer.size());
+        for (uint32_t i = 0; i < VALUE_COUNT; ++i) {
+            cmWriteU32(&writer, i);
+        }
+        return writer.usedSize;
+    };
+
+    BENCHMARK("write 1024 mixed values") {
+        auto writer = cmGetWriter(buffer.data(), buffer.size());
+        for (uint32_t i = 0; i < VALUE_COUNT; i += 4) {
+            cmWriteI8(&writer, (int8_t) i);
+            cmWriteU16(&writer, (uint16_t) i);
+            cmWriteF(&writer, (float) i);
+            cmWriteD(&writer, (double) i);
+        }
+        return writer.usedSize;
+    };
+
+    BENCHMARK("write 1024 compact u32") {
+        auto writer = cmGetWriter(buffer.data(), buffer.size());
+        cmSetCompactIntegers(&writer, true);
+        for (uint32_t i = 0; i < VALUE_COUNT; ++i) {
+            cmWriteU32(&writer, i * 37);
+        }
+        return writer.usedSize;
+    };
+
+    auto writer = cmGetWriter(buffer.data(), buffer.size());
+    for (uint32_t i = 0; i < VALUE_COUNT; ++i) {
+        cmWriteU32(&writer, i);
+    }
+    uint32_t size = writer.usedSize;
+
+    BENCHMARK("read 1024 u32") {
+        CompositeMessageReader reader;
+        cmInitConstReader(&reader, buffer.data(), size);
+        uint32_t sum = 0;
+        for (uint32_t i = 0; i < VALUE_COUNT; ++i) {
+            sum += cmReadU32(&reader);
+        }
+        return sum;
+    };
+
+    BENCHMARK("validate and read 1024 u32 unchecked") {
+        CompositeMessageReader reader;
+        cmInitConstReader(&reader, buffer.data(), size);
+        cmValidate(&reader);
+        uint32_t sum = 0;
+        for (uint32_t i = 0; i < VALUE_COUNT; ++i) {
+            sum += cmReadU32Unchecked(&reader);
+        }
+        return sum;
+    };
+
+    std::vector<uint8_t> compact(buffer.size());
+    writer = cmGetWriter(compact.data(), compact.size());
+    cmSetCompactIntegers(&writer, true);
+    for (uint32_t i = 0; i < VALUE_COUNT; ++i) {
+        cmWriteU32(&writer, i * 37);
+    }
+    uint32_t compactSize = writer.usedSize;
+
+    BENCHMARK("read 1024 compact u32") {
+        CompositeMessageReader reader;
+        cmInitConstReader(&reader, compact.data(), compactSize);
+        uint32_t sum = 0;
+        for (uint32_t i = 0; i < VALUE_COUNT; ++i) {
+            sum += cmReadU32(&reader);
+        }
+        return sum;
+    };
+}
+
+TEST_CASE("Arrays", "[bench][array]") {
+    std::vector<uint8_t> items(ARRAY_ITEMS * sizeof(uint64_t));
+    for (uint32_t i = 0; i < items.size(); ++i) {
+        items[i] = (uint8_t) i;
+    }
+    std::vector<uint8_t> buffer(cmSizeofArray(sizeof(uint64_t), ARRAY_ITEMS) + CM_SIZEOF_MARK);
+    std::vector<uint8_t> output(items.size());
+
+    for (uint8_t itemSize : {1, 2, 4, 8}) {
+        std::string suffix = " of 4096 u" + std::to_string(itemSize * 8) + " (" +
+                             std::to_string(ARRAY_ITEMS * itemSize) + " bytes)";
+
+        BENCHMARK("write array" + suffix) {
+            auto writer = cmGetWriter(buffer.data(), buffer.size());
+            cmWriteTypedArray(&writer, CM_TYPE_UINT, itemSize, items.data(), ARRAY_ITEMS);
+            return writer.usedSize;
+        };
+
+        auto writer = cmGetWriter(buffer.data(), buffer.size());
+        cmWriteTypedArray(&writer, CM_TYPE_UINT, itemSize, items.data(), ARRAY_ITEMS);
+        uint32_t size = writer.usedSize;
+
+        BENCHMARK("read array" + suffix) {
+            CompositeMessageReader reader;
+            cmInitConstReader(&reader, buffer.data(), size);
+            return cmReadTypedArray(&reader, CM_TYPE_UINT, itemSize, output.data(), ARRAY_ITEMS);
+        };
+
+        BENCHMARK("read array view" + suffix) {
+            CompositeMessageReader reader;
+            cmInitConstReader(&reader, buffer.data(), size);
+            const void *view;
+            return cmReadArrayView(&reader, CM_TYPE_UINT, itemSize, &view);
+        };
+    }
+
+    std::vector<uint8_t> compact(cmSizeofVarintArray(sizeof(uint32_t), ARRAY_ITEMS) + CM_SIZEOF_MARK);
+    std::vector<uint32_t> values(ARRAY_ITEMS);
+    for (uint32_t i = 0; i < ARRAY_ITEMS; ++i) {
+        values[i] = 1000 + i * 3;
+    }
+    for (uint8_t codec : {CM_CODEC_VARINT, CM_CODEC_DELTA, CM_CODEC_FOR}) {
+        std::string suffix = " of 4096 u32 with codec " + std::to_string(codec);
+
+        BENCHMARK("write encoded array" + suffix) {
+            auto writer = cmGetWriter(compact.data(), compact.size());
+            cmWriteEncodedUArray(&writer, codec, values.data(), ARRAY_ITEMS);
+            return writer.usedSize;
+        };
+
+        auto writer = cmGetWriter(compact.data(), compact.size());
+        cmWriteEncodedUArray(&writer, codec, values.data(), ARRAY_ITEMS);
+        uint32_t size = writer.usedSize;
+
+        BENCHMARK("read encoded array" + suffix) {
+            CompositeMessageReader reader;
+            cmInitConstReader(&reader, compact.data(), size);
+            return cmReadUArray(&reader, (uint32_t *) output.data(), ARRAY_ITEMS);
+        };
+    }
+}
+
+TEST_CASE("Strings", "[bench][string]") {
+    uint32_t length = (uint32_t) std::strlen(STRING);
+    std::vector<uint8_t> buffer(STRING_COUNT * cmSizeofString(length) + CM_SIZEOF_MARK);
+
+    BENCHMARK("write 256 strings") {
+        auto writer = cmGetWriter(buffer.data(), buffer.size());
+        for (uint32_t i = 0; i < STRING_COUNT; ++i) {
+            cmWriteString(&writer, STRING, length);
+        }
+        return writer.usedSize;
+    };
+
+    auto writer = cmGetWriter(buffer.data(), buffer.size());
+    for (uint32_t i = 0; i < STRING_COUNT; ++i) {
+        cmWriteString(&writer, STRING, length);
+    }
+    uint32_t size = writer.usedSize;
+
+    BENCHMARK("read 256 strings") {
+        CompositeMessageReader reader;
+        cmInitConstReader(&reader, buffer.data(), size);
+        char str[32];
+        uint32_t total = 0;
+        for (uint32_t i = 0; i < STRING_COUNT; ++i) {
+            total += cmReadString(&reader, str, sizeof(str));
+        }
+        return total;
+    };
+
+    BENCHMARK("read 256 string views") {
+        CompositeMessageReader reader;
+        cmInitConstReader(&reader, buffer.data(), size);
+        const char *str;
+        uint32_t total = 0;
+        for (uint32_t i = 0; i < STRING_COUNT; ++i) {
+            total += cmReadStringView(&reader, &str);
+        }
+        return total;
+    };
+}
+
+TEST_CASE("Inverse endianness", "[bench][endian]") {
+    for (uint8_t itemSize : {2, 4, 8}) {
+        auto message = getInverseMessage(itemSize);
+        std::string suffix = " of u" + std::to_string(itemSize * 8) + " (" +
+                             std::to_string(ARRAY_ITEMS) + " items + " +
+                             std::to_string(VALUE_COUNT) + " values, " +
+                             std::to_string(message.size()) + " bytes)";
+
+        // message is converted in place, so each run gets its own copy
+        BENCHMARK_ADVANCED("convert message" + suffix)(Catch::Benchmark::Chronometer meter) {
+            std::vector<std::vector<uint8_t>> copies(meter.runs(), message);
+            meter.measure([&copies](int i) {
+                auto reader = cmGetReader(copies[i].data(), copies[i].size());
+                return reader.firstError;
+            });
+        };
+
+        std::vector<uint8_t> output(ARRAY_ITEMS * itemSize);
+        BENCHMARK("read with swapping const reader" + suffix) {
+            CompositeMessageReader reader;
+            cmInitConstReader(&reader, message.data(), message.size());
+            cmReadTypedArray(&reader, CM_TYPE_UINT, itemSize, output.data(), ARRAY_ITEMS);
+            uint64_t sum = 0;
+            for (uint32_t i = 0; i < VALUE_COUNT; ++i) {
+                if (itemSize == 2) {
+                    sum += cmReadU16(&reader);
+                } else if (itemSize == 4) {
+                    sum += cmReadU32(&reader);
+                } else {
+                    sum += cmReadU64(&reader);
+                }
+            }
+            return sum;
+        };
+    }
+}
+
+TEST_CASE("Peek and search", "[bench][peek]") {
+    std::vector<uint32_t> values(64);
+    std::vector<uint8_t> buffer(64 * 1024);
+    auto writer = cmGetWriter(buffer.data(), buffer.size());
+    for (uint32_t i = 0; i < 64; ++i) {
+        std::string name = "field" + std::to_string(i);
+        cmWriteName(&writer, name.c_str());
+        cmWriteUArray(&writer, values.data(), i + 1);
+        cmWriteString(&writer, STRING, (uint32_t) std::strlen(STRING));
+    }
+    REQUIRE(writer.firstError == CM_ERROR_NONE);
+    uint32_t size = writer.usedSize;
+
+    BENCHMARK("peek and read 64 arrays and strings") {
+        CompositeMessageReader reader;
+        cmInitConstReader(&reader, buffer.data(), size);
+        std::vector<uint32_t> array;
+        std::string str;
+        uint32_t total = 0;
+        for (uint32_t i = 0; i < 64; ++i) {
+            const char *name;
+            cmReadNameView(&reader, &name);
+            array.resize(cmPeekArraySize(&reader));
+            total += cmReadUArray(&reader, array.data(), array.size());
+            str.resize(cmPeekStringLength(&reader) + 1);
+            total += cmReadString(&reader, &str[0], str.size());
+        }
+        return total;
+    };
+
+    std::vector<CMFieldSlot> slots(128);
+    BENCHMARK("index 64 fields and find last one") {
+        CompositeMessageReader reader;
+        cmInitConstReader(&reader, buffer.data(), size);
+        cmIndexFields(&reader, slots.data(), slots.size());
+        cmFindField(&reader, "field63");
+        return cmPeekArraySize(&reader);
+    };
+
+    std::vector<CMIndexEntry> table(3 * 64);
+    BENCHMARK("build index of 192 elements") {
+        CompositeMessageReader reader;
+        cmInitConstReader(&reader, buffer.data(), size);
+        return cmBuildIndex(&reader, table.data(), table.size());
+    };
+}
+
+TEST_CASE("Mixed elements", "[bench][mixed]") {
+    std::vector<uint8_t> buffer(64 * 1024);
+    uint16_t items[4] = {1, 2, 3, 4};
+    auto writer = cmGetWriter(buffer.data(), buffer.size());
+    for (uint32_t i = 0; i < VALUE_COUNT / 8; ++i) {
+        cmWriteName(&writer, "v");
+        cmWriteU8(&writer, (uint8_t) i);
+        cmWriteBlockStart(&writer);
+        cmWriteI32(&writer, (int32_t) i);
+        cmWriteD(&writer, i * 0.5);
+        cmWriteUArray(&writer, items, 4);
+        cmWriteBool(&writer, true);
+        cmWriteBlockEnd(&writer);
+    }
+    REQUIRE(writer.firstError == CM_ERROR_NONE);
+    uint32_t size = writer.usedSize;
+
+    // each named value and each block is skipped as a single field
+    BENCHMARK("skip 1024 mixed elements in 256 fields") {
+        CompositeMessageReader reader;
+        cmInitConstReader(&reader, buffer.data(), size);
+        for (uint32_t i = 0; i < VALUE_COUNT / 4; ++i) {
+            cmSkip(&reader);
+        }
+        return cmTell(&reader);
+    };
+
+    std::vector<CMIndexEntry> table(VALUE_COUNT);
+    BENCHMARK("build index of 1024 mixed elements") {
+        CompositeMessageReader reader;
+        cmInitConstReader(&reader, buffer.data(), size);
+        return cmBuildIndex(&reader, table.data(), table.size());
+    };
+}
+
+namespace {
+    struct Record {
+        int8_t i8;
+        uint16_t u16;
+        float f;
+        double d;
+    };
+
+    const CMFieldDesc RECORD_FIELDS[] = {
+            cmFieldDesc(Record, i8, CM_TYPE_INT),
+            cmFieldDesc(Record, u16, CM_TYPE_UINT),
+            cmFieldDesc(Record, f, CM_TYPE_FLOAT),
+            cmFieldDesc(Record, d, CM_TYPE_FLOAT),
+    };
+}
+
+TEST_CASE("Batch records", "[bench][batch]") {
+    // the same 1024 mixed values as in scalar benchmarks, grouped in records
+    std::vector<uint8_t> buffer(VALUE_COUNT * CM_SIZEOF_D + CM_SIZEOF_MARK);
+    std::vector<Record> records(VALUE_COUNT / 4);
+    for (uint32_t i = 0; i < records.size(); ++i) {
+        records[i] = {(int8_t) i, (uint16_t) i, (float) i, (double) i};
+    }
+
+    BENCHMARK("write 1024 mixed values in 256 batches") {
+        auto writer = cmGetWriter(buffer.data(), buffer.size());
+        for (const auto &r : records) {
+            cmWriteBatch(&writer, RECORD_FIELDS, &r, 4);
+        }
+        return writer.usedSize;
+    };
+
+    auto writer = cmGetWriter(buffer.data(), buffer.size());
+    for (const auto &r : records) {
+        cmWriteBatch(&writer, RECORD_FIELDS, &r, 4);
+    }
+    REQUIRE(writer.firstError == CM_ERROR_NONE);
+    uint32_t size = writer.usedSize;
+
+    BENCHMARK("read 1024 mixed values one by one") {
+        CompositeMessageReader reader;
+        cmInitConstReader(&reader, buffer.data(), size);
+        for (auto &r : records) {
+            r.i8 = cmReadI8(&reader);
+            r.u16 = cmReadU16(&reader);
+            r.f = cmReadF(&reader);
+            r.d = cmReadD(&reader);
+        }
+        return reader.readSize;
+    };
+
+    BENCHMARK("read 1024 mixed values in 256 batches") {
+        CompositeMessageReader reader;
+        cmInitConstReader(&reader, buffer.data(), size);
+        for (auto &r : records) {
+            cmReadBatch(&reader, RECORD_FIELDS, &r, 4);
+        }
+        return reader.readSize;
+    };
+}
+
+TEST_CASE("Record tables", "[bench][table]") {
+    std::vector<uint8_t> buffer(VALUE_COUNT * CM_SIZEOF_D + CM_SIZEOF_MARK);
+    std::vector<Record> records(VALUE_COUNT / 4);
+    for (uint32_t i = 0; i < records.size(); ++i) {
+        records[i] = {(int8_t) i, (uint16_t) i, (float) i, (double) i};
+    }
+
+    BENCHMARK("write 256 records as table") {
+        auto writer = cmGetWriter(buffer.data(), buffer.size());
+        cmWriteRecordTable(&writer, RECORD_FIELDS, 4, records.data(),
+                           sizeof(Record), records.size());
+        return writer.usedSize;
+    };
+
+    auto writer = cmGetWriter(buffer.data(), buffer.size());
+    cmWriteRecordTable(&writer, RECORD_FIELDS, 4, records.data(),
+                       sizeof(Record), records.size());
+    REQUIRE(writer.firstError == CM_ERROR_NONE);
+    uint32_t size = writer.usedSize;
+
+    BENCHMARK("read table of 256 records") {
+        CompositeMessageReader reader;
+        cmInitConstReader(&reader, buffer.data(), size);
+        return cmReadRecordTable(&reader, RECORD_FIELDS, 4, records.data(),
+                                 sizeof(Record), records.size());
+    };
+
+    std::vector<double> column(records.size());
+    BENCHMARK("read column of 256 records") {
+        CompositeMessageReader reader;
+        cmInitConstReader(&reader, buffer.data(), size);
+        return cmReadFloatColumn(&reader, 3, column.data(), column.size());
+    };
+}
+
+TEST_CASE("Dictionary strings", "[bench][dictionary]") {
+    // 256 fields with the same names and a few repeated string values
+    const char *units[] = {"celsius", "fahrenheit", "kelvin", "percent"};
+    std::vector<uint8_t> buffer(16 * 1024);
+    std::vector<CMDictionaryEntry> entries(16);
+    std::vector<char> chars(256);
+    CMDictionary dictionary;
+    cmInitDictionary(&dictionary, entries.data(), entries.size(), chars.data(),
+                     chars.size());
+    auto write = [&](CompositeMessageWriter *writer) {
+        for (uint32_t i = 0; i < VALUE_COUNT / 4; ++i) {
+            const char *unit = units[i % 4];
+            cmWriteName(writer, "temperature");
+            cmWriteName(writer, "unit");
+            cmWriteString(writer, unit, strlen(unit));
+        }
+    };
+    auto read = [](CompositeMessageReader *reader) {
+        char name[16];
+        char unit[16];
+        for (uint32_t i = 0; i < VALUE_COUNT / 4; ++i) {
+            cmReadName(reader, name, sizeof(name));
+            cmReadName(reader, name, sizeof(name));
+            cmReadString(reader, unit, sizeof(unit));
+        }
+        return reader->readSize;
+    };
+
+    BENCHMARK("write 256 text fields") {
+        auto writer = cmGetWriter(buffer.data(), buffer.size());
+        write(&writer);
+        return writer.usedSize;
+    };
+
+    BENCHMARK("write 256 text fields with dictionary") {
+        cmResetDictionary(&dictionary);
+        auto writer = cmGetWriter(buffer.data(), buffer.size());
+        cmSetWriterDictionary(&writer, &dictionary);
+        write(&writer);
+        return writer.usedSize;
+    };
+
+    auto writer = cmGetWriter(buffer.data(), buffer.size());
+    write(&writer);
+    REQUIRE(writer.firstError == CM_ERROR_NONE);
+    uint32_t size = writer.usedSize;
+    BENCHMARK("read 256 text fields") {
+        CompositeMessageReader reader;
+        cmInitConstReader(&reader, buffer.data(), size);
+        return read(&reader);
+    };
+
+    std::vector<uint8_t> compact(buffer.size());
+    cmResetDictionary(&dictionary);
+    writer = cmGetWriter(compact.data(), compact.size());
+    cmSetWriterDictionary(&writer, &dictionary);
+    write(&writer);
+    REQUIRE(writer.firstError == CM_ERROR_NONE);
+    uint32_t compactSize = writer.usedSize;
+    BENCHMARK("read 256 text fields with dictionary") {
+        cmResetDictionary(&dictionary);
+        CompositeMessageReader reader;
+        cmInitConstReader(&reader, compact.data(), compactSize);
+        cmSetReaderDictionary(&reader, &dictionary);
+        return read(&reader);
+    };
+}
+
+TEST_CASE("Compression", "[bench][compression]") {
+    // mixed values and names repeated in each record
+    std::vector<uint8_t> message(VALUE_COUNT * CM_SIZEOF_D + CM_SIZEOF_MARK);
+    auto messageWriter = cmGetWriter(message.data(), message.size());
+    for (uint32_t i = 0; i < VALUE_COUNT / 4; ++i) {
+        cmWriteName(&messageWriter, "value");
+        cmWriteU16(&messageWriter, (uint16_t) (i % 16));
+        cmWriteD(&messageWriter, (double) (i % 4));
+    }
+    REQUIRE(messageWriter.firstError == CM_ERROR_NONE);
+    uint32_t size = messageWriter.usedSize;
+
+    CMLz4WorkBuffer work;
+    CMCompressor lz4;
+    cmInitLz4Compressor(&lz4, &work, 4096);
+    std::vector<uint8_t> buffer(cmSizeofCompressed(size, 4096) + CM_SIZEOF_MARK);
+
+    BENCHMARK("compress with LZ4") {
+        auto writer = cmGetWriter(buffer.data(), buffer.size());
+        cmWriteCompressed(&writer, &lz4, message.data(), size);
+        return writer.usedSize;
+    };
+
+    auto writer = cmGetWriter(buffer.data(), buffer.size());
+    cmWriteCompressed(&writer, &lz4, message.data(), size);
+    REQUIRE(writer.firstError == CM_ERROR_NONE);
+    uint32_t compressedSize = writer.usedSize;
+    std::vector<uint8_t> output(4096 + CM_SIZEOF_MARK);
+
+    BENCHMARK("decompress with LZ4") {
+        CompositeMessageReader reader;
+        cmInitConstReader(&reader, buffer.data(), compressedSize);
+        CompositeMessageReader stream;
+        cmInitStreamReader(&stream, output.data(), output.size());
+        uint32_t total = 0;
+        while (reader.readSize < reader.totalSize && reader.firstError == CM_ERROR_NONE) {
+            total += cmDecompress(&reader, &lz4, &stream);
+            cmSeek(&stream, stream.totalSize);
+        }
+        return total;
+    };
+}
+
+TEST_CASE("Templates", "[bench][template]") {
+    // 256 records with fixed layout of 4 named values
+    std::vector<uint8_t> buffer(VALUE_COUNT * (CM_SIZEOF_D + 8) + CM_SIZEOF_MARK);
+    auto writer = cmGetWriter(buffer.data(), buffer.size());
+    for (uint32_t i = 0; i < VALUE_COUNT / 4; ++i) {
+        cmWriteName(&writer, "id");
+        cmWriteU32(&writer, i);
+        cmWriteName(&writer, "mode");
+        cmWriteU16(&writer, (uint16_t) (i % 16));
+        cmWriteName(&writer, "x");
+        cmWriteD(&writer, (double) i);
+        cmWriteName(&writer, "y");
+        cmWriteD(&writer, (double) -i);
+    }
+    REQUIRE(writer.firstError == CM_ERROR_NONE);
+    uint32_t size = writer.usedSize;
+
+    uint8_t signature[64];
+    uint8_t mask[64];
+    CMTemplateField fields[4];
+    CMTemplate tmpl;
+    cmInitTemplate(&tmpl, signature, mask, sizeof(signature), fields, 4);
+    // first record is the sample
+    uint32_t recordSize = (size - CM_SIZEOF_MARK) / (VALUE_COUNT / 4);
+    auto sample = cmGetReader(buffer.data(), CM_SIZEOF_MARK + recordSize);
+    REQUIRE(cmCompileTemplate(&tmpl, &sample));
+
+    BENCHMARK("read 1024 named values one by one") {
+        CompositeMessageReader reader;
+        cmInitConstReader(&reader, buffer.data(), size);
+        char name[8];
+        double sum = 0;
+        for (uint32_t i = 0; i < VALUE_COUNT / 4; ++i) {
+            cmReadName(&reader, name, sizeof(name));
+            sum += cmReadU32(&reader);
+            cmReadName(&reader, name, sizeof(name));
+            sum += cmReadU16(&reader);
+            cmReadName(&reader, name, sizeof(name));
+            sum += cmReadD(&reader);
+            cmReadName(&reader, name, sizeof(name));
+            sum += cmReadD(&reader);
+        }
+        return sum;
+    };
+
+    BENCHMARK("read 1024 named values with template") {
+        CompositeMessageReader reader;
+        cmInitConstReader(&reader, buffer.data(), size);
+        double sum = 0;
+        const uint8_t *data;
+        while ((data = cmMatchTemplate(&reader, &tmpl)) != nullptr) {
+            uint32_t id;
+            uint16_t mode;
+            double x, y;
+            std::memcpy(&id, data + fields[0].offset, sizeof(id));
+            std::memcpy(&mode, data + fields[1].offset, sizeof(mode));
+            std::memcpy(&x, data + fields[2].offset, sizeof(x));
+            std::memcpy(&y, data + fields[3].offset, sizeof(y));
+            sum += id + mode + x + y;
+        }
+        return sum;
+    };
+}
+
+static bool appendToFile(void *context, const void *data, uint32_t size) {
+    auto *file = (std::vector<uint8_t> *) context;
+    file->insert(file->end(), (const uint8_t *) data, (const uint8_t *) data + size);
+    return true;
+}
+
+TEST_CASE("Log files", "[bench][log]") {
+    // 65536 small messages with increasing versions, index after each 256
+    const uint32_t messageCount = 64 * VALUE_COUNT;
+    std::vector<uint8_t> file;
+    std::vector<CMLogEntry> entries(256);
+    CMLogWriter log;
+    cmInitLogWriter(&log, entries.data(), entries.size(), appendToFile, &file);
+    for (uint32_t i = 0; i < messageCount; ++i) {
+        uint8_t buffer[32];
+        auto writer = cmGetWriter(buffer, sizeof(buffer));
+        cmWriteVersion(&writer, i);
+        cmWriteD(&writer, (double) i);
+        cmAppendLog(&log, buffer, writer.usedSize);
+    }
+    cmWriteLogIndex(&log);
+    REQUIRE(log.firstError == CM_ERROR_NONE);
+
+    std::vector<CMLogIndex> indexes(messageCount / 256);
+    CMLogReader reader;
+    REQUIRE(cmInitLogReader(&reader, file.data(), file.size(), indexes.data(),
+                            indexes.size()));
+
+    BENCHMARK("open log of 65536 messages") {
+        CMLogReader r;
+        return cmInitLogReader(&r, file.data(), file.size(), indexes.data(),
+                               indexes.size());
+    };
+
+    BENCHMARK("read 1024 messages by number") {
+        double sum = 0;
+        for (uint32_t i = 0; i < VALUE_COUNT; ++i) {
+            CompositeMessageReader message;
+            cmReadLogMessage(&reader, (i * 2654435761u) % messageCount, &message);
+            cmReadVersion(&message);
+            sum += cmReadD(&message);
+        }
+        return sum;
+    };
+
+    BENCHMARK("find 1024 messages by version") {
+        uint64_t sum = 0;
+        for (uint32_t i = 0; i < VALUE_COUNT; ++i) {
+            sum += cmFindLogVersion(&reader, (i * 2654435761u) % messageCount);
+        }
+        return sum;
+    };
+}
@@ -29,6 +29,8 @@
  * - 001X XXXX  Primitive type without value (null equivalent)
  * - 010X XXXX  Array of primitive types (first 5 bits represent type)
  *              Array begins with its size (uint32) followed by elements
+ * - 011X XXXX  Value of integer type (first 5 bits represent type) encoded
+ *              as LEB128 varint. Signed values are zig-zag encoded first
  * - 1000 0000  Name of the next value/block.
  *              Name begins with its length (uint8) followed by chars.
  *              At the end 0x00 is placed which doesn't count in name length
@@ -39,8 +41,49 @@
  *              Marker begins with its size (uint8) followed by its bytes
  * - 1000 0101  Protocol metadata start
  * - 1000 0110  Protocol metadata end
+ * - 1000 0111  Padding (single byte without value) which is skipped by
+ *              readers, so items of the next array are aligned
  * - 1000 1000  CRC32 hash of everything up to this point (excluding endian
  *              indicator and this flag)
+ *              CRC value (uint32) follows the flag, previous CRC elements
+ *              are hashed as any other bytes
+ * - 1000 1001  Embedded message. Begins with its size (uint32) followed by
+ *              its elements (without endianness mark)
+ * - 1000 1010  Record table. Begins with number of records (uint32), number
+ *              of columns (uint8) and primitive type of each column (uint8,
+ *              5 bits as above). Items of each column follow the header
+ *              (all items of first column, then all items of second one...)
+ * - 1000 1011  Name that is added to dictionary. Begins with index in
+ *              dictionary (uint8), followed by length, chars and 0x00 as name
+ * - 1000 1100  Name stored in dictionary. Index in dictionary (uint8) follows
+ *              the flag
+ * - 1000 1101  String that is added to dictionary, layout is the same as of
+ *              name that is added to dictionary
+ * - 1000 1110  String stored in dictionary. Index in dictionary (uint8)
+ *              follows the flag
+ * - 1000 1111  Compressed elements. Begins with size of the rest of element
+ *              (uint32), followed by compression codec (uint8), size of
+ *              decompressed bytes (varint) and compressed bytes.
+ *              Decompressed bytes are elements of message (without
+ *              endianness mark) with endianness of this message, element
+ *              may continue in the next compressed element. Codecs:
+ *              0x00 - bytes are stored without compression
+ *              0x01 - LZ4 block format
+ *              0x02 - heatshrink (provided by application)
+ * - 1001 0000  Encoded array. Begins with codec (uint8) and primitive type
+ *              of items (uint8, 5 bits as above), followed by number of items
+ *              (varint) and size of encoded items in bytes (varint).
+ *              Encoded items follow the header. Codecs:
+ *              0x01 - each item is a LEB128 varint (zig-zag for signed)
+ *              0x02 - first item as in 0x01, then zig-zag varint difference
+ *                     of each item with the previous one
+ *              0x03 - frame of reference: minimum as in 0x01, bit width
+ *                     (uint8) and offset of each item from minimum packed
+ *                     with this width (bits from least significant)
+ *              0x04 - bool items as varint lengths of alternating runs,
+ *                     starting from run of false values
+ *              0x05 - bool items packed to bits, 8 items per byte (item i
+ *                     is bit i % 8 of byte i / 8, unused bits are zero)
  */
 #ifndef COMPOSITE_MESSAGE_H
 #define COMPOSITE_MESSAGE_H
@@ -51,11 +94,173 @@
 #define CM_TYPE_BOOL    0x10u
 #define CM_TYPE_CHAR    0x14u
 
+// parts of element flags that are used by inline functions of this header
+#define CM_TYPE_MASK     0x1Cu
+#define CM_TYPE_LEN_MASK 0x03u
+#define CM_ARRAY         0x40u
+#define CM_ARRAY_MASK    0xE0u
+#define CM_PADDING       0x87u
+
+#define CM_CODEC_VARINT 0x01u
+#define CM_CODEC_DELTA  0x02u
+#define CM_CODEC_FOR    0x03u
+#define CM_CODEC_RLE    0x04u
+#define CM_CODEC_BITS   0x05u
+
+#define CM_COMPRESSION_STORED       0x00u
+#define CM_COMPRESSION_LZ4          0x01u
+#define CM_COMPRESSION_HEATSHRINK   0x02u
+
+/**
+ * Hash table of built-in LZ4 compressor has 2^CM_LZ4_HASH_LOG entries of
+ * 2 bytes each. Smaller table takes less memory but finds fewer matches
+ */
+#ifndef CM_LZ4_HASH_LOG
+#define CM_LZ4_HASH_LOG 10
+#endif
+
+/**
+ * Sizes of elements in bytes, so buffer for the whole message can be
+ * allocated in advance. Message begins with endianness mark, so
+ * CM_SIZEOF_MARK must be added once to sizes of all elements.
+ * Sizes of integers are for fixed size encoding, with compact integers
+ * cmSizeofVarint gives the largest possible size
+ */
+#define CM_SIZEOF_MARK          2u
+#define CM_SIZEOF_I8            2u
+#define CM_SIZEOF_U8            2u
+#define CM_SIZEOF_I16           3u
+#define CM_SIZEOF_U16           3u
+#define CM_SIZEOF_I32           5u
+#define CM_SIZEOF_U32           5u
+#define CM_SIZEOF_I64           9u
+#define CM_SIZEOF_U64           9u
+#define CM_SIZEOF_F             5u
+#define CM_SIZEOF_D             9u
+#define CM_SIZEOF_BOOL          2u
+#define CM_SIZEOF_CHAR          2u
+#define CM_SIZEOF_VERSION       5u
+#define CM_SIZEOF_CRC32         5u
+#define CM_SIZEOF_BLOCK_START   1u
+#define CM_SIZEOF_BLOCK_END     1u
+#define CM_SIZEOF_METADATA_START 1u
+#define CM_SIZEOF_METADATA_END  1u
+
+/**
+ * Largest size of header of encoded array
+ */
+#define CM_SIZEOF_ENCODED_HEADER 13u
+
+/**
+ * Largest size of header of compressed elements
+ */
+#define CM_SIZEOF_COMPRESSED_HEADER 11u
+
+/**
+ * Largest size of compressed elements that take 'size' bytes and are
+ * compressed in blocks of 'blockSize' bytes (blocks that don't shrink are
+ * stored as is)
+ */
+#define cmSizeofCompressed(size, blockSize) \
+    ((uint32_t) (size) + \
+     ((uint32_t) (size) / (uint32_t) (blockSize) + 1u) * CM_SIZEOF_COMPRESSED_HEADER)
+
+/**
+ * Size of array of 'itemCount' items with 'itemSize' bytes each
+ */
+#define cmSizeofArray(itemSize, itemCount) \
+    (5u + (uint32_t) (itemSize) * (uint32_t) (itemCount))
+
+/**
+ * Size of array that is written with aligned arrays enabled (includes
+ * largest possible padding)
+ */
+#define cmSizeofAlignedArray(itemSize, itemCount) \
+    (cmSizeofArray(itemSize, itemCount) + (uint32_t) (itemSize) - 1u)
+
+/**
+ * Size of string with 'length' chars (without null terminator)
+ */
+#define cmSizeofString(length) (6u + (uint32_t) (length))
+
+/**
+ * Size of name with 'length' chars (without null terminator)
+ */
+#define cmSizeofName(length) (3u + (uint32_t) (length))
+
+/**
+ * Size of name with 'length' chars written as dictionary definition
+ * (without null terminator)
+ */
+#define cmSizeofNameDefinition(length) (4u + (uint32_t) (length))
+
+/**
+ * Size of string with 'length' chars written as dictionary definition
+ * (without null terminator)
+ */
+#define cmSizeofStringDefinition(length) (4u + (uint32_t) (length))
+
+/**
+ * Size of marker with 'size' bytes
+ */
+#define cmSizeofMarker(size) (2u + (uint32_t) (size))
+
+/**
+ * Size of embedded message whose elements take 'size' bytes
+ */
+#define cmSizeofMessage(size) (5u + (uint32_t) (size))
+
+/**
+ * Size of record table with 'columnCount' columns whose items of single
+ * record take 'recordSize' bytes
+ */
+#define cmSizeofRecordTable(columnCount, recordSize, recordCount) \
+    (6u + (uint32_t) (columnCount) + (uint32_t) (recordSize) * (uint32_t) (recordCount))
+
+/**
+ * Largest size of integer with 'itemSize' bytes written as varint
+ */
+#define cmSizeofVarint(itemSize) (1u + ((uint32_t) (itemSize) * 8u + 6u) / 7u)
+
+/**
+ * Largest size of integer array written with compact integers enabled
+ * (or with CM_CODEC_VARINT or CM_CODEC_DELTA codecs)
+ */
+#define cmSizeofVarintArray(itemSize, itemCount) \
+    (CM_SIZEOF_ENCODED_HEADER + \
+     (uint32_t) (itemCount) * (((uint32_t) (itemSize) * 8u + 6u) / 7u))
+
+/**
+ * Largest size of bool array written with CM_CODEC_BITS codec or bitmap
+ * with 'bitCount' bits
+ */
+#define cmSizeofPackedBoolArray(itemCount) \
+    (CM_SIZEOF_ENCODED_HEADER + ((uint32_t) (itemCount) + 7u) / 8u)
+
+/**
+ * Size of buffer for writer created with cmInitCountingWriter. It can hold
+ * any element except payloads of arrays (which are counted without copying)
+ */
+#define CM_COUNTING_BUFFER_SIZE cmSizeofNameDefinition(255)
+
 #define CM_ERROR_NONE 0
 #define CM_ERROR_NO_ENDIAN 1
 #define CM_ERROR_NO_SPACE 2
 #define CM_ERROR_NO_VALUE 3
 #define CM_ERROR_INVALID_ARG 4
+#define CM_ERROR_NEED_MORE 5
+#define CM_ERROR_IO 6
+#define CM_ERROR_CRC 7
+#define CM_ERROR_MALFORMED 8
+
+/**
+ * Operations that are measured when library is built with CM_PROFILE
+ */
+#define CM_PROFILE_GET_READER   0u
+#define CM_PROFILE_READ_VALUE   1u
+#define CM_PROFILE_WRITE_ARRAY  2u
+#define CM_PROFILE_CONVERT      3u
+#define CM_PROFILE_OP_COUNT     4u
 
 #ifdef __cplusplus
 
@@ -68,183 +273,1230 @@ extern "C" {
 
 // cstdint is available only since C++11, so use C header instead
 #include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <assert.h>
 
 /**
- * After finished writing, check if firstError is CM_ERROR_NONE.
- * This ensures that all written values are correct and message can be
- * used in CompositeMessageReader.
- * When first error is encountered, all other operations on writer
- * are no-op.
- * Do not modify fields directly
+ * Part of message produced by writer in gather mode.
+ * Layout is the same as of struct iovec, so array of segments can be
+ * passed to writev/sendmsg directly
  */
 typedef struct {
-    uint8_t *buffer;
-    uint32_t bufferSize;
-    uint32_t usedSize;
-    uint32_t firstError;
-} CompositeMessageWriter;
+    const void *data;
+    size_t size;
+} CMSegment;
 
 /**
- * After finished reading, check if firstError is CM_ERROR_NONE.
- * This ensures that all read values are correct.
- * When first error is encountered, all other operations on reader
- * are no-op.
+ * Slot of field index built by cmIndexFields
  */
 typedef struct {
-    uint8_t *message;
-
     /**
-     * Total number of bytes in message
+     * Hash of field name
      */
-    uint32_t totalSize;
+    uint32_t hash;
 
     /**
-     * How much bytes are already read
+     * Offset of name in message or 0 if slot is empty
      */
-    uint32_t readSize;
+    uint32_t offset;
+} CMFieldSlot;
 
+/**
+ * Element of message recorded by cmBuildIndex
+ */
+typedef struct {
     /**
-     * First error occurred when reading bytes
+     * Offset of element (its flag) in message
      */
-    uint32_t firstError;
-} CompositeMessageReader;
+    uint32_t offset;
 
-/**
- * Initialize message writer with given buffer and size
- * @param buffer - pointer to buffer for message building
- * @size size - size of buffer in bytes
- * @return initialized CompositeMessageWriter
- */
-CompositeMessageWriter cmGetWriter(void *buffer, uint32_t size);
+    /**
+     * Size of element in bytes including its flag
+     */
+    uint32_t size;
+    uint8_t flag;
+} CMIndexEntry;
 
 /**
- * Initialize message reader with given message and size
- * Message must be non const since it will be modified internally
- * @param message - pointer to message that should be read
- * @size size - size of message in bytes
- * @return initialized CompositeMessageReader
+ * Value or array of message layout that is described by CMTemplate
  */
-CompositeMessageReader cmGetReader(void *message, uint32_t size);
+typedef struct {
+    /**
+     * Offset of value (or first item of array) from the beginning of bytes
+     * that are matched by template
+     */
+    uint32_t offset;
 
-/**
- * Write signed 8-bit integer to message. If buffer can't hold integer then
- * firstError is set to CM_ERROR_NO_SPACE
- * @param writer
- * @param i
- */
-void cmWriteI8(CompositeMessageWriter *writer, int8_t i);
+    /**
+     * Size of value or of all items of array in bytes
+     */
+    uint32_t size;
+    uint8_t flag;
+} CMTemplateField;
 
 /**
- * Read signed 8-bit integer from message.
- * If there is no int8 at this place, firstError is set to CM_ERROR_NO_VALUE
- * @param reader
- * @return read value
+ * Fixed layout of part of message that is compiled from sample message by
+ * cmCompileTemplate. Flags, sizes of arrays, names and markers of layout
+ * form a signature that is compared with message by cmMatchTemplate in one
+ * pass, then values are accessed at fixed offsets.
+ * Template uses only provided storage, so it can be allocated statically
  */
-int8_t cmReadI8(CompositeMessageReader *reader);
+typedef struct {
+    /**
+     * Expected bytes of layout (bytes of values are zero)
+     */
+    uint8_t *signature;
 
-void cmWriteU8(CompositeMessageWriter *writer, uint8_t i);
+    /**
+     * 0xFF for each byte of signature and 0x00 for each byte of value
+     */
+    uint8_t *mask;
 
-uint8_t cmReadU8(CompositeMessageReader *reader);
+    /**
+     * How many bytes signature and mask can store
+     */
+    uint32_t capacity;
 
-void cmWriteI16(CompositeMessageWriter *writer, int16_t i);
+    /**
+     * Number of bytes covered by template
+     */
+    uint32_t size;
 
-int16_t cmReadI16(CompositeMessageReader *reader);
+    CMTemplateField *fields;
+    uint32_t maxFields;
 
-void cmWriteU16(CompositeMessageWriter *writer, uint16_t i);
+    /**
+     * Number of values and arrays in layout
+     */
+    uint32_t fieldCount;
+} CMTemplate;
 
-uint16_t cmReadU16(CompositeMessageReader *reader);
+/**
+ * Description of scalar field of struct that is written by cmWriteBatch
+ * and read by cmReadBatch. Tables of descriptions are usually static and
+ * are created with cmFieldDesc macro
+ */
+typedef struct {
+    /**
+     * Offset of field from the beginning of struct
+     */
+    uint32_t offset;
 
-void cmWriteI32(CompositeMessageWriter *writer, int32_t i);
+    /**
+     * Type of field (one of CM_TYPE_X defines)
+     */
+    uint8_t type;
 
-int32_t cmReadI32(CompositeMessageReader *reader);
+    /**
+     * Size of field in bytes (1, 2, 4 or 8)
+     */
+    uint8_t size;
+} CMFieldDesc;
 
-void cmWriteU32(CompositeMessageWriter *writer, uint32_t i);
+/**
+ * Description of field 'field' of struct 'structType' with type 'type'
+ * (one of CM_TYPE_X defines)
+ */
+#define cmFieldDesc(structType, field, type) \
+    {(uint32_t) offsetof(structType, field), (type), sizeof(((structType *) 0)->field)}
 
-uint32_t cmReadU32(CompositeMessageReader *reader);
+/**
+ * String stored in CMDictionary
+ */
+typedef struct {
+    /**
+     * Hash of chars of string
+     */
+    uint32_t hash;
 
-void cmWriteI64(CompositeMessageWriter *writer, int64_t i);
+    /**
+     * Offset of chars in storage of dictionary
+     */
+    uint32_t offset;
 
-int64_t cmReadI64(CompositeMessageReader *reader);
+    /**
+     * Length of string (without null terminator)
+     */
+    uint8_t length;
 
-void cmWriteU64(CompositeMessageWriter *writer, uint64_t i);
+    /**
+     * Entry holds a string
+     */
+    bool defined;
+} CMDictionaryEntry;
 
-uint64_t cmReadU64(CompositeMessageReader *reader);
+/**
+ * Dictionary of names and strings that repeat in messages. Writer stores
+ * the first use of each string together with its index, later uses are
+ * stored as index only. Reader collects stored strings and resolves indexes
+ * back to them. Dictionary uses only provided storage, so it can be
+ * allocated statically. Dictionary can be reset before each message or it
+ * can be kept for whole session (then messages must be read in the same
+ * order as they were written)
+ */
+typedef struct {
+    CMDictionaryEntry *entries;
 
-void cmWriteF(CompositeMessageWriter *writer, float f);
+    /**
+     * Number of entries (up to 256)
+     */
+    uint32_t capacity;
 
-float cmReadF(CompositeMessageReader *reader);
+    /**
+     * Number of used entries (writer assigns entries in order)
+     */
+    uint32_t count;
 
-void cmWriteD(CompositeMessageWriter *writer, double d);
+    /**
+     * Storage of chars of strings, each string takes length + 1 bytes
+     */
+    char *chars;
+    uint32_t charsCapacity;
+    uint32_t charsUsed;
+} CMDictionary;
 
-double cmReadD(CompositeMessageReader *reader);
+/**
+ * Statistics of single operation collected when library is built with
+ * CM_PROFILE defined
+ */
+typedef struct {
+    /**
+     * How many times operation was performed
+     */
+    uint32_t count;
 
-void cmWriteBool(CompositeMessageWriter *writer, bool val);
+    /**
+     * Total number of message bytes processed by operation
+     */
+    uint64_t bytes;
 
-bool cmReadBool(CompositeMessageReader *reader);
+    /**
+     * Total duration of operation. Measured in CPU cycles with DWT counter
+     * on Cortex-M and in nanoseconds with clock_gettime on other systems
+     * (or in units of CM_PROFILE_COUNTER if it is defined)
+     */
+    uint64_t cycles;
+} CMProfileCounter;
 
-void cmWriteChar(CompositeMessageWriter *writer, char val);
+typedef struct {
+    /**
+     * Counters of each CM_PROFILE_X operation
+     */
+    CMProfileCounter ops[CM_PROFILE_OP_COUNT];
+} CMProfileStats;
 
-char cmReadChar(CompositeMessageReader *reader);
+/**
+ * Callback that receives written parts of message from stream writer
+ * @param context - context pointer provided to cmSetFlushCallback
+ * @param data - bytes of message
+ * @param size - number of bytes
+ * @return true if bytes were consumed, false to abort writing
+ */
+typedef bool (*CMFlushCallback)(void *context, const void *data, uint32_t size);
 
 /**
- * Write array of values. Each value can be up to 8 bytes long
- * If buffer can't hold array of this size
- * firstError is set to CM_ERROR_NO_SPACE
- * itemSize must be power of two (maximum 8) otherwise
- * firstError is set to CM_ERROR_INVALID_ARG
- * There are helper macros cmWriteXArray where you don't need to set
- * itemType and itemSize
- * @param writer
- * @param itemType type of each item (one of CM_TYPE_X defines)
- * @param itemSize size of each item in bytes
- * @param data
- * @param itemCount how many items are in data array
+ * Callback that compresses block of bytes
+ * @param context - context pointer of CMCompressor
+ * @param data - bytes to compress
+ * @param size - number of bytes (not larger than blockSize of compressor)
+ * @param output - where compressed bytes should be written
+ * @param capacity - size of output in bytes
+ * @return size of compressed bytes or 0 if they don't fit in output
  */
-void cmWriteTypedArray(CompositeMessageWriter *writer, uint8_t itemType,
-                       uint8_t itemSize, const void *data, uint32_t itemCount);
+typedef uint32_t (*CMCompressCallback)(void *context, const void *data,
+                                       uint32_t size, void *output,
+                                       uint32_t capacity);
 
-#define cmWriteUArray(writer, data, itemCount) \
-    cmWriteTypedArray((writer), CM_TYPE_UINT, sizeof(*(data)), (data), (itemCount))
-#define cmWriteIArray(writer, data, itemCount) \
-    cmWriteTypedArray((writer), CM_TYPE_INT, sizeof(*(data)), (data), (itemCount))
-#define cmWriteFloatArray(writer, data, itemCount) \
-    cmWriteTypedArray((writer), CM_TYPE_FLOAT, sizeof(*(data)), (data), (itemCount))
-#define cmWriteBoolArray(writer, data, itemCount) \
-    cmWriteTypedArray((writer), CM_TYPE_BOOL, sizeof(*(data)), (data), (itemCount))
-#define cmWriteString(writer, data, itemCount) \
-    cmWriteTypedArray((writer), CM_TYPE_CHAR, sizeof(*(data)), (data), (itemCount))
+/**
+ * Callback that decompresses block of bytes produced by CMCompressCallback
+ * @param context - context pointer of CMCompressor
+ * @param data - compressed bytes
+ * @param size - number of compressed bytes
+ * @param output - where decompressed bytes should be written
+ * @param outputSize - exact size of decompressed bytes
+ * @return true if block was decompressed, false if it's corrupted
+ */
+typedef bool (*CMDecompressCallback)(void *context, const void *data,
+                                     uint32_t size, void *output,
+                                     uint32_t outputSize);
 
 /**
- * Read array of values into provided buffer. Each value can be up to 8 bytes
- * If next element is not an array, firstError is set to CM_ERROR_NO_VALUE
- * If provided buffer is insufficient to store array, firstError
- * is set to CM_ERROR_NO_SPACE
- * If itemSize is 0 or greater than 8, firstError is set to CM_ERROR_INVALID_ARG
- * If actual array in message has different item size or type, firstError
- * is set to CM_ERROR_INVALID_ARG
- * If read is successful, size of read array is returned
- * There are helper macros cmReadXArray where you don't need to set
- * itemType and itemSize
- * @param reader
- * @param itemType type of each item (one of CM_TYPE_X defines)
- * @param itemSize size of each item in bytes
- * @param buffer
- * @param maxItems how many items buffer can store
- * @return number of items read. For char arrays this includes null terminator
+ * Compression stage used by cmWriteCompressed, cmFlushCompressed and
+ * cmDecompress. Built-in LZ4 codec is created with cmInitLz4Compressor,
+ * other codecs (like heatshrink) are provided with callbacks
  */
-uint32_t cmReadTypedArray(CompositeMessageReader *reader, uint8_t itemType,
-                          uint8_t itemSize, void *buffer, uint32_t maxItems);
+typedef struct {
+    /**
+     * One of CM_COMPRESSION_X codecs
+     */
+    uint8_t codec;
 
-#define cmReadUArray(reader, buffer, maxItems) \
-    cmReadTypedArray((reader), CM_TYPE_UINT, sizeof(*(buffer)), (buffer), (maxItems))
-#define cmReadIArray(reader, buffer, maxItems) \
-    cmReadTypedArray((reader), CM_TYPE_INT, sizeof(*(buffer)), (buffer), (maxItems))
-#define cmReadFloatArray(reader, buffer, maxItems) \
-    cmReadTypedArray((reader), CM_TYPE_FLOAT, sizeof(*(buffer)), (buffer), (maxItems))
-#define cmReadBoolArray(reader, buffer, maxItems) \
-    cmReadTypedArray((reader), CM_TYPE_BOOL, sizeof(*(buffer)), (buffer), (maxItems))
-#define cmReadString(reader, buffer, maxItems) \
-    cmReadTypedArray((reader), CM_TYPE_CHAR, sizeof(*(buffer)), (buffer), (maxItems))
+    /**
+     * How many bytes are compressed together at most. Decompressing reader
+     * must have this much free space in its buffer
+     */
+    uint32_t blockSize;
+    CMCompressCallback compress;
+    CMDecompressCallback decompress;
+    void *context;
+} CMCompressor;
+
+/**
+ * Work buffer of built-in LZ4 compressor, can be allocated statically
+ */
+typedef struct {
+    uint16_t table[1u << CM_LZ4_HASH_LOG];
+} CMLz4WorkBuffer;
+
+/**
+ * After finished writing, check if firstError is CM_ERROR_NONE.
+ * This ensures that all written values are correct and message can be
+ * used in CompositeMessageReader.
+ * When first error is encountered, all other operations on writer
+ * are no-op.
+ * Do not modify fields directly
+ */
+typedef struct {
+    uint8_t *buffer;
+    uint32_t bufferSize;
+    uint32_t usedSize;
+    uint32_t firstError;
+
+    /**
+     * Offset of array started with cmBeginArray, valid only if arrayOpen
+     * is set (stream writer may start array at offset 0 after flush)
+     */
+    uint32_t arrayStart;
+    uint32_t arrayMaxCount;
+    bool arrayOpen;
+
+    /**
+     * Segments of message when writer is in gather mode or NULL
+     */
+    CMSegment *segments;
+    uint32_t maxSegments;
+    uint32_t segmentCount;
+
+    /**
+     * Offset in buffer where current (not yet recorded) segment begins
+     */
+    uint32_t segmentStart;
+    uint32_t gatherThreshold;
+
+    /**
+     * Total size of payloads that are referenced instead of being copied
+     * to buffer. Size of the whole message is usedSize + externalSize
+     */
+    uint32_t externalSize;
+
+    /**
+     * Callback of stream writer or NULL
+     */
+    CMFlushCallback flush;
+    void *flushContext;
+
+    /**
+     * How much bytes are already passed to flush callback.
+     * Size of the whole message is usedSize + flushedSize
+     */
+    uint32_t flushedSize;
+
+    /**
+     * CRC32 of message bytes up to crcOffset (without final inversion).
+     * Used only if CRC is enabled with cmEnableCrc32
+     */
+    bool crcEnabled;
+    uint32_t crc;
+    uint32_t crcOffset;
+
+    /**
+     * Integers (except 8-bit ones) are written as varints
+     */
+    bool compactIntegers;
+
+    /**
+     * Items of arrays are aligned to their size by padding flags
+     */
+    bool alignArrays;
+
+    /**
+     * Offset of size of embedded message that is being written
+     * (0 if there is no such message)
+     */
+    uint32_t messageStart;
+
+    /**
+     * Size of outer message at the beginning of body of embedded message
+     */
+    uint32_t messageOffset;
+
+    /**
+     * Dictionary of repeated names and strings or NULL
+     */
+    CMDictionary *dictionary;
+
+    /**
+     * Stats where measurements of writer operations are added or NULL
+     */
+    CMProfileStats *profileStats;
+} CompositeMessageWriter;
+
+/**
+ * After finished reading, check if firstError is CM_ERROR_NONE.
+ * This ensures that all read values are correct.
+ * When first error is encountered, all other operations on reader
+ * are no-op.
+ */
+typedef struct {
+    const uint8_t *message;
+
+    /**
+     * Total number of bytes in message
+     */
+    uint32_t totalSize;
+
+    /**
+     * How much bytes are already read
+     */
+    uint32_t readSize;
+
+    /**
+     * First error occurred when reading bytes
+     */
+    uint32_t firstError;
+
+    /**
+     * Message has inversed endianness and each value is swapped when read
+     */
+    bool swapBytes;
+
+    /**
+     * Size of message buffer for stream reader or 0 for other readers
+     */
+    uint32_t capacity;
+
+    /**
+     * Field index built by cmIndexFields or NULL
+     */
+    CMFieldSlot *fieldSlots;
+    uint32_t fieldSlotCount;
+
+    /**
+     * Message had inversed endianness and was converted in place
+     */
+    bool converted;
+
+    /**
+     * CRC32 of message bytes up to crcOffset (without final inversion)
+     */
+    uint32_t crc;
+    uint32_t crcOffset;
+
+    /**
+     * Structure of message was checked by cmValidate, so values can be read
+     * with cmReadXUnchecked functions
+     */
+    bool trusted;
+
+    /**
+     * Dictionary of repeated names and strings or NULL
+     */
+    CMDictionary *dictionary;
+
+    /**
+     * Offset up to which strings of message were added to dictionary
+     */
+    uint32_t dictionaryOffset;
+
+    /**
+     * Stats where measurements of reader operations are added or NULL
+     */
+    CMProfileStats *profileStats;
+} CompositeMessageReader;
+
+/**
+ * Context of cmFlushCompressed: stream writer that uses it as flush
+ * callback passes its elements compressed to output writer
+ */
+typedef struct {
+    CompositeMessageWriter *output;
+    const CMCompressor *compressor;
+
+    /**
+     * How many bytes of endianness mark of stream were already skipped
+     */
+    uint8_t markSkipped;
+} CMCompressingStream;
+
+/**
+ * Message recorded in index of log file
+ */
+typedef struct {
+    /**
+     * Offset of message (its endianness mark) in file
+     */
+    uint64_t offset;
+    uint32_t size;
+
+    /**
+     * Protocol version of message or 0 if message has no version
+     */
+    uint32_t version;
+} CMLogEntry;
+
+/**
+ * Writer of append-only log file with composite messages. After header
+ * (chars "CMLG", endianness mark, format version uint16 and reserved uint32)
+ * each message is stored as its size (uint32) followed by its bytes, so
+ * messages can be read in place. Size of each message starts 4 bytes before
+ * offset that is a multiple of 8 (zero bytes are added after message), so
+ * messages are aligned to 8 bytes in file.
+ * After every maxEntries messages index is appended. Index begins with
+ * 0xFFFFFFFF (instead of size), number of entries (uint32), number of first
+ * indexed message (uint64) and offset of previous index (uint64, 0 for the
+ * first one), followed by offset (uint64), size (uint32) and version
+ * (uint32) of each message and by trailer: offset of this index (uint64),
+ * number of indexes in file (uint32) and chars "CMLI". Values of file have
+ * endianness of writer.
+ * If file is closed after cmWriteLogIndex, it ends with trailer, so reader
+ * finds all indexes without reading messages.
+ * Bytes are passed to write callback, so file can be written with any
+ * API. Writer uses only provided storage of entries
+ */
+typedef struct {
+    CMFlushCallback write;
+    void *context;
+
+    /**
+     * Entries of messages that are appended after the last index
+     */
+    CMLogEntry *entries;
+    uint32_t maxEntries;
+    uint32_t entryCount;
+
+    /**
+     * Number of bytes passed to write callback (size of file)
+     */
+    uint64_t size;
+    uint64_t messageCount;
+
+    /**
+     * Offset of the last index or 0 if there is no index yet
+     */
+    uint64_t lastIndex;
+    uint32_t indexCount;
+
+    uint32_t firstError;
+} CMLogWriter;
+
+/**
+ * Index of log file found by CMLogReader
+ */
+typedef struct {
+    /**
+     * Offset of index in file
+     */
+    uint64_t offset;
+    uint64_t firstMessage;
+    uint32_t entryCount;
+} CMLogIndex;
+
+/**
+ * Reader of log file written by CMLogWriter. Reader holds only file
+ * bytes (usually mapped into memory) and list of indexes found in file,
+ * messages are located with binary search in indexes and are read in place
+ */
+typedef struct {
+    const uint8_t *data;
+    uint64_t size;
+
+    /**
+     * Data is mapped from file by cmOpenLog
+     */
+    bool mapped;
+
+    /**
+     * File has inversed endianness
+     */
+    bool swapBytes;
+
+    /**
+     * Indexes in order of messages
+     */
+    CMLogIndex *indexes;
+    uint32_t maxIndexes;
+    uint32_t indexCount;
+
+    /**
+     * Number of all messages in file, messages after the last index can be
+     * found only by walking through them
+     */
+    uint64_t messageCount;
+
+    /**
+     * Offset of the first message after the last index and number of
+     * such messages
+     */
+    uint64_t tailOffset;
+    uint64_t tailCount;
+
+    uint32_t firstError;
+} CMLogReader;
+
+/**
+ * Initialize message writer with given buffer and size
+ * @param buffer - pointer to buffer for message building
+ * @size size - size of buffer in bytes
+ * @return initialized CompositeMessageWriter
+ */
+CompositeMessageWriter cmGetWriter(void *buffer, uint32_t size);
+
+/**
+ * Initialize message reader with given message and size
+ * Message must be non const since it will be modified internally
+ * If message has inversed endianness, it is converted in place. When some
+ * element of such message doesn't fit into message or has unknown flag,
+ * firstError is set to CM_ERROR_MALFORMED (elements before it stay converted)
+ * @param message - pointer to message that should be read
+ * @size size - size of message in bytes
+ * @return initialized CompositeMessageReader
+ */
+CompositeMessageReader cmGetReader(void *message, uint32_t size);
+
+/**
+ * Initialize message writer in place with given buffer and size.
+ * Same as cmGetWriter, but doesn't use any shared state, so different
+ * writers can be initialized from different threads at the same time
+ * @param writer - writer to initialize
+ * @param buffer - pointer to buffer for message building
+ * @param size - size of buffer in bytes
+ */
+void cmInitWriter(CompositeMessageWriter *writer, void *buffer, uint32_t size);
+
+/**
+ * Initialize message reader in place with given message and size.
+ * Same as cmGetReader, but doesn't use any shared state, so different
+ * readers can be initialized from different threads at the same time
+ * Message must be non const since it will be modified internally
+ * @param reader - reader to initialize
+ * @param message - pointer to message that should be read
+ * @param size - size of message in bytes
+ */
+void cmInitReader(CompositeMessageReader *reader, void *message, uint32_t size);
+
+/**
+ * Same as cmInitReader, but initialization is measured and reader adds
+ * measurements of its operations to given stats (see cmSetReaderProfileStats)
+ * @param reader - reader to initialize
+ * @param message - pointer to message that should be read
+ * @param size - size of message in bytes
+ * @param stats - stats to update or NULL
+ */
+void cmInitProfiledReader(CompositeMessageReader *reader, void *message,
+                          uint32_t size, CMProfileStats *stats);
+
+/**
+ * Initialize message reader that never modifies the message.
+ * Message with any endianness is accepted and is not converted in advance,
+ * instead each value is converted at the moment it is read. This makes
+ * reader creation O(1) and allows reading from read-only memory (like mmap'd
+ * files) or from buffer that is shared between several readers
+ * @param reader - reader to initialize
+ * @param message - pointer to message that should be read
+ * @param size - size of message in bytes
+ */
+void cmInitConstReader(CompositeMessageReader *reader, const void *message,
+                       uint32_t size);
+
+/**
+ * Initialize stream reader that receives message in parts with cmFeed.
+ * Buffer is used to store received bytes that are not read yet, so it must
+ * be large enough to hold the largest single element of message (plus 2
+ * bytes for endianness mark), but not the whole message.
+ * When element at current position is not received completely yet,
+ * read functions set firstError to CM_ERROR_NEED_MORE instead of
+ * CM_ERROR_NO_VALUE and don't change read position, so read can be
+ * repeated after more bytes are fed.
+ * Values are converted to native endianness when they are read.
+ * Until endianness mark is received, firstError is CM_ERROR_NEED_MORE
+ * @param reader - reader to initialize
+ * @param buffer - buffer where received bytes are stored
+ * @param capacity - size of buffer in bytes
+ */
+void cmInitStreamReader(CompositeMessageReader *reader, void *buffer,
+                        uint32_t capacity);
+
+/**
+ * Append received part of message to stream reader.
+ * If firstError is CM_ERROR_NEED_MORE, it is cleared so failed read can be
+ * repeated. When there is not enough space in buffer, already read bytes
+ * are discarded (so offsets inside of buffer and pointers returned by view
+ * functions become invalid). If buffer is filled with element that is
+ * still incomplete, firstError is set to CM_ERROR_NO_SPACE.
+ * If reader is not a stream reader, firstError is set to CM_ERROR_INVALID_ARG
+ * @param reader
+ * @param data - received bytes
+ * @param size - number of received bytes
+ * @return how many bytes were accepted, rest should be fed again after
+ * some values are read
+ */
+uint32_t cmFeed(CompositeMessageReader *reader, const void *data,
+                uint32_t size);
+
+/**
+ * Write signed 8-bit integer to message. If buffer can't hold integer then
+ * firstError is set to CM_ERROR_NO_SPACE
+ * @param writer
+ * @param i
+ */
+void cmWriteI8(CompositeMessageWriter *writer, int8_t i);
+
+/**
+ * Read signed 8-bit integer from message.
+ * If there is no int8 at this place, firstError is set to CM_ERROR_NO_VALUE
+ * @param reader
+ * @return read value
+ */
+int8_t cmReadI8(CompositeMessageReader *reader);
+
+void cmWriteU8(CompositeMessageWriter *writer, uint8_t i);
+
+uint8_t cmReadU8(CompositeMessageReader *reader);
+
+void cmWriteI16(CompositeMessageWriter *writer, int16_t i);
+
+int16_t cmReadI16(CompositeMessageReader *reader);
+
+void cmWriteU16(CompositeMessageWriter *writer, uint16_t i);
+
+uint16_t cmReadU16(CompositeMessageReader *reader);
+
+void cmWriteI32(CompositeMessageWriter *writer, int32_t i);
+
+int32_t cmReadI32(CompositeMessageReader *reader);
+
+void cmWriteU32(CompositeMessageWriter *writer, uint32_t i);
+
+uint32_t cmReadU32(CompositeMessageReader *reader);
+
+void cmWriteI64(CompositeMessageWriter *writer, int64_t i);
+
+int64_t cmReadI64(CompositeMessageReader *reader);
+
+void cmWriteU64(CompositeMessageWriter *writer, uint64_t i);
+
+uint64_t cmReadU64(CompositeMessageReader *reader);
+
+void cmWriteF(CompositeMessageWriter *writer, float f);
+
+float cmReadF(CompositeMessageReader *reader);
+
+void cmWriteD(CompositeMessageWriter *writer, double d);
+
+double cmReadD(CompositeMessageReader *reader);
+
+void cmWriteBool(CompositeMessageWriter *writer, bool val);
+
+bool cmReadBool(CompositeMessageReader *reader);
+
+void cmWriteChar(CompositeMessageWriter *writer, char val);
+
+char cmReadChar(CompositeMessageReader *reader);
+
+/**
+ * Write array of values. Each value can be up to 8 bytes long
+ * If buffer can't hold array of this size
+ * firstError is set to CM_ERROR_NO_SPACE
+ * itemSize must be power of two (maximum 8) otherwise
+ * firstError is set to CM_ERROR_INVALID_ARG
+ * There are helper macros cmWriteXArray where you don't need to set
+ * itemType and itemSize
+ * @param writer
+ * @param itemType type of each item (one of CM_TYPE_X defines)
+ * @param itemSize size of each item in bytes
+ * @param data
+ * @param itemCount how many items are in data array
+ */
+void cmWriteTypedArray(CompositeMessageWriter *writer, uint8_t itemType,
+                       uint8_t itemSize, const void *data, uint32_t itemCount);
+
+#define cmWriteUArray(writer, data, itemCount) \
+    cmWriteTypedArray((writer), CM_TYPE_UINT, sizeof(*(data)), (data), (itemCount))
+#define cmWriteIArray(writer, data, itemCount) \
+    cmWriteTypedArray((writer), CM_TYPE_INT, sizeof(*(data)), (data), (itemCount))
+#define cmWriteFloatArray(writer, data, itemCount) \
+    cmWriteTypedArray((writer), CM_TYPE_FLOAT, sizeof(*(data)), (data), (itemCount))
+#define cmWriteBoolArray(writer, data, itemCount) \
+    cmWriteTypedArray((writer), CM_TYPE_BOOL, sizeof(*(data)), (data), (itemCount))
+#define cmWriteString(writer, data, itemCount) \
+    cmWriteTypedArray((writer), CM_TYPE_CHAR, sizeof(*(data)), (data), (itemCount))
+
+/**
+ * Switch writer to gather mode. In this mode payloads of arrays written
+ * with cmWriteTypedArray that are at least threshold bytes long are not
+ * copied to buffer. Instead message is described by list of segments where
+ * such payloads are referenced directly, while everything else is stored in
+ * buffer. Referenced data must stay valid until message is sent.
+ * When there is not enough segments to reference array, it is copied
+ * to buffer as usual.
+ * Should be called right after writer is initialized.
+ * If segments is NULL or maxSegments is 0, firstError is set to
+ * CM_ERROR_INVALID_ARG
+ * @param writer
+ * @param segments array where segments will be stored
+ * @param maxSegments how many segments can be stored
+ * @param threshold minimal payload size (in bytes) that is referenced
+ */
+void cmSetGatherMode(CompositeMessageWriter *writer, CMSegment *segments,
+                     uint32_t maxSegments, uint32_t threshold);
+
+/**
+ * Switch writer to stream mode. In this mode buffer is passed to flush
+ * callback each time it can't hold next element, after that buffer is
+ * reused, so message size is not limited by buffer size. Array payloads
+ * that are larger than the whole buffer bypass it and are passed to
+ * callback directly. Bytes left in buffer must be flushed with cmFlush
+ * after message is complete.
+ * Should be called right after writer is initialized.
+ * If callback returns false, firstError is set to CM_ERROR_IO.
+ * If flush is NULL or writer is in gather mode, firstError is set to
+ * CM_ERROR_INVALID_ARG
+ * @param writer
+ * @param flush - callback that receives parts of message
+ * @param context - pointer that is passed to callback
+ */
+void cmSetFlushCallback(CompositeMessageWriter *writer, CMFlushCallback flush,
+                        void *context);
+
+/**
+ * Write array encoded with one of CM_CODEC_X codecs. Varint, delta and
+ * frame of reference codecs support integer items, run-length codec
+ * supports bool items. Delta codec works best for monotonic series
+ * (e.g. timestamps), frame of reference for values that stay in narrow
+ * range. Array is read back with cmReadTypedArray.
+ * If codec doesn't support items or arguments are invalid as in
+ * cmWriteTypedArray, firstError is set to CM_ERROR_INVALID_ARG.
+ * If buffer can't hold encoded array, firstError is set to
+ * CM_ERROR_NO_SPACE
+ * @param writer
+ * @param codec one of CM_CODEC_X defines
+ * @param itemType type of each item (one of CM_TYPE_X defines)
+ * @param itemSize size of each item in bytes
+ * @param data
+ * @param itemCount how many items are in data array
+ */
+void cmWriteEncodedArray(CompositeMessageWriter *writer, uint8_t codec,
+                         uint8_t itemType, uint8_t itemSize, const void *data,
+                         uint32_t itemCount);
+
+#define cmWriteEncodedUArray(writer, codec, data, itemCount) \
+    cmWriteEncodedArray((writer), (codec), CM_TYPE_UINT, sizeof(*(data)), (data), (itemCount))
+#define cmWriteEncodedIArray(writer, codec, data, itemCount) \
+    cmWriteEncodedArray((writer), (codec), CM_TYPE_INT, sizeof(*(data)), (data), (itemCount))
+#define cmWriteEncodedBoolArray(writer, data, itemCount) \
+    cmWriteEncodedArray((writer), CM_CODEC_RLE, CM_TYPE_BOOL, sizeof(*(data)), (data), (itemCount))
+#define cmWritePackedBoolArray(writer, data, itemCount) \
+    cmWriteEncodedArray((writer), CM_CODEC_BITS, CM_TYPE_BOOL, sizeof(*(data)), (data), (itemCount))
+
+/**
+ * Write bitmap as bool array packed to bits (8 values per byte).
+ * Bit i of bitmap is bit i % 8 of byte i / 8. Array can be read as bitmap
+ * with cmReadBitmap or as bool array with cmReadBoolArray.
+ * If buffer can't hold bitmap, firstError is set to CM_ERROR_NO_SPACE
+ * @param writer
+ * @param bits
+ * @param bitCount number of bits in bitmap
+ */
+void cmWriteBitmap(CompositeMessageWriter *writer, const void *bits,
+                   uint32_t bitCount);
+
+/**
+ * Reserve space for raw bytes of elements that will be written directly
+ * to writer buffer. Stream writer flushes its buffer if needed.
+ * Bytes must form valid elements and must be committed with cmCommitBytes.
+ * If buffer can't hold 'size' bytes, firstError is set to CM_ERROR_NO_SPACE
+ * @param writer
+ * @param size maximum number of bytes that will be written
+ * @return pointer to reserved space or NULL on error
+ */
+void *cmReserveBytes(CompositeMessageWriter *writer, uint32_t size);
+
+/**
+ * Add bytes written to space returned by cmReserveBytes to message.
+ * If size is larger than free space of buffer, firstError is set to
+ * CM_ERROR_INVALID_ARG
+ * @param writer
+ * @param size number of written bytes
+ */
+void cmCommitBytes(CompositeMessageWriter *writer, uint32_t size);
+
+/**
+ * Write scalar fields of struct as separate values, in the same way as
+ * sequence of cmWriteX calls. Space for all fields is checked once, so it's
+ * faster than writing fields one by one (unless compact integers are
+ * enabled, in that case integers are written as varints one by one).
+ * If description has invalid type or size, firstError is set to
+ * CM_ERROR_INVALID_ARG and nothing is written.
+ * If buffer can't hold all fields, firstError is set to CM_ERROR_NO_SPACE
+ * and nothing is written (stream writer writes fields one by one if its
+ * buffer is smaller than record)
+ * @param writer
+ * @param desc descriptions of fields
+ * @param base pointer to struct
+ * @param count number of fields
+ */
+void cmWriteBatch(CompositeMessageWriter *writer, const CMFieldDesc *desc,
+                  const void *base, uint32_t count);
+
+/**
+ * Write array of structs as record table. Each field described by desc
+ * becomes a column, items of each column are stored contiguously as items
+ * of array, so there is a single flag for the whole table.
+ * If columnCount is 0 or description has invalid type or size, firstError
+ * is set to CM_ERROR_INVALID_ARG and nothing is written.
+ * If buffer can't hold table, firstError is set to CM_ERROR_NO_SPACE
+ * (stream writer flushes table in parts if its buffer is smaller)
+ * @param writer
+ * @param desc descriptions of columns
+ * @param columnCount number of columns
+ * @param records pointer to the first struct
+ * @param stride distance between structs in bytes (usually size of struct)
+ * @param recordCount number of structs
+ */
+void cmWriteRecordTable(CompositeMessageWriter *writer, const CMFieldDesc *desc,
+                        uint8_t columnCount, const void *records,
+                        uint32_t stride, uint32_t recordCount);
+
+/**
+ * Enable or disable compact encoding of integers. When enabled, 16, 32 and
+ * 64-bit integers are written as LEB128 varints (signed ones are zig-zag
+ * encoded), so small values take 2-3 bytes instead of 3-9. Integer arrays
+ * written with cmWriteTypedArray are stored as encoded arrays of varints.
+ * Arrays started with cmBeginArray keep fixed size items.
+ * Readers accept both encodings in cmReadX and cmReadTypedArray functions,
+ * but views can't be provided for encoded arrays
+ * @param writer
+ * @param enable
+ */
+void cmSetCompactIntegers(CompositeMessageWriter *writer, bool enable);
+
+/**
+ * Enable or disable alignment of arrays. When enabled, padding flags are
+ * written before arrays of 2, 4 and 8-byte items (up to itemSize - 1 bytes),
+ * so offset of first item from the beginning of message is a multiple of
+ * item size. Readers skip padding, so if message is placed in buffer that is
+ * aligned to 8 bytes, views of such arrays are naturally aligned and can be
+ * accessed directly on targets without unaligned access.
+ * Alignment is kept by const readers and by in place readers. Stream readers
+ * move received bytes to the beginning of their buffer, so views provided by
+ * them have no alignment guarantees.
+ * Encoded arrays (see cmSetCompactIntegers) are not padded
+ * @param writer
+ * @param enable
+ */
+void cmSetAlignedArrays(CompositeMessageWriter *writer, bool enable);
+
+/**
+ * Initialize empty dictionary with provided storage
+ * @param dictionary
+ * @param entries storage of entries
+ * @param capacity number of entries (only first 256 are used)
+ * @param chars storage of chars of strings
+ * @param charsCapacity size of chars storage in bytes
+ */
+void cmInitDictionary(CMDictionary *dictionary, CMDictionaryEntry *entries,
+                      uint32_t capacity, char *chars, uint32_t charsCapacity);
+
+/**
+ * Remove all strings from dictionary. Writer and reader that share
+ * dictionary within session should reset it at the same message
+ * @param dictionary
+ */
+void cmResetDictionary(CMDictionary *dictionary);
+
+/**
+ * Use dictionary for names written with cmWriteName and strings written
+ * with cmWriteString (up to 255 chars). First use of string is written
+ * together with its index in dictionary, later uses are written as index
+ * only. When dictionary is full or definition doesn't fit in buffer of
+ * stream writer, strings are written in regular way.
+ * Message can be read only by reader with dictionary of the same capacity
+ * @param writer
+ * @param dictionary dictionary or NULL to stop using it
+ */
+void cmSetWriterDictionary(CompositeMessageWriter *writer,
+                           CMDictionary *dictionary);
+
+/**
+ * Use dictionary to resolve names and strings stored in dictionary.
+ * Strings are added to dictionary when reader passes them (including
+ * skipped fields), so cmReadName, cmReadString and other functions return
+ * the same result as for strings written in regular way. Views of strings
+ * stored in dictionary point to storage of dictionary.
+ * If string is not found in dictionary, firstError is set to
+ * CM_ERROR_NO_VALUE. Strings that don't fit into dictionary are not added
+ * @param reader
+ * @param dictionary dictionary or NULL to stop using it
+ */
+void cmSetReaderDictionary(CompositeMessageReader *reader,
+                           CMDictionary *dictionary);
+
+/**
+ * Add all strings that are defined in the rest of message to dictionary of
+ * reader, so following messages that share the same dictionary can refer to
+ * them even if they were not read. Read position is not changed
+ * @param reader
+ */
+void cmUpdateDictionary(CompositeMessageReader *reader);
+
+/**
+ * Pass bytes stored in buffer of stream writer to its flush callback.
+ * If writer is not in stream mode, firstError is set to CM_ERROR_INVALID_ARG
+ * @param writer
+ */
+void cmFlush(CompositeMessageWriter *writer);
+
+/**
+ * Initialize writer that doesn't store message, but only counts its size.
+ * Elements are written as usual and size of message is returned by
+ * cmGetMessageSize, so the real writer can be created with buffer of
+ * exact size. Writer works in stream mode with given scratch buffer:
+ * array payloads that don't fit in it are counted without copying, other
+ * elements are written to it and then discarded. Arrays started with
+ * cmBeginArray are limited by size of scratch buffer.
+ * Size of scratch buffer should be at least CM_COUNTING_BUFFER_SIZE,
+ * otherwise long names and markers set firstError to CM_ERROR_NO_SPACE
+ * @param writer - writer to initialize
+ * @param buffer - scratch buffer
+ * @param size - size of scratch buffer in bytes
+ */
+void cmInitCountingWriter(CompositeMessageWriter *writer, void *buffer,
+                          uint32_t size);
+
+/**
+ * Get size of message written so far, including bytes that were already
+ * passed to flush callback and payloads referenced in gather mode
+ * @param writer
+ * @return size of message in bytes
+ */
+uint32_t cmGetMessageSize(const CompositeMessageWriter *writer);
+
+/**
+ * Finish message written in gather mode. Data written to buffer after
+ * last referenced payload is recorded as the last segment.
+ * If writer is not in gather mode, firstError is set to CM_ERROR_INVALID_ARG
+ * @param writer
+ * @return number of segments that describe the whole message
+ */
+uint32_t cmFinishSegments(CompositeMessageWriter *writer);
+
+/**
+ * Start array that will be filled in place inside of writer buffer.
+ * Space for maxCount items is reserved and pointer to the first item is
+ * returned, so items can be written there directly without staging them
+ * in separate buffer. Array must be finished with cmCommitArray before
+ * anything else is written to message, otherwise firstError is set
+ * to CM_ERROR_INVALID_ARG.
+ * For char arrays additional byte is reserved for null terminator which
+ * is placed by cmCommitArray.
+ * If buffer can't hold array of this size, firstError is set to
+ * CM_ERROR_NO_SPACE. Arguments are checked as in cmWriteTypedArray.
+ * Returned pointer has no alignment guarantees
+ * @param writer
+ * @param itemType type of each item (one of CM_TYPE_X defines)
+ * @param itemSize size of each item in bytes
+ * @param maxCount how many items can be written to array
+ * @return pointer to the first item or NULL on error
+ */
+void *cmBeginArray(CompositeMessageWriter *writer, uint8_t itemType,
+                   uint8_t itemSize, uint32_t maxCount);
+
+/**
+ * Finish array started with cmBeginArray. Size of array is set to
+ * itemCount and space reserved for other items is released.
+ * If there is no started array or itemCount is larger than maxCount that
+ * was provided to cmBeginArray, firstError is set to CM_ERROR_INVALID_ARG
+ * @param writer
+ * @param itemCount how many items were actually written
+ */
+void cmCommitArray(CompositeMessageWriter *writer, uint32_t itemCount);
+
+/**
+ * Read array of values into provided buffer. Each value can be up to 8 bytes
+ * If next element is not an array, firstError is set to CM_ERROR_NO_VALUE
+ * If provided buffer is insufficient to store array, firstError
+ * is set to CM_ERROR_NO_SPACE
+ * If itemSize is 0 or greater than 8, firstError is set to CM_ERROR_INVALID_ARG
+ * If actual array in message has different item size or type, firstError
+ * is set to CM_ERROR_INVALID_ARG
+ * If read is successful, size of read array is returned
+ * There are helper macros cmReadXArray where you don't need to set
+ * itemType and itemSize
+ * @param reader
+ * @param itemType type of each item (one of CM_TYPE_X defines)
+ * @param itemSize size of each item in bytes
+ * @param buffer
+ * @param maxItems how many items buffer can store
+ * @return number of items read. For char arrays this includes null terminator
+ */
+uint32_t cmReadTypedArray(CompositeMessageReader *reader, uint8_t itemType,
+                          uint8_t itemSize, void *buffer, uint32_t maxItems);
+
+#define cmReadUArray(reader, buffer, maxItems) \
+    cmReadTypedArray((reader), CM_TYPE_UINT, sizeof(*(buffer)), (buffer), (maxItems))
+#define cmReadIArray(reader, buffer, maxItems) \
+    cmReadTypedArray((reader), CM_TYPE_INT, sizeof(*(buffer)), (buffer), (maxItems))
+#define cmReadFloatArray(reader, buffer, maxItems) \
+    cmReadTypedArray((reader), CM_TYPE_FLOAT, sizeof(*(buffer)), (buffer), (maxItems))
+#define cmReadBoolArray(reader, buffer, maxItems) \
+    cmReadTypedArray((reader), CM_TYPE_BOOL, sizeof(*(buffer)), (buffer), (maxItems))
+#define cmReadString(reader, buffer, maxItems) \
+    cmReadTypedArray((reader), CM_TYPE_CHAR, sizeof(*(buffer)), (buffer), (maxItems))
+
+/**
+ * Read packed bool array as bitmap (see cmWriteBitmap). Plain bool arrays
+ * are accepted as well and are packed to bits while they are read.
+ * Unused bits of the last byte are cleared.
+ * If there is no bool array at current position, firstError is set to
+ * CM_ERROR_NO_VALUE. If buffer can't hold all bits, firstError is set
+ * to CM_ERROR_NO_SPACE
+ * @param reader
+ * @param bits buffer for at least (maxBits + 7) / 8 bytes
+ * @param maxBits how many bits buffer can store
+ * @return number of bits read
+ */
+uint32_t cmReadBitmap(CompositeMessageReader *reader, void *bits,
+                      uint32_t maxBits);
+
+/**
+ * Read array of values without copying it.
+ * On success data is set to point to the first item of array inside of
+ * the message and read position is moved past the array, so pointer stays
+ * valid as long as message buffer is valid.
+ * Items are stored right after array flag and its size (5 bytes in total),
+ * so pointer has no alignment guarantees. On targets that don't allow
+ * unaligned access, items must be accessed with memcpy or byte by byte,
+ * unless message was written with aligned arrays (see cmSetAlignedArrays)
+ * and is placed in buffer aligned to 8 bytes.
+ * Errors are the same as in cmReadTypedArray (except there is no
+ * CM_ERROR_NO_SPACE). If message has inversed endianness and is read
+ * by const reader, items longer than 1 byte can't be converted in place
+ * and firstError is set to CM_ERROR_NO_ENDIAN
+ * There are helper macros cmReadXArrayView where you don't need to set
+ * itemType and itemSize
+ * @param reader
+ * @param itemType type of each item (one of CM_TYPE_X defines)
+ * @param itemSize size of each item in bytes
+ * @param data pointer to the first item or NULL if nothing was read
+ * @return number of items in array. For char arrays this includes
+ * null terminator
+ */
+uint32_t cmReadArrayView(CompositeMessageReader *reader, uint8_t itemType,
+                         uint8_t itemSize, const void **data);
+
+#define cmReadUArrayView(reader, data) \
+    cmReadArrayView((reader), CM_TYPE_UINT, sizeof(**(data)), (const void **) (data))
+#define cmReadIArrayView(reader, data) \
+    cmReadArrayView((reader), CM_TYPE_INT, sizeof(**(data)), (const void **) (data))
+#define cmReadFloatArrayView(reader, data) \
+    cmReadArrayView((reader), CM_TYPE_FLOAT, sizeof(**(data)), (const void **) (data))
+#define cmReadBoolArrayView(reader, data) \
+    cmReadArrayView((reader), CM_TYPE_BOOL, sizeof(**(data)), (const void **) (data))
+
+/**
+ * Read scalar fields of struct written by cmWriteBatch (or by sequence of
+ * cmWriteX calls). If all fields are present with fixed size and matching
+ * flags, bounds are checked once for the whole record, otherwise fields are
+ * read one by one as with cmReadX functions (so compact integers are
+ * accepted). Errors are the same as in cmReadX functions. If any field
+ * can't be read, read position is restored to the beginning of record,
+ * so stream reader can read whole record again after more bytes are fed.
+ * Fields of struct are not restored. If description has invalid type or
+ * size, firstError is set to CM_ERROR_INVALID_ARG
+ * @param reader
+ * @param desc descriptions of fields
+ * @param base pointer to struct
+ * @param count number of fields
+ * @return true if all fields were read
+ */
+bool cmReadBatch(CompositeMessageReader *reader, const CMFieldDesc *desc,
+                 void *base, uint32_t count);
+
+/**
+ * Read number of records in next record table. This function doesn't
+ * change state of reader if next element is record table.
+ * If next element is not a record table or it's not complete, firstError is
+ * set to CM_ERROR_NO_VALUE (CM_ERROR_NEED_MORE for stream readers)
+ * @param reader
+ * @return number of records
+ */
+uint32_t cmPeekRecordCount(CompositeMessageReader *reader);
+
+/**
+ * Read record table into array of structs.
+ * If next element is not a record table or its columns don't match
+ * descriptions (number of columns, type and size of each one), firstError
+ * is set to CM_ERROR_NO_VALUE.
+ * If records can't hold all records, firstError is set to CM_ERROR_NO_SPACE
+ * If description has invalid type or size, firstError is set to
+ * CM_ERROR_INVALID_ARG
+ * @param reader
+ * @param desc descriptions of columns
+ * @param columnCount number of columns
+ * @param records pointer to the first struct
+ * @param stride distance between structs in bytes (usually size of struct)
+ * @param maxRecords how many structs can be stored
+ * @return number of read records
+ */
+uint32_t cmReadRecordTable(CompositeMessageReader *reader, const CMFieldDesc *desc,
+                           uint8_t columnCount, void *records, uint32_t stride,
+                           uint32_t maxRecords);
+
+/**
+ * Read single column of next record table into contiguous buffer. Read
+ * position is not changed, so several columns can be read one by one
+ * (table can be skipped with cmSkip afterwards).
+ * If next element is not a record table, it doesn't have such column or
+ * column has different item type or size, firstError is set to
+ * CM_ERROR_NO_VALUE.
+ * If buffer is insufficient to store column, firstError is set to
+ * CM_ERROR_NO_SPACE
+ * If itemType is not one of CM_TYPE_X defines or itemSize is not 1, 2, 4
+ * or 8, firstError is set to CM_ERROR_INVALID_ARG
+ * There are helper macros cmReadXColumn where you don't need to set
+ * itemType and itemSize
+ * @param reader
+ * @param column index of column
+ * @param itemType type of each item (one of CM_TYPE_X defines)
+ * @param itemSize size of each item in bytes
+ * @param buffer
+ * @param maxItems how many items buffer can store
+ * @return number of read items (number of records)
+ */
+uint32_t cmReadColumn(CompositeMessageReader *reader, uint8_t column,
+                      uint8_t itemType, uint8_t itemSize, void *buffer,
+                      uint32_t maxItems);
+
+#define cmReadUColumn(reader, column, buffer, maxItems) \
+    cmReadColumn((reader), (column), CM_TYPE_UINT, sizeof(*(buffer)), (buffer), (maxItems))
+#define cmReadIColumn(reader, column, buffer, maxItems) \
+    cmReadColumn((reader), (column), CM_TYPE_INT, sizeof(*(buffer)), (buffer), (maxItems))
+#define cmReadFloatColumn(reader, column, buffer, maxItems) \
+    cmReadColumn((reader), (column), CM_TYPE_FLOAT, sizeof(*(buffer)), (buffer), (maxItems))
+#define cmReadBoolColumn(reader, column, buffer, maxItems) \
+    cmReadColumn((reader), (column), CM_TYPE_BOOL, sizeof(*(buffer)), (buffer), (maxItems))
+
+/**
+ * Read string without copying it.
+ * On success str is set to point to null terminated string inside of
+ * the message and read position is moved past the string.
+ * If next element is not a string, firstError is set to CM_ERROR_NO_VALUE
+ * @param reader
+ * @param str pointer to the string or NULL if nothing was read
+ * @return length of string (without null terminator)
+ */
+uint32_t cmReadStringView(CompositeMessageReader *reader, const char **str);
 
 /**
  * Read size of next array. This function doesn't change state of
@@ -269,6 +1521,709 @@ void cmWriteVersion(CompositeMessageWriter *writer, uint32_t ver);
 
 uint32_t cmReadVersion(CompositeMessageReader *reader);
 
+/**
+ * Write name of the next value or block.
+ * If name is longer than 255 chars, firstError is set to CM_ERROR_INVALID_ARG
+ * @param writer
+ * @param name null terminated name
+ */
+void cmWriteName(CompositeMessageWriter *writer, const char *name);
+
+/**
+ * Read name into provided buffer. Name is always null terminated.
+ * If next element is not a name, firstError is set to CM_ERROR_NO_VALUE
+ * If buffer can't hold name and null terminator, firstError is set to
+ * CM_ERROR_NO_SPACE
+ * @param reader
+ * @param buffer
+ * @param bufferSize size of buffer in bytes
+ * @return length of name (without null terminator)
+ */
+uint8_t cmReadName(CompositeMessageReader *reader, char *buffer,
+                   uint32_t bufferSize);
+
+/**
+ * Read name without copying it. On success name is set to point to
+ * null terminated name inside of the message.
+ * If next element is not a name, firstError is set to CM_ERROR_NO_VALUE
+ * @param reader
+ * @param name pointer to the name or NULL if nothing was read
+ * @return length of name (without null terminator)
+ */
+uint8_t cmReadNameView(CompositeMessageReader *reader, const char **name);
+
+/**
+ * Start block of values. Each block must be finished with cmWriteBlockEnd,
+ * blocks can be nested
+ * @param writer
+ */
+void cmWriteBlockStart(CompositeMessageWriter *writer);
+
+/**
+ * Read start of block.
+ * If next element is not a block start, firstError is set to CM_ERROR_NO_VALUE
+ * @param reader
+ */
+void cmReadBlockStart(CompositeMessageReader *reader);
+
+void cmWriteBlockEnd(CompositeMessageWriter *writer);
+
+void cmReadBlockEnd(CompositeMessageReader *reader);
+
+/**
+ * Start protocol metadata. Metadata is written in the same way as other
+ * values and must be finished with cmWriteMetadataEnd
+ * @param writer
+ */
+void cmWriteMetadataStart(CompositeMessageWriter *writer);
+
+void cmReadMetadataStart(CompositeMessageReader *reader);
+
+void cmWriteMetadataEnd(CompositeMessageWriter *writer);
+
+void cmReadMetadataEnd(CompositeMessageReader *reader);
+
+/**
+ * Write protocol marker
+ * @param writer
+ * @param marker bytes of marker
+ * @param size size of marker in bytes
+ */
+void cmWriteMarker(CompositeMessageWriter *writer, const void *marker,
+                   uint8_t size);
+
+/**
+ * Read protocol marker into provided buffer.
+ * If next element is not a marker, firstError is set to CM_ERROR_NO_VALUE
+ * If buffer can't hold marker, firstError is set to CM_ERROR_NO_SPACE
+ * @param reader
+ * @param buffer
+ * @param maxSize size of buffer in bytes
+ * @return size of marker in bytes
+ */
+uint8_t cmReadMarker(CompositeMessageReader *reader, void *buffer,
+                     uint8_t maxSize);
+
+/**
+ * Build index of named fields, so they can be found with cmFindField
+ * without scanning message again.
+ * Message is scanned once from current position to the end of current
+ * block (or to the end of message). Only names at this level are indexed,
+ * names inside of nested blocks are not, so to index fields of nested block,
+ * call this function again after its start is read.
+ * Number of slots must be a power of two and should be larger than number
+ * of fields (twice as large is a good choice), otherwise firstError is set
+ * to CM_ERROR_INVALID_ARG. If there are more names than slots, firstError is
+ * set to CM_ERROR_NO_SPACE. If message can't be scanned, firstError is set
+ * to CM_ERROR_NO_VALUE. Read position is not changed.
+ * Slots must stay valid while index is used
+ * @param reader
+ * @param slots array of slots
+ * @param slotCount number of slots
+ */
+void cmIndexFields(CompositeMessageReader *reader, CMFieldSlot *slots,
+                   uint32_t slotCount);
+
+/**
+ * Move read position to value that follows field with given name.
+ * Field is looked up in index built with cmIndexFields, so lookup doesn't
+ * depend on number of fields in message. If there are several fields with
+ * the same name, the first one is found.
+ * If index was not built, firstError is set to CM_ERROR_INVALID_ARG
+ * @param reader
+ * @param name null terminated name of field
+ * @return true if field is found, otherwise read position is not changed
+ */
+bool cmFindField(CompositeMessageReader *reader, const char *name);
+
+/**
+ * Skip next field without reading it. Field is a single value, array,
+ * marker, version or a whole block (together with nested blocks).
+ * Name is skipped together with the field that follows it.
+ * Only flags and sizes are inspected, payloads are not read.
+ * If there is no field to skip (end of message or end of current block)
+ * or field is unknown, firstError is set to CM_ERROR_NO_VALUE
+ * @param reader
+ */
+void cmSkip(CompositeMessageReader *reader);
+
+/**
+ * Skip several fields in the same way as cmSkip
+ * @param reader
+ * @param count number of fields to skip
+ */
+void cmSkipN(CompositeMessageReader *reader, uint32_t count);
+
+/**
+ * Get current read position, so it can be restored with cmSeek later.
+ * For stream readers position is invalidated by cmFeed
+ * @param reader
+ * @return offset of next element in message
+ */
+uint32_t cmTell(const CompositeMessageReader *reader);
+
+/**
+ * Move read position to given offset. Offset should be obtained with
+ * cmTell (or other function that provides offsets of elements).
+ * If offset is outside of message, firstError is set to CM_ERROR_INVALID_ARG
+ * @param reader
+ * @param offset
+ */
+void cmSeek(CompositeMessageReader *reader, uint32_t offset);
+
+/**
+ * Start calculation of CRC32 for writer, so cmWriteCrc32 can be used later.
+ * CRC is updated when bytes leave the buffer (stream writer) or are
+ * referenced (gather mode) and when it is written, so there is no
+ * separate pass over the message.
+ * Must be called before anything is flushed or referenced by writer
+ * @param writer
+ */
+void cmEnableCrc32(CompositeMessageWriter *writer);
+
+/**
+ * Write CRC32 of everything written so far (excluding endianness mark).
+ * CRC must be enabled with cmEnableCrc32
+ * @param writer
+ */
+void cmWriteCrc32(CompositeMessageWriter *writer);
+
+/**
+ * Read CRC32 at current position and check that it matches CRC of all bytes
+ * of message before it (excluding endianness mark). Bytes are hashed
+ * regardless of whether they were read, skipped or not visited at all.
+ * If CRC doesn't match, firstError is set to CM_ERROR_CRC
+ * @param reader
+ * @return true if CRC matches
+ */
+bool cmVerifyCrc32(CompositeMessageReader *reader);
+
+/**
+ * Start embedded message, so several messages can be sent in one buffer with
+ * a single endianness mark. Everything written until cmEndMessage is stored
+ * as elements of embedded message. Embedded messages can't be nested.
+ * While message is open, CRC can't be written and, if CRC is enabled,
+ * arrays are copied in gather mode instead of being referenced.
+ * Stream writers (except counting one) can't patch size of message after
+ * its bytes are flushed, so firstError is set to CM_ERROR_INVALID_ARG,
+ * complete messages can be embedded with cmWriteMessage instead.
+ * If there is already open message, firstError is set to CM_ERROR_INVALID_ARG
+ * @param writer
+ */
+void cmBeginMessage(CompositeMessageWriter *writer);
+
+/**
+ * Finish embedded message started with cmBeginMessage and store its size.
+ * If there is no open message, firstError is set to CM_ERROR_INVALID_ARG
+ * @param writer
+ */
+void cmEndMessage(CompositeMessageWriter *writer);
+
+/**
+ * Embed complete message created by another writer. Message is copied
+ * without its endianness mark (so it must have native endianness).
+ * If message doesn't begin with native endianness mark, firstError is set
+ * to CM_ERROR_INVALID_ARG
+ * @param writer
+ * @param message
+ * @param size size of message in bytes (including endianness mark)
+ */
+void cmWriteMessage(CompositeMessageWriter *writer, const void *message,
+                    uint32_t size);
+
+/**
+ * Read embedded message at current position. Message reader is initialized
+ * to read elements of embedded message in place, without copying. It
+ * inherits endianness of outer message and stays valid while outer message
+ * is valid (for stream reader - until next cmFeed).
+ * Whole embedded message must be available, otherwise firstError is set to
+ * CM_ERROR_NEED_MORE for stream reader or CM_ERROR_NO_VALUE for others
+ * @param reader
+ * @param message reader of embedded message
+ * @return true if embedded message was read
+ */
+bool cmReadMessage(CompositeMessageReader *reader,
+                   CompositeMessageReader *message);
+
+/**
+ * Initialize compressor with built-in LZ4 codec that produces LZ4 block
+ * format, so blocks can be decompressed by liblz4 too. Work buffer is used
+ * only while block is compressed, so it can be shared by compressors that
+ * are not used at the same time
+ * @param compressor
+ * @param work work buffer for compression or NULL if compressor is used
+ * only for decompression
+ * @param blockSize how many bytes are compressed together (up to 65535)
+ */
+void cmInitLz4Compressor(CMCompressor *compressor, CMLz4WorkBuffer *work,
+                         uint32_t blockSize);
+
+/**
+ * Write elements of complete message compressed with compressor. Elements
+ * are split into blocks of blockSize bytes of compressor and each block is
+ * written as compressed elements. Block that doesn't get smaller (or any
+ * block if compressor has no compress callback) is stored as is.
+ * Stream writer compresses blocks that fit in its buffer, so blocks can be
+ * smaller than blockSize. Message must have native endianness, otherwise
+ * firstError is set to CM_ERROR_INVALID_ARG
+ * @param writer
+ * @param compressor
+ * @param message
+ * @param size size of message in bytes (including endianness mark)
+ */
+void cmWriteCompressed(CompositeMessageWriter *writer,
+                       const CMCompressor *compressor, const void *message,
+                       uint32_t size);
+
+/**
+ * Flush callback that compresses parts of message passed by stream writer.
+ * Stream writer is set up with cmSetFlushCallback and CMCompressingStream
+ * as context, so message is compressed while it's written and only buffer
+ * of stream writer holds uncompressed bytes. Compressed elements are
+ * written to output writer (which can be stream writer too)
+ * @param context pointer to CMCompressingStream
+ * @param data
+ * @param size
+ * @return false if output writer failed
+ */
+bool cmFlushCompressed(void *context, const void *data, uint32_t size);
+
+/**
+ * Decompress compressed elements at current position and feed decompressed
+ * bytes to output stream reader, so they are read as usual (with
+ * endianness of compressed message). Endianness mark is fed to output
+ * before the first block. Bytes are decompressed directly to buffer of
+ * output, already read bytes of output are discarded as by cmFeed.
+ * If output doesn't have space for decompressed bytes, 0 is returned and
+ * read position is not changed, so decompression can be repeated after
+ * more elements are read from output. If output can't hold decompressed
+ * bytes even after discarding, firstError is set to CM_ERROR_NO_SPACE.
+ * If there are no compressed elements at current position, firstError is
+ * set to CM_ERROR_NO_VALUE. If codec differs from codec of compressor (and
+ * is not CM_COMPRESSION_STORED) or output is not a stream reader,
+ * firstError is set to CM_ERROR_INVALID_ARG. Corrupted compressed bytes set
+ * firstError to CM_ERROR_MALFORMED
+ * @param reader
+ * @param compressor
+ * @param output stream reader that receives decompressed bytes
+ * @return how many bytes were fed to output
+ */
+uint32_t cmDecompress(CompositeMessageReader *reader,
+                      const CMCompressor *compressor,
+                      CompositeMessageReader *output);
+
+/**
+ * Record offset, flag and size of each element from current read position
+ * up to the end of message. Elements of nested blocks are recorded as well,
+ * names, boundaries of blocks and other extras are separate entries.
+ * Read position is not changed, so several consumers can read their fields
+ * with cmReadXAt functions after a single scan of message.
+ * If table can't hold all elements, firstError is set to CM_ERROR_NO_SPACE.
+ * If message contains unknown or truncated element, firstError is set to
+ * CM_ERROR_NO_VALUE (CM_ERROR_NEED_MORE for stream readers)
+ * @param reader
+ * @param table
+ * @param maxEntries how many entries table can store
+ * @return number of recorded entries
+ */
+uint32_t cmBuildIndex(CompositeMessageReader *reader, CMIndexEntry *table,
+                      uint32_t maxEntries);
+
+/**
+ * Read value of element recorded in index. Index i must be less than
+ * number of entries returned by cmBuildIndex. Read position is not changed.
+ * Errors are the same as in corresponding cmReadX function
+ * @param reader
+ * @param table index of message built by cmBuildIndex
+ * @param i index of entry in table
+ * @return read value
+ */
+int8_t cmReadI8At(CompositeMessageReader *reader, const CMIndexEntry *table,
+                  uint32_t i);
+
+uint8_t cmReadU8At(CompositeMessageReader *reader, const CMIndexEntry *table,
+                   uint32_t i);
+
+int16_t cmReadI16At(CompositeMessageReader *reader, const CMIndexEntry *table,
+                    uint32_t i);
+
+uint16_t cmReadU16At(CompositeMessageReader *reader, const CMIndexEntry *table,
+                     uint32_t i);
+
+int32_t cmReadI32At(CompositeMessageReader *reader, const CMIndexEntry *table,
+                    uint32_t i);
+
+uint32_t cmReadU32At(CompositeMessageReader *reader, const CMIndexEntry *table,
+                     uint32_t i);
+
+int64_t cmReadI64At(CompositeMessageReader *reader, const CMIndexEntry *table,
+                    uint32_t i);
+
+uint64_t cmReadU64At(CompositeMessageReader *reader, const CMIndexEntry *table,
+                     uint32_t i);
+
+float cmReadFAt(CompositeMessageReader *reader, const CMIndexEntry *table,
+                uint32_t i);
+
+double cmReadDAt(CompositeMessageReader *reader, const CMIndexEntry *table,
+                 uint32_t i);
+
+bool cmReadBoolAt(CompositeMessageReader *reader, const CMIndexEntry *table,
+                  uint32_t i);
+
+char cmReadCharAt(CompositeMessageReader *reader, const CMIndexEntry *table,
+                  uint32_t i);
+
+/**
+ * Read array recorded in index. Read position is not changed.
+ * Errors are the same as in cmReadTypedArray
+ * @param reader
+ * @param table index of message built by cmBuildIndex
+ * @param i index of entry in table
+ * @param itemType type of each item (one of CM_TYPE_X defines)
+ * @param itemSize size of each item in bytes
+ * @param buffer
+ * @param maxItems how many items buffer can store
+ * @return number of items read
+ */
+uint32_t cmReadTypedArrayAt(CompositeMessageReader *reader,
+                            const CMIndexEntry *table, uint32_t i,
+                            uint8_t itemType, uint8_t itemSize, void *buffer,
+                            uint32_t maxItems);
+
+#define cmReadUArrayAt(reader, table, i, buffer, maxItems) \
+    cmReadTypedArrayAt((reader), (table), (i), CM_TYPE_UINT, sizeof(*(buffer)), (buffer), (maxItems))
+#define cmReadIArrayAt(reader, table, i, buffer, maxItems) \
+    cmReadTypedArrayAt((reader), (table), (i), CM_TYPE_INT, sizeof(*(buffer)), (buffer), (maxItems))
+#define cmReadFloatArrayAt(reader, table, i, buffer, maxItems) \
+    cmReadTypedArrayAt((reader), (table), (i), CM_TYPE_FLOAT, sizeof(*(buffer)), (buffer), (maxItems))
+#define cmReadBoolArrayAt(reader, table, i, buffer, maxItems) \
+    cmReadTypedArrayAt((reader), (table), (i), CM_TYPE_BOOL, sizeof(*(buffer)), (buffer), (maxItems))
+#define cmReadStringAt(reader, table, i, buffer, maxItems) \
+    cmReadTypedArrayAt((reader), (table), (i), CM_TYPE_CHAR, sizeof(*(buffer)), (buffer), (maxItems))
+
+/**
+ * Initialize empty template with provided storage
+ * @param tmpl
+ * @param signature storage of expected bytes
+ * @param mask storage of mask, same size as signature
+ * @param capacity size of signature and mask in bytes (largest layout)
+ * @param fields storage of fields
+ * @param maxFields how many fields can be stored
+ */
+void cmInitTemplate(CMTemplate *tmpl, uint8_t *signature, uint8_t *mask,
+                    uint32_t capacity, CMTemplateField *fields,
+                    uint32_t maxFields);
+
+/**
+ * Compile template from elements of sample message between current read
+ * position and the end of message. Usually sample is a message written
+ * with the same calls as messages that are matched later (values don't
+ * matter). Layout may contain values, arrays (with the same number of
+ * items in every message), names, markers, padding and boundaries of
+ * blocks and metadata. Read position is not changed.
+ * If layout contains elements of variable size (varints, encoded arrays,
+ * embedded messages, record tables, compressed elements and strings of
+ * dictionary) or sample has inversed endianness and is read by const
+ * reader, firstError of sample is set to CM_ERROR_INVALID_ARG.
+ * If template can't hold all bytes or fields, firstError is set to
+ * CM_ERROR_NO_SPACE. Other errors are the same as in cmBuildIndex
+ * @param tmpl
+ * @param sample
+ * @return true if template was compiled
+ */
+bool cmCompileTemplate(CMTemplate *tmpl, CompositeMessageReader *sample);
+
+/**
+ * Compare bytes at current read position with signature of template.
+ * Whole signature is compared at once without per element checks, so on
+ * match all values of layout are read directly: value of field i starts at
+ * offset tmpl->fields[i].offset from returned pointer (values have native
+ * endianness, alignment is the same as in cmReadArrayView).
+ * On match read position is moved past the layout. Otherwise NULL is
+ * returned, read position is not changed and firstError stays the same,
+ * so message can be read with regular functions. If reader has inversed
+ * endianness and doesn't convert it, template never matches.
+ * If stream reader didn't receive the whole layout yet and received bytes
+ * match, firstError is set to CM_ERROR_NEED_MORE
+ * @param reader
+ * @param tmpl compiled template
+ * @return pointer to the first matched byte or NULL
+ */
+const uint8_t *cmMatchTemplate(CompositeMessageReader *reader,
+                               const CMTemplate *tmpl);
+
+/**
+ * Walk through message from current read position once and check its
+ * structure: each element must be known and fit into message, names must
+ * be null terminated and blocks must be balanced. Elements of embedded
+ * messages are not checked, reader created by cmReadMessage should be
+ * validated separately. Read position is not changed.
+ * On success reader is marked as trusted, so values can be read with
+ * cmReadXUnchecked functions. Reader that swaps bytes (const or stream
+ * reader of message with inversed endianness) is never marked as trusted.
+ * If message is malformed, firstError is set to CM_ERROR_MALFORMED.
+ * If reader is a stream reader, firstError is set to CM_ERROR_INVALID_ARG
+ * @param reader
+ * @return true if message is valid
+ */
+bool cmValidate(CompositeMessageReader *reader);
+
+/**
+ * Read value from message that was validated with cmValidate without
+ * checking errors, bounds and flag of element. Next element must be a value
+ * with given flag (compact integers are not accepted) and reader must not
+ * swap bytes (message with inversed endianness should be converted by
+ * cmInitReader). Requirements are checked only with assert, so in builds
+ * with NDEBUG read is just a load and increment of read position
+ * @param reader
+ * @param val pointer where value should be stored
+ * @param len size of value in bytes
+ * @param flag expected flag of element
+ */
+static inline void cmReadValueUnchecked(CompositeMessageReader *reader,
+                                        void *val, uint8_t len, uint8_t flag) {
+    assert(reader->trusted && !reader->swapBytes);
+    assert(reader->firstError == CM_ERROR_NONE);
+    assert(reader->totalSize - reader->readSize > len);
+    assert(reader->message[reader->readSize] == flag);
+    (void) flag;
+    memcpy(val, &reader->message[reader->readSize + 1], len);
+    reader->readSize += 1u + len;
+}
+
+/**
+ * Read array from message that was validated with cmValidate without
+ * copying it and without checks (same requirements as in
+ * cmReadValueUnchecked). Next element must be an array (not encoded one)
+ * @param reader
+ * @param data pointer to the first item (aligned only if message was
+ * written with aligned arrays)
+ * @return number of items in array
+ */
+static inline uint32_t cmReadArrayViewUnchecked(CompositeMessageReader *reader,
+                                                const void **data) {
+    assert(reader->trusted && !reader->swapBytes);
+    assert(reader->firstError == CM_ERROR_NONE);
+    // skip padding flags of aligned arrays
+    while (reader->message[reader->readSize] == CM_PADDING) {
+        ++reader->readSize;
+    }
+    assert(reader->totalSize - reader->readSize >= 1u + sizeof(uint32_t));
+    const uint8_t *m = &reader->message[reader->readSize];
+    assert((m[0] & CM_ARRAY_MASK) == CM_ARRAY);
+    uint32_t count;
+    memcpy(&count, &m[1], sizeof(count));
+    *data = &m[1 + sizeof(count)];
+    reader->readSize += 1u + (uint32_t) sizeof(count) + (count << (m[0] & CM_TYPE_LEN_MASK));
+    return count;
+}
+
+static inline uint8_t cmReadU8Unchecked(CompositeMessageReader *reader) {
+    uint8_t val;
+    cmReadValueUnchecked(reader, &val, sizeof(val), CM_TYPE_UINT);
+    return val;
+}
+
+static inline int8_t cmReadI8Unchecked(CompositeMessageReader *reader) {
+    int8_t val;
+    cmReadValueUnchecked(reader, &val, sizeof(val), CM_TYPE_INT);
+    return val;
+}
+
+static inline uint16_t cmReadU16Unchecked(CompositeMessageReader *reader) {
+    uint16_t val;
+    cmReadValueUnchecked(reader, &val, sizeof(val), CM_TYPE_UINT | 0x01u);
+    return val;
+}
+
+static inline int16_t cmReadI16Unchecked(CompositeMessageReader *reader) {
+    int16_t val;
+    cmReadValueUnchecked(reader, &val, sizeof(val), CM_TYPE_INT | 0x01u);
+    return val;
+}
+
+static inline uint32_t cmReadU32Unchecked(CompositeMessageReader *reader) {
+    uint32_t val;
+    cmReadValueUnchecked(reader, &val, sizeof(val), CM_TYPE_UINT | 0x02u);
+    return val;
+}
+
+static inline int32_t cmReadI32Unchecked(CompositeMessageReader *reader) {
+    int32_t val;
+    cmReadValueUnchecked(reader, &val, sizeof(val), CM_TYPE_INT | 0x02u);
+    return val;
+}
+
+static inline uint64_t cmReadU64Unchecked(CompositeMessageReader *reader) {
+    uint64_t val;
+    cmReadValueUnchecked(reader, &val, sizeof(val), CM_TYPE_UINT | 0x03u);
+    return val;
+}
+
+static inline int64_t cmReadI64Unchecked(CompositeMessageReader *reader) {
+    int64_t val;
+    cmReadValueUnchecked(reader, &val, sizeof(val), CM_TYPE_INT | 0x03u);
+    return val;
+}
+
+static inline float cmReadFUnchecked(CompositeMessageReader *reader) {
+    float val;
+    cmReadValueUnchecked(reader, &val, sizeof(val), CM_TYPE_FLOAT | 0x02u);
+    return val;
+}
+
+static inline double cmReadDUnchecked(CompositeMessageReader *reader) {
+    double val;
+    cmReadValueUnchecked(reader, &val, sizeof(val), CM_TYPE_FLOAT | 0x03u);
+    return val;
+}
+
+static inline bool cmReadBoolUnchecked(CompositeMessageReader *reader) {
+    uint8_t val;
+    cmReadValueUnchecked(reader, &val, sizeof(val), CM_TYPE_BOOL);
+    return val != 0;
+}
+
+static inline char cmReadCharUnchecked(CompositeMessageReader *reader) {
+    char val;
+    cmReadValueUnchecked(reader, &val, sizeof(val), CM_TYPE_CHAR);
+    return val;
+}
+
+/**
+ * Initialize log writer and write header of log file
+ * If maxEntries is 0, firstError is set to CM_ERROR_INVALID_ARG.
+ * If write callback returns false, firstError is set to CM_ERROR_IO
+ * @param log
+ * @param entries storage of entries
+ * @param maxEntries number of messages between indexes
+ * @param write callback that appends bytes to file
+ * @param context
+ */
+void cmInitLogWriter(CMLogWriter *log, CMLogEntry *entries, uint32_t maxEntries,
+                     CMFlushCallback write, void *context);
+
+/**
+ * Append complete message (starting with its endianness mark) to log file.
+ * Version of message is taken from version element at the beginning of
+ * message (it may be preceded by start of metadata and markers).
+ * Index is written after every maxEntries messages.
+ * If message has no endianness mark or is larger than 4294967294 bytes,
+ * firstError is set to CM_ERROR_INVALID_ARG.
+ * If write callback returns false, firstError is set to CM_ERROR_IO
+ * @param log
+ * @param message
+ * @param size
+ */
+void cmAppendLog(CMLogWriter *log, const void *message, uint32_t size);
+
+/**
+ * Write index of messages appended after the last index. Should be called
+ * before file is closed, so reader doesn't have to walk through messages.
+ * Does nothing if there are no such messages
+ * @param log
+ */
+void cmWriteLogIndex(CMLogWriter *log);
+
+/**
+ * Initialize reader of log file that is stored in memory. Indexes are
+ * found through the trailer at the end of file. If file doesn't end with
+ * trailer (writer didn't finish), all messages are walked once to find
+ * indexes and messages after them. Incomplete message at the end of file
+ * is ignored.
+ * If data is not a log file or indexes are inconsistent, firstError is
+ * set to CM_ERROR_MALFORMED.
+ * If there are more than maxIndexes indexes, firstError is set to
+ * CM_ERROR_NO_SPACE
+ * @param log
+ * @param data bytes of file (messages are aligned as in file only if data
+ * is aligned to 8 bytes)
+ * @param size
+ * @param indexes storage of indexes
+ * @param maxIndexes
+ * @return true if file was read
+ */
+bool cmInitLogReader(CMLogReader *log, const void *data, uint64_t size,
+                     CMLogIndex *indexes, uint32_t maxIndexes);
+
+/**
+ * Map log file to memory with mmap and initialize reader as with
+ * cmInitLogReader. Only pages of file that are accessed are read, so
+ * finding a message touches indexes and the message itself.
+ * If file can't be opened or mapped, firstError is set to CM_ERROR_IO.
+ * On systems without mmap (or if library is built with CM_NO_MMAP defined)
+ * firstError is set to CM_ERROR_INVALID_ARG
+ * @param log
+ * @param path
+ * @param indexes storage of indexes
+ * @param maxIndexes
+ * @return true if file was mapped and read
+ */
+bool cmOpenLog(CMLogReader *log, const char *path, CMLogIndex *indexes,
+               uint32_t maxIndexes);
+
+/**
+ * Unmap file mapped by cmOpenLog. Readers of its messages must not be
+ * used after that. Does nothing for readers created by cmInitLogReader
+ * @param log
+ */
+void cmCloseLog(CMLogReader *log);
+
+/**
+ * Get const reader of message number n without copying it. Reader points
+ * to bytes of file, so it is valid while file is mapped.
+ * If there is no such message, false is returned and reader is not changed.
+ * If entry of message points outside of file, firstError of log is set to
+ * CM_ERROR_MALFORMED
+ * @param log
+ * @param n number of message (from 0)
+ * @param reader
+ * @return true if reader was initialized
+ */
+bool cmReadLogMessage(CMLogReader *log, uint64_t n,
+                      CompositeMessageReader *reader);
+
+/**
+ * Find the first message with version that is equal to or larger than
+ * given one. Versions of messages must not decrease through the file
+ * (e.g. version holds timestamp or sequence number), then message is found
+ * with binary search
+ * @param log
+ * @param version
+ * @return number of message or messageCount if there is no such message
+ */
+uint64_t cmFindLogVersion(CMLogReader *log, uint32_t version);
+
+/**
+ * Set statistics where measurements of CM_PROFILE_X operations performed
+ * by writer are added.
+ * Statistics are collected only when library is built with CM_PROFILE
+ * defined, otherwise profiling code is not compiled at all and this
+ * function only stores the pointer. Counters are not reset, so stats should
+ * be zeroed before they are set. The same stats may be set to several
+ * writers and readers of one thread, writers of different threads should
+ * use their own stats.
+ * On Cortex-M3 and newer DWT cycle counter is enabled by this function.
+ * Define CM_PROFILE_COUNTER() to use other counter, it must return uint32_t
+ * @param writer
+ * @param stats - stats to update or NULL to stop profiling
+ */
+void cmSetWriterProfileStats(CompositeMessageWriter *writer,
+                             CMProfileStats *stats);
+
+/**
+ * Set statistics where measurements of CM_PROFILE_X operations performed
+ * by reader are added. Embedded message readers use stats of outer reader.
+ * Initialization of reader (CM_PROFILE_GET_READER and CM_PROFILE_CONVERT)
+ * is measured only when reader is initialized by cmInitProfiledReader.
+ * Same rules as for cmSetWriterProfileStats apply
+ * @param reader
+ * @param stats - stats to update or NULL to stop profiling
+ */
+void cmSetReaderProfileStats(CompositeMessageReader *reader,
+                             CMProfileStats *stats);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,519 @@
+/**
+ * Header-only C++17 layer for writing and reading whole structs.
+ * Fields of struct are listed with CM_REFLECT macro placed inside of it:
+ *
+ * struct Sample {
+ *     uint32_t id;
+ *     double value;
+ *     std::array<int16_t, 4> raw;
+ *     char name[16];
+ *     CM_REFLECT(id, value, raw, name)
+ * };
+ *
+ * Each field is stored exactly as corresponding function of C API
+ * would store it:
+ * - integers, floating point values, bool, char and enums as single values
+ * - std::array<V, N> and V[N] as arrays of N items
+ * - char[N] and std::array<char, N> as null terminated strings
+ * - structs with CM_REFLECT as blocks
+ *
+ * Flags of fields and maximum size of struct are calculated at compile
+ * time, so encode checks free space once for the whole struct and decode
+ * checks bounds once when enough bytes are available
+ */
+#ifndef COMPOSITE_MESSAGE_HPP
+#define COMPOSITE_MESSAGE_HPP
+
+#include "composite_message.h"
+
+#include <array>
+#include <cstring>
+#include <iterator>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+/**
+ * List fields of struct that should be written to message and read from it.
+ * Fields are processed in the listed order
+ */
+#define CM_REFLECT(...) \
+    auto cmFields() { return std::tie(__VA_ARGS__); } \
+    auto cmFields() const { return std::tie(__VA_ARGS__); }
+
+namespace cm {
+    namespace detail {
+        constexpr uint8_t ARRAY_FLAG = 0x40u;
+        constexpr uint8_t BLOCK_START_FLAG = 0x81u;
+        constexpr uint8_t BLOCK_END_FLAG = 0x82u;
+
+        template<typename T, typename = void>
+        struct IsReflected : std::false_type {
+        };
+
+        template<typename T>
+        struct IsReflected<T, std::void_t<decltype(std::declval<const T &>().cmFields())>>
+                : std::true_type {
+        };
+
+        template<typename F>
+        struct ArrayInfo {
+            static constexpr bool isArray = false;
+        };
+
+        template<typename V, size_t N>
+        struct ArrayInfo<std::array<V, N>> {
+            static constexpr bool isArray = true;
+            using Item = V;
+            static constexpr size_t size = N;
+        };
+
+        template<typename V, size_t N>
+        struct ArrayInfo<V[N]> {
+            static constexpr bool isArray = true;
+            using Item = V;
+            static constexpr size_t size = N;
+        };
+
+        template<typename V, bool = std::is_enum_v<V>>
+        struct Scalar {
+            using type = V;
+        };
+
+        template<typename V>
+        struct Scalar<V, true> {
+            using type = std::underlying_type_t<V>;
+        };
+
+        template<typename V>
+        constexpr uint8_t getType() {
+            using S = typename Scalar<V>::type;
+            static_assert(std::is_arithmetic_v<S>, "Unsupported type of field");
+            if constexpr (std::is_same_v<S, bool>) {
+                return CM_TYPE_BOOL;
+            } else if constexpr (std::is_same_v<S, char>) {
+                return CM_TYPE_CHAR;
+            } else if constexpr (std::is_floating_point_v<S>) {
+                return CM_TYPE_FLOAT;
+            } else if constexpr (std::is_signed_v<S>) {
+                return CM_TYPE_INT;
+            } else {
+                return CM_TYPE_UINT;
+            }
+        }
+
+        template<typename V>
+        constexpr uint8_t getFlag() {
+            static_assert(sizeof(V) == 1 || sizeof(V) == 2 || sizeof(V) == 4 ||
+                          sizeof(V) == 8, "Unsupported size of field");
+            return getType<V>() | (sizeof(V) == 1 ? 0u : sizeof(V) == 2 ? 1u :
+                                                         sizeof(V) == 4 ? 2u : 3u);
+        }
+
+        template<typename F>
+        using FieldType = std::remove_cv_t<std::remove_reference_t<F>>;
+
+        template<typename T>
+        using FieldsTuple = decltype(std::declval<const T &>().cmFields());
+
+        template<typename T>
+        constexpr uint64_t getFieldsMaxSize();
+
+        template<typename F>
+        constexpr uint64_t getFieldMaxSize() {
+            if constexpr (IsReflected<F>::value) {
+                return 2 + getFieldsMaxSize<F>();
+            } else if constexpr (ArrayInfo<F>::isArray) {
+                using V = typename ArrayInfo<F>::Item;
+                // string of N chars holds at most N - 1 chars and terminator
+                return 1 + sizeof(uint32_t) + ArrayInfo<F>::size * sizeof(V);
+            } else {
+                return 1 + sizeof(F);
+            }
+        }
+
+        template<typename Tuple, size_t... I>
+        constexpr uint64_t getTupleMaxSize(std::index_sequence<I...>) {
+            return (uint64_t(0) + ... +
+                    getFieldMaxSize<FieldType<std::tuple_element_t<I, Tuple>>>());
+        }
+
+        template<typename T>
+        constexpr uint64_t getFieldsMaxSize() {
+            using Tuple = FieldsTuple<T>;
+            return getTupleMaxSize<Tuple>(std::make_index_sequence<std::tuple_size_v<Tuple>>{});
+        }
+
+        /**
+         * Get length of string stored in char array
+         * @return length or N if there is no null terminator
+         */
+        template<typename F>
+        size_t getStringLength(const F &field) {
+            const char *d = std::data(field);
+            auto *end = static_cast<const char *>(std::memchr(d, '\0', ArrayInfo<F>::size));
+            return end == nullptr ? ArrayInfo<F>::size : size_t(end - d);
+        }
+
+        template<typename T>
+        uint8_t *writeFields(uint8_t *p, const T &value);
+
+        template<typename F>
+        uint8_t *writeField(uint8_t *p, const F &field) {
+            if constexpr (IsReflected<F>::value) {
+                *p++ = BLOCK_START_FLAG;
+                p = writeFields(p, field);
+                if (p == nullptr)
+                    return nullptr;
+                *p++ = BLOCK_END_FLAG;
+                return p;
+            } else if constexpr (ArrayInfo<F>::isArray) {
+                using V = typename ArrayInfo<F>::Item;
+                uint32_t count = ArrayInfo<F>::size;
+                if constexpr (std::is_same_v<V, char>) {
+                    auto length = getStringLength(field);
+                    if (length == ArrayInfo<F>::size)
+                        return nullptr;
+                    count = uint32_t(length + 1);
+                }
+                *p++ = ARRAY_FLAG | getFlag<V>();
+                std::memcpy(p, &count, sizeof(count));
+                p += sizeof(count);
+                std::memcpy(p, std::data(field), count * sizeof(V));
+                return p + count * sizeof(V);
+            } else {
+                *p++ = getFlag<F>();
+                std::memcpy(p, &field, sizeof(F));
+                return p + sizeof(F);
+            }
+        }
+
+        template<typename T>
+        uint8_t *writeFields(uint8_t *p, const T &value) {
+            std::apply([&p](const auto &... fields) {
+                ((p = p == nullptr ? nullptr : writeField(p, fields)), ...);
+            }, value.cmFields());
+            return p;
+        }
+
+        template<typename V>
+        void writeScalar(CompositeMessageWriter &writer, V value) {
+            using S = typename Scalar<V>::type;
+            auto s = static_cast<S>(value);
+            constexpr uint8_t type = getType<V>();
+            if constexpr (type == CM_TYPE_BOOL) {
+                cmWriteBool(&writer, s);
+            } else if constexpr (type == CM_TYPE_CHAR) {
+                cmWriteChar(&writer, s);
+            } else if constexpr (type == CM_TYPE_FLOAT) {
+                if constexpr (sizeof(S) == sizeof(float)) {
+                    cmWriteF(&writer, s);
+                } else {
+                    cmWriteD(&writer, double(s));
+                }
+            } else if constexpr (type == CM_TYPE_INT) {
+                if constexpr (sizeof(S) == 1) {
+                    cmWriteI8(&writer, int8_t(s));
+                } else if constexpr (sizeof(S) == 2) {
+                    cmWriteI16(&writer, int16_t(s));
+                } else if constexpr (sizeof(S) == 4) {
+                    cmWriteI32(&writer, int32_t(s));
+                } else {
+                    cmWriteI64(&writer, int64_t(s));
+                }
+            } else {
+                if constexpr (sizeof(S) == 1) {
+                    cmWriteU8(&writer, uint8_t(s));
+                } else if constexpr (sizeof(S) == 2) {
+                    cmWriteU16(&writer, uint16_t(s));
+                } else if constexpr (sizeof(S) == 4) {
+                    cmWriteU32(&writer, uint32_t(s));
+                } else {
+                    cmWriteU64(&writer, uint64_t(s));
+                }
+            }
+        }
+
+        template<typename T>
+        void writeFieldsChecked(CompositeMessageWriter &writer, const T &value);
+
+        template<typename F>
+        void writeFieldChecked(CompositeMessageWriter &writer, const F &field) {
+            if constexpr (IsReflected<F>::value) {
+                cmWriteBlockStart(&writer);
+                writeFieldsChecked(writer, field);
+                cmWriteBlockEnd(&writer);
+            } else if constexpr (ArrayInfo<F>::isArray) {
+                using V = typename ArrayInfo<F>::Item;
+                if constexpr (std::is_same_v<V, char>) {
+                    auto length = getStringLength(field);
+                    if (length == ArrayInfo<F>::size) {
+                        if (writer.firstError == CM_ERROR_NONE)
+                            writer.firstError = CM_ERROR_INVALID_ARG;
+                        return;
+                    }
+                    cmWriteString(&writer, std::data(field), uint32_t(length));
+                } else {
+                    cmWriteTypedArray(&writer, getType<V>(), sizeof(V), std::data(field),
+                                      uint32_t(ArrayInfo<F>::size));
+                }
+            } else {
+                writeScalar(writer, field);
+            }
+        }
+
+        template<typename T>
+        void writeFieldsChecked(CompositeMessageWriter &writer, const T &value) {
+            std::apply([&writer](const auto &... fields) {
+                (writeFieldChecked(writer, fields), ...);
+            }, value.cmFields());
+        }
+
+        template<typename T>
+        const uint8_t *readFields(const uint8_t *p, T &value);
+
+        template<typename F>
+        const uint8_t *readField(const uint8_t *p, F &field) {
+            if constexpr (IsReflected<F>::value) {
+                if (*p != BLOCK_START_FLAG)
+                    return nullptr;
+                p = readFields(p + 1, field);
+                if (p == nullptr || *p != BLOCK_END_FLAG)
+                    return nullptr;
+                return p + 1;
+            } else if constexpr (ArrayInfo<F>::isArray) {
+                using V = typename ArrayInfo<F>::Item;
+                if (*p != (ARRAY_FLAG | getFlag<V>()))
+                    return nullptr;
+                uint32_t count;
+                std::memcpy(&count, p + 1, sizeof(count));
+                p += 1 + sizeof(count);
+                if constexpr (std::is_same_v<V, char>) {
+                    if (count == 0 || count > ArrayInfo<F>::size || p[count - 1] != '\0')
+                        return nullptr;
+                } else if (count != ArrayInfo<F>::size) {
+                    return nullptr;
+                }
+                std::memcpy(std::data(field), p, count * sizeof(V));
+                return p + count * sizeof(V);
+            } else {
+                if (*p != getFlag<F>())
+                    return nullptr;
+                std::memcpy(&field, p + 1, sizeof(F));
+                return p + 1 + sizeof(F);
+            }
+        }
+
+        template<typename T>
+        const uint8_t *readFields(const uint8_t *p, T &value) {
+            std::apply([&p](auto &... fields) {
+                ((p = p == nullptr ? nullptr : readField(p, fields)), ...);
+            }, value.cmFields());
+            return p;
+        }
+
+        template<typename V>
+        void readScalar(CompositeMessageReader &reader, V &value) {
+            using S = typename Scalar<V>::type;
+            constexpr uint8_t type = getType<V>();
+            S s;
+            if constexpr (type == CM_TYPE_BOOL) {
+                s = cmReadBool(&reader);
+            } else if constexpr (type == CM_TYPE_CHAR) {
+                s = cmReadChar(&reader);
+            } else if constexpr (type == CM_TYPE_FLOAT) {
+                if constexpr (sizeof(S) == sizeof(float)) {
+                    s = cmReadF(&reader);
+                } else {
+                    s = S(cmReadD(&reader));
+                }
+            } else if constexpr (type == CM_TYPE_INT) {
+                if constexpr (sizeof(S) == 1) {
+                    s = S(cmReadI8(&reader));
+                } else if constexpr (sizeof(S) == 2) {
+                    s = S(cmReadI16(&reader));
+                } else if constexpr (sizeof(S) == 4) {
+                    s = S(cmReadI32(&reader));
+                } else {
+                    s = S(cmReadI64(&reader));
+                }
+            } else {
+                if constexpr (sizeof(S) == 1) {
+                    s = S(cmReadU8(&reader));
+                } else if constexpr (sizeof(S) == 2) {
+                    s = S(cmReadU16(&reader));
+                } else if constexpr (sizeof(S) == 4) {
+                    s = S(cmReadU32(&reader));
+                } else {
+                    s = S(cmReadU64(&reader));
+                }
+            }
+            value = static_cast<V>(s);
+        }
+
+        template<typename T>
+        void readFieldsChecked(CompositeMessageReader &reader, T &value);
+
+        template<typename F>
+        void readFieldChecked(CompositeMessageReader &reader, F &field) {
+            if constexpr (IsReflected<F>::value) {
+                cmReadBlockStart(&reader);
+                readFieldsChecked(reader, field);
+                cmReadBlockEnd(&reader);
+            } else if constexpr (ArrayInfo<F>::isArray) {
+                using V = typename ArrayInfo<F>::Item;
+                if constexpr (std::is_same_v<V, char>) {
+                    const char *str;
+                    uint32_t length = cmReadStringView(&reader, &str);
+                    if (reader.firstError != CM_ERROR_NONE)
+                        return;
+                    if (length >= ArrayInfo<F>::size) {
+                        reader.firstError = CM_ERROR_NO_SPACE;
+                        return;
+                    }
+                    std::memcpy(std::data(field), str, length + 1);
+                } else {
+                    uint32_t count = cmReadTypedArray(&reader, getType<V>(), sizeof(V),
+                                                      std::data(field),
+                                                      uint32_t(ArrayInfo<F>::size));
+                    if (reader.firstError == CM_ERROR_NONE && count != ArrayInfo<F>::size) {
+                        reader.firstError = CM_ERROR_NO_VALUE;
+                    }
+                }
+            } else {
+                readScalar(reader, field);
+            }
+        }
+
+        template<typename T>
+        void readFieldsChecked(CompositeMessageReader &reader, T &value) {
+            std::apply([&reader](auto &... fields) {
+                (readFieldChecked(reader, fields), ...);
+            }, value.cmFields());
+        }
+    }
+
+    /**
+     * Get maximum number of bytes that fields of struct can take in message
+     * @tparam T struct with CM_REFLECT
+     * @return size in bytes
+     */
+    template<typename T>
+    constexpr uint32_t maxSize() {
+        static_assert(detail::IsReflected<T>::value, "Struct must list its fields with CM_REFLECT");
+        constexpr uint64_t size = detail::getFieldsMaxSize<T>();
+        static_assert(size <= UINT32_MAX, "Struct is too large");
+        return uint32_t(size);
+    }
+
+    /**
+     * Get size of buffer that can hold message with single struct
+     * (including endianness mark)
+     * @tparam T struct with CM_REFLECT
+     * @return size in bytes
+     */
+    template<typename T>
+    constexpr uint32_t maxMessageSize() {
+        return 2 + maxSize<T>();
+    }
+
+    /**
+     * Write all fields of struct. Bytes are the same as if each field was
+     * written with C API. When writer buffer has space for maxSize<T>()
+     * bytes, fields are written directly without checks for each field.
+     * If string field has no null terminator, firstError is set to
+     * CM_ERROR_INVALID_ARG. Other errors are the same as in C API
+     * @param writer
+     * @param value
+     */
+    template<typename T>
+    void encode(CompositeMessageWriter &writer, const T &value) {
+        constexpr uint32_t size = maxSize<T>();
+        // stream writer can always free the whole buffer
+        bool fits = writer.flush != nullptr ? size <= writer.bufferSize :
+                    size <= writer.bufferSize - writer.usedSize;
+        // compact integers, dictionary strings and padded arrays have
+        // different encoding, so they are written by C API
+        if (writer.firstError != CM_ERROR_NONE || writer.compactIntegers ||
+            writer.alignArrays || writer.dictionary != nullptr ||
+            writer.arrayOpen || !fits) {
+            detail::writeFieldsChecked(writer, value);
+            return;
+        }
+
+        auto *start = static_cast<uint8_t *>(cmReserveBytes(&writer, size));
+        if (start == nullptr)
+            return;
+        uint8_t *end = detail::writeFields(start, value);
+        if (end == nullptr) {
+            writer.firstError = CM_ERROR_INVALID_ARG;
+            return;
+        }
+        cmCommitBytes(&writer, uint32_t(end - start));
+    }
+
+    /**
+     * Write message that holds single struct to buffer
+     * @param value
+     * @param buffer
+     * @param size size of buffer, maxMessageSize<T>() is always enough
+     * @return size of message or 0 on error
+     */
+    template<typename T>
+    uint32_t encode(const T &value, void *buffer, uint32_t size) {
+        CompositeMessageWriter writer;
+        cmInitWriter(&writer, buffer, size);
+        encode(writer, value);
+        return writer.firstError == CM_ERROR_NONE ? writer.usedSize : 0;
+    }
+
+    /**
+     * Read all fields of struct. Arrays must have exactly the same number of
+     * items as array fields, otherwise firstError is set to CM_ERROR_NO_VALUE.
+     * When at least maxSize<T>() bytes are available and message has native
+     * endianness, fields are read directly with a single bounds check.
+     * Values with compact encoding and inverse endianness are read through
+     * C API. If stream reader needs more bytes, read position is restored,
+     * so struct can be read again after next cmFeed
+     * @param reader
+     * @param value
+     * @return true if all fields were read
+     */
+    template<typename T>
+    bool decode(CompositeMessageReader &reader, T &value) {
+        constexpr uint32_t size = maxSize<T>();
+        if (reader.firstError != CM_ERROR_NONE)
+            return false;
+
+        uint32_t start = cmTell(&reader);
+        if (!reader.swapBytes && reader.totalSize - start >= size) {
+            const uint8_t *end = detail::readFields(&reader.message[start], value);
+            if (end != nullptr) {
+                cmSeek(&reader, start + uint32_t(end - &reader.message[start]));
+                return true;
+            }
+        }
+
+        detail::readFieldsChecked(reader, value);
+        if (reader.firstError == CM_ERROR_NEED_MORE) {
+            reader.readSize = start;
+        }
+        return reader.firstError == CM_ERROR_NONE;
+    }
+
+    /**
+     * Read message that holds single struct without modifying it
+     * @param message
+     * @param size
+     * @param value
+     * @return true if all fields were read
+     */
+    template<typename T>
+    bool decode(const void *message, uint32_t size, T &value) {
+        CompositeMessageReader reader;
+        cmInitConstReader(&reader, message, size);
+        return decode(reader, value);
+    }
+}
+
+#endif //COMPOSITE_MESSAGE_HPP
@@ -1,19 +1,247 @@
+// Log files are mapped with mmap on POSIX systems unless CM_NO_MMAP is
+// defined
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(CM_NO_MMAP)
+#define CM_LOG_MMAP
+#endif
+
+// clock_gettime and mmap are not part of C11, so they have to be requested
+// before any system header is included
+#if ((defined(CM_PROFILE) && !defined(CM_PROFILE_COUNTER)) || defined(CM_LOG_MMAP)) && \
+    !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200112L
+#endif
+
 #include "composite_message.h"
 
 #include <string.h>
 
-#define CM_TYPE_MASK     0x1Cu
-#define CM_TYPE_LEN_MASK 0x03u
+#if defined(CM_LOG_MMAP)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Vectorized byte swapping is selected at build time from the instruction
+// sets enabled for the compiler (e.g. -mssse3, -mavx2 or -march=native).
+// Define CM_NO_SIMD to always use scalar code
+#if !defined(CM_NO_SIMD) && defined(__AVX2__)
+#include <immintrin.h>
+#define CM_SWAP_AVX2
+#define CM_SWAP_SSSE3
+#elif !defined(CM_NO_SIMD) && defined(__SSSE3__)
+#include <tmmintrin.h>
+#define CM_SWAP_SSSE3
+#elif !defined(CM_NO_SIMD) && defined(__SSE2__)
+#include <emmintrin.h>
+#define CM_SWAP_SSE2
+#elif !defined(CM_NO_SIMD) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#include <arm_neon.h>
+#define CM_SWAP_NEON
+#endif
+
+// CRC32 (IEEE 802.3, reflected) implementation is selected at build time.
+// Define CM_CRC32_UPDATE(crc, data, size) to use external implementation
+// (e.g. hardware CRC unit of STM32), it must return crc updated with 'size'
+// bytes at 'data' without final inversion. ARMv8 CRC instructions are used
+// when enabled (e.g. -march=armv8-a+crc). SSE4.2 crc32 instruction computes
+// CRC32C (Castagnoli polynomial), so it can't be used for this format.
+// Define CM_CRC32_SMALL to use single 1KB table instead of 8KB table
+// of slicing-by-8 algorithm
+#if defined(CM_CRC32_UPDATE)
+#elif defined(__ARM_FEATURE_CRC32) && !defined(__ARM_BIG_ENDIAN)
+#include <arm_acle.h>
+#define CM_CRC32_ARM
+#elif defined(CM_CRC32_SMALL)
+#define CM_CRC32_TABLE
+#else
+#define CM_CRC32_SLICING
+#endif
 
-#define CM_ARRAY    0x40u
+// Profiling is enabled by defining CM_PROFILE. Then duration of operations
+// is measured with CM_PROFILE_COUNTER() if it is defined, with DWT cycle
+// counter on Cortex-M3 and newer or with clock_gettime on other systems.
+// Without CM_PROFILE hooks are empty, so they don't cost anything
+#if defined(CM_PROFILE)
+#if defined(CM_PROFILE_COUNTER)
+#elif defined(__ARM_ARCH_7M__) || defined(__ARM_ARCH_7EM__) || \
+      defined(__ARM_ARCH_8M_MAIN__) || defined(__ARM_ARCH_8_1M_MAIN__)
+#define CM_PROFILE_DWT
+#define CM_DEMCR        (*(volatile uint32_t *) 0xE000EDFCu)
+#define CM_DWT_CTRL     (*(volatile uint32_t *) 0xE0001000u)
+#define CM_DWT_CYCCNT   (*(volatile uint32_t *) 0xE0001004u)
+#define CM_PROFILE_COUNTER() CM_DWT_CYCCNT
+#else
+#include <time.h>
+#define CM_PROFILE_COUNTER() getProfileTime()
+#define CM_PROFILE_CLOCK
+#endif
+
+#define CM_PROFILE_BEGIN(op, position) \
+    uint32_t cmProfileStart##op = CM_PROFILE_COUNTER(); \
+    uint64_t cmProfilePosition##op = (position)
+#define CM_PROFILE_END(stats, op, position) \
+    recordProfile((stats), (op), cmProfileStart##op, \
+                  (position) - cmProfilePosition##op)
+#else
+#define CM_PROFILE_BEGIN(op, position)
+#define CM_PROFILE_END(stats, op, position)
+#endif
+
+#define CM_VARINT   0x60u
 
 #define CM_END_OF_MESSAGE   0x00u
 
-#define CM_VERSION   0x83u
+#define CM_NAME             0x80u
+#define CM_BLOCK_START      0x81u
+#define CM_BLOCK_END        0x82u
+#define CM_VERSION          0x83u
+#define CM_MARKER           0x84u
+#define CM_METADATA_START   0x85u
+#define CM_METADATA_END     0x86u
+#define CM_CRC32            0x88u
+#define CM_MESSAGE          0x89u
+#define CM_RECORD_TABLE     0x8Au
+#define CM_NAME_DEFINITION  0x8Bu
+#define CM_NAME_REFERENCE   0x8Cu
+#define CM_STRING_DEFINITION 0x8Du
+#define CM_STRING_REFERENCE 0x8Eu
+#define CM_COMPRESSED       0x8Fu
+#define CM_ENCODED_ARRAY    0x90u
+
+// LEB128 encoding of uint64 takes up to 10 bytes
+#define CM_MAX_VARINT_SIZE  10u
+// flag, codec, item type and two varints (uint32)
+#define CM_MAX_ENCODED_HEADER_SIZE  13u
+
+// LZ4 matches are at least 4 bytes long, last match starts at least 12 bytes
+// before the end of block and last 5 bytes of block are always literals
+#define CM_LZ4_MIN_MATCH    4u
+#define CM_LZ4_MATCH_LIMIT  12u
+#define CM_LZ4_LAST_LITERALS 5u
+
+// layout of log file, see CMLogWriter
+#define CM_LOG_FORMAT       1u
+#define CM_LOG_HEADER_SIZE  12u
+#define CM_LOG_INDEX_TAG    0xFFFFFFFFu
+#define CM_LOG_INDEX_HEADER_SIZE    24u
+#define CM_LOG_ENTRY_SIZE   16u
+#define CM_LOG_TRAILER_SIZE 16u
+
+#define CRC32_INIT          0xFFFFFFFFu
+
+#define FNV_OFFSET_BASIS    0x811C9DC5u
+#define FNV_PRIME           0x01000193u
 
 #define ENDIAN_MARK     0x0709u
 #define ENDIAN_INV_MARK 0x0907u
 
+// classes of elements defined by their flags
+#define CM_KIND_INVALID 0u
+// values, version, CRC, padding and boundaries of blocks and metadata
+#define CM_KIND_FIXED   1u
+#define CM_KIND_ARRAY   2u
+// varints and encoded arrays
+#define CM_KIND_ENCODED 3u
+#define CM_KIND_NAME    4u
+#define CM_KIND_MARKER  5u
+#define CM_KIND_MESSAGE 6u
+#define CM_KIND_TABLE   7u
+// names and strings that are added to dictionary
+#define CM_KIND_DEFINITION 8u
+
+/**
+ * Layout of element that is defined by its flag
+ */
+typedef struct {
+    /**
+     * One of CM_KIND_X classes
+     */
+    uint8_t kind;
+
+    /**
+     * Size of value or of each array item (bytes for embedded message)
+     */
+    uint8_t itemSize;
+
+    /**
+     * Size of flag and fields that precede items (size of array or length)
+     */
+    uint8_t headerSize;
+
+    /**
+     * Size of groups of item bytes that are swapped when endianness is
+     * converted (0 if bytes of items are not swapped)
+     */
+    uint8_t swapSize;
+} FlagInfo;
+
+#define CM_FLAG_LEN(f) (1u << ((f) & CM_TYPE_LEN_MASK))
+#define CM_FLAG_IS_FIXED(f) \
+    ((f) == CM_VERSION || (f) == CM_CRC32 || (f) == CM_BLOCK_START || \
+     (f) == CM_BLOCK_END || (f) == CM_METADATA_START || (f) == CM_METADATA_END || \
+     (f) == CM_NAME_REFERENCE || (f) == CM_STRING_REFERENCE || (f) == CM_PADDING)
+#define CM_FLAG_KIND(f) \
+    ((f) == 0x00u ? CM_KIND_INVALID : \
+     (f) < 0x20u ? CM_KIND_FIXED : \
+     (f) < 0x40u ? CM_KIND_INVALID : \
+     (f) < 0x60u ? CM_KIND_ARRAY : \
+     (f) == CM_COMPRESSED ? CM_KIND_ARRAY : \
+     (f) < 0x80u ? CM_KIND_ENCODED : \
+     (f) == CM_NAME ? CM_KIND_NAME : \
+     (f) == CM_MARKER ? CM_KIND_MARKER : \
+     (f) == CM_MESSAGE ? CM_KIND_MESSAGE : \
+     (f) == CM_RECORD_TABLE ? CM_KIND_TABLE : \
+     (f) == CM_NAME_DEFINITION || (f) == CM_STRING_DEFINITION ? CM_KIND_DEFINITION : \
+     (f) == CM_ENCODED_ARRAY ? CM_KIND_ENCODED : \
+     CM_FLAG_IS_FIXED(f) ? CM_KIND_FIXED : CM_KIND_INVALID)
+#define CM_FLAG_ITEM_SIZE(f) \
+    ((f) == 0x00u ? 0u : \
+     (f) < 0x20u || ((f) >= 0x40u && (f) < 0x60u) ? CM_FLAG_LEN(f) : \
+     (f) == CM_VERSION || (f) == CM_CRC32 ? 4u : \
+     (f) == CM_MESSAGE || (f) == CM_COMPRESSED || (f) == CM_NAME_REFERENCE || \
+     (f) == CM_STRING_REFERENCE ? 1u : 0u)
+#define CM_FLAG_HEADER_SIZE(f) \
+    (CM_FLAG_KIND(f) == CM_KIND_ARRAY || CM_FLAG_KIND(f) == CM_KIND_MESSAGE ? 5u : \
+     CM_FLAG_KIND(f) == CM_KIND_NAME || CM_FLAG_KIND(f) == CM_KIND_MARKER ? 2u : \
+     CM_FLAG_KIND(f) == CM_KIND_TABLE ? 6u : \
+     CM_FLAG_KIND(f) == CM_KIND_DEFINITION ? 3u : \
+     CM_FLAG_KIND(f) == CM_KIND_INVALID ? 0u : 1u)
+#define CM_FLAG_SWAP_SIZE(f) \
+    (CM_FLAG_KIND(f) == CM_KIND_MESSAGE || CM_FLAG_ITEM_SIZE(f) < 2u ? 0u : \
+     CM_FLAG_ITEM_SIZE(f))
+#define CM_FLAG_INFO(f) \
+    {CM_FLAG_KIND(f), CM_FLAG_ITEM_SIZE(f), CM_FLAG_HEADER_SIZE(f), CM_FLAG_SWAP_SIZE(f)}
+#define CM_FLAG_INFO_ROW(f) \
+    CM_FLAG_INFO((f) + 0x0u), CM_FLAG_INFO((f) + 0x1u), CM_FLAG_INFO((f) + 0x2u), \
+    CM_FLAG_INFO((f) + 0x3u), CM_FLAG_INFO((f) + 0x4u), CM_FLAG_INFO((f) + 0x5u), \
+    CM_FLAG_INFO((f) + 0x6u), CM_FLAG_INFO((f) + 0x7u), CM_FLAG_INFO((f) + 0x8u), \
+    CM_FLAG_INFO((f) + 0x9u), CM_FLAG_INFO((f) + 0xAu), CM_FLAG_INFO((f) + 0xBu), \
+    CM_FLAG_INFO((f) + 0xCu), CM_FLAG_INFO((f) + 0xDu), CM_FLAG_INFO((f) + 0xEu), \
+    CM_FLAG_INFO((f) + 0xFu)
+
+/**
+ * Layout of elements indexed by flag, so element is decoded with a single
+ * lookup instead of chain of comparisons
+ */
+static const FlagInfo flagInfo[256] = {
+        CM_FLAG_INFO_ROW(0x00u), CM_FLAG_INFO_ROW(0x10u),
+        CM_FLAG_INFO_ROW(0x20u), CM_FLAG_INFO_ROW(0x30u),
+        CM_FLAG_INFO_ROW(0x40u), CM_FLAG_INFO_ROW(0x50u),
+        CM_FLAG_INFO_ROW(0x60u), CM_FLAG_INFO_ROW(0x70u),
+        CM_FLAG_INFO_ROW(0x80u), CM_FLAG_INFO_ROW(0x90u),
+        CM_FLAG_INFO_ROW(0xA0u), CM_FLAG_INFO_ROW(0xB0u),
+        CM_FLAG_INFO_ROW(0xC0u), CM_FLAG_INFO_ROW(0xD0u),
+        CM_FLAG_INFO_ROW(0xE0u), CM_FLAG_INFO_ROW(0xF0u),
+};
+
+/**
+ * Bits that encode length of primitive type indexed by length in bytes
+ * (0xFF for invalid lengths)
+ */
+static const uint8_t lengthBits[9] = {0xFFu, 0x00u, 0x01u, 0xFFu, 0x02u,
+                                      0xFFu, 0xFFu, 0xFFu, 0x03u};
+
 /**
  * Ensures that current writer has enough space to write 'size' bytes
  * @param writer
@@ -22,6 +250,152 @@
  */
 static bool ensureSpace(CompositeMessageWriter *writer, uint32_t size);
 
+/**
+ * Ensures that current writer has enough space to write array header
+ * (flag and size) followed by 'itemCount' items of 'itemSize' bytes
+ * @param writer
+ * @param itemSize
+ * @param itemCount
+ * @return true if there is enough space
+ */
+static bool ensureArraySpace(CompositeMessageWriter *writer, uint8_t itemSize,
+                             uint32_t itemCount);
+
+/**
+ * Write padding flags, so items of array that is written next start at
+ * offset (from the beginning of message) that is a multiple of item size.
+ * Does nothing if aligned arrays are not enabled
+ * @param writer
+ * @param itemSize
+ * @return false if there is no space for padding
+ */
+static bool writePadding(CompositeMessageWriter *writer, uint8_t itemSize);
+
+/**
+ * Move read position past padding flags that precede current element
+ * @param reader
+ */
+static void skipPadding(CompositeMessageReader *reader);
+
+/**
+ * Write array header to buffer and record its payload as external segment
+ * Writer must be in gather mode and have space for two more segments
+ * @param writer
+ * @param flag array flag
+ * @param data payload of array
+ * @param size size of payload in bytes
+ * @param itemCount number of items as it should be stored in message
+ */
+static void writeArrayReference(CompositeMessageWriter *writer, uint8_t flag,
+                                const void *data, uint32_t size,
+                                uint32_t itemCount);
+
+/**
+ * Append segment to the list of segments of writer in gather mode
+ * Empty segments are not appended
+ * @param writer
+ * @param data
+ * @param size
+ */
+static void addSegment(CompositeMessageWriter *writer, const void *data,
+                       uint32_t size);
+
+/**
+ * Pass everything stored in buffer of stream writer to its flush callback
+ * and empty buffer. If callback fails, firstError is set to CM_ERROR_IO
+ * @param writer
+ * @return true if buffer was flushed
+ */
+static bool flushBuffer(CompositeMessageWriter *writer);
+
+/**
+ * Flush callback of counting writer that ignores all bytes
+ * @param context
+ * @param data
+ * @param size
+ * @return always true
+ */
+static bool discardBytes(void *context, const void *data, uint32_t size);
+
+/**
+ * Update CRC of writer with bytes of buffer that were not hashed yet
+ * Does nothing if CRC is not enabled
+ * @param writer
+ */
+static void updateWriterCrc(CompositeMessageWriter *writer);
+
+/**
+ * Update CRC of reader with bytes of message up to given offset
+ * @param reader
+ * @param offset must be at the beginning of element
+ */
+static void updateReaderCrc(CompositeMessageReader *reader, uint32_t offset);
+
+/**
+ * Update CRC with bytes of elements of message that was converted in place.
+ * Multibyte values are hashed in reverse order, so CRC is calculated over
+ * the original bytes
+ * @param reader
+ * @param crc
+ * @param from offset of first element
+ * @param to offset after last element
+ * @return updated crc
+ */
+static uint32_t updateConvertedCrc(const CompositeMessageReader *reader,
+                                   uint32_t crc, uint32_t from, uint32_t to);
+
+/**
+ * Update CRC with items whose bytes were swapped in place, so CRC is
+ * calculated over the original bytes of each item
+ * @param crc
+ * @param data
+ * @param size size of all items in bytes
+ * @param itemLen size of each item (items of 0 or 1 byte are not swapped)
+ * @return updated crc
+ */
+static uint32_t updateSwappedCrc(uint32_t crc, const uint8_t *data,
+                                 uint32_t size, uint8_t itemLen);
+
+/**
+ * Get size of items of single record of record table
+ * @param columns flags of columns
+ * @param columnCount
+ * @return size of record in bytes or 0 if there are no columns or some
+ * column is not a primitive type
+ */
+static uint32_t getRecordSize(const uint8_t *columns, uint8_t columnCount);
+
+/**
+ * Check if there is complete record table at current position.
+ * If there is no such table, firstError is set to CM_ERROR_NO_VALUE
+ * (or CM_ERROR_NEED_MORE if stream reader didn't receive it completely)
+ * @param reader
+ * @param recordCount number of records in table
+ * @return pointer to flags of columns (number of columns precedes them)
+ * or NULL on error
+ */
+static const uint8_t *checkRecordTable(CompositeMessageReader *reader,
+                                       uint32_t *recordCount);
+
+/**
+ * Update CRC32 with given bytes
+ * @param crc current crc (without final inversion)
+ * @param data
+ * @param size
+ * @return updated crc
+ */
+static uint32_t updateCrc32(uint32_t crc, const void *data, uint32_t size);
+
+/**
+ * Check that 'size' bytes starting at current read position are present
+ * in message. Otherwise firstError is set to CM_ERROR_NEED_MORE for
+ * stream readers and to CM_ERROR_NO_VALUE for other readers
+ * @param reader
+ * @param size
+ * @return true if bytes are present
+ */
+static bool ensureAvailable(CompositeMessageReader *reader, uint32_t size);
+
 /**
  * Check if there is value of specified type and size at current position
  * @param type
@@ -31,6 +405,307 @@ static bool ensureSpace(CompositeMessageWriter *writer, uint32_t size);
 static bool checkValue(CompositeMessageReader *reader,
                        uint8_t type, uint8_t size);
 
+/**
+ * Check if there is array of specified item type and size at current
+ * position and whole array fits in message
+ * @param reader
+ * @param itemType type of each item (one of CM_TYPE_X defines)
+ * @param itemSize size of each item in bytes
+ * @return number of items in array
+ */
+static uint32_t checkArray(CompositeMessageReader *reader, uint8_t itemType,
+                           uint8_t itemSize);
+
+/**
+ * Header of encoded array
+ */
+typedef struct {
+    uint8_t codec;
+    uint8_t itemFlag;
+    uint32_t itemCount;
+    uint32_t payloadSize;
+} EncodedArrayHeader;
+
+/**
+ * Destination of encoded items. Items are collected in small chunk that is
+ * written to writer when it is full. If writer is NULL, only size of
+ * encoded items is calculated
+ */
+typedef struct {
+    CompositeMessageWriter *writer;
+    uint64_t size;
+    uint32_t used;
+    uint8_t chunk[64];
+
+    /**
+     * Bits that don't form a complete byte yet
+     */
+    uint64_t bits;
+    uint32_t bitCount;
+} EncodedOutput;
+
+/**
+ * Source of encoded items
+ */
+typedef struct {
+    const uint8_t *data;
+    uint32_t available;
+
+    /**
+     * Bits that were loaded but not consumed yet
+     */
+    uint64_t bits;
+    uint32_t bitCount;
+} EncodedInput;
+
+/**
+ * Check if there is encoded array at current position and parse its header
+ * If header is not complete or is malformed, firstError is set
+ * @param reader
+ * @param header
+ * @return size of header or 0 on error
+ */
+static uint32_t checkEncodedHeader(CompositeMessageReader *reader,
+                                   EncodedArrayHeader *header);
+
+/**
+ * Read encoded array at current position into buffer
+ * @param reader
+ * @param itemType type of each item (one of CM_TYPE_X defines)
+ * @param itemSize size of each item in bytes
+ * @param buffer
+ * @param maxItems
+ * @return number of items read
+ */
+static uint32_t readEncodedArray(CompositeMessageReader *reader, uint8_t itemType,
+                                 uint8_t itemSize, void *buffer, uint32_t maxItems);
+
+/**
+ * Write array as encoded array
+ * @param writer
+ * @param codec one of CM_CODEC_X defines, must be compatible with item type
+ * @param itemType
+ * @param itemSize
+ * @param data
+ * @param itemCount
+ */
+static void writeEncodedArray(CompositeMessageWriter *writer, uint8_t codec,
+                              uint8_t itemType, uint8_t itemSize,
+                              const void *data, uint32_t itemCount);
+
+/**
+ * Check if items of given type can be encoded with codec
+ * @param codec
+ * @param itemType
+ * @return true if codec supports items
+ */
+static bool isCodecCompatible(uint8_t codec, uint8_t itemType);
+
+/**
+ * Encode items of array to output
+ * @param out
+ * @param codec
+ * @param itemType
+ * @param itemSize
+ * @param data
+ * @param itemCount
+ */
+static void encodeItems(EncodedOutput *out, uint8_t codec, uint8_t itemType,
+                        uint8_t itemSize, const void *data, uint32_t itemCount);
+
+/**
+ * Decode items of array from input
+ * @param in
+ * @param codec
+ * @param itemType
+ * @param itemSize
+ * @param buffer
+ * @param itemCount
+ * @return false if encoded items are malformed
+ */
+static bool decodeItems(EncodedInput *in, uint8_t codec, uint8_t itemType,
+                        uint8_t itemSize, void *buffer, uint32_t itemCount);
+
+/**
+ * Append byte to encoded output
+ * @param out
+ * @param byte
+ */
+static void putByte(EncodedOutput *out, uint8_t byte);
+
+/**
+ * Append LEB128 varint to encoded output
+ * @param out
+ * @param value
+ */
+static void putVarint(EncodedOutput *out, uint64_t value);
+
+/**
+ * Append lowest 'count' bits of value to encoded output.
+ * Bits are packed starting from the least significant bit of each byte
+ * @param out
+ * @param value
+ * @param count number of bits (up to 64)
+ */
+static void putBits(EncodedOutput *out, uint64_t value, uint32_t count);
+
+/**
+ * Append bytes to encoded output
+ * @param out
+ * @param data
+ * @param size
+ */
+static void putBytes(EncodedOutput *out, const void *data, uint32_t size);
+
+/**
+ * Write collected bytes of encoded output to its writer
+ * Incomplete byte of bits is written as well
+ * @param out
+ */
+static void flushOutput(EncodedOutput *out);
+
+/**
+ * Take varint from encoded input
+ * @param in
+ * @param value
+ * @return false if there is no complete varint
+ */
+static bool takeVarint(EncodedInput *in, uint64_t *value);
+
+/**
+ * Take 'count' bits from encoded input
+ * @param in
+ * @param count number of bits (up to 64)
+ * @param value
+ * @return false if there are not enough bits
+ */
+static bool takeBits(EncodedInput *in, uint32_t count, uint64_t *value);
+
+/**
+ * Fill header of encoded array
+ * @param header buffer for at least CM_MAX_ENCODED_HEADER_SIZE bytes
+ * @param codec
+ * @param itemFlag
+ * @param itemCount
+ * @param payloadSize
+ * @return size of header
+ */
+static uint32_t fillEncodedHeader(uint8_t *header, uint8_t codec,
+                                  uint8_t itemFlag, uint32_t itemCount,
+                                  uint32_t payloadSize);
+
+/**
+ * Pack bool values (any non-zero byte is true) to bits. Bit i is stored
+ * in byte i / 8 starting from the least significant bit. Unused bits of
+ * the last byte are cleared
+ * @param bools
+ * @param count
+ * @param bits buffer for (count + 7) / 8 bytes
+ */
+static void packBools(const uint8_t *bools, uint32_t count, uint8_t *bits);
+
+/**
+ * Unpack bits produced by packBools to bool values
+ * @param bits
+ * @param count
+ * @param bools
+ */
+static void unpackBools(const uint8_t *bits, uint32_t count, uint8_t *bools);
+
+/**
+ * Write single integer value as varint
+ * @param writer
+ * @param val pointer to value
+ * @param len size of value type in bytes
+ * @param type CM_TYPE_UINT or CM_TYPE_INT
+ * @return true if value was written
+ */
+static bool writeVarint(CompositeMessageWriter *writer, const void *val,
+                        uint8_t len, uint8_t type);
+
+/**
+ * Read single integer value stored as varint at current position
+ * @param reader
+ * @param val pointer where value should be stored
+ * @param len size of value type in bytes
+ * @param type CM_TYPE_UINT or CM_TYPE_INT
+ * @return true if value was read
+ */
+static bool readVarint(CompositeMessageReader *reader, void *val, uint8_t len,
+                       uint8_t type);
+
+/**
+ * Load integer item from array as unsigned 64-bit value
+ * Signed values are sign extended
+ * @param data
+ * @param index
+ * @param type CM_TYPE_UINT or CM_TYPE_INT
+ * @param len size of item in bytes
+ * @return loaded value
+ */
+static uint64_t loadInteger(const void *data, uint32_t index, uint8_t type,
+                            uint8_t len);
+
+/**
+ * Store value produced by loadInteger to array of integers
+ * @param data
+ * @param index
+ * @param value
+ * @param type CM_TYPE_UINT or CM_TYPE_INT
+ * @param len size of item in bytes
+ * @return false if value doesn't fit in item
+ */
+static bool storeInteger(void *data, uint32_t index, uint64_t value,
+                         uint8_t type, uint8_t len);
+
+/**
+ * Map signed value (stored as uint64) to unsigned one, so values with
+ * small magnitude become small
+ * @param value
+ * @return zig-zag encoded value
+ */
+static uint64_t zigzagEncode(uint64_t value);
+
+static uint64_t zigzagDecode(uint64_t value);
+
+/**
+ * Get number of bytes in LEB128 encoding of value
+ * @param value
+ * @return size in bytes
+ */
+static uint32_t getVarintSize(uint64_t value);
+
+/**
+ * Encode value as LEB128 varint
+ * @param value
+ * @param out buffer for at least CM_MAX_VARINT_SIZE bytes
+ * @return number of written bytes
+ */
+static uint32_t encodeVarint(uint64_t value, uint8_t *out);
+
+/**
+ * Decode LEB128 varint
+ * @param data
+ * @param available how many bytes can be accessed at data
+ * @param value decoded value
+ * @return size of varint in bytes or 0 if varint is not terminated in
+ * available bytes or doesn't fit in 64 bits
+ */
+static uint32_t decodeVarint(const uint8_t *data, uint32_t available,
+                             uint64_t *value);
+
+/**
+ * Parse header of encoded array
+ * @param data pointer to flag of encoded array
+ * @param available how many bytes can be accessed at data
+ * @param header
+ * @return size of header or 0 if header is not complete or malformed.
+ * Header is malformed if 0 is returned with at least
+ * CM_MAX_ENCODED_HEADER_SIZE bytes available
+ */
+static uint32_t parseEncodedHeader(const uint8_t *data, uint32_t available,
+                                   EncodedArrayHeader *header);
+
 /**
  * Write single value
  * @param writer
@@ -53,6 +728,16 @@ static bool writeValue(CompositeMessageWriter *writer, void *val, uint8_t len,
 static bool readValue(CompositeMessageReader *reader, void *val, uint8_t len,
                       uint8_t type);
 
+/**
+ * Read uint32 stored at given offset of message.
+ * Offset doesn't need to be aligned. Bytes are swapped if message
+ * has inversed endianness and is read without conversion
+ * @param reader
+ * @param offset
+ * @return read value
+ */
+static uint32_t readU32(const CompositeMessageReader *reader, uint32_t offset);
+
 /**
  * Get flag of primitive type that is defined by type (CM_TYPE_*) and length in
  * bytes
@@ -62,6 +747,23 @@ static bool readValue(CompositeMessageReader *reader, void *val, uint8_t len,
  */
 static uint8_t getTypeFlag(uint8_t type, uint8_t len);
 
+/**
+ * Get flag of value with given type (CM_TYPE_*) and length in bytes that is
+ * passed by user (e.g. in CMFieldDesc)
+ * @param type
+ * @param len
+ * @return type flag or 0 if type or length is invalid
+ */
+static uint8_t getValueFlag(uint8_t type, uint8_t len);
+
+/**
+ * Get flag of array with items of given type (CM_TYPE_*) and length in bytes
+ * @param itemType
+ * @param itemSize
+ * @return array flag or 0 if type or length is invalid
+ */
+static uint8_t getArrayFlag(uint8_t itemType, uint8_t itemSize);
+
 /**
  * Split provided flag into type of primitive and its length in bytes
  * @param flag
@@ -72,7 +774,8 @@ static void splitTypeFlag(uint8_t flag, uint8_t *type, uint8_t *len);
 
 /**
  * Write array of bytes directly into message
- * Writer must have enough space in its internal buffer
+ * Writer must have enough space in its internal buffer unless it is
+ * a stream writer
  * @param writer
  * @param data
  * @param size
@@ -88,69 +791,518 @@ static bool writeBytes(CompositeMessageWriter *writer,
 static void inverseByteOrder(void *data, uint8_t size);
 
 /**
- * Convert endianness in whole message
+ * Inverse byte order of each item in given array
+ * Uses SIMD instructions when they are available
+ * @param data
+ * @param itemSize size of each item in bytes (1, 2, 4 or 8)
+ * @param itemCount
+ */
+static void inverseArrayByteOrder(void *data, uint8_t itemSize,
+                                  uint32_t itemCount);
+
+/**
+ * Convert endianness in whole message. Every element is checked to fit
+ * into remaining bytes before its bytes are swapped, so malformed message
+ * is never accessed outside of given size. If message is malformed,
+ * elements before malformed one stay converted
  * @param message
  * @param size
  * @return true if conversion was successful
  */
 static bool convertEndianness(void *message, uint32_t size);
 
-static bool isSingleValue(uint8_t flag);
-
 static bool isArray(uint8_t flag);
 
-static bool isVersion(uint8_t flag);
+static bool isVarint(uint8_t flag);
 
-CompositeMessageWriter cmGetWriter(void *buffer, uint32_t size) {
-    static CompositeMessageWriter writer;
-    writer.buffer = (uint8_t *) buffer;
-    writer.bufferSize = size;
-    writer.usedSize = 0;
-    writer.firstError = CM_ERROR_NONE;
-    if (size < 2) {
-        writer.firstError = CM_ERROR_NO_SPACE;
-    } else {
-        *(uint16_t *) writer.buffer = ENDIAN_MARK;
-        writer.usedSize = 2;
-    }
-    return writer;
-}
+/**
+ * Check if flag is one of name flags (regular name or name stored in
+ * dictionary)
+ * @param flag
+ * @return true if element is a name
+ */
+static bool isName(uint8_t flag);
 
-CompositeMessageReader cmGetReader(void *message, uint32_t size) {
-    static CompositeMessageReader reader;
-    uint8_t *m = (uint8_t *) message;
-    reader.message = m;
-    reader.totalSize = size;
-    reader.readSize = 0;
-    reader.firstError = CM_ERROR_NONE;
-    uint16_t e = *(uint16_t *) m;
-    if (size < 2 || (e != ENDIAN_MARK && e != ENDIAN_INV_MARK)) {
-        reader.firstError = CM_ERROR_NO_ENDIAN;
-    } else {
-        // in case of inversed endianness, swap all groups of bytes
-        // so message can be processed in normal way
-        if (e != ENDIAN_MARK && !convertEndianness(&m[2], size - 2)) {
-            reader.firstError = CM_ERROR_NO_ENDIAN;
-        } else {
-            reader.readSize = 2;
-        }
-    }
-    return reader;
-}
+/**
+ * Write name or string with dictionary of writer: as index if string is
+ * already in dictionary, or as string with its new index otherwise
+ * @param writer
+ * @param flag CM_NAME_DEFINITION or CM_STRING_DEFINITION
+ * @param str
+ * @param length
+ * @return false if string can't be stored in dictionary and should be
+ * written in regular way
+ */
+static bool writeDictionaryString(CompositeMessageWriter *writer, uint8_t flag,
+                                  const char *str, uint8_t length);
 
-void cmWriteI8(CompositeMessageWriter *writer, int8_t i) {
-    writeValue(writer, &i, sizeof(i), CM_TYPE_INT);
-}
+/**
+ * Store string in dictionary at given index. String that is already stored
+ * at this index is not copied again
+ * @param dictionary
+ * @param index
+ * @param str
+ * @param length
+ */
+static void addDictionaryString(CMDictionary *dictionary, uint8_t index,
+                                const char *str, uint8_t length);
 
-int8_t cmReadI8(CompositeMessageReader *reader) {
-    int8_t val = 0;
-    readValue(reader, &val, sizeof(val), CM_TYPE_INT);
-    return val;
-}
+/**
+ * Add strings stored in elements of message between dictionaryOffset of
+ * reader and given offset to dictionary of reader
+ * @param reader
+ * @param offset offset of element where scan stops
+ */
+static void updateDictionary(CompositeMessageReader *reader, uint32_t offset);
 
-void cmWriteU8(CompositeMessageWriter *writer, uint8_t i) {
-    writeValue(writer, &i, sizeof(i), CM_TYPE_UINT);
-}
+/**
+ * Get chars of name or string element at given offset. Element must be
+ * complete. Strings stored in dictionary are resolved with dictionary
+ * @param reader
+ * @param offset offset of element
+ * @param length length of string
+ * @return pointer to null terminated string or NULL if it is not found
+ * or is not terminated in message
+ */
+static const char *getStringAt(CompositeMessageReader *reader, uint32_t offset,
+                               uint8_t *length);
+
+/**
+ * Read string that is stored in dictionary (or is added to it) at current
+ * position. If there is no such string, firstError is set to
+ * CM_ERROR_NO_VALUE (or CM_ERROR_NEED_MORE if element is not complete)
+ * @param reader
+ * @param length length of string
+ * @param move true if read position should be moved past the string
+ * @return pointer to null terminated string or NULL on error
+ */
+static const char *readDictionaryString(CompositeMessageReader *reader,
+                                        uint8_t *length, bool move);
+
+/**
+ * Check if there is element with string stored in dictionary at current
+ * position
+ * @param reader
+ * @return true if such element can be read with readDictionaryString
+ */
+static bool isDictionaryString(const CompositeMessageReader *reader);
+
+/**
+ * Write single flag without payload
+ * @param writer
+ * @param flag
+ */
+static void writeFlag(CompositeMessageWriter *writer, uint8_t flag);
+
+/**
+ * Read single flag without payload
+ * @param reader
+ * @param flag expected flag
+ */
+static void readFlag(CompositeMessageReader *reader, uint8_t flag);
+
+/**
+ * Get size of element (including its flag) at given offset of message.
+ * Name is treated as separate element. Returned size is not checked against
+ * size of message. If only part of element header is present in message,
+ * size of header is returned
+ * @param reader
+ * @param offset offset of element, must be inside of message
+ * @return size of element or 0 if element is unknown
+ */
+static uint64_t getElementSize(const CompositeMessageReader *reader,
+                               uint32_t offset);
+
+/**
+ * Get size of varint value or encoded array. Returned size is not checked
+ * against available bytes. If element is not complete, size larger than
+ * available is returned
+ * @param data pointer to flag of element
+ * @param available how many bytes can be accessed at data (at least 1)
+ * @return size of element or 0 if element is malformed
+ */
+static uint64_t getEncodedElementSize(const uint8_t *data, uint32_t available);
+
+/**
+ * Get size of field at current read position. Field is either a single
+ * element or a whole block (including nested ones). Name is included in size
+ * of field that follows it.
+ * If field can't be measured, firstError is set to CM_ERROR_NO_VALUE
+ * (or CM_ERROR_NEED_MORE if stream reader didn't receive it completely)
+ * @param reader
+ * @return size of field in bytes or 0 on error
+ */
+static uint32_t getFieldSize(CompositeMessageReader *reader);
+
+/**
+ * Create copy of reader that is positioned at element recorded in index
+ * If entry doesn't belong to message, firstError is set to
+ * CM_ERROR_INVALID_ARG
+ * @param reader
+ * @param entry
+ * @param copy
+ * @return true if copy was created
+ */
+static bool getReaderAt(CompositeMessageReader *reader,
+                        const CMIndexEntry *entry, CompositeMessageReader *copy);
+
+/**
+ * Read single value of element recorded in index without changing
+ * read position of reader
+ * @param reader
+ * @param entry
+ * @param val pointer where value should be stored
+ * @param len size of value type in bytes
+ * @param type expected type of value as defined by CM_TYPE_*
+ * @return true if value was read
+ */
+static bool readValueAt(CompositeMessageReader *reader, const CMIndexEntry *entry,
+                        void *val, uint8_t len, uint8_t type);
+
+/**
+ * Calculate FNV-1a hash of bytes
+ * @param data
+ * @param size
+ * @return hash value
+ */
+static uint32_t hashBytes(const void *data, uint32_t size);
+
+/**
+ * Write bytes of elements as blocks of compressed elements
+ * @param writer
+ * @param compressor
+ * @param data
+ * @param size
+ */
+static void writeCompressedBlocks(CompositeMessageWriter *writer,
+                                  const CMCompressor *compressor,
+                                  const uint8_t *data, uint32_t size);
+
+/**
+ * Discard already read bytes of stream reader if there is not enough free
+ * space in its buffer (endianness mark is kept)
+ * @param reader
+ * @param size how many bytes should fit into buffer
+ */
+static void compactStream(CompositeMessageReader *reader, uint32_t size);
+
+/**
+ * Compress block with LZ4 block format, CMCompressCallback of built-in
+ * compressor
+ * @param context pointer to CMLz4WorkBuffer
+ * @param data
+ * @param size up to 65535 bytes
+ * @param output
+ * @param capacity
+ * @return size of compressed block or 0 if it doesn't fit in output
+ */
+static uint32_t lz4Compress(void *context, const void *data, uint32_t size,
+                            void *output, uint32_t capacity);
+
+/**
+ * Decompress block with LZ4 block format, CMDecompressCallback of built-in
+ * compressor. Every access is checked, so corrupted block is rejected
+ * @param context unused
+ * @param data
+ * @param size
+ * @param output
+ * @param outputSize
+ * @return true if block decompressed exactly to outputSize bytes
+ */
+static bool lz4Decompress(void *context, const void *data, uint32_t size,
+                          void *output, uint32_t outputSize);
+
+/**
+ * Append LZ4 sequence of literals followed by match
+ * @param output
+ * @param used number of bytes in output, updated with size of sequence
+ * @param capacity
+ * @param literals
+ * @param literalCount
+ * @param offset distance to match
+ * @param matchLength length of match or 0 for last sequence of block
+ * @return false if sequence doesn't fit in output
+ */
+static bool putLz4Sequence(uint8_t *output, uint32_t *used, uint32_t capacity,
+                           const uint8_t *literals, uint32_t literalCount,
+                           uint32_t offset, uint32_t matchLength);
+
+/**
+ * Read extra bytes of LZ4 length that begins with 15 in token
+ * @param data
+ * @param size
+ * @param pos position of next byte in data, updated after read
+ * @param length length from token, updated with extra bytes
+ * @param limit largest valid length
+ * @return false if length is truncated or is larger than limit
+ */
+static bool takeLz4Length(const uint8_t *data, uint32_t size, uint32_t *pos,
+                          uint32_t *length, uint32_t limit);
+
+/**
+ * Write array of primitive types, same as cmWriteTypedArray but without
+ * profiling hooks
+ * @param writer
+ * @param itemType
+ * @param itemSize
+ * @param data
+ * @param itemCount
+ */
+static void writeTypedArray(CompositeMessageWriter *writer, uint8_t itemType,
+                            uint8_t itemSize, const void *data,
+                            uint32_t itemCount);
+
+/**
+ * Compare bytes with signature of template, bytes that are not part of
+ * signature are masked out. Bytes are compared by 8-byte words and
+ * differences are accumulated without branches
+ * @param data
+ * @param signature
+ * @param mask
+ * @param size number of compared bytes
+ * @return true if all bytes of signature are the same
+ */
+static bool matchSignature(const uint8_t *data, const uint8_t *signature,
+                           const uint8_t *mask, uint32_t size);
+
+/**
+ * Pass bytes to write callback of log writer
+ * @param log
+ * @param data
+ * @param size
+ * @return false if callback failed (firstError is set to CM_ERROR_IO)
+ */
+static bool writeLogBytes(CMLogWriter *log, const void *data, uint32_t size);
+
+/**
+ * Get protocol version of complete message: value of version element that
+ * is preceded only by start of metadata and markers
+ * @param message
+ * @param size
+ * @return version or 0 if message has no version
+ */
+static uint32_t getLogVersion(const void *message, uint32_t size);
+
+/**
+ * Read uint32 from log file with conversion of its endianness
+ * Offset must be checked by caller
+ * @param log
+ * @param offset
+ * @return
+ */
+static uint32_t readLogU32(const CMLogReader *log, uint64_t offset);
+
+/**
+ * Read uint64 from log file with conversion of its endianness
+ * Offset must be checked by caller
+ * @param log
+ * @param offset
+ * @return
+ */
+static uint64_t readLogU64(const CMLogReader *log, uint64_t offset);
+
+/**
+ * Get size of log index with given number of entries (including trailer)
+ * @param entryCount
+ * @return
+ */
+static uint64_t getLogIndexSize(uint32_t entryCount);
+
+/**
+ * Find indexes by following offsets of previous indexes from trailer at
+ * the end of file
+ * @param log
+ * @return false if file doesn't end with valid trailer (firstError is set
+ * only if indexes don't fit in storage)
+ */
+static bool readLogTrailer(CMLogReader *log);
+
+/**
+ * Find indexes and messages after the last index by walking through all
+ * messages of file
+ * @param log
+ * @return false if indexes are inconsistent or don't fit in storage
+ */
+static bool scanLog(CMLogReader *log);
+
+/**
+ * Find message in log file
+ * @param log
+ * @param n number of message, must be less than number of messages
+ * @param offset offset of message in file
+ * @param size size of message
+ * @param version version of message
+ * @return false if entry of message points outside of file
+ */
+static bool findLogMessage(CMLogReader *log, uint64_t n, uint64_t *offset,
+                           uint32_t *size, uint32_t *version);
+
+/**
+ * Enable hardware counter that is used for profiling (if it needs enabling)
+ */
+static void startProfileCounter(void);
+
+#if defined(CM_PROFILE)
+/**
+ * Add measurement of operation to profile stats
+ * @param stats stats of reader or writer (NULL if profiling is stopped)
+ * @param op one of CM_PROFILE_X operations
+ * @param start value of profile counter when operation was started
+ * @param bytes number of bytes processed by operation
+ */
+static void recordProfile(CMProfileStats *stats, uint32_t op, uint32_t start,
+                          uint64_t bytes);
+
+#if defined(CM_PROFILE_CLOCK)
+/**
+ * Get current time of monotonic clock
+ * @return time in nanoseconds (wraps around every ~4 seconds)
+ */
+static uint32_t getProfileTime(void);
+#endif
+#endif
+
+CompositeMessageWriter cmGetWriter(void *buffer, uint32_t size) {
+    CompositeMessageWriter writer;
+    cmInitWriter(&writer, buffer, size);
+    return writer;
+}
+
+CompositeMessageReader cmGetReader(void *message, uint32_t size) {
+    CompositeMessageReader reader;
+    cmInitReader(&reader, message, size);
+    return reader;
+}
+
+void cmInitWriter(CompositeMessageWriter *writer, void *buffer, uint32_t size) {
+    writer->buffer = (uint8_t *) buffer;
+    writer->bufferSize = size;
+    writer->usedSize = 0;
+    writer->firstError = CM_ERROR_NONE;
+    writer->arrayStart = 0;
+    writer->arrayMaxCount = 0;
+    writer->arrayOpen = false;
+    writer->segments = NULL;
+    writer->maxSegments = 0;
+    writer->segmentCount = 0;
+    writer->segmentStart = 0;
+    writer->gatherThreshold = 0;
+    writer->externalSize = 0;
+    writer->flush = NULL;
+    writer->flushContext = NULL;
+    writer->flushedSize = 0;
+    writer->crcEnabled = false;
+    writer->crc = CRC32_INIT;
+    writer->crcOffset = 2;
+    writer->compactIntegers = false;
+    writer->alignArrays = false;
+    writer->messageStart = 0;
+    writer->messageOffset = 0;
+    writer->dictionary = NULL;
+    writer->profileStats = NULL;
+    if (size < 2) {
+        writer->firstError = CM_ERROR_NO_SPACE;
+    } else {
+        uint16_t e = ENDIAN_MARK;
+        memcpy(writer->buffer, &e, sizeof(e));
+        writer->usedSize = 2;
+    }
+}
+
+void cmInitReader(CompositeMessageReader *reader, void *message, uint32_t size) {
+    cmInitProfiledReader(reader, message, size, NULL);
+}
+
+void cmInitProfiledReader(CompositeMessageReader *reader, void *message,
+                          uint32_t size, CMProfileStats *stats) {
+    if (stats != NULL) {
+        startProfileCounter();
+    }
+    CM_PROFILE_BEGIN(CM_PROFILE_GET_READER, 0);
+    uint8_t *m = (uint8_t *) message;
+    reader->message = m;
+    reader->totalSize = size;
+    reader->readSize = 0;
+    reader->firstError = CM_ERROR_NONE;
+    reader->swapBytes = false;
+    reader->capacity = 0;
+    reader->fieldSlots = NULL;
+    reader->fieldSlotCount = 0;
+    reader->converted = false;
+    reader->crc = CRC32_INIT;
+    reader->crcOffset = 2;
+    reader->trusted = false;
+    reader->dictionary = NULL;
+    reader->dictionaryOffset = 0;
+    reader->profileStats = stats;
+    uint16_t e = 0;
+    if (size >= 2) {
+        memcpy(&e, m, sizeof(e));
+    }
+    if (e != ENDIAN_MARK && e != ENDIAN_INV_MARK) {
+        reader->firstError = CM_ERROR_NO_ENDIAN;
+    } else {
+        // in case of inversed endianness, swap all groups of bytes
+        // so message can be processed in normal way
+        bool valid = true;
+        if (e != ENDIAN_MARK) {
+            CM_PROFILE_BEGIN(CM_PROFILE_CONVERT, 0);
+            valid = convertEndianness(&m[2], size - 2);
+            CM_PROFILE_END(stats, CM_PROFILE_CONVERT, size - 2);
+        }
+        if (!valid) {
+            reader->firstError = CM_ERROR_MALFORMED;
+        } else {
+            reader->converted = e != ENDIAN_MARK;
+            reader->readSize = 2;
+        }
+    }
+    CM_PROFILE_END(stats, CM_PROFILE_GET_READER, size);
+}
+
+void cmInitConstReader(CompositeMessageReader *reader, const void *message,
+                       uint32_t size) {
+    reader->message = (const uint8_t *) message;
+    reader->totalSize = size;
+    reader->readSize = 0;
+    reader->firstError = CM_ERROR_NONE;
+    reader->swapBytes = false;
+    reader->capacity = 0;
+    reader->fieldSlots = NULL;
+    reader->fieldSlotCount = 0;
+    reader->converted = false;
+    reader->crc = CRC32_INIT;
+    reader->crcOffset = 2;
+    reader->trusted = false;
+    reader->dictionary = NULL;
+    reader->dictionaryOffset = 0;
+    reader->profileStats = NULL;
+    uint16_t e = 0;
+    if (size >= 2) {
+        memcpy(&e, message, sizeof(e));
+    }
+    if (e != ENDIAN_MARK && e != ENDIAN_INV_MARK) {
+        reader->firstError = CM_ERROR_NO_ENDIAN;
+    } else {
+        // values are swapped one by one when they are read
+        reader->swapBytes = e != ENDIAN_MARK;
+        reader->readSize = 2;
+    }
+}
+
+void cmWriteI8(CompositeMessageWriter *writer, int8_t i) {
+    writeValue(writer, &i, sizeof(i), CM_TYPE_INT);
+}
+
+int8_t cmReadI8(CompositeMessageReader *reader) {
+    int8_t val = 0;
+    readValue(reader, &val, sizeof(val), CM_TYPE_INT);
+    return val;
+}
+
+void cmWriteU8(CompositeMessageWriter *writer, uint8_t i) {
+    writeValue(writer, &i, sizeof(i), CM_TYPE_UINT);
+}
 
 uint8_t cmReadU8(CompositeMessageReader *reader) {
     uint8_t val = 0;
@@ -262,270 +1414,4215 @@ char cmReadChar(CompositeMessageReader *reader) {
 
 void cmWriteTypedArray(CompositeMessageWriter *writer, uint8_t itemType,
                        uint8_t itemSize, const void *data, uint32_t itemCount) {
-    if (itemSize > 0x08 || itemSize == 0) {
+    CM_PROFILE_BEGIN(CM_PROFILE_WRITE_ARRAY, cmGetMessageSize(writer));
+    writeTypedArray(writer, itemType, itemSize, data, itemCount);
+    CM_PROFILE_END(writer->profileStats, CM_PROFILE_WRITE_ARRAY,
+                   cmGetMessageSize(writer));
+}
+
+static void writeTypedArray(CompositeMessageWriter *writer, uint8_t itemType,
+                            uint8_t itemSize, const void *data,
+                            uint32_t itemCount) {
+    if (writer->firstError != CM_ERROR_NONE)
+        return;
+    uint8_t flag = getArrayFlag(itemType, itemSize);
+    if (flag == 0) {
         writer->firstError = CM_ERROR_INVALID_ARG;
         return;
     }
-    if (itemType > 0x14 || itemType < 0x04) {
-        writer->firstError = CM_ERROR_INVALID_ARG;
+
+    if (writer->compactIntegers && itemSize > 1 &&
+        (itemType == CM_TYPE_UINT || itemType == CM_TYPE_INT)) {
+        writeEncodedArray(writer, CM_CODEC_VARINT, itemType, itemSize, data,
+                          itemCount);
+        return;
+    }
+
+    if (itemType == CM_TYPE_CHAR && writer->dictionary != NULL &&
+        itemCount <= UINT8_MAX &&
+        writeDictionaryString(writer, CM_STRING_DEFINITION, (const char *) data,
+                              (uint8_t) itemCount))
+        return;
+
+    // whole array (with null terminator of string) must fit in message
+    // size, otherwise payload size and count of items would wrap around
+    uint64_t fullSize = (uint64_t) itemCount * itemSize +
+                        (itemType == CM_TYPE_CHAR ? 1u : 0u);
+    if (fullSize > UINT32_MAX - 1 - sizeof(uint32_t)) {
+        writer->firstError = CM_ERROR_NO_SPACE;
         return;
     }
-    uint8_t flag = getTypeFlag(CM_ARRAY | itemType, itemSize);
+    uint32_t payloadSize = itemCount * itemSize;
+
+    if (!writePadding(writer, itemSize))
+        return;
 
     // increase number of stored items to store extra null terminator
     if (itemType == CM_TYPE_CHAR) {
         ++itemCount;
     }
 
-    // we need to place flag (1 byte), array size (uint32) and array itself
-    if (!ensureSpace(writer, 1 + sizeof(uint32_t) + itemSize * itemCount))
+    // referenced payload is hashed right away, so CRC can't skip size of
+    // open embedded message that is not known yet
+    if (writer->segments != NULL && payloadSize >= writer->gatherThreshold &&
+        writer->segmentCount + 3 <= writer->maxSegments &&
+        !(writer->crcEnabled && writer->messageStart != 0)) {
+        writeArrayReference(writer, flag, data, payloadSize, itemCount);
+        return;
+    }
+
+    if (writer->flush != NULL) {
+        // only header must fit in buffer, payload may bypass it
+        if (!ensureArraySpace(writer, itemSize, 0))
+            return;
+    } else if (!ensureArraySpace(writer, itemSize, itemCount)) {
+        // we need to place flag (1 byte), array size (uint32) and array itself
         return;
+    }
 
     writer->buffer[writer->usedSize] = flag;
     writer->usedSize++;
     writeBytes(writer, &itemCount, sizeof(uint32_t));
+    writeBytes(writer, data, payloadSize);
     if (itemType == CM_TYPE_CHAR) {
-        writeBytes(writer, data, (itemCount - 1) * itemSize);
-        writer->buffer[writer->usedSize] = 0x00;
-        ++writer->usedSize;
-    } else {
-        writeBytes(writer, data, itemCount * itemSize);
+        uint8_t terminator = 0x00;
+        writeBytes(writer, &terminator, 1);
     }
 }
 
-uint32_t cmReadTypedArray(CompositeMessageReader *reader, uint8_t itemType,
-                          uint8_t itemSize, void *buffer, uint32_t maxItems) {
-    if (itemSize > 0x08 || itemSize == 0) {
-        reader->firstError = CM_ERROR_INVALID_ARG;
-        return 0;
-    }
-    if (itemType > 0x14 || itemType < 0x04) {
-        reader->firstError = CM_ERROR_INVALID_ARG;
-        return 0;
+void cmSetGatherMode(CompositeMessageWriter *writer, CMSegment *segments,
+                     uint32_t maxSegments, uint32_t threshold) {
+    if (segments == NULL || maxSegments == 0 || writer->flush != NULL) {
+        writer->firstError = CM_ERROR_INVALID_ARG;
+        return;
     }
-    uint8_t flag = getTypeFlag(CM_ARRAY | itemType, itemSize);
-
-    uint32_t arraySize = cmPeekArraySize(reader);
+    writer->segments = segments;
+    writer->maxSegments = maxSegments;
+    writer->segmentCount = 0;
+    writer->segmentStart = 0;
+    writer->gatherThreshold = threshold;
+}
 
-    if (reader->firstError != CM_ERROR_NONE) {
-        return 0;
+void cmSetFlushCallback(CompositeMessageWriter *writer, CMFlushCallback flush,
+                        void *context) {
+    if (flush == NULL || writer->segments != NULL) {
+        writer->firstError = CM_ERROR_INVALID_ARG;
+        return;
     }
+    writer->flush = flush;
+    writer->flushContext = context;
+}
 
-    if (reader->message[reader->readSize] != flag) {
-        reader->firstError = CM_ERROR_NO_VALUE;
-        return 0;
+void cmWriteEncodedArray(CompositeMessageWriter *writer, uint8_t codec,
+                         uint8_t itemType, uint8_t itemSize, const void *data,
+                         uint32_t itemCount) {
+    if (writer->firstError != CM_ERROR_NONE)
+        return;
+    if (getArrayFlag(itemType, itemSize) == 0 ||
+        !isCodecCompatible(codec, itemType)) {
+        writer->firstError = CM_ERROR_INVALID_ARG;
+        return;
     }
+    writeEncodedArray(writer, codec, itemType, itemSize, data, itemCount);
+}
 
-    if (maxItems < arraySize) {
-        reader->firstError = CM_ERROR_NO_SPACE;
-        return 0;
+void cmWriteBitmap(CompositeMessageWriter *writer, const void *bits,
+                   uint32_t bitCount) {
+    if (writer->firstError != CM_ERROR_NONE)
+        return;
+    uint32_t size = (uint32_t) (((uint64_t) bitCount + 7) / 8);
+    uint8_t header[CM_MAX_ENCODED_HEADER_SIZE];
+    uint32_t headerSize = fillEncodedHeader(header, CM_CODEC_BITS,
+                                            getTypeFlag(CM_TYPE_BOOL, 1),
+                                            bitCount, size);
+    // in stream mode only header must fit in buffer
+    if ((uint64_t) headerSize + size > UINT32_MAX ||
+        !ensureSpace(writer, headerSize + (writer->flush != NULL ? 0 : size))) {
+        if (writer->firstError == CM_ERROR_NONE)
+            writer->firstError = CM_ERROR_NO_SPACE;
+        return;
     }
+    writeBytes(writer, header, headerSize);
 
-    reader->readSize += 1 + sizeof(uint32_t);
-    memcpy(buffer, &reader->message[reader->readSize], arraySize * itemSize);
-    reader->readSize += arraySize * itemSize;
-
-    return arraySize;
+    // unused bits of the last byte are always cleared
+    const uint8_t *d = (const uint8_t *) bits;
+    uint32_t full = bitCount / 8;
+    writeBytes(writer, d, full);
+    if (full != size) {
+        uint8_t last = (uint8_t) (d[full] & ((1u << (bitCount % 8u)) - 1));
+        writeBytes(writer, &last, 1);
+    }
 }
 
-uint32_t cmPeekArraySize(CompositeMessageReader *reader) {
+uint32_t cmReadBitmap(CompositeMessageReader *reader, void *bits,
+                      uint32_t maxBits) {
     if (reader->firstError != CM_ERROR_NONE)
         return 0;
-
-    if (reader->readSize + 1 + sizeof(uint32_t) > reader->totalSize ||
-        !(reader->message[reader->readSize] & CM_ARRAY)) {
-        reader->firstError = CM_ERROR_NO_VALUE;
+    if (!ensureAvailable(reader, 1))
         return 0;
-    }
 
-    uint32_t size = *(uint32_t *) &reader->message[reader->readSize + 1];
-
-    return size;
-}
+    if (reader->message[reader->readSize] != CM_ENCODED_ARRAY) {
+        // plain bool arrays are packed while they are read
+        uint32_t count = checkArray(reader, CM_TYPE_BOOL, 1);
+        if (reader->firstError != CM_ERROR_NONE)
+            return 0;
+        if (maxBits < count) {
+            reader->firstError = CM_ERROR_NO_SPACE;
+            return 0;
+        }
+        reader->readSize += 1 + sizeof(uint32_t);
+        packBools(&reader->message[reader->readSize], count, (uint8_t *) bits);
+        reader->readSize += count;
+        return count;
+    }
 
-uint32_t cmPeekStringLength(CompositeMessageReader *reader) {
-    uint32_t len = cmPeekArraySize(reader);
-    if (reader->firstError != CM_ERROR_NONE)
+    EncodedArrayHeader header;
+    uint32_t headerSize = checkEncodedHeader(reader, &header);
+    if (headerSize == 0)
         return 0;
-
-    uint8_t typeStored;
-    splitTypeFlag(reader->message[reader->readSize], &typeStored, NULL);
-    if (typeStored != CM_TYPE_CHAR || len == 0) {
+    if (header.codec != CM_CODEC_BITS ||
+        header.itemFlag != getTypeFlag(CM_TYPE_BOOL, 1) ||
+        header.payloadSize != ((uint64_t) header.itemCount + 7) / 8) {
         reader->firstError = CM_ERROR_NO_VALUE;
         return 0;
     }
+    if (!ensureAvailable(reader, headerSize + header.payloadSize))
+        return 0;
+    if (maxBits < header.itemCount) {
+        reader->firstError = CM_ERROR_NO_SPACE;
+        return 0;
+    }
 
-    return len - 1;
+    uint8_t *d = (uint8_t *) bits;
+    if (header.payloadSize != 0) {
+        memcpy(d, &reader->message[reader->readSize + headerSize], header.payloadSize);
+    }
+    if (header.itemCount % 8u != 0) {
+        d[header.payloadSize - 1] &= (uint8_t) ((1u << (header.itemCount % 8u)) - 1);
+    }
+    reader->readSize += headerSize + header.payloadSize;
+    return header.itemCount;
 }
 
-void cmWriteVersion(CompositeMessageWriter *writer, uint32_t ver) {
-    cmWriteU32(writer, ver);
-
-    if (writer->firstError == CM_ERROR_NONE) {
-        writer->buffer[writer->usedSize - sizeof(uint32_t) - 1] = CM_VERSION;
-    }
+void *cmReserveBytes(CompositeMessageWriter *writer, uint32_t size) {
+    if (!ensureSpace(writer, size))
+        return NULL;
+    return &writer->buffer[writer->usedSize];
 }
 
-uint32_t cmReadVersion(CompositeMessageReader *reader) {
-    if (!checkValue(reader, CM_VERSION, sizeof(uint32_t)))
-        return 0;
+void cmCommitBytes(CompositeMessageWriter *writer, uint32_t size) {
+    if (writer->firstError != CM_ERROR_NONE)
+        return;
+    if (size > writer->bufferSize - writer->usedSize) {
+        writer->firstError = CM_ERROR_INVALID_ARG;
+        return;
+    }
+    writer->usedSize += size;
+}
+
+void cmWriteBatch(CompositeMessageWriter *writer, const CMFieldDesc *desc,
+                  const void *base, uint32_t count) {
+    if (writer->firstError != CM_ERROR_NONE)
+        return;
+
+    const uint8_t *b = (const uint8_t *) base;
+    uint64_t size = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        if (getValueFlag(desc[i].type, desc[i].size) == 0) {
+            writer->firstError = CM_ERROR_INVALID_ARG;
+            return;
+        }
+        size += 1u + desc[i].size;
+    }
+
+    // varints have variable size and stream writer can't hold whole record,
+    // so such fields are written one by one
+    if (writer->compactIntegers ||
+        (writer->flush != NULL && size > writer->bufferSize)) {
+        for (uint32_t i = 0; i < count; ++i) {
+            writeValue(writer, (void *) &b[desc[i].offset], desc[i].size,
+                       desc[i].type);
+        }
+        return;
+    }
+
+    if (size > UINT32_MAX) {
+        writer->firstError = CM_ERROR_NO_SPACE;
+        return;
+    }
+    if (!ensureSpace(writer, (uint32_t) size))
+        return;
+
+    uint8_t *d = &writer->buffer[writer->usedSize];
+    for (uint32_t i = 0; i < count; ++i) {
+        *d = getTypeFlag(desc[i].type, desc[i].size);
+        memcpy(&d[1], &b[desc[i].offset], desc[i].size);
+        d += 1u + desc[i].size;
+    }
+    writer->usedSize += (uint32_t) size;
+}
+
+void cmWriteRecordTable(CompositeMessageWriter *writer, const CMFieldDesc *desc,
+                        uint8_t columnCount, const void *records,
+                        uint32_t stride, uint32_t recordCount) {
+    if (writer->firstError != CM_ERROR_NONE)
+        return;
+
+    uint8_t header[6 + UINT8_MAX];
+    header[0] = CM_RECORD_TABLE;
+    memcpy(&header[1], &recordCount, sizeof(recordCount));
+    header[5] = columnCount;
+    uint32_t recordSize = 0;
+    for (uint8_t i = 0; i < columnCount; ++i) {
+        header[6 + i] = getValueFlag(desc[i].type, desc[i].size);
+        if (header[6 + i] == 0) {
+            writer->firstError = CM_ERROR_INVALID_ARG;
+            return;
+        }
+        recordSize += desc[i].size;
+    }
+    if (columnCount == 0) {
+        writer->firstError = CM_ERROR_INVALID_ARG;
+        return;
+    }
+
+    uint32_t headerSize = 6u + columnCount;
+    uint64_t size = headerSize + (uint64_t) recordSize * recordCount;
+    if (size > UINT32_MAX) {
+        writer->firstError = CM_ERROR_NO_SPACE;
+        return;
+    }
+
+    const uint8_t *r = (const uint8_t *) records;
+    if (writer->flush != NULL && size > writer->bufferSize) {
+        // table doesn't fit in buffer of stream writer, so items are
+        // written one by one and buffer is flushed when it's full
+        writeBytes(writer, header, headerSize);
+        for (uint8_t i = 0; i < columnCount; ++i) {
+            for (uint32_t j = 0; j < recordCount; ++j) {
+                writeBytes(writer, &r[(size_t) j * stride + desc[i].offset],
+                           desc[i].size);
+            }
+        }
+        return;
+    }
+    if (!ensureSpace(writer, (uint32_t) size))
+        return;
+
+    uint8_t *d = &writer->buffer[writer->usedSize];
+    memcpy(d, header, headerSize);
+    d += headerSize;
+    for (uint8_t i = 0; i < columnCount; ++i) {
+        const uint8_t *src = &r[desc[i].offset];
+        uint8_t len = desc[i].size;
+        for (uint32_t j = 0; j < recordCount; ++j) {
+            memcpy(d, src, len);
+            d += len;
+            src += stride;
+        }
+    }
+    writer->usedSize += (uint32_t) size;
+}
+
+void cmSetCompactIntegers(CompositeMessageWriter *writer, bool enable) {
+    writer->compactIntegers = enable;
+}
+
+void cmSetAlignedArrays(CompositeMessageWriter *writer, bool enable) {
+    writer->alignArrays = enable;
+}
+
+void cmInitDictionary(CMDictionary *dictionary, CMDictionaryEntry *entries,
+                      uint32_t capacity, char *chars, uint32_t charsCapacity) {
+    dictionary->entries = entries;
+    // indexes are stored in a single byte
+    dictionary->capacity = capacity > UINT8_MAX + 1u ? UINT8_MAX + 1u : capacity;
+    dictionary->chars = chars;
+    dictionary->charsCapacity = charsCapacity;
+    cmResetDictionary(dictionary);
+}
+
+void cmResetDictionary(CMDictionary *dictionary) {
+    for (uint32_t i = 0; i < dictionary->capacity; ++i) {
+        dictionary->entries[i].defined = false;
+    }
+    dictionary->count = 0;
+    dictionary->charsUsed = 0;
+}
+
+void cmSetWriterDictionary(CompositeMessageWriter *writer,
+                           CMDictionary *dictionary) {
+    writer->dictionary = dictionary;
+}
+
+void cmSetReaderDictionary(CompositeMessageReader *reader,
+                           CMDictionary *dictionary) {
+    reader->dictionary = dictionary;
+    // endianness mark of stream may be not received yet
+    reader->dictionaryOffset = reader->readSize < 2 ? 2 : reader->readSize;
+}
+
+void cmUpdateDictionary(CompositeMessageReader *reader) {
+    updateDictionary(reader, reader->totalSize);
+}
+
+void cmFlush(CompositeMessageWriter *writer) {
+    if (writer->flush == NULL) {
+        writer->firstError = CM_ERROR_INVALID_ARG;
+        return;
+    }
+    if (writer->firstError != CM_ERROR_NONE)
+        return;
+    flushBuffer(writer);
+}
+
+void cmInitCountingWriter(CompositeMessageWriter *writer, void *buffer,
+                          uint32_t size) {
+    cmInitWriter(writer, buffer, size);
+    cmSetFlushCallback(writer, discardBytes, NULL);
+}
+
+uint32_t cmGetMessageSize(const CompositeMessageWriter *writer) {
+    return writer->flushedSize + writer->usedSize + writer->externalSize;
+}
+
+uint32_t cmFinishSegments(CompositeMessageWriter *writer) {
+    if (writer->segments == NULL) {
+        writer->firstError = CM_ERROR_INVALID_ARG;
+        return 0;
+    }
+    if (writer->firstError != CM_ERROR_NONE)
+        return 0;
+
+    addSegment(writer, &writer->buffer[writer->segmentStart],
+               writer->usedSize - writer->segmentStart);
+    writer->segmentStart = writer->usedSize;
+    return writer->segmentCount;
+}
+
+void *cmBeginArray(CompositeMessageWriter *writer, uint8_t itemType,
+                   uint8_t itemSize, uint32_t maxCount) {
+    if (writer->firstError != CM_ERROR_NONE)
+        return NULL;
+    uint8_t flag = getArrayFlag(itemType, itemSize);
+    if (flag == 0 || (itemType == CM_TYPE_CHAR && maxCount == UINT32_MAX)) {
+        writer->firstError = CM_ERROR_INVALID_ARG;
+        return NULL;
+    }
+    // space for null terminator is reserved in addition to maxCount chars
+    uint32_t reserved = itemType == CM_TYPE_CHAR ? maxCount + 1 : maxCount;
+    if (!writePadding(writer, itemSize) ||
+        !ensureArraySpace(writer, itemSize, reserved))
+        return NULL;
+
+    writer->arrayStart = writer->usedSize;
+    writer->arrayMaxCount = maxCount;
+    writer->arrayOpen = true;
+    writer->buffer[writer->usedSize] = flag;
+    writer->usedSize += 1 + sizeof(uint32_t);
+    void *data = &writer->buffer[writer->usedSize];
+    writer->usedSize += itemSize * reserved;
+    return data;
+}
+
+void cmCommitArray(CompositeMessageWriter *writer, uint32_t itemCount) {
+    uint32_t start = writer->arrayStart;
+    bool open = writer->arrayOpen;
+    writer->arrayStart = 0;
+    writer->arrayOpen = false;
+    if (writer->firstError != CM_ERROR_NONE)
+        return;
+    if (!open || itemCount > writer->arrayMaxCount) {
+        writer->firstError = CM_ERROR_INVALID_ARG;
+        return;
+    }
+
+    uint8_t itemType, itemSize;
+    splitTypeFlag(writer->buffer[start], &itemType, &itemSize);
+
+    uint32_t storedCount = itemType == CM_TYPE_CHAR ? itemCount + 1 : itemCount;
+    memcpy(&writer->buffer[start + 1], &storedCount, sizeof(uint32_t));
+    writer->usedSize = start + 1 + sizeof(uint32_t) + itemSize * itemCount;
+    if (itemType == CM_TYPE_CHAR) {
+        writer->buffer[writer->usedSize] = 0x00;
+        ++writer->usedSize;
+    }
+}
+
+void cmInitStreamReader(CompositeMessageReader *reader, void *buffer,
+                        uint32_t capacity) {
+    reader->message = (const uint8_t *) buffer;
+    reader->totalSize = 0;
+    reader->readSize = 0;
+    reader->firstError = CM_ERROR_NEED_MORE;
+    reader->swapBytes = false;
+    reader->capacity = capacity;
+    reader->fieldSlots = NULL;
+    reader->fieldSlotCount = 0;
+    reader->converted = false;
+    reader->crc = CRC32_INIT;
+    reader->crcOffset = 2;
+    reader->trusted = false;
+    reader->dictionary = NULL;
+    reader->dictionaryOffset = 0;
+    reader->profileStats = NULL;
+    if (capacity < 2) {
+        reader->firstError = CM_ERROR_NO_SPACE;
+    }
+}
+
+uint32_t cmFeed(CompositeMessageReader *reader, const void *data,
+                uint32_t size) {
+    if (reader->capacity == 0) {
+        reader->firstError = CM_ERROR_INVALID_ARG;
+        return 0;
+    }
+    if (reader->firstError != CM_ERROR_NONE &&
+        reader->firstError != CM_ERROR_NEED_MORE)
+        return 0;
+
+    // buffer is owned by stream reader, so it's safe to modify it
+    uint8_t *m = (uint8_t *) reader->message;
+    compactStream(reader, size);
+
+    uint32_t accepted = reader->capacity - reader->totalSize;
+    if (accepted > size) {
+        accepted = size;
+    }
+    if (accepted == 0 && size > 0 && reader->firstError == CM_ERROR_NEED_MORE) {
+        // current element is larger than buffer, so it will never complete
+        reader->firstError = CM_ERROR_NO_SPACE;
+        return 0;
+    }
+    memcpy(&m[reader->totalSize], data, accepted);
+    reader->totalSize += accepted;
+
+    if (reader->readSize == 0 && reader->totalSize >= 2) {
+        uint16_t e;
+        memcpy(&e, m, sizeof(e));
+        if (e != ENDIAN_MARK && e != ENDIAN_INV_MARK) {
+            reader->firstError = CM_ERROR_NO_ENDIAN;
+            return accepted;
+        }
+        reader->swapBytes = e != ENDIAN_MARK;
+        reader->readSize = 2;
+    }
+    if (reader->readSize != 0 && reader->firstError == CM_ERROR_NEED_MORE) {
+        // failed read can be repeated now
+        reader->firstError = CM_ERROR_NONE;
+    }
+
+    return accepted;
+}
+
+uint32_t cmReadTypedArray(CompositeMessageReader *reader, uint8_t itemType,
+                          uint8_t itemSize, void *buffer, uint32_t maxItems) {
+    if (reader->firstError == CM_ERROR_NONE &&
+        reader->readSize < reader->totalSize &&
+        reader->message[reader->readSize] == CM_ENCODED_ARRAY) {
+        return readEncodedArray(reader, itemType, itemSize, buffer, maxItems);
+    }
+    if (itemType == CM_TYPE_CHAR && itemSize == 1 && isDictionaryString(reader)) {
+        uint8_t length;
+        uint32_t offset = reader->readSize;
+        const char *str = readDictionaryString(reader, &length, true);
+        if (str == NULL)
+            return 0;
+        if (maxItems < length + 1u) {
+            reader->readSize = offset;
+            reader->firstError = CM_ERROR_NO_SPACE;
+            return 0;
+        }
+        // null terminator is counted as in regular strings
+        memcpy(buffer, str, length + 1u);
+        return length + 1u;
+    }
+
+    uint32_t arraySize = checkArray(reader, itemType, itemSize);
+
+    if (reader->firstError != CM_ERROR_NONE) {
+        return 0;
+    }
+
+    if (maxItems < arraySize) {
+        reader->firstError = CM_ERROR_NO_SPACE;
+        return 0;
+    }
+
+    reader->readSize += 1 + sizeof(uint32_t);
+    memcpy(buffer, &reader->message[reader->readSize], arraySize * itemSize);
+    reader->readSize += arraySize * itemSize;
+
+    if (reader->swapBytes) {
+        inverseArrayByteOrder(buffer, itemSize, arraySize);
+    }
+
+    return arraySize;
+}
+
+uint32_t cmReadArrayView(CompositeMessageReader *reader, uint8_t itemType,
+                         uint8_t itemSize, const void **data) {
+    *data = NULL;
+    uint32_t arraySize = checkArray(reader, itemType, itemSize);
+
+    if (reader->firstError != CM_ERROR_NONE) {
+        return 0;
+    }
+
+    // items can't be swapped in place when message must not be modified
+    if (reader->swapBytes && itemSize > 1) {
+        reader->firstError = CM_ERROR_NO_ENDIAN;
+        return 0;
+    }
+
+    reader->readSize += 1 + sizeof(uint32_t);
+    *data = &reader->message[reader->readSize];
+    reader->readSize += arraySize * itemSize;
+
+    return arraySize;
+}
+
+bool cmReadBatch(CompositeMessageReader *reader, const CMFieldDesc *desc,
+                 void *base, uint32_t count) {
+    if (reader->firstError != CM_ERROR_NONE)
+        return false;
+
+    uint8_t *b = (uint8_t *) base;
+    uint32_t start = reader->readSize;
+    uint32_t available = reader->totalSize - start;
+    const uint8_t *m = &reader->message[start];
+    uint32_t offset = 0;
+    uint32_t i = 0;
+    // fields with fixed size are copied while whole field is available,
+    // so each field needs only a check of its flag
+    for (; i < count; ++i) {
+        uint8_t len = desc[i].size;
+        uint8_t flag = getValueFlag(desc[i].type, len);
+        if (flag == 0) {
+            reader->firstError = CM_ERROR_INVALID_ARG;
+            return false;
+        }
+        if (available - offset < 1u + len || m[offset] != flag)
+            break;
+        memcpy(&b[desc[i].offset], &m[offset + 1], len);
+        if (reader->swapBytes) {
+            inverseByteOrder(&b[desc[i].offset], len);
+        }
+        offset += 1u + len;
+    }
+    reader->readSize += offset;
+
+    // the rest (varints, partially received or missing fields) is read
+    // with checks of regular reads
+    for (; i < count; ++i) {
+        if (!readValue(reader, &b[desc[i].offset], desc[i].size, desc[i].type))
+            break;
+    }
+
+    if (reader->firstError != CM_ERROR_NONE) {
+        reader->readSize = start;
+        return false;
+    }
+    return true;
+}
+
+uint32_t cmPeekRecordCount(CompositeMessageReader *reader) {
+    uint32_t recordCount;
+    if (checkRecordTable(reader, &recordCount) == NULL)
+        return 0;
+    return recordCount;
+}
+
+uint32_t cmReadRecordTable(CompositeMessageReader *reader, const CMFieldDesc *desc,
+                           uint8_t columnCount, void *records, uint32_t stride,
+                           uint32_t maxRecords) {
+    uint32_t recordCount;
+    const uint8_t *columns = checkRecordTable(reader, &recordCount);
+    if (columns == NULL)
+        return 0;
+
+    if (columns[0] != columnCount) {
+        reader->firstError = CM_ERROR_NO_VALUE;
+        return 0;
+    }
+    uint32_t recordSize = 0;
+    for (uint8_t i = 0; i < columnCount; ++i) {
+        uint8_t flag = getValueFlag(desc[i].type, desc[i].size);
+        if (flag == 0) {
+            reader->firstError = CM_ERROR_INVALID_ARG;
+            return 0;
+        }
+        if (columns[1 + i] != flag) {
+            reader->firstError = CM_ERROR_NO_VALUE;
+            return 0;
+        }
+        recordSize += desc[i].size;
+    }
+    if (maxRecords < recordCount) {
+        reader->firstError = CM_ERROR_NO_SPACE;
+        return 0;
+    }
+
+    uint8_t *r = (uint8_t *) records;
+    const uint8_t *src = &columns[1 + columnCount];
+    for (uint8_t i = 0; i < columnCount; ++i) {
+        uint8_t *dst = &r[desc[i].offset];
+        uint8_t len = desc[i].size;
+        for (uint32_t j = 0; j < recordCount; ++j) {
+            memcpy(dst, src, len);
+            if (reader->swapBytes) {
+                inverseByteOrder(dst, len);
+            }
+            dst += stride;
+            src += len;
+        }
+    }
+    reader->readSize += 6u + columnCount + recordSize * recordCount;
+    return recordCount;
+}
+
+uint32_t cmReadColumn(CompositeMessageReader *reader, uint8_t column,
+                      uint8_t itemType, uint8_t itemSize, void *buffer,
+                      uint32_t maxItems) {
+    uint32_t recordCount;
+    const uint8_t *columns = checkRecordTable(reader, &recordCount);
+    if (columns == NULL)
+        return 0;
+
+    uint8_t flag = getValueFlag(itemType, itemSize);
+    if (flag == 0) {
+        reader->firstError = CM_ERROR_INVALID_ARG;
+        return 0;
+    }
+    uint8_t columnCount = columns[0];
+    if (column >= columnCount || columns[1 + column] != flag) {
+        reader->firstError = CM_ERROR_NO_VALUE;
+        return 0;
+    }
+    if (maxItems < recordCount) {
+        reader->firstError = CM_ERROR_NO_SPACE;
+        return 0;
+    }
+
+    // items of previous columns precede the column
+    const uint8_t *src = &columns[1 + columnCount];
+    for (uint8_t i = 0; i < column; ++i) {
+        src += flagInfo[columns[1 + i]].itemSize * recordCount;
+    }
+    memcpy(buffer, src, itemSize * recordCount);
+    if (reader->swapBytes) {
+        inverseArrayByteOrder(buffer, itemSize, recordCount);
+    }
+    return recordCount;
+}
+
+uint32_t cmReadStringView(CompositeMessageReader *reader, const char **str) {
+    if (isDictionaryString(reader)) {
+        uint8_t length = 0;
+        *str = readDictionaryString(reader, &length, true);
+        return length;
+    }
+
+    const void *data;
+    uint32_t size = cmReadArrayView(reader, CM_TYPE_CHAR, 1, &data);
+    *str = (const char *) data;
+
+    if (reader->firstError != CM_ERROR_NONE) {
+        return 0;
+    }
+    if (size == 0 || str[0][size - 1] != '\0') {
+        // string without null terminator can't be used as C string
+        reader->readSize -= 1 + sizeof(uint32_t) + size;
+        reader->firstError = CM_ERROR_NO_VALUE;
+        *str = NULL;
+        return 0;
+    }
+
+    return size - 1;
+}
+
+uint32_t cmPeekArraySize(CompositeMessageReader *reader) {
+    if (reader->firstError != CM_ERROR_NONE)
+        return 0;
+
+    // padding is written only before arrays, so it's skipped only here
+    skipPadding(reader);
+    if (!ensureAvailable(reader, 1))
+        return 0;
+
+    if (reader->message[reader->readSize] == CM_ENCODED_ARRAY) {
+        EncodedArrayHeader header;
+        if (checkEncodedHeader(reader, &header) == 0)
+            return 0;
+        return header.itemCount;
+    }
+
+    if (!isArray(reader->message[reader->readSize])) {
+        reader->firstError = CM_ERROR_NO_VALUE;
+        return 0;
+    }
+
+    if (!ensureAvailable(reader, 1 + sizeof(uint32_t)))
+        return 0;
+
+    return readU32(reader, reader->readSize + 1);
+}
+
+uint32_t cmPeekStringLength(CompositeMessageReader *reader) {
+    if (isDictionaryString(reader)) {
+        uint8_t length = 0;
+        readDictionaryString(reader, &length, false);
+        return length;
+    }
+
+    uint32_t len = cmPeekArraySize(reader);
+    if (reader->firstError != CM_ERROR_NONE)
+        return 0;
+
+    uint8_t typeStored;
+    splitTypeFlag(reader->message[reader->readSize], &typeStored, NULL);
+    if (typeStored != CM_TYPE_CHAR || len == 0) {
+        reader->firstError = CM_ERROR_NO_VALUE;
+        return 0;
+    }
+
+    return len - 1;
+}
+
+void cmWriteVersion(CompositeMessageWriter *writer, uint32_t ver) {
+    // version always has fixed size, even if integers are compact
+    if (!ensureSpace(writer, 1 + sizeof(uint32_t)))
+        return;
+
+    writer->buffer[writer->usedSize] = CM_VERSION;
+    writer->usedSize++;
+    writeBytes(writer, &ver, sizeof(ver));
+}
+
+uint32_t cmReadVersion(CompositeMessageReader *reader) {
+    if (!checkValue(reader, CM_VERSION, sizeof(uint32_t)))
+        return 0;
+
+    uint32_t i = readU32(reader, reader->readSize + 1);
+
+    reader->readSize += 1 + sizeof(uint32_t);
+    return i;
+}
+
+void cmWriteName(CompositeMessageWriter *writer, const char *name) {
+    size_t length = strlen(name);
+    if (length > UINT8_MAX) {
+        if (writer->firstError == CM_ERROR_NONE)
+            writer->firstError = CM_ERROR_INVALID_ARG;
+        return;
+    }
+    if (writer->dictionary != NULL &&
+        writeDictionaryString(writer, CM_NAME_DEFINITION, name, (uint8_t) length))
+        return;
+    // flag, length, chars and null terminator
+    if (!ensureSpace(writer, 2 + (uint32_t) length + 1))
+        return;
+
+    uint8_t header[2] = {CM_NAME, (uint8_t) length};
+    writeBytes(writer, header, sizeof(header));
+    writeBytes(writer, name, (uint32_t) length + 1);
+}
+
+uint8_t cmReadNameView(CompositeMessageReader *reader, const char **name) {
+    *name = NULL;
+    if (reader->firstError != CM_ERROR_NONE || !ensureAvailable(reader, 1))
+        return 0;
+    if (!isName(reader->message[reader->readSize])) {
+        reader->firstError = CM_ERROR_NO_VALUE;
+        return 0;
+    }
+
+    // name takes at most 259 bytes
+    uint32_t size = (uint32_t) getElementSize(reader, reader->readSize);
+    if (!ensureAvailable(reader, size))
+        return 0;
+
+    uint8_t length;
+    *name = getStringAt(reader, reader->readSize, &length);
+    if (*name == NULL) {
+        reader->firstError = CM_ERROR_NO_VALUE;
+        return 0;
+    }
+    reader->readSize += size;
+    return length;
+}
+
+uint8_t cmReadName(CompositeMessageReader *reader, char *buffer,
+                   uint32_t bufferSize) {
+    uint32_t offset = reader->readSize;
+    const char *name;
+    uint8_t length = cmReadNameView(reader, &name);
+    if (reader->firstError != CM_ERROR_NONE)
+        return 0;
+
+    if (bufferSize < length + 1u) {
+        reader->readSize = offset;
+        reader->firstError = CM_ERROR_NO_SPACE;
+        return 0;
+    }
+    memcpy(buffer, name, length);
+    buffer[length] = '\0';
+    return length;
+}
+
+void cmWriteBlockStart(CompositeMessageWriter *writer) {
+    writeFlag(writer, CM_BLOCK_START);
+}
+
+void cmReadBlockStart(CompositeMessageReader *reader) {
+    readFlag(reader, CM_BLOCK_START);
+}
+
+void cmWriteBlockEnd(CompositeMessageWriter *writer) {
+    writeFlag(writer, CM_BLOCK_END);
+}
+
+void cmReadBlockEnd(CompositeMessageReader *reader) {
+    readFlag(reader, CM_BLOCK_END);
+}
+
+void cmWriteMetadataStart(CompositeMessageWriter *writer) {
+    writeFlag(writer, CM_METADATA_START);
+}
+
+void cmReadMetadataStart(CompositeMessageReader *reader) {
+    readFlag(reader, CM_METADATA_START);
+}
+
+void cmWriteMetadataEnd(CompositeMessageWriter *writer) {
+    writeFlag(writer, CM_METADATA_END);
+}
+
+void cmReadMetadataEnd(CompositeMessageReader *reader) {
+    readFlag(reader, CM_METADATA_END);
+}
+
+void cmWriteMarker(CompositeMessageWriter *writer, const void *marker,
+                   uint8_t size) {
+    if (!ensureSpace(writer, 2u + size))
+        return;
+
+    uint8_t header[2] = {CM_MARKER, size};
+    writeBytes(writer, header, sizeof(header));
+    writeBytes(writer, marker, size);
+}
+
+uint8_t cmReadMarker(CompositeMessageReader *reader, void *buffer,
+                     uint8_t maxSize) {
+    if (!checkValue(reader, CM_MARKER, 1))
+        return 0;
+
+    uint8_t size = reader->message[reader->readSize + 1];
+    if (!ensureAvailable(reader, 2u + size))
+        return 0;
+    if (maxSize < size) {
+        reader->firstError = CM_ERROR_NO_SPACE;
+        return 0;
+    }
+
+    memcpy(buffer, &reader->message[reader->readSize + 2], size);
+    reader->readSize += 2u + size;
+    return size;
+}
+
+void cmIndexFields(CompositeMessageReader *reader, CMFieldSlot *slots,
+                   uint32_t slotCount) {
+    reader->fieldSlots = NULL;
+    reader->fieldSlotCount = 0;
+    if (reader->firstError != CM_ERROR_NONE)
+        return;
+    if (slots == NULL || slotCount == 0 || (slotCount & (slotCount - 1)) != 0) {
+        reader->firstError = CM_ERROR_INVALID_ARG;
+        return;
+    }
+    memset(slots, 0, slotCount * sizeof(CMFieldSlot));
+
+    uint32_t mask = slotCount - 1;
+    uint32_t used = 0;
+    uint32_t depth = 0;
+    uint32_t offset = reader->readSize;
+    while (offset < reader->totalSize) {
+        uint8_t flag = reader->message[offset];
+        if (flag == CM_BLOCK_END || flag == CM_METADATA_END) {
+            if (depth == 0)
+                break;
+            --depth;
+        } else if (flag == CM_BLOCK_START || flag == CM_METADATA_START) {
+            ++depth;
+        }
+
+        uint64_t size = getElementSize(reader, offset);
+        if (size == 0 || size > reader->totalSize - offset) {
+            reader->firstError = CM_ERROR_NO_VALUE;
+            return;
+        }
+
+        if (isName(flag) && depth == 0) {
+            if (used == slotCount) {
+                reader->firstError = CM_ERROR_NO_SPACE;
+                return;
+            }
+            uint8_t length;
+            const char *name = getStringAt(reader, offset, &length);
+            if (name == NULL) {
+                reader->firstError = CM_ERROR_NO_VALUE;
+                return;
+            }
+            uint32_t hash = hashBytes(name, length);
+            uint32_t slot = hash & mask;
+            while (slots[slot].offset != 0) {
+                slot = (slot + 1) & mask;
+            }
+            slots[slot].hash = hash;
+            slots[slot].offset = offset;
+            ++used;
+        }
+        offset += (uint32_t) size;
+    }
+
+    reader->fieldSlots = slots;
+    reader->fieldSlotCount = slotCount;
+}
+
+bool cmFindField(CompositeMessageReader *reader, const char *name) {
+    if (reader->firstError != CM_ERROR_NONE)
+        return false;
+    if (reader->fieldSlots == NULL) {
+        reader->firstError = CM_ERROR_INVALID_ARG;
+        return false;
+    }
+
+    size_t length = strlen(name);
+    if (length > UINT8_MAX)
+        return false;
+    uint32_t hash = hashBytes(name, (uint32_t) length);
+    uint32_t mask = reader->fieldSlotCount - 1;
+    uint32_t slot = hash & mask;
+    for (uint32_t i = 0; i < reader->fieldSlotCount; ++i) {
+        const CMFieldSlot *s = &reader->fieldSlots[slot];
+        if (s->offset == 0)
+            break;
+        uint8_t storedLength = 0;
+        const char *stored = s->hash == hash ?
+                             getStringAt(reader, s->offset, &storedLength) : NULL;
+        if (stored != NULL && storedLength == length &&
+            memcmp(stored, name, length) == 0) {
+            // position reader at value that follows the name
+            reader->readSize = s->offset + (uint32_t) getElementSize(reader, s->offset);
+            return true;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return false;
+}
+
+void cmSkip(CompositeMessageReader *reader) {
+    if (reader->firstError != CM_ERROR_NONE)
+        return;
+
+    uint32_t size = getFieldSize(reader);
+    reader->readSize += size;
+}
+
+void cmSkipN(CompositeMessageReader *reader, uint32_t count) {
+    for (uint32_t i = 0; i < count && reader->firstError == CM_ERROR_NONE; ++i) {
+        cmSkip(reader);
+    }
+}
+
+uint32_t cmTell(const CompositeMessageReader *reader) {
+    return reader->readSize;
+}
+
+void cmSeek(CompositeMessageReader *reader, uint32_t offset) {
+    if (reader->firstError != CM_ERROR_NONE)
+        return;
+    if (offset < 2 || offset > reader->totalSize) {
+        reader->firstError = CM_ERROR_INVALID_ARG;
+        return;
+    }
+    reader->readSize = offset;
+}
+
+void cmEnableCrc32(CompositeMessageWriter *writer) {
+    if (writer->firstError != CM_ERROR_NONE)
+        return;
+    if (writer->flushedSize != 0 || writer->segmentCount != 0) {
+        // some bytes already left writer without being hashed
+        writer->firstError = CM_ERROR_INVALID_ARG;
+        return;
+    }
+    writer->crcEnabled = true;
+    writer->crc = CRC32_INIT;
+    writer->crcOffset = 2;
+}
+
+void cmWriteCrc32(CompositeMessageWriter *writer) {
+    if (!writer->crcEnabled) {
+        if (writer->firstError == CM_ERROR_NONE)
+            writer->firstError = CM_ERROR_INVALID_ARG;
+        return;
+    }
+    if (writer->messageStart != 0) {
+        if (writer->firstError == CM_ERROR_NONE)
+            writer->firstError = CM_ERROR_INVALID_ARG;
+        return;
+    }
+    if (!ensureSpace(writer, 1 + sizeof(uint32_t)))
+        return;
+
+    // written CRC element will be hashed as part of the next CRC
+    updateWriterCrc(writer);
+    uint32_t crc = ~writer->crc;
+    writer->buffer[writer->usedSize] = CM_CRC32;
+    writer->usedSize++;
+    writeBytes(writer, &crc, sizeof(crc));
+}
+
+bool cmVerifyCrc32(CompositeMessageReader *reader) {
+    if (!checkValue(reader, CM_CRC32, sizeof(uint32_t)))
+        return false;
+
+    if (reader->crcOffset > reader->readSize) {
+        // reader was moved back, so CRC starts from the beginning
+        reader->crc = CRC32_INIT;
+        reader->crcOffset = 2;
+    }
+    updateReaderCrc(reader, reader->readSize);
+
+    if (readU32(reader, reader->readSize + 1) != ~reader->crc) {
+        reader->firstError = CM_ERROR_CRC;
+        return false;
+    }
+    reader->readSize += 1 + sizeof(uint32_t);
+    return true;
+}
+
+void cmBeginMessage(CompositeMessageWriter *writer) {
+    if (writer->firstError != CM_ERROR_NONE)
+        return;
+    if (writer->messageStart != 0 ||
+        (writer->flush != NULL && writer->flush != discardBytes)) {
+        writer->firstError = CM_ERROR_INVALID_ARG;
+        return;
+    }
+    if (!ensureSpace(writer, 1 + sizeof(uint32_t)))
+        return;
+
+    // size is stored when message is finished
+    uint32_t size = 0;
+    writer->buffer[writer->usedSize] = CM_MESSAGE;
+    writer->usedSize++;
+    writer->messageStart = writer->usedSize;
+    writeBytes(writer, &size, sizeof(size));
+    writer->messageOffset = cmGetMessageSize(writer);
+}
+
+void cmEndMessage(CompositeMessageWriter *writer) {
+    if (writer->firstError != CM_ERROR_NONE)
+        return;
+    if (writer->messageStart == 0 || writer->arrayOpen) {
+        writer->firstError = CM_ERROR_INVALID_ARG;
+        return;
+    }
+
+    uint32_t size = cmGetMessageSize(writer) - writer->messageOffset;
+    // counting writer doesn't keep bytes, so there is nothing to patch
+    if (writer->flush == NULL) {
+        memcpy(&writer->buffer[writer->messageStart], &size, sizeof(size));
+    }
+    writer->messageStart = 0;
+}
+
+void cmWriteMessage(CompositeMessageWriter *writer, const void *message,
+                    uint32_t size) {
+    if (writer->firstError != CM_ERROR_NONE)
+        return;
+    uint16_t e = 0;
+    if (size >= 2) {
+        memcpy(&e, message, sizeof(e));
+    }
+    if (e != ENDIAN_MARK) {
+        writer->firstError = CM_ERROR_INVALID_ARG;
+        return;
+    }
+
+    // in stream mode only header must fit in buffer
+    uint32_t bodySize = size - 2;
+    uint64_t required = 1 + sizeof(uint32_t) + (writer->flush != NULL ? 0 : (uint64_t) bodySize);
+    if (required > UINT32_MAX) {
+        writer->firstError = CM_ERROR_NO_SPACE;
+        return;
+    }
+    if (!ensureSpace(writer, (uint32_t) required))
+        return;
+
+    writer->buffer[writer->usedSize] = CM_MESSAGE;
+    writer->usedSize++;
+    writeBytes(writer, &bodySize, sizeof(bodySize));
+    writeBytes(writer, (const uint8_t *) message + 2, bodySize);
+}
+
+bool cmReadMessage(CompositeMessageReader *reader,
+                   CompositeMessageReader *message) {
+    if (!checkValue(reader, CM_MESSAGE, sizeof(uint32_t)))
+        return false;
+
+    uint32_t size = readU32(reader, reader->readSize + 1);
+    if (size > UINT32_MAX - 1 - sizeof(uint32_t)) {
+        reader->firstError = CM_ERROR_NO_VALUE;
+        return false;
+    }
+    if (!ensureAvailable(reader, 1 + sizeof(uint32_t) + size))
+        return false;
+
+    // embedded message doesn't have endianness mark, so its reader starts
+    // 2 bytes before its first element, as any other reader
+    uint32_t start = reader->readSize + 1 + sizeof(uint32_t) - 2;
+    message->message = &reader->message[start];
+    message->totalSize = size + 2;
+    message->readSize = 2;
+    message->firstError = CM_ERROR_NONE;
+    message->swapBytes = reader->swapBytes;
+    message->capacity = 0;
+    message->fieldSlots = NULL;
+    message->fieldSlotCount = 0;
+    message->converted = reader->converted;
+    message->crc = CRC32_INIT;
+    message->crcOffset = 2;
+    message->trusted = false;
+    message->dictionary = reader->dictionary;
+    message->dictionaryOffset = 2;
+    message->profileStats = reader->profileStats;
+
+    reader->readSize += 1 + sizeof(uint32_t) + size;
+    return true;
+}
+
+void cmInitLz4Compressor(CMCompressor *compressor, CMLz4WorkBuffer *work,
+                         uint32_t blockSize) {
+    compressor->codec = CM_COMPRESSION_LZ4;
+    compressor->blockSize = blockSize > UINT16_MAX ? UINT16_MAX : blockSize;
+    compressor->compress = work != NULL ? lz4Compress : NULL;
+    compressor->decompress = lz4Decompress;
+    compressor->context = work;
+}
+
+void cmWriteCompressed(CompositeMessageWriter *writer,
+                       const CMCompressor *compressor, const void *message,
+                       uint32_t size) {
+    if (writer->firstError != CM_ERROR_NONE)
+        return;
+    uint16_t e = 0;
+    if (size >= 2) {
+        memcpy(&e, message, sizeof(e));
+    }
+    if (e != ENDIAN_MARK) {
+        writer->firstError = CM_ERROR_INVALID_ARG;
+        return;
+    }
+    writeCompressedBlocks(writer, compressor, (const uint8_t *) message + 2,
+                          size - 2);
+}
+
+bool cmFlushCompressed(void *context, const void *data, uint32_t size) {
+    CMCompressingStream *stream = (CMCompressingStream *) context;
+    const uint8_t *d = (const uint8_t *) data;
+    // stream writer begins with its own endianness mark
+    while (stream->markSkipped < 2 && size > 0) {
+        ++stream->markSkipped;
+        ++d;
+        --size;
+    }
+    writeCompressedBlocks(stream->output, stream->compressor, d, size);
+    return stream->output->firstError == CM_ERROR_NONE;
+}
+
+uint32_t cmDecompress(CompositeMessageReader *reader,
+                      const CMCompressor *compressor,
+                      CompositeMessageReader *output) {
+    if (reader->firstError != CM_ERROR_NONE)
+        return 0;
+    if (output->capacity == 0) {
+        reader->firstError = CM_ERROR_INVALID_ARG;
+        return 0;
+    }
+    if (!ensureAvailable(reader, 1))
+        return 0;
+    if (reader->message[reader->readSize] != CM_COMPRESSED) {
+        reader->firstError = CM_ERROR_NO_VALUE;
+        return 0;
+    }
+    uint64_t size = getElementSize(reader, reader->readSize);
+    if (size > UINT32_MAX) {
+        reader->firstError = CM_ERROR_NO_VALUE;
+        return 0;
+    }
+    if (!ensureAvailable(reader, (uint32_t) size))
+        return 0;
+
+    const uint8_t *element = &reader->message[reader->readSize];
+    uint32_t bodySize = (uint32_t) size - 1 - (uint32_t) sizeof(uint32_t);
+    uint8_t codec = bodySize > 0 ? element[1 + sizeof(uint32_t)] : 0;
+    uint64_t rawSize = 0;
+    uint32_t varintSize = bodySize > 1 ?
+                          decodeVarint(&element[2 + sizeof(uint32_t)], bodySize - 1, &rawSize) : 0;
+    uint32_t compressedSize = bodySize - 1 - varintSize;
+    if (varintSize == 0 || rawSize > UINT32_MAX ||
+        (codec == CM_COMPRESSION_STORED && compressedSize != rawSize)) {
+        reader->firstError = CM_ERROR_MALFORMED;
+        return 0;
+    }
+    if (codec != CM_COMPRESSION_STORED &&
+        (codec != compressor->codec || compressor->decompress == NULL)) {
+        reader->firstError = CM_ERROR_INVALID_ARG;
+        return 0;
+    }
+
+    if (output->totalSize == 0) {
+        // decompressed elements have endianness of compressed message
+        uint16_t mark = reader->swapBytes || reader->converted ?
+                        ENDIAN_INV_MARK : ENDIAN_MARK;
+        cmFeed(output, &mark, sizeof(mark));
+    }
+    compactStream(output, (uint32_t) rawSize);
+    if (output->capacity - output->totalSize < rawSize) {
+        if (output->capacity - 2 < rawSize) {
+            reader->firstError = CM_ERROR_NO_SPACE;
+        }
+        return 0;
+    }
+
+    const uint8_t *compressed = &element[2 + sizeof(uint32_t) + varintSize];
+    uint8_t *m = (uint8_t *) &output->message[output->totalSize];
+    if (codec == CM_COMPRESSION_STORED) {
+        memcpy(m, compressed, (uint32_t) rawSize);
+    } else if (!compressor->decompress(compressor->context, compressed,
+                                       compressedSize, m, (uint32_t) rawSize)) {
+        reader->firstError = CM_ERROR_MALFORMED;
+        return 0;
+    }
+    output->totalSize += (uint32_t) rawSize;
+    if (output->readSize != 0 && output->firstError == CM_ERROR_NEED_MORE) {
+        // failed read can be repeated now
+        output->firstError = CM_ERROR_NONE;
+    }
+    reader->readSize += (uint32_t) size;
+    return (uint32_t) rawSize;
+}
+
+bool cmValidate(CompositeMessageReader *reader) {
+    if (reader->firstError != CM_ERROR_NONE)
+        return false;
+    if (reader->capacity != 0) {
+        // stream reader doesn't hold whole message
+        reader->firstError = CM_ERROR_INVALID_ARG;
+        return false;
+    }
+
+    const uint8_t *m = reader->message;
+    uint32_t offset = reader->readSize;
+    uint32_t depth = 0;
+    while (offset < reader->totalSize) {
+        uint8_t flag = m[offset];
+        // body of embedded message is a single element of outer message
+        uint64_t size = getElementSize(reader, offset);
+        if (size == 0 || size > reader->totalSize - offset)
+            break;
+
+        if (flag == CM_BLOCK_START) {
+            ++depth;
+        } else if (flag == CM_BLOCK_END) {
+            if (depth == 0)
+                break;
+            --depth;
+        } else if ((isName(flag) || flag == CM_STRING_DEFINITION) &&
+                   flag != CM_NAME_REFERENCE && m[offset + size - 1] != 0) {
+            break;
+        }
+        offset += (uint32_t) size;
+    }
+
+    if (offset != reader->totalSize || depth != 0) {
+        reader->firstError = CM_ERROR_MALFORMED;
+        return false;
+    }
+    // unchecked reads don't swap bytes of values
+    reader->trusted = !reader->swapBytes;
+    return true;
+}
+
+uint32_t cmBuildIndex(CompositeMessageReader *reader, CMIndexEntry *table,
+                      uint32_t maxEntries) {
+    if (reader->firstError != CM_ERROR_NONE)
+        return 0;
+
+    uint32_t count = 0;
+    uint32_t offset = reader->readSize;
+    while (offset < reader->totalSize) {
+        uint64_t size = getElementSize(reader, offset);
+        if (size == 0) {
+            reader->firstError = CM_ERROR_NO_VALUE;
+            return 0;
+        }
+        if (size > reader->totalSize - offset) {
+            // in stream mode rest of element may be fed later
+            reader->firstError = reader->capacity != 0 ? CM_ERROR_NEED_MORE :
+                                 CM_ERROR_NO_VALUE;
+            return 0;
+        }
+        // padding is not an entry, entry of array points right to its flag
+        if (reader->message[offset] == CM_PADDING) {
+            ++offset;
+            continue;
+        }
+        if (count == maxEntries) {
+            reader->firstError = CM_ERROR_NO_SPACE;
+            return 0;
+        }
+        table[count].offset = offset;
+        table[count].size = (uint32_t) size;
+        table[count].flag = reader->message[offset];
+        ++count;
+        offset += (uint32_t) size;
+    }
+    return count;
+}
+
+int8_t cmReadI8At(CompositeMessageReader *reader, const CMIndexEntry *table,
+                  uint32_t i) {
+    int8_t val = 0;
+    readValueAt(reader, &table[i], &val, sizeof(val), CM_TYPE_INT);
+    return val;
+}
+
+uint8_t cmReadU8At(CompositeMessageReader *reader, const CMIndexEntry *table,
+                   uint32_t i) {
+    uint8_t val = 0;
+    readValueAt(reader, &table[i], &val, sizeof(val), CM_TYPE_UINT);
+    return val;
+}
+
+int16_t cmReadI16At(CompositeMessageReader *reader, const CMIndexEntry *table,
+                    uint32_t i) {
+    int16_t val = 0;
+    readValueAt(reader, &table[i], &val, sizeof(val), CM_TYPE_INT);
+    return val;
+}
+
+uint16_t cmReadU16At(CompositeMessageReader *reader, const CMIndexEntry *table,
+                     uint32_t i) {
+    uint16_t val = 0;
+    readValueAt(reader, &table[i], &val, sizeof(val), CM_TYPE_UINT);
+    return val;
+}
+
+int32_t cmReadI32At(CompositeMessageReader *reader, const CMIndexEntry *table,
+                    uint32_t i) {
+    int32_t val = 0;
+    readValueAt(reader, &table[i], &val, sizeof(val), CM_TYPE_INT);
+    return val;
+}
+
+uint32_t cmReadU32At(CompositeMessageReader *reader, const CMIndexEntry *table,
+                     uint32_t i) {
+    uint32_t val = 0;
+    readValueAt(reader, &table[i], &val, sizeof(val), CM_TYPE_UINT);
+    return val;
+}
+
+int64_t cmReadI64At(CompositeMessageReader *reader, const CMIndexEntry *table,
+                    uint32_t i) {
+    int64_t val = 0;
+    readValueAt(reader, &table[i], &val, sizeof(val), CM_TYPE_INT);
+    return val;
+}
+
+uint64_t cmReadU64At(CompositeMessageReader *reader, const CMIndexEntry *table,
+                     uint32_t i) {
+    uint64_t val = 0;
+    readValueAt(reader, &table[i], &val, sizeof(val), CM_TYPE_UINT);
+    return val;
+}
+
+float cmReadFAt(CompositeMessageReader *reader, const CMIndexEntry *table,
+                uint32_t i) {
+    float val = 0;
+    readValueAt(reader, &table[i], &val, sizeof(val), CM_TYPE_FLOAT);
+    return val;
+}
+
+double cmReadDAt(CompositeMessageReader *reader, const CMIndexEntry *table,
+                 uint32_t i) {
+    double val = 0;
+    readValueAt(reader, &table[i], &val, sizeof(val), CM_TYPE_FLOAT);
+    return val;
+}
+
+bool cmReadBoolAt(CompositeMessageReader *reader, const CMIndexEntry *table,
+                  uint32_t i) {
+    bool val = 0;
+    readValueAt(reader, &table[i], &val, sizeof(val), CM_TYPE_BOOL);
+    return val;
+}
+
+char cmReadCharAt(CompositeMessageReader *reader, const CMIndexEntry *table,
+                  uint32_t i) {
+    char val = 0;
+    readValueAt(reader, &table[i], &val, sizeof(val), CM_TYPE_CHAR);
+    return val;
+}
+
+uint32_t cmReadTypedArrayAt(CompositeMessageReader *reader,
+                            const CMIndexEntry *table, uint32_t i,
+                            uint8_t itemType, uint8_t itemSize, void *buffer,
+                            uint32_t maxItems) {
+    CompositeMessageReader copy;
+    if (!getReaderAt(reader, &table[i], &copy))
+        return 0;
+    uint32_t count = cmReadTypedArray(&copy, itemType, itemSize, buffer, maxItems);
+    reader->firstError = copy.firstError;
+    return count;
+}
+
+void cmInitTemplate(CMTemplate *tmpl, uint8_t *signature, uint8_t *mask,
+                    uint32_t capacity, CMTemplateField *fields,
+                    uint32_t maxFields) {
+    tmpl->signature = signature;
+    tmpl->mask = mask;
+    tmpl->capacity = capacity;
+    tmpl->size = 0;
+    tmpl->fields = fields;
+    tmpl->maxFields = maxFields;
+    tmpl->fieldCount = 0;
+}
+
+bool cmCompileTemplate(CMTemplate *tmpl, CompositeMessageReader *sample) {
+    tmpl->size = 0;
+    tmpl->fieldCount = 0;
+    if (sample->firstError != CM_ERROR_NONE)
+        return false;
+    if (sample->swapBytes) {
+        sample->firstError = CM_ERROR_INVALID_ARG;
+        return false;
+    }
+
+    const uint8_t *m = sample->message;
+    uint32_t start = sample->readSize;
+    uint32_t offset = start;
+    while (offset < sample->totalSize) {
+        uint8_t flag = m[offset];
+        const FlagInfo *info = &flagInfo[flag];
+        uint64_t size = getElementSize(sample, offset);
+        if (size == 0) {
+            sample->firstError = CM_ERROR_NO_VALUE;
+            return false;
+        }
+        if (size > sample->totalSize - offset) {
+            sample->firstError = sample->capacity != 0 ? CM_ERROR_NEED_MORE :
+                                 CM_ERROR_NO_VALUE;
+            return false;
+        }
+        // only elements with size that is defined by signature are accepted
+        bool value = info->kind == CM_KIND_FIXED && info->itemSize != 0;
+        if ((info->kind != CM_KIND_FIXED && info->kind != CM_KIND_ARRAY &&
+             info->kind != CM_KIND_NAME && info->kind != CM_KIND_MARKER) ||
+            flag == CM_COMPRESSED || flag == CM_NAME_REFERENCE ||
+            flag == CM_STRING_REFERENCE) {
+            sample->firstError = CM_ERROR_INVALID_ARG;
+            return false;
+        }
+        bool array = info->kind == CM_KIND_ARRAY;
+        if (size > tmpl->capacity - tmpl->size ||
+            ((value || array) && tmpl->fieldCount == tmpl->maxFields)) {
+            sample->firstError = CM_ERROR_NO_SPACE;
+            return false;
+        }
+
+        // header of value or array is a part of signature, its payload isn't
+        uint32_t headerSize = value || array ? info->headerSize : (uint32_t) size;
+        uint8_t *sig = &tmpl->signature[tmpl->size];
+        uint8_t *mask = &tmpl->mask[tmpl->size];
+        memcpy(sig, &m[offset], headerSize);
+        memset(mask, 0xFF, headerSize);
+        memset(&sig[headerSize], 0, (uint32_t) size - headerSize);
+        memset(&mask[headerSize], 0, (uint32_t) size - headerSize);
+        if (value || array) {
+            CMTemplateField *field = &tmpl->fields[tmpl->fieldCount++];
+            field->offset = tmpl->size + headerSize;
+            field->size = (uint32_t) size - headerSize;
+            field->flag = flag;
+        }
+        tmpl->size += (uint32_t) size;
+        offset += (uint32_t) size;
+    }
+    return true;
+}
+
+const uint8_t *cmMatchTemplate(CompositeMessageReader *reader,
+                               const CMTemplate *tmpl) {
+    if (reader->firstError != CM_ERROR_NONE || reader->swapBytes)
+        return NULL;
+
+    const uint8_t *data = &reader->message[reader->readSize];
+    uint32_t available = reader->totalSize - reader->readSize;
+    if (available < tmpl->size) {
+        // stream reader waits for the rest only if received part matches
+        if (reader->capacity != 0 &&
+            matchSignature(data, tmpl->signature, tmpl->mask, available)) {
+            reader->firstError = CM_ERROR_NEED_MORE;
+        }
+        return NULL;
+    }
+    if (!matchSignature(data, tmpl->signature, tmpl->mask, tmpl->size))
+        return NULL;
+    reader->readSize += tmpl->size;
+    return data;
+}
+
+static bool ensureSpace(CompositeMessageWriter *writer, uint32_t size) {
+    if (writer->firstError != CM_ERROR_NONE)
+        return false;
+
+    // nothing can be written until started array is committed
+    if (writer->arrayOpen) {
+        writer->firstError = CM_ERROR_INVALID_ARG;
+        return false;
+    }
+
+    if (writer->bufferSize - writer->usedSize < size) {
+        // in stream mode buffer can be emptied to make space
+        if (writer->flush == NULL || writer->bufferSize < size) {
+            writer->firstError = CM_ERROR_NO_SPACE;
+            return false;
+        }
+        return flushBuffer(writer);
+    }
+
+    return true;
+}
+
+static bool flushBuffer(CompositeMessageWriter *writer) {
+    if (writer->usedSize == 0)
+        return true;
+    if (!writer->flush(writer->flushContext, writer->buffer, writer->usedSize)) {
+        writer->firstError = CM_ERROR_IO;
+        return false;
+    }
+    updateWriterCrc(writer);
+    writer->flushedSize += writer->usedSize;
+    writer->usedSize = 0;
+    writer->crcOffset = 0;
+    return true;
+}
+
+static bool discardBytes(void *context, const void *data, uint32_t size) {
+    (void) context;
+    (void) data;
+    (void) size;
+    return true;
+}
+
+static void updateWriterCrc(CompositeMessageWriter *writer) {
+    if (!writer->crcEnabled)
+        return;
+    writer->crc = updateCrc32(writer->crc, &writer->buffer[writer->crcOffset],
+                              writer->usedSize - writer->crcOffset);
+    writer->crcOffset = writer->usedSize;
+}
+
+static bool ensureArraySpace(CompositeMessageWriter *writer, uint8_t itemSize,
+                             uint32_t itemCount) {
+    uint64_t size = 1 + sizeof(uint32_t) + (uint64_t) itemSize * itemCount;
+    if (size > UINT32_MAX) {
+        if (writer->firstError == CM_ERROR_NONE)
+            writer->firstError = CM_ERROR_NO_SPACE;
+        return false;
+    }
+    return ensureSpace(writer, (uint32_t) size);
+}
+
+static bool writePadding(CompositeMessageWriter *writer, uint8_t itemSize) {
+    if (!writer->alignArrays || itemSize < 2)
+        return true;
+    // items follow flag and size of array
+    uint32_t offset = cmGetMessageSize(writer) + 1 + sizeof(uint32_t);
+    uint32_t padding = (0u - offset) & (itemSize - 1u);
+    if (padding == 0)
+        return true;
+    if (!ensureSpace(writer, padding))
+        return false;
+    memset(&writer->buffer[writer->usedSize], CM_PADDING, padding);
+    writer->usedSize += padding;
+    return true;
+}
+
+static void skipPadding(CompositeMessageReader *reader) {
+    while (reader->readSize < reader->totalSize &&
+           reader->message[reader->readSize] == CM_PADDING) {
+        ++reader->readSize;
+    }
+}
+
+static bool matchSignature(const uint8_t *data, const uint8_t *signature,
+                           const uint8_t *mask, uint32_t size) {
+    uint64_t diff = 0;
+    uint32_t i = 0;
+    for (; size - i >= sizeof(uint64_t); i += sizeof(uint64_t)) {
+        uint64_t d, s, k;
+        memcpy(&d, &data[i], sizeof(d));
+        memcpy(&s, &signature[i], sizeof(s));
+        memcpy(&k, &mask[i], sizeof(k));
+        diff |= (d & k) ^ s;
+    }
+    for (; i < size; ++i) {
+        diff |= (uint8_t) ((data[i] & mask[i]) ^ signature[i]);
+    }
+    return diff == 0;
+}
+
+static void writeArrayReference(CompositeMessageWriter *writer, uint8_t flag,
+                                const void *data, uint32_t size,
+                                uint32_t itemCount) {
+    uint8_t itemType;
+    splitTypeFlag(flag, &itemType, NULL);
+    uint32_t headerSize = 1 + sizeof(uint32_t);
+    if (!ensureSpace(writer, itemType == CM_TYPE_CHAR ? headerSize + 1 : headerSize))
+        return;
+
+    writer->buffer[writer->usedSize] = flag;
+    writer->usedSize++;
+    writeBytes(writer, &itemCount, sizeof(uint32_t));
+    updateWriterCrc(writer);
+    if (writer->crcEnabled) {
+        writer->crc = updateCrc32(writer->crc, data, size);
+    }
+
+    // everything before payload goes to its own segment, payload follows it
+    addSegment(writer, &writer->buffer[writer->segmentStart],
+               writer->usedSize - writer->segmentStart);
+    addSegment(writer, data, size);
+    writer->segmentStart = writer->usedSize;
+    writer->externalSize += size;
+
+    if (itemType == CM_TYPE_CHAR) {
+        writer->buffer[writer->usedSize] = 0x00;
+        ++writer->usedSize;
+    }
+}
+
+static void addSegment(CompositeMessageWriter *writer, const void *data,
+                       uint32_t size) {
+    if (size == 0)
+        return;
+    writer->segments[writer->segmentCount].data = data;
+    writer->segments[writer->segmentCount].size = size;
+    ++writer->segmentCount;
+}
+
+static void updateReaderCrc(CompositeMessageReader *reader, uint32_t offset) {
+    if (reader->converted) {
+        reader->crc = updateConvertedCrc(reader, reader->crc,
+                                         reader->crcOffset, offset);
+    } else {
+        reader->crc = updateCrc32(reader->crc, &reader->message[reader->crcOffset],
+                                  offset - reader->crcOffset);
+    }
+    reader->crcOffset = offset;
+}
+
+static uint32_t updateConvertedCrc(const CompositeMessageReader *reader,
+                                   uint32_t crc, uint32_t from, uint32_t to) {
+    const uint8_t *m = reader->message;
+    while (from < to) {
+        const FlagInfo *info = &flagInfo[m[from]];
+        // sizes of elements were validated when message was converted
+        uint32_t end = from + (uint32_t) getElementSize(reader, from);
+        if (info->kind == CM_KIND_MESSAGE) {
+            // elements of embedded message are hashed one by one
+            end = from + info->headerSize;
+        }
+        crc = updateCrc32(crc, &m[from], 1);
+
+        ++from;
+        if (info->kind == CM_KIND_ARRAY || info->kind == CM_KIND_MESSAGE ||
+            info->kind == CM_KIND_TABLE) {
+            crc = updateSwappedCrc(crc, &m[from], sizeof(uint32_t), sizeof(uint32_t));
+            from += sizeof(uint32_t);
+        }
+
+        if (info->kind == CM_KIND_TABLE) {
+            uint8_t columnCount = m[from];
+            const uint8_t *columns = &m[from + 1];
+            uint32_t recordCount;
+            memcpy(&recordCount, &m[from - sizeof(uint32_t)], sizeof(recordCount));
+            crc = updateCrc32(crc, &m[from], 1u + columnCount);
+            from += 1u + columnCount;
+            for (uint8_t i = 0; i < columnCount; ++i) {
+                uint8_t itemLen = flagInfo[columns[i]].itemSize;
+                crc = updateSwappedCrc(crc, &m[from], itemLen * recordCount, itemLen);
+                from += itemLen * recordCount;
+            }
+        } else {
+            // bytes of names and markers are not swapped
+            crc = updateSwappedCrc(crc, &m[from], end - from, info->swapSize);
+            from = end;
+        }
+    }
+    return crc;
+}
+
+static uint32_t updateSwappedCrc(uint32_t crc, const uint8_t *data,
+                                 uint32_t size, uint8_t itemLen) {
+    if (itemLen < 2)
+        return updateCrc32(crc, data, size);
+
+    for (uint32_t i = 0; i < size; i += itemLen) {
+        uint8_t item[sizeof(uint64_t)];
+        memcpy(item, &data[i], itemLen);
+        inverseByteOrder(item, itemLen);
+        crc = updateCrc32(crc, item, itemLen);
+    }
+    return crc;
+}
+
+static bool ensureAvailable(CompositeMessageReader *reader, uint32_t size) {
+    if (reader->totalSize - reader->readSize >= size)
+        return true;
+
+    // in stream mode rest of element may be fed later
+    if (reader->capacity != 0) {
+        reader->firstError = CM_ERROR_NEED_MORE;
+    } else {
+        reader->firstError = CM_ERROR_NO_VALUE;
+    }
+    return false;
+}
+
+static bool checkValue(CompositeMessageReader *reader,
+                       uint8_t type, uint8_t size) {
+    if (reader->firstError != CM_ERROR_NONE)
+        return false;
+
+    if (!ensureAvailable(reader, 1))
+        return false;
+
+    if (reader->message[reader->readSize] != type) {
+        reader->firstError = CM_ERROR_NO_VALUE;
+        return false;
+    }
+
+    return ensureAvailable(reader, 1u + size);
+}
+
+static uint32_t checkArray(CompositeMessageReader *reader, uint8_t itemType,
+                           uint8_t itemSize) {
+    if (reader->firstError != CM_ERROR_NONE)
+        return 0;
+
+    uint8_t flag = getArrayFlag(itemType, itemSize);
+    if (flag == 0) {
+        reader->firstError = CM_ERROR_INVALID_ARG;
+        return 0;
+    }
+
+    uint32_t arraySize = cmPeekArraySize(reader);
+
+    if (reader->firstError != CM_ERROR_NONE) {
+        return 0;
+    }
+
+    if (reader->message[reader->readSize] != flag) {
+        reader->firstError = CM_ERROR_NO_VALUE;
+        return 0;
+    }
+
+    uint64_t size = 1 + sizeof(uint32_t) + (uint64_t) arraySize * itemSize;
+    if (size > UINT32_MAX) {
+        reader->firstError = CM_ERROR_NO_VALUE;
+        return 0;
+    }
+    if (!ensureAvailable(reader, (uint32_t) size))
+        return 0;
+
+    return arraySize;
+}
+
+static bool writeValue(CompositeMessageWriter *writer, void *val, uint8_t len,
+                       uint8_t type) {
+    if (writer->firstError != CM_ERROR_NONE)
+        return false;
+    if (writer->compactIntegers && len > 1 &&
+        (type == CM_TYPE_UINT || type == CM_TYPE_INT))
+        return writeVarint(writer, val, len, type);
+    if (!ensureSpace(writer, 1 + len))
+        return false;
+    uint8_t flag = getTypeFlag(type, len);
+    if (flag == 0) {
+        writer->firstError = CM_ERROR_INVALID_ARG;
+        return false;
+    }
+
+    writer->buffer[writer->usedSize] = flag;
+    writer->usedSize++;
+    writeBytes(writer, val, len);
+    return true;
+}
+
+static bool readValue(CompositeMessageReader *reader, void *val, uint8_t len,
+                      uint8_t type) {
+    CM_PROFILE_BEGIN(CM_PROFILE_READ_VALUE, reader->readSize);
+    bool read = false;
+    if ((type == CM_TYPE_UINT || type == CM_TYPE_INT) &&
+        reader->firstError == CM_ERROR_NONE &&
+        reader->readSize < reader->totalSize &&
+        reader->message[reader->readSize] == (CM_VARINT | getTypeFlag(type, len))) {
+        read = readVarint(reader, val, len, type);
+    } else if (checkValue(reader, getTypeFlag(type, len), len)) {
+        ++reader->readSize;
+        memcpy(val, &reader->message[reader->readSize], len);
+        if (reader->swapBytes) {
+            inverseByteOrder(val, len);
+        }
+        reader->readSize += len;
+        read = true;
+    }
+    CM_PROFILE_END(reader->profileStats, CM_PROFILE_READ_VALUE, reader->readSize);
+    return read;
+}
+
+static uint32_t checkEncodedHeader(CompositeMessageReader *reader,
+                                   EncodedArrayHeader *header) {
+    uint32_t available = reader->totalSize - reader->readSize;
+    uint32_t size = parseEncodedHeader(&reader->message[reader->readSize],
+                                       available, header);
+    if (size == 0) {
+        if (available < CM_MAX_ENCODED_HEADER_SIZE) {
+            ensureAvailable(reader, available + 1);
+        } else {
+            reader->firstError = CM_ERROR_NO_VALUE;
+        }
+    }
+    return size;
+}
+
+static uint32_t readEncodedArray(CompositeMessageReader *reader, uint8_t itemType,
+                                 uint8_t itemSize, void *buffer, uint32_t maxItems) {
+    EncodedArrayHeader header;
+    uint32_t headerSize = checkEncodedHeader(reader, &header);
+    if (headerSize == 0)
+        return 0;
+
+    uint8_t flag = getArrayFlag(itemType, itemSize);
+    if (flag == 0) {
+        reader->firstError = CM_ERROR_INVALID_ARG;
+        return 0;
+    }
+    if (header.itemFlag != (flag & ~CM_ARRAY) ||
+        (uint64_t) headerSize + header.payloadSize > UINT32_MAX) {
+        reader->firstError = CM_ERROR_NO_VALUE;
+        return 0;
+    }
+    if (!ensureAvailable(reader, headerSize + header.payloadSize))
+        return 0;
+    if (maxItems < header.itemCount) {
+        reader->firstError = CM_ERROR_NO_SPACE;
+        return 0;
+    }
+
+    EncodedInput in;
+    in.data = &reader->message[reader->readSize + headerSize];
+    in.available = header.payloadSize;
+    in.bits = 0;
+    in.bitCount = 0;
+    // all encoded bytes must belong to items
+    if (!isCodecCompatible(header.codec, itemType) ||
+        !decodeItems(&in, header.codec, itemType, itemSize, buffer,
+                     header.itemCount) || in.available != 0) {
+        reader->firstError = CM_ERROR_NO_VALUE;
+        return 0;
+    }
+
+    reader->readSize += headerSize + header.payloadSize;
+    return header.itemCount;
+}
+
+static void writeEncodedArray(CompositeMessageWriter *writer, uint8_t codec,
+                              uint8_t itemType, uint8_t itemSize,
+                              const void *data, uint32_t itemCount) {
+    // size of encoded items must be known before they are written
+    EncodedOutput out;
+    out.writer = NULL;
+    out.size = 0;
+    out.used = 0;
+    out.bits = 0;
+    out.bitCount = 0;
+    encodeItems(&out, codec, itemType, itemSize, data, itemCount);
+    flushOutput(&out);
+    uint64_t payloadSize = out.size;
+
+    if (payloadSize + CM_MAX_ENCODED_HEADER_SIZE > UINT32_MAX) {
+        writer->firstError = CM_ERROR_NO_SPACE;
+        return;
+    }
+    uint8_t header[CM_MAX_ENCODED_HEADER_SIZE];
+    uint32_t headerSize = fillEncodedHeader(header, codec,
+                                            getTypeFlag(itemType, itemSize),
+                                            itemCount, (uint32_t) payloadSize);
+
+    // in stream mode only header must fit in buffer
+    if (!ensureSpace(writer, headerSize + (writer->flush != NULL ? 0 : (uint32_t) payloadSize)))
+        return;
+    writeBytes(writer, header, headerSize);
+
+    out.writer = writer;
+    encodeItems(&out, codec, itemType, itemSize, data, itemCount);
+    flushOutput(&out);
+}
+
+static bool isCodecCompatible(uint8_t codec, uint8_t itemType) {
+    if (codec == CM_CODEC_RLE || codec == CM_CODEC_BITS)
+        return itemType == CM_TYPE_BOOL;
+    if (codec == CM_CODEC_VARINT || codec == CM_CODEC_DELTA ||
+        codec == CM_CODEC_FOR)
+        return itemType == CM_TYPE_UINT || itemType == CM_TYPE_INT;
+    return false;
+}
+
+static void encodeItems(EncodedOutput *out, uint8_t codec, uint8_t itemType,
+                        uint8_t itemSize, const void *data, uint32_t itemCount) {
+    if (itemCount == 0)
+        return;
+    const uint8_t *d = (const uint8_t *) data;
+    bool isSigned = itemType == CM_TYPE_INT;
+
+    if (codec == CM_CODEC_VARINT) {
+        for (uint32_t i = 0; i < itemCount; ++i) {
+            uint64_t v = loadInteger(data, i, itemType, itemSize);
+            putVarint(out, isSigned ? zigzagEncode(v) : v);
+        }
+    } else if (codec == CM_CODEC_DELTA) {
+        // first item is stored as is, others as difference with previous one
+        uint64_t prev = loadInteger(data, 0, itemType, itemSize);
+        putVarint(out, isSigned ? zigzagEncode(prev) : prev);
+        for (uint32_t i = 1; i < itemCount; ++i) {
+            uint64_t v = loadInteger(data, i, itemType, itemSize);
+            putVarint(out, zigzagEncode(v - prev));
+            prev = v;
+        }
+    } else if (codec == CM_CODEC_FOR) {
+        // items are stored as offsets from minimum using minimal bit width
+        uint64_t min = loadInteger(data, 0, itemType, itemSize);
+        uint64_t max = min;
+        for (uint32_t i = 1; i < itemCount; ++i) {
+            uint64_t v = loadInteger(data, i, itemType, itemSize);
+            if (isSigned ? (int64_t) v < (int64_t) min : v < min) {
+                min = v;
+            }
+            if (isSigned ? (int64_t) v > (int64_t) max : v > max) {
+                max = v;
+            }
+        }
+        uint8_t width = 0;
+        for (uint64_t range = max - min; range != 0; range >>= 1u) {
+            ++width;
+        }
+        putVarint(out, isSigned ? zigzagEncode(min) : min);
+        putByte(out, width);
+        for (uint32_t i = 0; i < itemCount; ++i) {
+            putBits(out, loadInteger(data, i, itemType, itemSize) - min, width);
+        }
+    } else if (codec == CM_CODEC_BITS) {
+        uint8_t packed[64];
+        for (uint32_t i = 0; i < itemCount; i += sizeof(packed) * 8) {
+            uint32_t count = itemCount - i < sizeof(packed) * 8 ?
+                             itemCount - i : (uint32_t) sizeof(packed) * 8;
+            packBools(&d[i], count, packed);
+            putBytes(out, packed, (count + 7) / 8);
+        }
+    } else {
+        // lengths of alternating runs of false and true values
+        bool current = false;
+        uint32_t run = 0;
+        for (uint32_t i = 0; i < itemCount; ++i) {
+            if ((d[i] != 0) != current) {
+                putVarint(out, run);
+                current = !current;
+                run = 0;
+            }
+            ++run;
+        }
+        putVarint(out, run);
+    }
+}
+
+static bool decodeItems(EncodedInput *in, uint8_t codec, uint8_t itemType,
+                        uint8_t itemSize, void *buffer, uint32_t itemCount) {
+    if (itemCount == 0)
+        return true;
+    bool isSigned = itemType == CM_TYPE_INT;
+    uint64_t v;
+
+    if (codec == CM_CODEC_VARINT) {
+        for (uint32_t i = 0; i < itemCount; ++i) {
+            if (!takeVarint(in, &v) ||
+                !storeInteger(buffer, i, isSigned ? zigzagDecode(v) : v,
+                              itemType, itemSize))
+                return false;
+        }
+    } else if (codec == CM_CODEC_DELTA) {
+        uint64_t prev;
+        if (!takeVarint(in, &prev))
+            return false;
+        prev = isSigned ? zigzagDecode(prev) : prev;
+        if (!storeInteger(buffer, 0, prev, itemType, itemSize))
+            return false;
+        for (uint32_t i = 1; i < itemCount; ++i) {
+            if (!takeVarint(in, &v))
+                return false;
+            prev += zigzagDecode(v);
+            if (!storeInteger(buffer, i, prev, itemType, itemSize))
+                return false;
+        }
+    } else if (codec == CM_CODEC_FOR) {
+        uint64_t min;
+        if (!takeVarint(in, &min) || in->available == 0 || in->data[0] > 64)
+            return false;
+        min = isSigned ? zigzagDecode(min) : min;
+        uint8_t width = in->data[0];
+        ++in->data;
+        --in->available;
+        // packed items must fill all bytes except the last one
+        if (((uint64_t) itemCount * width + 7) / 8 != in->available)
+            return false;
+        for (uint32_t i = 0; i < itemCount; ++i) {
+            takeBits(in, width, &v);
+            if (!storeInteger(buffer, i, min + v, itemType, itemSize))
+                return false;
+        }
+        in->bitCount = 0;
+    } else if (codec == CM_CODEC_BITS) {
+        uint32_t size = (uint32_t) (((uint64_t) itemCount + 7) / 8);
+        if (in->available != size)
+            return false;
+        unpackBools(in->data, itemCount, (uint8_t *) buffer);
+        in->data += size;
+        in->available = 0;
+    } else {
+        uint8_t *d = (uint8_t *) buffer;
+        bool current = false;
+        uint32_t filled = 0;
+        while (filled < itemCount) {
+            if (!takeVarint(in, &v) || v > itemCount - filled)
+                return false;
+            memset(&d[filled], current ? 1 : 0, (size_t) v);
+            filled += (uint32_t) v;
+            current = !current;
+        }
+    }
+    return true;
+}
+
+static void putByte(EncodedOutput *out, uint8_t byte) {
+    ++out->size;
+    if (out->writer == NULL)
+        return;
+    if (out->used == sizeof(out->chunk)) {
+        writeBytes(out->writer, out->chunk, out->used);
+        out->used = 0;
+    }
+    out->chunk[out->used++] = byte;
+}
+
+static void putVarint(EncodedOutput *out, uint64_t value) {
+    if (out->writer == NULL) {
+        out->size += getVarintSize(value);
+        return;
+    }
+    if (out->used > sizeof(out->chunk) - CM_MAX_VARINT_SIZE) {
+        writeBytes(out->writer, out->chunk, out->used);
+        out->used = 0;
+    }
+    uint32_t size = encodeVarint(value, &out->chunk[out->used]);
+    out->used += size;
+    out->size += size;
+}
+
+static void putBits(EncodedOutput *out, uint64_t value, uint32_t count) {
+    // at most 32 bits are added at once, so pending bits always fit in 64
+    if (count > 32) {
+        putBits(out, value & 0xFFFFFFFFu, 32);
+        putBits(out, value >> 32u, count - 32);
+        return;
+    }
+    if (count < 32) {
+        value &= (1ull << count) - 1;
+    }
+    out->bits |= value << out->bitCount;
+    out->bitCount += count;
+    while (out->bitCount >= 8) {
+        putByte(out, (uint8_t) out->bits);
+        out->bits >>= 8u;
+        out->bitCount -= 8;
+    }
+}
+
+static void putBytes(EncodedOutput *out, const void *data, uint32_t size) {
+    if (out->writer == NULL) {
+        out->size += size;
+        return;
+    }
+    if (size > sizeof(out->chunk) - out->used) {
+        writeBytes(out->writer, out->chunk, out->used);
+        out->used = 0;
+    }
+    memcpy(&out->chunk[out->used], data, size);
+    out->used += size;
+    out->size += size;
+}
+
+static void flushOutput(EncodedOutput *out) {
+    if (out->bitCount > 0) {
+        putByte(out, (uint8_t) out->bits);
+        out->bits = 0;
+        out->bitCount = 0;
+    }
+    if (out->writer != NULL && out->used > 0) {
+        writeBytes(out->writer, out->chunk, out->used);
+        out->used = 0;
+    }
+}
+
+static bool takeVarint(EncodedInput *in, uint64_t *value) {
+    uint32_t size = decodeVarint(in->data, in->available, value);
+    in->data += size;
+    in->available -= size;
+    return size != 0;
+}
+
+static bool takeBits(EncodedInput *in, uint32_t count, uint64_t *value) {
+    if (count > 32) {
+        uint64_t low, high;
+        if (!takeBits(in, 32, &low) || !takeBits(in, count - 32, &high))
+            return false;
+        *value = low | (high << 32u);
+        return true;
+    }
+    while (in->bitCount < count) {
+        if (in->available == 0)
+            return false;
+        in->bits |= (uint64_t) in->data[0] << in->bitCount;
+        in->bitCount += 8;
+        ++in->data;
+        --in->available;
+    }
+    *value = count == 32 ? in->bits & 0xFFFFFFFFu : in->bits & ((1ull << count) - 1);
+    in->bits >>= count;
+    in->bitCount -= count;
+    return true;
+}
+
+static uint32_t fillEncodedHeader(uint8_t *header, uint8_t codec,
+                                  uint8_t itemFlag, uint32_t itemCount,
+                                  uint32_t payloadSize) {
+    header[0] = CM_ENCODED_ARRAY;
+    header[1] = codec;
+    header[2] = itemFlag;
+    uint32_t size = 3 + encodeVarint(itemCount, &header[3]);
+    return size + encodeVarint(payloadSize, &header[size]);
+}
+
+static void packBools(const uint8_t *bools, uint32_t count, uint8_t *bits) {
+    uint32_t i = 0;
+#if defined(CM_SWAP_SSSE3) || defined(CM_SWAP_SSE2)
+    // sign bits of bytes that are equal to zero are collected by movemask
+    __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= count; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) &bools[i]);
+        uint32_t mask = ~(uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v, zero));
+        bits[i / 8] = (uint8_t) mask;
+        bits[i / 8 + 1] = (uint8_t) (mask >> 8u);
+    }
+#endif
+    for (; i + 8 <= count; i += 8) {
+        uint64_t v;
+        memcpy(&v, &bools[i], sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        v = __builtin_bswap64(v);
+#endif
+        // set lowest bit of each non-zero byte, then gather these bits
+        // to the highest byte with multiplication
+        v = ((((v & 0x7F7F7F7F7F7F7F7Full) + 0x7F7F7F7F7F7F7F7Full) | v) >> 7u) &
+            0x0101010101010101ull;
+        bits[i / 8] = (uint8_t) ((v * 0x0102040810204080ull) >> 56u);
+    }
+    if (i < count) {
+        uint8_t last = 0;
+        for (uint32_t j = 0; i + j < count; ++j) {
+            last |= (uint8_t) ((bools[i + j] != 0 ? 1u : 0u) << j);
+        }
+        bits[i / 8] = last;
+    }
+}
+
+static void unpackBools(const uint8_t *bits, uint32_t count, uint8_t *bools) {
+    uint32_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        // spread byte to all 8 bytes and keep single bit in each of them
+        uint64_t v = (bits[i / 8] * 0x0101010101010101ull) & 0x8040201008040201ull;
+        v = ((v + 0x7F7F7F7F7F7F7F7Full) >> 7u) & 0x0101010101010101ull;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        v = __builtin_bswap64(v);
+#endif
+        memcpy(&bools[i], &v, sizeof(v));
+    }
+    for (; i < count; ++i) {
+        bools[i] = (bits[i / 8] >> (i % 8u)) & 1u;
+    }
+}
+
+static bool writeVarint(CompositeMessageWriter *writer, const void *val,
+                        uint8_t len, uint8_t type) {
+    uint8_t bytes[1 + CM_MAX_VARINT_SIZE];
+    bytes[0] = CM_VARINT | getTypeFlag(type, len);
+    uint64_t v = loadInteger(val, 0, type, len);
+    uint32_t size = 1 + encodeVarint(type == CM_TYPE_INT ? zigzagEncode(v) : v,
+                                     &bytes[1]);
+    return writeBytes(writer, bytes, size);
+}
+
+static bool readVarint(CompositeMessageReader *reader, void *val, uint8_t len,
+                       uint8_t type) {
+    uint32_t available = reader->totalSize - reader->readSize - 1;
+    uint64_t value;
+    uint32_t size = decodeVarint(&reader->message[reader->readSize + 1],
+                                 available, &value);
+    if (size == 0) {
+        if (available < CM_MAX_VARINT_SIZE) {
+            ensureAvailable(reader, available + 2);
+        } else {
+            reader->firstError = CM_ERROR_NO_VALUE;
+        }
+        return false;
+    }
+    if (type == CM_TYPE_INT) {
+        value = zigzagDecode(value);
+    }
+    if (!storeInteger(val, 0, value, type, len)) {
+        reader->firstError = CM_ERROR_NO_VALUE;
+        return false;
+    }
+    reader->readSize += 1 + size;
+    return true;
+}
+
+static uint64_t loadInteger(const void *data, uint32_t index, uint8_t type,
+                            uint8_t len) {
+    const uint8_t *d = (const uint8_t *) data + (size_t) index * len;
+    if (type == CM_TYPE_UINT) {
+        if (len == 1) {
+            return *d;
+        } else if (len == 2) {
+            uint16_t v;
+            memcpy(&v, d, sizeof(v));
+            return v;
+        } else if (len == 4) {
+            uint32_t v;
+            memcpy(&v, d, sizeof(v));
+            return v;
+        }
+        uint64_t v;
+        memcpy(&v, d, sizeof(v));
+        return v;
+    }
+
+    if (len == 1) {
+        return (uint64_t) (int64_t) (int8_t) *d;
+    } else if (len == 2) {
+        int16_t v;
+        memcpy(&v, d, sizeof(v));
+        return (uint64_t) (int64_t) v;
+    } else if (len == 4) {
+        int32_t v;
+        memcpy(&v, d, sizeof(v));
+        return (uint64_t) (int64_t) v;
+    }
+    uint64_t v;
+    memcpy(&v, d, sizeof(v));
+    return v;
+}
+
+static bool storeInteger(void *data, uint32_t index, uint64_t value,
+                         uint8_t type, uint8_t len) {
+    uint8_t *d = (uint8_t *) data + (size_t) index * len;
+    if (len < 8) {
+        // bits above item (and its sign bit) must be all zeros or,
+        // for negative signed values, all ones
+        uint32_t bits = type == CM_TYPE_INT ? len * 8u - 1u : len * 8u;
+        uint64_t high = value >> bits;
+        if (high != 0 && (type != CM_TYPE_INT || high != UINT64_MAX >> bits))
+            return false;
+    }
+
+    if (len == 1) {
+        *d = (uint8_t) value;
+    } else if (len == 2) {
+        uint16_t v = (uint16_t) value;
+        memcpy(d, &v, sizeof(v));
+    } else if (len == 4) {
+        uint32_t v = (uint32_t) value;
+        memcpy(d, &v, sizeof(v));
+    } else {
+        memcpy(d, &value, sizeof(value));
+    }
+    return true;
+}
+
+static uint64_t zigzagEncode(uint64_t value) {
+    return (value << 1u) ^ (0 - (value >> 63u));
+}
+
+static uint64_t zigzagDecode(uint64_t value) {
+    return (value >> 1u) ^ (0 - (value & 1u));
+}
+
+static uint32_t getVarintSize(uint64_t value) {
+#if defined(__GNUC__)
+    // each byte holds 7 bits of value
+    return (uint32_t) (64 - __builtin_clzll(value | 1u) + 6) / 7;
+#else
+    uint32_t size = 1;
+    while (value >= 0x80u) {
+        value >>= 7u;
+        ++size;
+    }
+    return size;
+#endif
+}
+
+static uint32_t encodeVarint(uint64_t value, uint8_t *out) {
+    uint32_t size = 0;
+    while (value >= 0x80u) {
+        out[size++] = (uint8_t) (value | 0x80u);
+        value >>= 7u;
+    }
+    out[size++] = (uint8_t) value;
+    return size;
+}
+
+static uint32_t decodeVarint(const uint8_t *data, uint32_t available,
+                             uint64_t *value) {
+#if defined(__GNUC__)
+    if (available >= 8) {
+        // varints of up to 8 bytes are decoded without per byte branches:
+        // terminating byte is found by its cleared high bit and then
+        // 7-bit groups are packed together
+        uint64_t v;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        memcpy(&v, data, sizeof(v));
+#else
+        v = 0;
+        for (uint32_t i = 0; i < 8; ++i) {
+            v |= (uint64_t) data[i] << (i * 8u);
+        }
+#endif
+        uint64_t stops = ~v & 0x8080808080808080ull;
+        if (stops != 0) {
+            uint32_t size = (uint32_t) (__builtin_ctzll(stops) + 1) / 8;
+            v &= (stops ^ (stops - 1)) & 0x7F7F7F7F7F7F7F7Full;
+            v = (v & 0x007F007F007F007Full) | ((v & 0x7F007F007F007F00ull) >> 1u);
+            v = (v & 0x00003FFF00003FFFull) | ((v & 0x3FFF00003FFF0000ull) >> 2u);
+            v = (v & 0x000000000FFFFFFFull) | ((v & 0x0FFFFFFF00000000ull) >> 4u);
+            *value = v;
+            return size;
+        }
+    }
+#endif
+    uint64_t v = 0;
+    uint32_t limit = available < CM_MAX_VARINT_SIZE ? available : CM_MAX_VARINT_SIZE;
+    for (uint32_t i = 0; i < limit; ++i) {
+        v |= (uint64_t) (data[i] & 0x7Fu) << (i * 7u);
+        if ((data[i] & 0x80u) == 0) {
+            // only one bit of the last byte fits in 64 bits
+            if (i == CM_MAX_VARINT_SIZE - 1 && data[i] > 1)
+                return 0;
+            *value = v;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+static uint32_t parseEncodedHeader(const uint8_t *data, uint32_t available,
+                                   EncodedArrayHeader *header) {
+    if (available < 3)
+        return 0;
+    header->codec = data[1];
+    header->itemFlag = data[2];
+
+    uint64_t count, payloadSize;
+    uint32_t size = 3;
+    uint32_t countSize = decodeVarint(&data[size], available - size, &count);
+    if (countSize == 0 || count > UINT32_MAX)
+        return 0;
+    size += countSize;
+    uint32_t payloadSizeSize = decodeVarint(&data[size], available - size,
+                                            &payloadSize);
+    if (payloadSizeSize == 0 || payloadSize > UINT32_MAX)
+        return 0;
+    size += payloadSizeSize;
+
+    header->itemCount = (uint32_t) count;
+    header->payloadSize = (uint32_t) payloadSize;
+    return size;
+}
+
+static uint32_t readU32(const CompositeMessageReader *reader, uint32_t offset) {
+    uint32_t val;
+    memcpy(&val, &reader->message[offset], sizeof(val));
+    if (reader->swapBytes) {
+        inverseByteOrder(&val, sizeof(val));
+    }
+    return val;
+}
+
+static uint8_t getTypeFlag(uint8_t type, uint8_t len) {
+    if (len > 8 || lengthBits[len] == 0xFFu)
+        return 0;
+    return type | lengthBits[len];
+}
+
+static uint8_t getValueFlag(uint8_t type, uint8_t len) {
+    if (type > CM_TYPE_CHAR || type < CM_TYPE_UINT ||
+        (type & CM_TYPE_LEN_MASK) != 0)
+        return 0;
+    return getTypeFlag(type, len);
+}
+
+static uint8_t getArrayFlag(uint8_t itemType, uint8_t itemSize) {
+    uint8_t flag = getValueFlag(itemType, itemSize);
+    return flag == 0 ? 0 : (uint8_t) (CM_ARRAY | flag);
+}
+
+static void splitTypeFlag(uint8_t flag, uint8_t *type, uint8_t *len) {
+    if (len != NULL) {
+        *len = 1u << (flag & CM_TYPE_LEN_MASK);
+    }
+    if (type != NULL) {
+        *type = flag & CM_TYPE_MASK;
+    }
+}
+
+static bool writeBytes(CompositeMessageWriter *writer,
+                       const void *data, uint32_t size) {
+    // empty payload (e.g. bitmap without bits) may be passed as NULL
+    if (size == 0)
+        return writer->firstError == CM_ERROR_NONE;
+    if (writer->flush != NULL && size > writer->bufferSize) {
+        // data can't fit in buffer, so it is passed to callback directly
+        if (writer->firstError != CM_ERROR_NONE || !flushBuffer(writer))
+            return false;
+        if (!writer->flush(writer->flushContext, data, size)) {
+            writer->firstError = CM_ERROR_IO;
+            return false;
+        }
+        writer->flushedSize += size;
+        if (writer->crcEnabled) {
+            writer->crc = updateCrc32(writer->crc, data, size);
+        }
+        return true;
+    }
+    if (!ensureSpace(writer, size))
+        return false;
+
+    memcpy(&writer->buffer[writer->usedSize], data, size);
+    writer->usedSize += size;
+    return true;
+}
+
+static void inverseByteOrder(void *data, uint8_t size) {
+#if defined(__GNUC__)
+    if (size == 2) {
+        uint16_t v;
+        memcpy(&v, data, sizeof(v));
+        v = __builtin_bswap16(v);
+        memcpy(data, &v, sizeof(v));
+        return;
+    } else if (size == 4) {
+        uint32_t v;
+        memcpy(&v, data, sizeof(v));
+        v = __builtin_bswap32(v);
+        memcpy(data, &v, sizeof(v));
+        return;
+    } else if (size == 8) {
+        uint64_t v;
+        memcpy(&v, data, sizeof(v));
+        v = __builtin_bswap64(v);
+        memcpy(data, &v, sizeof(v));
+        return;
+    }
+#endif
+    uint8_t *d = (uint8_t *) data;
+    for (uint8_t i = 0; i < size / 2; ++i) {
+        uint8_t t = d[size - i - 1];
+        d[size - i - 1] = d[i];
+        d[i] = t;
+    }
+}
+
+static void inverseArrayByteOrder(void *data, uint8_t itemSize,
+                                  uint32_t itemCount) {
+    if (itemSize < 2)
+        return;
+
+    uint8_t *d = (uint8_t *) data;
+    uint32_t size = itemSize * itemCount;
+    uint32_t i = 0;
+
+#if defined(CM_SWAP_SSSE3)
+    __m128i mask;
+    if (itemSize == 2) {
+        mask = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6,
+                             9, 8, 11, 10, 13, 12, 15, 14);
+    } else if (itemSize == 4) {
+        mask = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4,
+                             11, 10, 9, 8, 15, 14, 13, 12);
+    } else {
+        mask = _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0,
+                             15, 14, 13, 12, 11, 10, 9, 8);
+    }
+#if defined(CM_SWAP_AVX2)
+    // shuffle works inside each 128-bit lane, so the same mask is used twice
+    __m256i mask256 = _mm256_broadcastsi128_si256(mask);
+    for (; i + 32 <= size; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) &d[i]);
+        _mm256_storeu_si256((__m256i *) &d[i], _mm256_shuffle_epi8(v, mask256));
+    }
+#endif
+    for (; i + 16 <= size; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) &d[i]);
+        _mm_storeu_si128((__m128i *) &d[i], _mm_shuffle_epi8(v, mask));
+    }
+#elif defined(CM_SWAP_SSE2)
+    // without pshufb, 16-bit words are reordered first and then
+    // bytes inside of each word are swapped
+    for (; i + 16 <= size; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) &d[i]);
+        if (itemSize == 4) {
+            v = _mm_shufflelo_epi16(_mm_shufflehi_epi16(v, 0xB1), 0xB1);
+        } else if (itemSize == 8) {
+            v = _mm_shufflelo_epi16(_mm_shufflehi_epi16(v, 0x1B), 0x1B);
+        }
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        _mm_storeu_si128((__m128i *) &d[i], v);
+    }
+#elif defined(CM_SWAP_NEON)
+    for (; i + 16 <= size; i += 16) {
+        uint8x16_t v = vld1q_u8(&d[i]);
+        if (itemSize == 2) {
+            v = vrev16q_u8(v);
+        } else if (itemSize == 4) {
+            v = vrev32q_u8(v);
+        } else {
+            v = vrev64q_u8(v);
+        }
+        vst1q_u8(&d[i], v);
+    }
+#endif
+
+    // separate loop for each size lets compiler unroll (and often vectorize)
+    // swap of remaining items
+    if (itemSize == 2) {
+        for (; i < size; i += 2) {
+            inverseByteOrder(&d[i], 2);
+        }
+    } else if (itemSize == 4) {
+        for (; i < size; i += 4) {
+            inverseByteOrder(&d[i], 4);
+        }
+    } else {
+        for (; i < size; i += itemSize) {
+            inverseByteOrder(&d[i], itemSize);
+        }
+    }
+}
+
+static bool convertEndianness(void *message, uint32_t size) {
+    uint8_t *d = (uint8_t *) message;
+    // size of element can't overflow since items are at most 8 bytes long
+    uint64_t elementSize;
+    while (size > 0) {
+        const FlagInfo *info = &flagInfo[*d];
+        uint8_t kind = info->kind;
+        uint32_t itemCount = 1;
+
+        // header is checked before its fields are read
+        if (kind == CM_KIND_INVALID || size < info->headerSize)
+            return false;
+
+        if (kind == CM_KIND_NAME || kind == CM_KIND_MARKER) {
+            // chars and bytes of marker don't depend on endianness
+            elementSize = info->headerSize + d[1] + (kind == CM_KIND_NAME ? 1u : 0u);
+        } else if (kind == CM_KIND_DEFINITION) {
+            elementSize = info->headerSize + d[2] + 1u;
+        } else if (kind == CM_KIND_ENCODED) {
+            // encoded values are sequences of bytes
+            elementSize = getEncodedElementSize(d, size);
+            if (elementSize == 0)
+                return false;
+        } else if (kind == CM_KIND_TABLE) {
+            uint8_t columnCount = d[5];
+            if (size - info->headerSize < columnCount)
+                return false;
+            uint32_t recordSize = getRecordSize(&d[6], columnCount);
+            if (recordSize == 0)
+                return false;
+            inverseByteOrder(&d[1], sizeof(uint32_t));
+            memcpy(&itemCount, &d[1], sizeof(itemCount));
+            elementSize = info->headerSize + columnCount +
+                          (uint64_t) recordSize * itemCount;
+            if (elementSize > size)
+                return false;
+            // each column is swapped as array
+            uint8_t *column = &d[info->headerSize + columnCount];
+            for (uint8_t i = 0; i < columnCount; ++i) {
+                uint8_t itemLen = flagInfo[d[6 + i]].itemSize;
+                inverseArrayByteOrder(column, itemLen, itemCount);
+                column += itemLen * itemCount;
+            }
+        } else {
+            if (kind == CM_KIND_ARRAY || kind == CM_KIND_MESSAGE) {
+                inverseByteOrder(&d[1], sizeof(uint32_t));
+                memcpy(&itemCount, &d[1], sizeof(itemCount));
+            }
+            elementSize = info->headerSize + (uint64_t) info->itemSize * itemCount;
+            if (elementSize > size)
+                return false;
+            if (kind == CM_KIND_MESSAGE) {
+                // elements of embedded message follow its size and are
+                // converted as elements of outer message
+                elementSize = info->headerSize;
+            } else if (info->swapSize != 0) {
+                inverseArrayByteOrder(&d[info->headerSize], info->swapSize, itemCount);
+            }
+        }
+
+        if (elementSize > size)
+            return false;
+        d += elementSize;
+        size -= (uint32_t) elementSize;
+    }
+    return true;
+}
+
+static bool isArray(uint8_t flag) {
+    return (flag >> 5u) == 2;
+}
+
+static bool isVarint(uint8_t flag) {
+    return (flag >> 5u) == 3;
+}
+
+static bool isName(uint8_t flag) {
+    return flag == CM_NAME || flag == CM_NAME_DEFINITION ||
+           flag == CM_NAME_REFERENCE;
+}
+
+static bool writeDictionaryString(CompositeMessageWriter *writer, uint8_t flag,
+                                  const char *str, uint8_t length) {
+    if (writer->firstError != CM_ERROR_NONE)
+        return true;
+
+    CMDictionary *dict = writer->dictionary;
+    uint32_t hash = hashBytes(str, length);
+    for (uint32_t i = 0; i < dict->count; ++i) {
+        const CMDictionaryEntry *e = &dict->entries[i];
+        if (e->defined && e->hash == hash && e->length == length &&
+            memcmp(&dict->chars[e->offset], str, length) == 0) {
+            // reference flag follows definition flag
+            if (!ensureSpace(writer, 2))
+                return true;
+            uint8_t reference[2] = {(uint8_t) (flag + 1u), (uint8_t) i};
+            writeBytes(writer, reference, sizeof(reference));
+            return true;
+        }
+    }
+
+    if (dict->count >= dict->capacity ||
+        dict->charsCapacity - dict->charsUsed < length + 1u)
+        return false;
+    // stream writer can pass long string around its buffer only when it is
+    // written in regular way
+    if (writer->flush != NULL && 3u + length + 1u > writer->bufferSize)
+        return false;
+    // flag, index, length, chars and null terminator
+    if (!ensureSpace(writer, 3u + length + 1u))
+        return true;
+
+    uint8_t index = (uint8_t) dict->count;
+    addDictionaryString(dict, index, str, length);
+    uint8_t header[3] = {flag, index, length};
+    uint8_t terminator = 0x00;
+    writeBytes(writer, header, sizeof(header));
+    writeBytes(writer, str, length);
+    writeBytes(writer, &terminator, 1);
+    return true;
+}
+
+static void addDictionaryString(CMDictionary *dictionary, uint8_t index,
+                                const char *str, uint8_t length) {
+    if (index >= dictionary->capacity)
+        return;
+
+    CMDictionaryEntry *e = &dictionary->entries[index];
+    uint32_t hash = hashBytes(str, length);
+    if (e->defined && e->hash == hash && e->length == length &&
+        memcmp(&dictionary->chars[e->offset], str, length) == 0)
+        return;
+    if (dictionary->charsCapacity - dictionary->charsUsed < length + 1u)
+        return;
 
-    uint32_t i = *(uint32_t *) &reader->message[reader->readSize + 1];
+    e->hash = hash;
+    e->offset = dictionary->charsUsed;
+    e->length = length;
+    e->defined = true;
+    memcpy(&dictionary->chars[e->offset], str, length);
+    dictionary->chars[e->offset + length] = '\0';
+    dictionary->charsUsed += length + 1u;
+    if (dictionary->count <= index) {
+        dictionary->count = index + 1u;
+    }
+}
 
-    reader->readSize += 1 + sizeof(uint32_t);
-    return i;
+static void updateDictionary(CompositeMessageReader *reader, uint32_t offset) {
+    if (reader->dictionary == NULL)
+        return;
+
+    const uint8_t *m = reader->message;
+    uint32_t o = reader->dictionaryOffset;
+    while (o < offset) {
+        const FlagInfo *info = &flagInfo[m[o]];
+        if (info->kind == CM_KIND_MESSAGE) {
+            // strings of embedded message are a part of the same session
+            o += info->headerSize;
+            continue;
+        }
+        uint64_t size = getElementSize(reader, o);
+        if (size == 0 || size > offset - o)
+            break;
+        // unterminated definition is reported when it is read
+        if (info->kind == CM_KIND_DEFINITION && m[o + 3 + m[o + 2]] == 0) {
+            addDictionaryString(reader->dictionary, m[o + 1],
+                                (const char *) &m[o + 3], m[o + 2]);
+        }
+        o += (uint32_t) size;
+    }
+    // incomplete element is scanned again after more bytes are received
+    if (o > reader->dictionaryOffset) {
+        reader->dictionaryOffset = o;
+    }
 }
 
-static bool ensureSpace(CompositeMessageWriter *writer, uint32_t size) {
-    if (writer->firstError != CM_ERROR_NONE)
-        return false;
+static const char *getStringAt(CompositeMessageReader *reader, uint32_t offset,
+                               uint8_t *length) {
+    const uint8_t *m = reader->message;
+    uint8_t flag = m[offset];
+    if (flag == CM_NAME) {
+        *length = m[offset + 1];
+        // view is used as C string, so terminator must be in message
+        if (m[offset + 2 + *length] != 0)
+            return NULL;
+        return (const char *) &m[offset + 2];
+    }
+    if (flag == CM_NAME_DEFINITION || flag == CM_STRING_DEFINITION) {
+        if (m[offset + 3 + m[offset + 2]] != 0)
+            return NULL;
+        if (reader->dictionary != NULL) {
+            addDictionaryString(reader->dictionary, m[offset + 1],
+                                (const char *) &m[offset + 3], m[offset + 2]);
+        }
+        *length = m[offset + 2];
+        return (const char *) &m[offset + 3];
+    }
 
-    if (writer->bufferSize - writer->usedSize < size) {
-        writer->firstError = CM_ERROR_NO_SPACE;
+    CMDictionary *dict = reader->dictionary;
+    if (dict == NULL)
+        return NULL;
+    // definition may be stored in any element that precedes reference
+    updateDictionary(reader, offset);
+    uint8_t index = m[offset + 1];
+    if (index >= dict->count || !dict->entries[index].defined)
+        return NULL;
+    *length = dict->entries[index].length;
+    return &dict->chars[dict->entries[index].offset];
+}
+
+static const char *readDictionaryString(CompositeMessageReader *reader,
+                                        uint8_t *length, bool move) {
+    *length = 0;
+    if (reader->firstError != CM_ERROR_NONE || !ensureAvailable(reader, 1))
+        return NULL;
+
+    uint32_t size = (uint32_t) getElementSize(reader, reader->readSize);
+    if (!ensureAvailable(reader, size))
+        return NULL;
+    const char *str = getStringAt(reader, reader->readSize, length);
+    if (str == NULL) {
+        reader->firstError = CM_ERROR_NO_VALUE;
+        return NULL;
+    }
+    if (move) {
+        reader->readSize += size;
+    }
+    return str;
+}
+
+static bool isDictionaryString(const CompositeMessageReader *reader) {
+    if (reader->firstError != CM_ERROR_NONE || reader->readSize >= reader->totalSize)
         return false;
+    uint8_t flag = reader->message[reader->readSize];
+    return flag == CM_STRING_DEFINITION || flag == CM_STRING_REFERENCE;
+}
+
+static void writeFlag(CompositeMessageWriter *writer, uint8_t flag) {
+    writeBytes(writer, &flag, 1);
+}
+
+static void readFlag(CompositeMessageReader *reader, uint8_t flag) {
+    if (checkValue(reader, flag, 0)) {
+        ++reader->readSize;
     }
+}
 
-    return true;
+static uint64_t getElementSize(const CompositeMessageReader *reader,
+                               uint32_t offset) {
+    uint32_t available = reader->totalSize - offset;
+    const FlagInfo *info = &flagInfo[reader->message[offset]];
+    if (info->kind == CM_KIND_FIXED)
+        return info->headerSize + info->itemSize;
+
+    // incomplete header is reported as element of header size
+    if (available < info->headerSize)
+        return info->headerSize;
+    if (info->kind == CM_KIND_ARRAY || info->kind == CM_KIND_MESSAGE) {
+        return info->headerSize +
+               (uint64_t) readU32(reader, offset + 1) * info->itemSize;
+    } else if (info->kind == CM_KIND_NAME) {
+        // name is followed by null terminator
+        return info->headerSize + reader->message[offset + 1] + 1u;
+    } else if (info->kind == CM_KIND_MARKER) {
+        return info->headerSize + reader->message[offset + 1];
+    } else if (info->kind == CM_KIND_DEFINITION) {
+        // index and length are followed by chars and null terminator
+        return info->headerSize + reader->message[offset + 2] + 1u;
+    } else if (info->kind == CM_KIND_ENCODED) {
+        return getEncodedElementSize(&reader->message[offset], available);
+    } else if (info->kind == CM_KIND_TABLE) {
+        uint8_t columnCount = reader->message[offset + 5];
+        if (available < info->headerSize + columnCount)
+            return info->headerSize + columnCount;
+        uint32_t recordSize = getRecordSize(&reader->message[offset + 6],
+                                            columnCount);
+        if (recordSize == 0)
+            return 0;
+        return info->headerSize + columnCount +
+               (uint64_t) readU32(reader, offset + 1) * recordSize;
+    }
+    return 0;
 }
 
-static bool checkValue(CompositeMessageReader *reader,
-                       uint8_t type, uint8_t size) {
+static uint64_t getEncodedElementSize(const uint8_t *data, uint32_t available) {
+    // incomplete element is reported as larger than available bytes
+    if (isVarint(data[0])) {
+        uint64_t value;
+        uint32_t size = decodeVarint(&data[1], available - 1, &value);
+        if (size != 0)
+            return 1u + size;
+        return available - 1 < CM_MAX_VARINT_SIZE ? (uint64_t) available + 1 : 0;
+    }
+
+    EncodedArrayHeader header;
+    uint32_t size = parseEncodedHeader(data, available, &header);
+    if (size != 0)
+        return (uint64_t) size + header.payloadSize;
+    return available < CM_MAX_ENCODED_HEADER_SIZE ? (uint64_t) available + 1 : 0;
+}
+
+static uint32_t getRecordSize(const uint8_t *columns, uint8_t columnCount) {
+    uint32_t size = 0;
+    for (uint8_t i = 0; i < columnCount; ++i) {
+        // columns hold only values of primitive types
+        if (columns[i] == 0 || columns[i] >= 0x20u)
+            return 0;
+        size += flagInfo[columns[i]].itemSize;
+    }
+    return size;
+}
+
+static const uint8_t *checkRecordTable(CompositeMessageReader *reader,
+                                       uint32_t *recordCount) {
     if (reader->firstError != CM_ERROR_NONE)
-        return false;
+        return NULL;
+    if (!ensureAvailable(reader, 1))
+        return NULL;
+    if (reader->message[reader->readSize] != CM_RECORD_TABLE) {
+        reader->firstError = CM_ERROR_NO_VALUE;
+        return NULL;
+    }
 
-    if (reader->readSize + 1 + size > reader->totalSize ||
-        reader->message[reader->readSize] != type) {
+    uint64_t size = getElementSize(reader, reader->readSize);
+    if (size == 0 || size > UINT32_MAX) {
         reader->firstError = CM_ERROR_NO_VALUE;
-        return false;
+        return NULL;
     }
+    if (!ensureAvailable(reader, (uint32_t) size))
+        return NULL;
 
-    return true;
+    *recordCount = readU32(reader, reader->readSize + 1);
+    return &reader->message[reader->readSize + 5];
 }
 
-static bool writeValue(CompositeMessageWriter *writer, void *val, uint8_t len,
-                       uint8_t type) {
-    if (writer->firstError != CM_ERROR_NONE)
+static uint32_t getFieldSize(CompositeMessageReader *reader) {
+    uint32_t offset = reader->readSize;
+    uint32_t depth = 0;
+    for (;;) {
+        if (offset >= reader->totalSize) {
+            break;
+        }
+        uint8_t flag = reader->message[offset];
+        uint64_t size = getElementSize(reader, offset);
+        if (size == 0 || (depth == 0 && (flag == CM_BLOCK_END ||
+                                         flag == CM_METADATA_END))) {
+            // unknown element or end of current block
+            reader->firstError = CM_ERROR_NO_VALUE;
+            return 0;
+        }
+        if (size > reader->totalSize - offset) {
+            break;
+        }
+        offset += (uint32_t) size;
+
+        if (flag == CM_BLOCK_START || flag == CM_METADATA_START) {
+            ++depth;
+        } else if (flag == CM_BLOCK_END || flag == CM_METADATA_END) {
+            --depth;
+        }
+        // name and padding are parts of field that follows them
+        if (depth == 0 && !isName(flag) && flag != CM_PADDING) {
+            return offset - reader->readSize;
+        }
+    }
+    // field continues past the end of available bytes
+    ensureAvailable(reader, reader->totalSize - reader->readSize + 1);
+    return 0;
+}
+
+static bool getReaderAt(CompositeMessageReader *reader,
+                        const CMIndexEntry *entry, CompositeMessageReader *copy) {
+    if (reader->firstError != CM_ERROR_NONE)
         return false;
-    if (!ensureSpace(writer, 1 + len))
+    if (entry->offset < 2 || entry->offset >= reader->totalSize) {
+        reader->firstError = CM_ERROR_INVALID_ARG;
         return false;
-    uint8_t flag = getTypeFlag(type, len);
-    if (flag == 0) {
+    }
+    *copy = *reader;
+    copy->readSize = entry->offset;
+    return true;
+}
+
+static bool readValueAt(CompositeMessageReader *reader, const CMIndexEntry *entry,
+                        void *val, uint8_t len, uint8_t type) {
+    CompositeMessageReader copy;
+    if (!getReaderAt(reader, entry, &copy))
+        return false;
+    bool result = readValue(&copy, val, len, type);
+    reader->firstError = copy.firstError;
+    return result;
+}
+
+static uint32_t hashBytes(const void *data, uint32_t size) {
+    const uint8_t *d = (const uint8_t *) data;
+    uint32_t hash = FNV_OFFSET_BASIS;
+    for (uint32_t i = 0; i < size; ++i) {
+        hash ^= d[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+static void compactStream(CompositeMessageReader *reader, uint32_t size) {
+    uint8_t *m = (uint8_t *) reader->message;
+    if (reader->capacity - reader->totalSize < size && reader->readSize > 2) {
+        // drop everything that was already read but keep endianness mark,
+        // dropped bytes are hashed first so CRC can still be verified
+        uint32_t unread = reader->totalSize - reader->readSize;
+        if (reader->crcOffset < reader->readSize) {
+            updateReaderCrc(reader, reader->readSize);
+        }
+        reader->crcOffset = reader->crcOffset - reader->readSize + 2;
+        // strings of dropped elements are stored before they are lost
+        if (reader->dictionary != NULL) {
+            updateDictionary(reader, reader->readSize);
+            if (reader->dictionaryOffset < reader->readSize) {
+                reader->dictionaryOffset = reader->readSize;
+            }
+            reader->dictionaryOffset = reader->dictionaryOffset - reader->readSize + 2;
+        }
+        memmove(&m[2], &m[reader->readSize], unread);
+        reader->readSize = 2;
+        reader->totalSize = 2 + unread;
+    }
+
+}
+
+static void writeCompressedBlocks(CompositeMessageWriter *writer,
+                                  const CMCompressor *compressor,
+                                  const uint8_t *data, uint32_t size) {
+    if (writer->firstError != CM_ERROR_NONE)
+        return;
+    uint32_t blockSize = compressor->blockSize;
+    if (blockSize == 0) {
         writer->firstError = CM_ERROR_INVALID_ARG;
+        return;
+    }
+    if (writer->flush != NULL) {
+        // each block must fit in buffer of stream writer
+        if (writer->bufferSize <= CM_SIZEOF_COMPRESSED_HEADER) {
+            writer->firstError = CM_ERROR_NO_SPACE;
+            return;
+        }
+        if (blockSize > writer->bufferSize - CM_SIZEOF_COMPRESSED_HEADER) {
+            blockSize = writer->bufferSize - CM_SIZEOF_COMPRESSED_HEADER;
+        }
+    }
+
+    while (size > 0) {
+        uint32_t n = size < blockSize ? size : blockSize;
+        uint8_t header[CM_SIZEOF_COMPRESSED_HEADER];
+        uint32_t headerSize = 2 + sizeof(uint32_t);
+        headerSize += encodeVarint(n, &header[headerSize]);
+        uint8_t *out = (uint8_t *) cmReserveBytes(writer, headerSize + n);
+        if (out == NULL)
+            return;
+
+        // block is compressed only if it gets smaller, so space for stored
+        // block is always enough
+        uint8_t codec = compressor->codec;
+        uint32_t compressedSize = 0;
+        if (compressor->compress != NULL && n > 1) {
+            compressedSize = compressor->compress(compressor->context, data, n,
+                                                  &out[headerSize], n - 1);
+        }
+        if (compressedSize == 0 || compressedSize >= n) {
+            codec = CM_COMPRESSION_STORED;
+            compressedSize = n;
+            memcpy(&out[headerSize], data, n);
+        }
+
+        uint32_t elementSize = headerSize - 1 - (uint32_t) sizeof(uint32_t) + compressedSize;
+        header[0] = CM_COMPRESSED;
+        memcpy(&header[1], &elementSize, sizeof(elementSize));
+        header[1 + sizeof(uint32_t)] = codec;
+        memcpy(out, header, headerSize);
+        cmCommitBytes(writer, headerSize + compressedSize);
+        data += n;
+        size -= n;
+    }
+}
+
+static uint32_t lz4Compress(void *context, const void *data, uint32_t size,
+                            void *output, uint32_t capacity) {
+    CMLz4WorkBuffer *work = (CMLz4WorkBuffer *) context;
+    const uint8_t *in = (const uint8_t *) data;
+    uint8_t *out = (uint8_t *) output;
+    // positions are stored as uint16
+    if (size > UINT16_MAX)
+        return 0;
+
+    uint32_t used = 0;
+    uint32_t anchor = 0;
+    if (size > CM_LZ4_MATCH_LIMIT) {
+        memset(work->table, 0, sizeof(work->table));
+        uint32_t matchLimit = size - CM_LZ4_MATCH_LIMIT;
+        uint32_t endLimit = size - CM_LZ4_LAST_LITERALS;
+        uint32_t pos = 0;
+        while (pos < matchLimit) {
+            uint32_t sequence;
+            memcpy(&sequence, &in[pos], sizeof(sequence));
+            uint32_t h = (sequence * 2654435761u) >> (32u - CM_LZ4_HASH_LOG);
+            uint32_t candidate = work->table[h];
+            work->table[h] = (uint16_t) pos;
+
+            uint32_t found;
+            if (candidate < pos) {
+                memcpy(&found, &in[candidate], sizeof(found));
+            }
+            if (candidate >= pos || found != sequence) {
+                // step grows in data without matches, so it's skipped faster
+                pos += 1u + ((pos - anchor) >> 6u);
+                continue;
+            }
+
+            uint32_t end = pos + CM_LZ4_MIN_MATCH;
+            while (end < endLimit && in[end] == in[end - pos + candidate]) {
+                ++end;
+            }
+            if (!putLz4Sequence(out, &used, capacity, &in[anchor], pos - anchor,
+                                pos - candidate, end - pos))
+                return 0;
+            pos = end;
+            anchor = end;
+        }
+    }
+    if (!putLz4Sequence(out, &used, capacity, &in[anchor], size - anchor, 0, 0))
+        return 0;
+    return used;
+}
+
+static bool lz4Decompress(void *context, const void *data, uint32_t size,
+                          void *output, uint32_t outputSize) {
+    (void) context;
+    const uint8_t *in = (const uint8_t *) data;
+    uint8_t *out = (uint8_t *) output;
+    uint32_t pos = 0;
+    uint32_t produced = 0;
+    while (pos < size) {
+        uint8_t token = in[pos++];
+        uint32_t length = token >> 4u;
+        if (!takeLz4Length(in, size, &pos, &length, outputSize - produced) ||
+            length > size - pos)
+            return false;
+        memcpy(&out[produced], &in[pos], length);
+        pos += length;
+        produced += length;
+        // last sequence has only literals
+        if (pos == size)
+            break;
+
+        if (size - pos < 2)
+            return false;
+        uint32_t offset = in[pos] | (uint32_t) in[pos + 1] << 8u;
+        pos += 2;
+        if (offset == 0 || offset > produced)
+            return false;
+        length = token & 0x0Fu;
+        if (outputSize - produced < CM_LZ4_MIN_MATCH ||
+            !takeLz4Length(in, size, &pos, &length,
+                           outputSize - produced - CM_LZ4_MIN_MATCH))
+            return false;
+        length += CM_LZ4_MIN_MATCH;
+
+        // match that overlaps bytes it produces repeats with period of
+        // offset, so it's copied in chunks that double each time
+        const uint8_t *match = &out[produced - offset];
+        uint32_t chunk = offset;
+        produced += length;
+        uint8_t *dst = &out[produced - length];
+        while (length > 0) {
+            if (chunk > length) {
+                chunk = length;
+            }
+            memcpy(dst, match, chunk);
+            dst += chunk;
+            length -= chunk;
+            chunk = (uint32_t) (dst - match);
+        }
+    }
+    return produced == outputSize;
+}
+
+static bool putLz4Sequence(uint8_t *output, uint32_t *used, uint32_t capacity,
+                           const uint8_t *literals, uint32_t literalCount,
+                           uint32_t offset, uint32_t matchLength) {
+    uint32_t matchCount = matchLength != 0 ? matchLength - CM_LZ4_MIN_MATCH : 0;
+    uint64_t size = 1u + (uint64_t) literalCount +
+                    (literalCount >= 15u ? (literalCount - 15u) / 255u + 1u : 0u);
+    if (matchLength != 0) {
+        size += 2u + (matchCount >= 15u ? (matchCount - 15u) / 255u + 1u : 0u);
+    }
+    if (size > capacity - *used)
         return false;
+
+    uint8_t *o = &output[*used];
+    uint8_t *token = o++;
+    *token = (uint8_t) ((literalCount >= 15u ? 15u : literalCount) << 4u);
+    if (literalCount >= 15u) {
+        uint32_t rest = literalCount - 15u;
+        for (; rest >= 255u; rest -= 255u) {
+            *o++ = 255u;
+        }
+        *o++ = (uint8_t) rest;
     }
+    memcpy(o, literals, literalCount);
+    o += literalCount;
 
-    writer->buffer[writer->usedSize] = flag;
-    writer->usedSize++;
-    writeBytes(writer, val, len);
+    if (matchLength != 0) {
+        *o++ = (uint8_t) offset;
+        *o++ = (uint8_t) (offset >> 8u);
+        *token |= (uint8_t) (matchCount >= 15u ? 15u : matchCount);
+        if (matchCount >= 15u) {
+            uint32_t rest = matchCount - 15u;
+            for (; rest >= 255u; rest -= 255u) {
+                *o++ = 255u;
+            }
+            *o++ = (uint8_t) rest;
+        }
+    }
+    *used += (uint32_t) size;
     return true;
 }
 
-static bool readValue(CompositeMessageReader *reader, void *val, uint8_t len,
-                      uint8_t type) {
-    if (reader->firstError != CM_ERROR_NONE)
+static bool takeLz4Length(const uint8_t *data, uint32_t size, uint32_t *pos,
+                          uint32_t *length, uint32_t limit) {
+    if (*length == 15u) {
+        uint8_t byte;
+        do {
+            if (*pos >= size || *length > limit)
+                return false;
+            byte = data[(*pos)++];
+            *length += byte;
+        } while (byte == 255u);
+    }
+    return *length <= limit;
+}
+
+#if defined(CM_CRC32_SLICING)
+// crcTable[k][n] is CRC of byte n followed by k zero bytes
+static const uint32_t crcTable[8][256] = {
+        {
+                0x00000000u, 0x77073096u, 0xEE0E612Cu, 0x990951BAu, 0x076DC419u, 0x706AF48Fu,
+                0xE963A535u, 0x9E6495A3u, 0x0EDB8832u, 0x79DCB8A4u, 0xE0D5E91Eu, 0x97D2D988u,
+                0x09B64C2Bu, 0x7EB17CBDu, 0xE7B82D07u, 0x90BF1D91u, 0x1DB71064u, 0x6AB020F2u,
+                0xF3B97148u, 0x84BE41DEu, 0x1ADAD47Du, 0x6DDDE4EBu, 0xF4D4B551u, 0x83D385C7u,
+                0x136C9856u, 0x646BA8C0u, 0xFD62F97Au, 0x8A65C9ECu, 0x14015C4Fu, 0x63066CD9u,
+                0xFA0F3D63u, 0x8D080DF5u, 0x3B6E20C8u, 0x4C69105Eu, 0xD56041E4u, 0xA2677172u,
+                0x3C03E4D1u, 0x4B04D447u, 0xD20D85FDu, 0xA50AB56Bu, 0x35B5A8FAu, 0x42B2986Cu,
+                0xDBBBC9D6u, 0xACBCF940u, 0x32D86CE3u, 0x45DF5C75u, 0xDCD60DCFu, 0xABD13D59u,
+                0x26D930ACu, 0x51DE003Au, 0xC8D75180u, 0xBFD06116u, 0x21B4F4B5u, 0x56B3C423u,
+                0xCFBA9599u, 0xB8BDA50Fu, 0x2802B89Eu, 0x5F058808u, 0xC60CD9B2u, 0xB10BE924u,
+                0x2F6F7C87u, 0x58684C11u, 0xC1611DABu, 0xB6662D3Du, 0x76DC4190u, 0x01DB7106u,
+                0x98D220BCu, 0xEFD5102Au, 0x71B18589u, 0x06B6B51Fu, 0x9FBFE4A5u, 0xE8B8D433u,
+                0x7807C9A2u, 0x0F00F934u, 0x9609A88Eu, 0xE10E9818u, 0x7F6A0DBBu, 0x086D3D2Du,
+                0x91646C97u, 0xE6635C01u, 0x6B6B51F4u, 0x1C6C6162u, 0x856530D8u, 0xF262004Eu,
+                0x6C0695EDu, 0x1B01A57Bu, 0x8208F4C1u, 0xF50FC457u, 0x65B0D9C6u, 0x12B7E950u,
+                0x8BBEB8EAu, 0xFCB9887Cu, 0x62DD1DDFu, 0x15DA2D49u, 0x8CD37CF3u, 0xFBD44C65u,
+                0x4DB26158u, 0x3AB551CEu, 0xA3BC0074u, 0xD4BB30E2u, 0x4ADFA541u, 0x3DD895D7u,
+                0xA4D1C46Du, 0xD3D6F4FBu, 0x4369E96Au, 0x346ED9FCu, 0xAD678846u, 0xDA60B8D0u,
+                0x44042D73u, 0x33031DE5u, 0xAA0A4C5Fu, 0xDD0D7CC9u, 0x5005713Cu, 0x270241AAu,
+                0xBE0B1010u, 0xC90C2086u, 0x5768B525u, 0x206F85B3u, 0xB966D409u, 0xCE61E49Fu,
+                0x5EDEF90Eu, 0x29D9C998u, 0xB0D09822u, 0xC7D7A8B4u, 0x59B33D17u, 0x2EB40D81u,
+                0xB7BD5C3Bu, 0xC0BA6CADu, 0xEDB88320u, 0x9ABFB3B6u, 0x03B6E20Cu, 0x74B1D29Au,
+                0xEAD54739u, 0x9DD277AFu, 0x04DB2615u, 0x73DC1683u, 0xE3630B12u, 0x94643B84u,
+                0x0D6D6A3Eu, 0x7A6A5AA8u, 0xE40ECF0Bu, 0x9309FF9Du, 0x0A00AE27u, 0x7D079EB1u,
+                0xF00F9344u, 0x8708A3D2u, 0x1E01F268u, 0x6906C2FEu, 0xF762575Du, 0x806567CBu,
+                0x196C3671u, 0x6E6B06E7u, 0xFED41B76u, 0x89D32BE0u, 0x10DA7A5Au, 0x67DD4ACCu,
+                0xF9B9DF6Fu, 0x8EBEEFF9u, 0x17B7BE43u, 0x60B08ED5u, 0xD6D6A3E8u, 0xA1D1937Eu,
+                0x38D8C2C4u, 0x4FDFF252u, 0xD1BB67F1u, 0xA6BC5767u, 0x3FB506DDu, 0x48B2364Bu,
+                0xD80D2BDAu, 0xAF0A1B4Cu, 0x36034AF6u, 0x41047A60u, 0xDF60EFC3u, 0xA867DF55u,
+                0x316E8EEFu, 0x4669BE79u, 0xCB61B38Cu, 0xBC66831Au, 0x256FD2A0u, 0x5268E236u,
+                0xCC0C7795u, 0xBB0B4703u, 0x220216B9u, 0x5505262Fu, 0xC5BA3BBEu, 0xB2BD0B28u,
+                0x2BB45A92u, 0x5CB36A04u, 0xC2D7FFA7u, 0xB5D0CF31u, 0x2CD99E8Bu, 0x5BDEAE1Du,
+                0x9B64C2B0u, 0xEC63F226u, 0x756AA39Cu, 0x026D930Au, 0x9C0906A9u, 0xEB0E363Fu,
+                0x72076785u, 0x05005713u, 0x95BF4A82u, 0xE2B87A14u, 0x7BB12BAEu, 0x0CB61B38u,
+                0x92D28E9Bu, 0xE5D5BE0Du, 0x7CDCEFB7u, 0x0BDBDF21u, 0x86D3D2D4u, 0xF1D4E242u,
+                0x68DDB3F8u, 0x1FDA836Eu, 0x81BE16CDu, 0xF6B9265Bu, 0x6FB077E1u, 0x18B74777u,
+                0x88085AE6u, 0xFF0F6A70u, 0x66063BCAu, 0x11010B5Cu, 0x8F659EFFu, 0xF862AE69u,
+                0x616BFFD3u, 0x166CCF45u, 0xA00AE278u, 0xD70DD2EEu, 0x4E048354u, 0x3903B3C2u,
+                0xA7672661u, 0xD06016F7u, 0x4969474Du, 0x3E6E77DBu, 0xAED16A4Au, 0xD9D65ADCu,
+                0x40DF0B66u, 0x37D83BF0u, 0xA9BCAE53u, 0xDEBB9EC5u, 0x47B2CF7Fu, 0x30B5FFE9u,
+                0xBDBDF21Cu, 0xCABAC28Au, 0x53B39330u, 0x24B4A3A6u, 0xBAD03605u, 0xCDD70693u,
+                0x54DE5729u, 0x23D967BFu, 0xB3667A2Eu, 0xC4614AB8u, 0x5D681B02u, 0x2A6F2B94u,
+                0xB40BBE37u, 0xC30C8EA1u, 0x5A05DF1Bu, 0x2D02EF8Du
+        },
+        {
+                0x00000000u, 0x191B3141u, 0x32366282u, 0x2B2D53C3u, 0x646CC504u, 0x7D77F445u,
+                0x565AA786u, 0x4F4196C7u, 0xC8D98A08u, 0xD1C2BB49u, 0xFAEFE88Au, 0xE3F4D9CBu,
+                0xACB54F0Cu, 0xB5AE7E4Du, 0x9E832D8Eu, 0x87981CCFu, 0x4AC21251u, 0x53D92310u,
+                0x78F470D3u, 0x61EF4192u, 0x2EAED755u, 0x37B5E614u, 0x1C98B5D7u, 0x05838496u,
+                0x821B9859u, 0x9B00A918u, 0xB02DFADBu, 0xA936CB9Au, 0xE6775D5Du, 0xFF6C6C1Cu,
+                0xD4413FDFu, 0xCD5A0E9Eu, 0x958424A2u, 0x8C9F15E3u, 0xA7B24620u, 0xBEA97761u,
+                0xF1E8E1A6u, 0xE8F3D0E7u, 0xC3DE8324u, 0xDAC5B265u, 0x5D5DAEAAu, 0x44469FEBu,
+                0x6F6BCC28u, 0x7670FD69u, 0x39316BAEu, 0x202A5AEFu, 0x0B07092Cu, 0x121C386Du,
+                0xDF4636F3u, 0xC65D07B2u, 0xED705471u, 0xF46B6530u, 0xBB2AF3F7u, 0xA231C2B6u,
+                0x891C9175u, 0x9007A034u, 0x179FBCFBu, 0x0E848DBAu, 0x25A9DE79u, 0x3CB2EF38u,
+                0x73F379FFu, 0x6AE848BEu, 0x41C51B7Du, 0x58DE2A3Cu, 0xF0794F05u, 0xE9627E44u,
+                0xC24F2D87u, 0xDB541CC6u, 0x94158A01u, 0x8D0EBB40u, 0xA623E883u, 0xBF38D9C2u,
+                0x38A0C50Du, 0x21BBF44Cu, 0x0A96A78Fu, 0x138D96CEu, 0x5CCC0009u, 0x45D73148u,
+                0x6EFA628Bu, 0x77E153CAu, 0xBABB5D54u, 0xA3A06C15u, 0x888D3FD6u, 0x91960E97u,
+                0xDED79850u, 0xC7CCA911u, 0xECE1FAD2u, 0xF5FACB93u, 0x7262D75Cu, 0x6B79E61Du,
+                0x4054B5DEu, 0x594F849Fu, 0x160E1258u, 0x0F152319u, 0x243870DAu, 0x3D23419Bu,
+                0x65FD6BA7u, 0x7CE65AE6u, 0x57CB0925u, 0x4ED03864u, 0x0191AEA3u, 0x188A9FE2u,
+                0x33A7CC21u, 0x2ABCFD60u, 0xAD24E1AFu, 0xB43FD0EEu, 0x9F12832Du, 0x8609B26Cu,
+                0xC94824ABu, 0xD05315EAu, 0xFB7E4629u, 0xE2657768u, 0x2F3F79F6u, 0x362448B7u,
+                0x1D091B74u, 0x04122A35u, 0x4B53BCF2u, 0x52488DB3u, 0x7965DE70u, 0x607EEF31u,
+                0xE7E6F3FEu, 0xFEFDC2BFu, 0xD5D0917Cu, 0xCCCBA03Du, 0x838A36FAu, 0x9A9107BBu,
+                0xB1BC5478u, 0xA8A76539u, 0x3B83984Bu, 0x2298A90Au, 0x09B5FAC9u, 0x10AECB88u,
+                0x5FEF5D4Fu, 0x46F46C0Eu, 0x6DD93FCDu, 0x74C20E8Cu, 0xF35A1243u, 0xEA412302u,
+                0xC16C70C1u, 0xD8774180u, 0x9736D747u, 0x8E2DE606u, 0xA500B5C5u, 0xBC1B8484u,
+                0x71418A1Au, 0x685ABB5Bu, 0x4377E898u, 0x5A6CD9D9u, 0x152D4F1Eu, 0x0C367E5Fu,
+                0x271B2D9Cu, 0x3E001CDDu, 0xB9980012u, 0xA0833153u, 0x8BAE6290u, 0x92B553D1u,
+                0xDDF4C516u, 0xC4EFF457u, 0xEFC2A794u, 0xF6D996D5u, 0xAE07BCE9u, 0xB71C8DA8u,
+                0x9C31DE6Bu, 0x852AEF2Au, 0xCA6B79EDu, 0xD37048ACu, 0xF85D1B6Fu, 0xE1462A2Eu,
+                0x66DE36E1u, 0x7FC507A0u, 0x54E85463u, 0x4DF36522u, 0x02B2F3E5u, 0x1BA9C2A4u,
+                0x30849167u, 0x299FA026u, 0xE4C5AEB8u, 0xFDDE9FF9u, 0xD6F3CC3Au, 0xCFE8FD7Bu,
+                0x80A96BBCu, 0x99B25AFDu, 0xB29F093Eu, 0xAB84387Fu, 0x2C1C24B0u, 0x350715F1u,
+                0x1E2A4632u, 0x07317773u, 0x4870E1B4u, 0x516BD0F5u, 0x7A468336u, 0x635DB277u,
+                0xCBFAD74Eu, 0xD2E1E60Fu, 0xF9CCB5CCu, 0xE0D7848Du, 0xAF96124Au, 0xB68D230Bu,
+                0x9DA070C8u, 0x84BB4189u, 0x03235D46u, 0x1A386C07u, 0x31153FC4u, 0x280E0E85u,
+                0x674F9842u, 0x7E54A903u, 0x5579FAC0u, 0x4C62CB81u, 0x8138C51Fu, 0x9823F45Eu,
+                0xB30EA79Du, 0xAA1596DCu, 0xE554001Bu, 0xFC4F315Au, 0xD7626299u, 0xCE7953D8u,
+                0x49E14F17u, 0x50FA7E56u, 0x7BD72D95u, 0x62CC1CD4u, 0x2D8D8A13u, 0x3496BB52u,
+                0x1FBBE891u, 0x06A0D9D0u, 0x5E7EF3ECu, 0x4765C2ADu, 0x6C48916Eu, 0x7553A02Fu,
+                0x3A1236E8u, 0x230907A9u, 0x0824546Au, 0x113F652Bu, 0x96A779E4u, 0x8FBC48A5u,
+                0xA4911B66u, 0xBD8A2A27u, 0xF2CBBCE0u, 0xEBD08DA1u, 0xC0FDDE62u, 0xD9E6EF23u,
+                0x14BCE1BDu, 0x0DA7D0FCu, 0x268A833Fu, 0x3F91B27Eu, 0x70D024B9u, 0x69CB15F8u,
+                0x42E6463Bu, 0x5BFD777Au, 0xDC656BB5u, 0xC57E5AF4u, 0xEE530937u, 0xF7483876u,
+                0xB809AEB1u, 0xA1129FF0u, 0x8A3FCC33u, 0x9324FD72u
+        },
+        {
+                0x00000000u, 0x01C26A37u, 0x0384D46Eu, 0x0246BE59u, 0x0709A8DCu, 0x06CBC2EBu,
+                0x048D7CB2u, 0x054F1685u, 0x0E1351B8u, 0x0FD13B8Fu, 0x0D9785D6u, 0x0C55EFE1u,
+                0x091AF964u, 0x08D89353u, 0x0A9E2D0Au, 0x0B5C473Du, 0x1C26A370u, 0x1DE4C947u,
+                0x1FA2771Eu, 0x1E601D29u, 0x1B2F0BACu, 0x1AED619Bu, 0x18ABDFC2u, 0x1969B5F5u,
+                0x1235F2C8u, 0x13F798FFu, 0x11B126A6u, 0x10734C91u, 0x153C5A14u, 0x14FE3023u,
+                0x16B88E7Au, 0x177AE44Du, 0x384D46E0u, 0x398F2CD7u, 0x3BC9928Eu, 0x3A0BF8B9u,
+                0x3F44EE3Cu, 0x3E86840Bu, 0x3CC03A52u, 0x3D025065u, 0x365E1758u, 0x379C7D6Fu,
+                0x35DAC336u, 0x3418A901u, 0x3157BF84u, 0x3095D5B3u, 0x32D36BEAu, 0x331101DDu,
+                0x246BE590u, 0x25A98FA7u, 0x27EF31FEu, 0x262D5BC9u, 0x23624D4Cu, 0x22A0277Bu,
+                0x20E69922u, 0x2124F315u, 0x2A78B428u, 0x2BBADE1Fu, 0x29FC6046u, 0x283E0A71u,
+                0x2D711CF4u, 0x2CB376C3u, 0x2EF5C89Au, 0x2F37A2ADu, 0x709A8DC0u, 0x7158E7F7u,
+                0x731E59AEu, 0x72DC3399u, 0x7793251Cu, 0x76514F2Bu, 0x7417F172u, 0x75D59B45u,
+                0x7E89DC78u, 0x7F4BB64Fu, 0x7D0D0816u, 0x7CCF6221u, 0x798074A4u, 0x78421E93u,
+                0x7A04A0CAu, 0x7BC6CAFDu, 0x6CBC2EB0u, 0x6D7E4487u, 0x6F38FADEu, 0x6EFA90E9u,
+                0x6BB5866Cu, 0x6A77EC5Bu, 0x68315202u, 0x69F33835u, 0x62AF7F08u, 0x636D153Fu,
+                0x612BAB66u, 0x60E9C151u, 0x65A6D7D4u, 0x6464BDE3u, 0x662203BAu, 0x67E0698Du,
+                0x48D7CB20u, 0x4915A117u, 0x4B531F4Eu, 0x4A917579u, 0x4FDE63FCu, 0x4E1C09CBu,
+                0x4C5AB792u, 0x4D98DDA5u, 0x46C49A98u, 0x4706F0AFu, 0x45404EF6u, 0x448224C1u,
+                0x41CD3244u, 0x400F5873u, 0x4249E62Au, 0x438B8C1Du, 0x54F16850u, 0x55330267u,
+                0x5775BC3Eu, 0x56B7D609u, 0x53F8C08Cu, 0x523AAABBu, 0x507C14E2u, 0x51BE7ED5u,
+                0x5AE239E8u, 0x5B2053DFu, 0x5966ED86u, 0x58A487B1u, 0x5DEB9134u, 0x5C29FB03u,
+                0x5E6F455Au, 0x5FAD2F6Du, 0xE1351B80u, 0xE0F771B7u, 0xE2B1CFEEu, 0xE373A5D9u,
+                0xE63CB35Cu, 0xE7FED96Bu, 0xE5B86732u, 0xE47A0D05u, 0xEF264A38u, 0xEEE4200Fu,
+                0xECA29E56u, 0xED60F461u, 0xE82FE2E4u, 0xE9ED88D3u, 0xEBAB368Au, 0xEA695CBDu,
+                0xFD13B8F0u, 0xFCD1D2C7u, 0xFE976C9Eu, 0xFF5506A9u, 0xFA1A102Cu, 0xFBD87A1Bu,
+                0xF99EC442u, 0xF85CAE75u, 0xF300E948u, 0xF2C2837Fu, 0xF0843D26u, 0xF1465711u,
+                0xF4094194u, 0xF5CB2BA3u, 0xF78D95FAu, 0xF64FFFCDu, 0xD9785D60u, 0xD8BA3757u,
+                0xDAFC890Eu, 0xDB3EE339u, 0xDE71F5BCu, 0xDFB39F8Bu, 0xDDF521D2u, 0xDC374BE5u,
+                0xD76B0CD8u, 0xD6A966EFu, 0xD4EFD8B6u, 0xD52DB281u, 0xD062A404u, 0xD1A0CE33u,
+                0xD3E6706Au, 0xD2241A5Du, 0xC55EFE10u, 0xC49C9427u, 0xC6DA2A7Eu, 0xC7184049u,
+                0xC25756CCu, 0xC3953CFBu, 0xC1D382A2u, 0xC011E895u, 0xCB4DAFA8u, 0xCA8FC59Fu,
+                0xC8C97BC6u, 0xC90B11F1u, 0xCC440774u, 0xCD866D43u, 0xCFC0D31Au, 0xCE02B92Du,
+                0x91AF9640u, 0x906DFC77u, 0x922B422Eu, 0x93E92819u, 0x96A63E9Cu, 0x976454ABu,
+                0x9522EAF2u, 0x94E080C5u, 0x9FBCC7F8u, 0x9E7EADCFu, 0x9C381396u, 0x9DFA79A1u,
+                0x98B56F24u, 0x99770513u, 0x9B31BB4Au, 0x9AF3D17Du, 0x8D893530u, 0x8C4B5F07u,
+                0x8E0DE15Eu, 0x8FCF8B69u, 0x8A809DECu, 0x8B42F7DBu, 0x89044982u, 0x88C623B5u,
+                0x839A6488u, 0x82580EBFu, 0x801EB0E6u, 0x81DCDAD1u, 0x8493CC54u, 0x8551A663u,
+                0x8717183Au, 0x86D5720Du, 0xA9E2D0A0u, 0xA820BA97u, 0xAA6604CEu, 0xABA46EF9u,
+                0xAEEB787Cu, 0xAF29124Bu, 0xAD6FAC12u, 0xACADC625u, 0xA7F18118u, 0xA633EB2Fu,
+                0xA4755576u, 0xA5B73F41u, 0xA0F829C4u, 0xA13A43F3u, 0xA37CFDAAu, 0xA2BE979Du,
+                0xB5C473D0u, 0xB40619E7u, 0xB640A7BEu, 0xB782CD89u, 0xB2CDDB0Cu, 0xB30FB13Bu,
+                0xB1490F62u, 0xB08B6555u, 0xBBD72268u, 0xBA15485Fu, 0xB853F606u, 0xB9919C31u,
+                0xBCDE8AB4u, 0xBD1CE083u, 0xBF5A5EDAu, 0xBE9834EDu
+        },
+        {
+                0x00000000u, 0xB8BC6765u, 0xAA09C88Bu, 0x12B5AFEEu, 0x8F629757u, 0x37DEF032u,
+                0x256B5FDCu, 0x9DD738B9u, 0xC5B428EFu, 0x7D084F8Au, 0x6FBDE064u, 0xD7018701u,
+                0x4AD6BFB8u, 0xF26AD8DDu, 0xE0DF7733u, 0x58631056u, 0x5019579Fu, 0xE8A530FAu,
+                0xFA109F14u, 0x42ACF871u, 0xDF7BC0C8u, 0x67C7A7ADu, 0x75720843u, 0xCDCE6F26u,
+                0x95AD7F70u, 0x2D111815u, 0x3FA4B7FBu, 0x8718D09Eu, 0x1ACFE827u, 0xA2738F42u,
+                0xB0C620ACu, 0x087A47C9u, 0xA032AF3Eu, 0x188EC85Bu, 0x0A3B67B5u, 0xB28700D0u,
+                0x2F503869u, 0x97EC5F0Cu, 0x8559F0E2u, 0x3DE59787u, 0x658687D1u, 0xDD3AE0B4u,
+                0xCF8F4F5Au, 0x7733283Fu, 0xEAE41086u, 0x525877E3u, 0x40EDD80Du, 0xF851BF68u,
+                0xF02BF8A1u, 0x48979FC4u, 0x5A22302Au, 0xE29E574Fu, 0x7F496FF6u, 0xC7F50893u,
+                0xD540A77Du, 0x6DFCC018u, 0x359FD04Eu, 0x8D23B72Bu, 0x9F9618C5u, 0x272A7FA0u,
+                0xBAFD4719u, 0x0241207Cu, 0x10F48F92u, 0xA848E8F7u, 0x9B14583Du, 0x23A83F58u,
+                0x311D90B6u, 0x89A1F7D3u, 0x1476CF6Au, 0xACCAA80Fu, 0xBE7F07E1u, 0x06C36084u,
+                0x5EA070D2u, 0xE61C17B7u, 0xF4A9B859u, 0x4C15DF3Cu, 0xD1C2E785u, 0x697E80E0u,
+                0x7BCB2F0Eu, 0xC377486Bu, 0xCB0D0FA2u, 0x73B168C7u, 0x6104C729u, 0xD9B8A04Cu,
+                0x446F98F5u, 0xFCD3FF90u, 0xEE66507Eu, 0x56DA371Bu, 0x0EB9274Du, 0xB6054028u,
+                0xA4B0EFC6u, 0x1C0C88A3u, 0x81DBB01Au, 0x3967D77Fu, 0x2BD27891u, 0x936E1FF4u,
+                0x3B26F703u, 0x839A9066u, 0x912F3F88u, 0x299358EDu, 0xB4446054u, 0x0CF80731u,
+                0x1E4DA8DFu, 0xA6F1CFBAu, 0xFE92DFECu, 0x462EB889u, 0x549B1767u, 0xEC277002u,
+                0x71F048BBu, 0xC94C2FDEu, 0xDBF98030u, 0x6345E755u, 0x6B3FA09Cu, 0xD383C7F9u,
+                0xC1366817u, 0x798A0F72u, 0xE45D37CBu, 0x5CE150AEu, 0x4E54FF40u, 0xF6E89825u,
+                0xAE8B8873u, 0x1637EF16u, 0x048240F8u, 0xBC3E279Du, 0x21E91F24u, 0x99557841u,
+                0x8BE0D7AFu, 0x335CB0CAu, 0xED59B63Bu, 0x55E5D15Eu, 0x47507EB0u, 0xFFEC19D5u,
+                0x623B216Cu, 0xDA874609u, 0xC832E9E7u, 0x708E8E82u, 0x28ED9ED4u, 0x9051F9B1u,
+                0x82E4565Fu, 0x3A58313Au, 0xA78F0983u, 0x1F336EE6u, 0x0D86C108u, 0xB53AA66Du,
+                0xBD40E1A4u, 0x05FC86C1u, 0x1749292Fu, 0xAFF54E4Au, 0x322276F3u, 0x8A9E1196u,
+                0x982BBE78u, 0x2097D91Du, 0x78F4C94Bu, 0xC048AE2Eu, 0xD2FD01C0u, 0x6A4166A5u,
+                0xF7965E1Cu, 0x4F2A3979u, 0x5D9F9697u, 0xE523F1F2u, 0x4D6B1905u, 0xF5D77E60u,
+                0xE762D18Eu, 0x5FDEB6EBu, 0xC2098E52u, 0x7AB5E937u, 0x680046D9u, 0xD0BC21BCu,
+                0x88DF31EAu, 0x3063568Fu, 0x22D6F961u, 0x9A6A9E04u, 0x07BDA6BDu, 0xBF01C1D8u,
+                0xADB46E36u, 0x15080953u, 0x1D724E9Au, 0xA5CE29FFu, 0xB77B8611u, 0x0FC7E174u,
+                0x9210D9CDu, 0x2AACBEA8u, 0x38191146u, 0x80A57623u, 0xD8C66675u, 0x607A0110u,
+                0x72CFAEFEu, 0xCA73C99Bu, 0x57A4F122u, 0xEF189647u, 0xFDAD39A9u, 0x45115ECCu,
+                0x764DEE06u, 0xCEF18963u, 0xDC44268Du, 0x64F841E8u, 0xF92F7951u, 0x41931E34u,
+                0x5326B1DAu, 0xEB9AD6BFu, 0xB3F9C6E9u, 0x0B45A18Cu, 0x19F00E62u, 0xA14C6907u,
+                0x3C9B51BEu, 0x842736DBu, 0x96929935u, 0x2E2EFE50u, 0x2654B999u, 0x9EE8DEFCu,
+                0x8C5D7112u, 0x34E11677u, 0xA9362ECEu, 0x118A49ABu, 0x033FE645u, 0xBB838120u,
+                0xE3E09176u, 0x5B5CF613u, 0x49E959FDu, 0xF1553E98u, 0x6C820621u, 0xD43E6144u,
+                0xC68BCEAAu, 0x7E37A9CFu, 0xD67F4138u, 0x6EC3265Du, 0x7C7689B3u, 0xC4CAEED6u,
+                0x591DD66Fu, 0xE1A1B10Au, 0xF3141EE4u, 0x4BA87981u, 0x13CB69D7u, 0xAB770EB2u,
+                0xB9C2A15Cu, 0x017EC639u, 0x9CA9FE80u, 0x241599E5u, 0x36A0360Bu, 0x8E1C516Eu,
+                0x866616A7u, 0x3EDA71C2u, 0x2C6FDE2Cu, 0x94D3B949u, 0x090481F0u, 0xB1B8E695u,
+                0xA30D497Bu, 0x1BB12E1Eu, 0x43D23E48u, 0xFB6E592Du, 0xE9DBF6C3u, 0x516791A6u,
+                0xCCB0A91Fu, 0x740CCE7Au, 0x66B96194u, 0xDE0506F1u
+        },
+        {
+                0x00000000u, 0x3D6029B0u, 0x7AC05360u, 0x47A07AD0u, 0xF580A6C0u, 0xC8E08F70u,
+                0x8F40F5A0u, 0xB220DC10u, 0x30704BC1u, 0x0D106271u, 0x4AB018A1u, 0x77D03111u,
+                0xC5F0ED01u, 0xF890C4B1u, 0xBF30BE61u, 0x825097D1u, 0x60E09782u, 0x5D80BE32u,
+                0x1A20C4E2u, 0x2740ED52u, 0x95603142u, 0xA80018F2u, 0xEFA06222u, 0xD2C04B92u,
+                0x5090DC43u, 0x6DF0F5F3u, 0x2A508F23u, 0x1730A693u, 0xA5107A83u, 0x98705333u,
+                0xDFD029E3u, 0xE2B00053u, 0xC1C12F04u, 0xFCA106B4u, 0xBB017C64u, 0x866155D4u,
+                0x344189C4u, 0x0921A074u, 0x4E81DAA4u, 0x73E1F314u, 0xF1B164C5u, 0xCCD14D75u,
+                0x8B7137A5u, 0xB6111E15u, 0x0431C205u, 0x3951EBB5u, 0x7EF19165u, 0x4391B8D5u,
+                0xA121B886u, 0x9C419136u, 0xDBE1EBE6u, 0xE681C256u, 0x54A11E46u, 0x69C137F6u,
+                0x2E614D26u, 0x13016496u, 0x9151F347u, 0xAC31DAF7u, 0xEB91A027u, 0xD6F18997u,
+                0x64D15587u, 0x59B17C37u, 0x1E1106E7u, 0x23712F57u, 0x58F35849u, 0x659371F9u,
+                0x22330B29u, 0x1F532299u, 0xAD73FE89u, 0x9013D739u, 0xD7B3ADE9u, 0xEAD38459u,
+                0x68831388u, 0x55E33A38u, 0x124340E8u, 0x2F236958u, 0x9D03B548u, 0xA0639CF8u,
+                0xE7C3E628u, 0xDAA3CF98u, 0x3813CFCBu, 0x0573E67Bu, 0x42D39CABu, 0x7FB3B51Bu,
+                0xCD93690Bu, 0xF0F340BBu, 0xB7533A6Bu, 0x8A3313DBu, 0x0863840Au, 0x3503ADBAu,
+                0x72A3D76Au, 0x4FC3FEDAu, 0xFDE322CAu, 0xC0830B7Au, 0x872371AAu, 0xBA43581Au,
+                0x9932774Du, 0xA4525EFDu, 0xE3F2242Du, 0xDE920D9Du, 0x6CB2D18Du, 0x51D2F83Du,
+                0x167282EDu, 0x2B12AB5Du, 0xA9423C8Cu, 0x9422153Cu, 0xD3826FECu, 0xEEE2465Cu,
+                0x5CC29A4Cu, 0x61A2B3FCu, 0x2602C92Cu, 0x1B62E09Cu, 0xF9D2E0CFu, 0xC4B2C97Fu,
+                0x8312B3AFu, 0xBE729A1Fu, 0x0C52460Fu, 0x31326FBFu, 0x7692156Fu, 0x4BF23CDFu,
+                0xC9A2AB0Eu, 0xF4C282BEu, 0xB362F86Eu, 0x8E02D1DEu, 0x3C220DCEu, 0x0142247Eu,
+                0x46E25EAEu, 0x7B82771Eu, 0xB1E6B092u, 0x8C869922u, 0xCB26E3F2u, 0xF646CA42u,
+                0x44661652u, 0x79063FE2u, 0x3EA64532u, 0x03C66C82u, 0x8196FB53u, 0xBCF6D2E3u,
+                0xFB56A833u, 0xC6368183u, 0x74165D93u, 0x49767423u, 0x0ED60EF3u, 0x33B62743u,
+                0xD1062710u, 0xEC660EA0u, 0xABC67470u, 0x96A65DC0u, 0x248681D0u, 0x19E6A860u,
+                0x5E46D2B0u, 0x6326FB00u, 0xE1766CD1u, 0xDC164561u, 0x9BB63FB1u, 0xA6D61601u,
+                0x14F6CA11u, 0x2996E3A1u, 0x6E369971u, 0x5356B0C1u, 0x70279F96u, 0x4D47B626u,
+                0x0AE7CCF6u, 0x3787E546u, 0x85A73956u, 0xB8C710E6u, 0xFF676A36u, 0xC2074386u,
+                0x4057D457u, 0x7D37FDE7u, 0x3A978737u, 0x07F7AE87u, 0xB5D77297u, 0x88B75B27u,
+                0xCF1721F7u, 0xF2770847u, 0x10C70814u, 0x2DA721A4u, 0x6A075B74u, 0x576772C4u,
+                0xE547AED4u, 0xD8278764u, 0x9F87FDB4u, 0xA2E7D404u, 0x20B743D5u, 0x1DD76A65u,
+                0x5A7710B5u, 0x67173905u, 0xD537E515u, 0xE857CCA5u, 0xAFF7B675u, 0x92979FC5u,
+                0xE915E8DBu, 0xD475C16Bu, 0x93D5BBBBu, 0xAEB5920Bu, 0x1C954E1Bu, 0x21F567ABu,
+                0x66551D7Bu, 0x5B3534CBu, 0xD965A31Au, 0xE4058AAAu, 0xA3A5F07Au, 0x9EC5D9CAu,
+                0x2CE505DAu, 0x11852C6Au, 0x562556BAu, 0x6B457F0Au, 0x89F57F59u, 0xB49556E9u,
+                0xF3352C39u, 0xCE550589u, 0x7C75D999u, 0x4115F029u, 0x06B58AF9u, 0x3BD5A349u,
+                0xB9853498u, 0x84E51D28u, 0xC34567F8u, 0xFE254E48u, 0x4C059258u, 0x7165BBE8u,
+                0x36C5C138u, 0x0BA5E888u, 0x28D4C7DFu, 0x15B4EE6Fu, 0x521494BFu, 0x6F74BD0Fu,
+                0xDD54611Fu, 0xE03448AFu, 0xA794327Fu, 0x9AF41BCFu, 0x18A48C1Eu, 0x25C4A5AEu,
+                0x6264DF7Eu, 0x5F04F6CEu, 0xED242ADEu, 0xD044036Eu, 0x97E479BEu, 0xAA84500Eu,
+                0x4834505Du, 0x755479EDu, 0x32F4033Du, 0x0F942A8Du, 0xBDB4F69Du, 0x80D4DF2Du,
+                0xC774A5FDu, 0xFA148C4Du, 0x78441B9Cu, 0x4524322Cu, 0x028448FCu, 0x3FE4614Cu,
+                0x8DC4BD5Cu, 0xB0A494ECu, 0xF704EE3Cu, 0xCA64C78Cu
+        },
+        {
+                0x00000000u, 0xCB5CD3A5u, 0x4DC8A10Bu, 0x869472AEu, 0x9B914216u, 0x50CD91B3u,
+                0xD659E31Du, 0x1D0530B8u, 0xEC53826Du, 0x270F51C8u, 0xA19B2366u, 0x6AC7F0C3u,
+                0x77C2C07Bu, 0xBC9E13DEu, 0x3A0A6170u, 0xF156B2D5u, 0x03D6029Bu, 0xC88AD13Eu,
+                0x4E1EA390u, 0x85427035u, 0x9847408Du, 0x531B9328u, 0xD58FE186u, 0x1ED33223u,
+                0xEF8580F6u, 0x24D95353u, 0xA24D21FDu, 0x6911F258u, 0x7414C2E0u, 0xBF481145u,
+                0x39DC63EBu, 0xF280B04Eu, 0x07AC0536u, 0xCCF0D693u, 0x4A64A43Du, 0x81387798u,
+                0x9C3D4720u, 0x57619485u, 0xD1F5E62Bu, 0x1AA9358Eu, 0xEBFF875Bu, 0x20A354FEu,
+                0xA6372650u, 0x6D6BF5F5u, 0x706EC54Du, 0xBB3216E8u, 0x3DA66446u, 0xF6FAB7E3u,
+                0x047A07ADu, 0xCF26D408u, 0x49B2A6A6u, 0x82EE7503u, 0x9FEB45BBu, 0x54B7961Eu,
+                0xD223E4B0u, 0x197F3715u, 0xE82985C0u, 0x23755665u, 0xA5E124CBu, 0x6EBDF76Eu,
+                0x73B8C7D6u, 0xB8E41473u, 0x3E7066DDu, 0xF52CB578u, 0x0F580A6Cu, 0xC404D9C9u,
+                0x4290AB67u, 0x89CC78C2u, 0x94C9487Au, 0x5F959BDFu, 0xD901E971u, 0x125D3AD4u,
+                0xE30B8801u, 0x28575BA4u, 0xAEC3290Au, 0x659FFAAFu, 0x789ACA17u, 0xB3C619B2u,
+                0x35526B1Cu, 0xFE0EB8B9u, 0x0C8E08F7u, 0xC7D2DB52u, 0x4146A9FCu, 0x8A1A7A59u,
+                0x971F4AE1u, 0x5C439944u, 0xDAD7EBEAu, 0x118B384Fu, 0xE0DD8A9Au, 0x2B81593Fu,
+                0xAD152B91u, 0x6649F834u, 0x7B4CC88Cu, 0xB0101B29u, 0x36846987u, 0xFDD8BA22u,
+                0x08F40F5Au, 0xC3A8DCFFu, 0x453CAE51u, 0x8E607DF4u, 0x93654D4Cu, 0x58399EE9u,
+                0xDEADEC47u, 0x15F13FE2u, 0xE4A78D37u, 0x2FFB5E92u, 0xA96F2C3Cu, 0x6233FF99u,
+                0x7F36CF21u, 0xB46A1C84u, 0x32FE6E2Au, 0xF9A2BD8Fu, 0x0B220DC1u, 0xC07EDE64u,
+                0x46EAACCAu, 0x8DB67F6Fu, 0x90B34FD7u, 0x5BEF9C72u, 0xDD7BEEDCu, 0x16273D79u,
+                0xE7718FACu, 0x2C2D5C09u, 0xAAB92EA7u, 0x61E5FD02u, 0x7CE0CDBAu, 0xB7BC1E1Fu,
+                0x31286CB1u, 0xFA74BF14u, 0x1EB014D8u, 0xD5ECC77Du, 0x5378B5D3u, 0x98246676u,
+                0x852156CEu, 0x4E7D856Bu, 0xC8E9F7C5u, 0x03B52460u, 0xF2E396B5u, 0x39BF4510u,
+                0xBF2B37BEu, 0x7477E41Bu, 0x6972D4A3u, 0xA22E0706u, 0x24BA75A8u, 0xEFE6A60Du,
+                0x1D661643u, 0xD63AC5E6u, 0x50AEB748u, 0x9BF264EDu, 0x86F75455u, 0x4DAB87F0u,
+                0xCB3FF55Eu, 0x006326FBu, 0xF135942Eu, 0x3A69478Bu, 0xBCFD3525u, 0x77A1E680u,
+                0x6AA4D638u, 0xA1F8059Du, 0x276C7733u, 0xEC30A496u, 0x191C11EEu, 0xD240C24Bu,
+                0x54D4B0E5u, 0x9F886340u, 0x828D53F8u, 0x49D1805Du, 0xCF45F2F3u, 0x04192156u,
+                0xF54F9383u, 0x3E134026u, 0xB8873288u, 0x73DBE12Du, 0x6EDED195u, 0xA5820230u,
+                0x2316709Eu, 0xE84AA33Bu, 0x1ACA1375u, 0xD196C0D0u, 0x5702B27Eu, 0x9C5E61DBu,
+                0x815B5163u, 0x4A0782C6u, 0xCC93F068u, 0x07CF23CDu, 0xF6999118u, 0x3DC542BDu,
+                0xBB513013u, 0x700DE3B6u, 0x6D08D30Eu, 0xA65400ABu, 0x20C07205u, 0xEB9CA1A0u,
+                0x11E81EB4u, 0xDAB4CD11u, 0x5C20BFBFu, 0x977C6C1Au, 0x8A795CA2u, 0x41258F07u,
+                0xC7B1FDA9u, 0x0CED2E0Cu, 0xFDBB9CD9u, 0x36E74F7Cu, 0xB0733DD2u, 0x7B2FEE77u,
+                0x662ADECFu, 0xAD760D6Au, 0x2BE27FC4u, 0xE0BEAC61u, 0x123E1C2Fu, 0xD962CF8Au,
+                0x5FF6BD24u, 0x94AA6E81u, 0x89AF5E39u, 0x42F38D9Cu, 0xC467FF32u, 0x0F3B2C97u,
+                0xFE6D9E42u, 0x35314DE7u, 0xB3A53F49u, 0x78F9ECECu, 0x65FCDC54u, 0xAEA00FF1u,
+                0x28347D5Fu, 0xE368AEFAu, 0x16441B82u, 0xDD18C827u, 0x5B8CBA89u, 0x90D0692Cu,
+                0x8DD55994u, 0x46898A31u, 0xC01DF89Fu, 0x0B412B3Au, 0xFA1799EFu, 0x314B4A4Au,
+                0xB7DF38E4u, 0x7C83EB41u, 0x6186DBF9u, 0xAADA085Cu, 0x2C4E7AF2u, 0xE712A957u,
+                0x15921919u, 0xDECECABCu, 0x585AB812u, 0x93066BB7u, 0x8E035B0Fu, 0x455F88AAu,
+                0xC3CBFA04u, 0x089729A1u, 0xF9C19B74u, 0x329D48D1u, 0xB4093A7Fu, 0x7F55E9DAu,
+                0x6250D962u, 0xA90C0AC7u, 0x2F987869u, 0xE4C4ABCCu
+        },
+        {
+                0x00000000u, 0xA6770BB4u, 0x979F1129u, 0x31E81A9Du, 0xF44F2413u, 0x52382FA7u,
+                0x63D0353Au, 0xC5A73E8Eu, 0x33EF4E67u, 0x959845D3u, 0xA4705F4Eu, 0x020754FAu,
+                0xC7A06A74u, 0x61D761C0u, 0x503F7B5Du, 0xF64870E9u, 0x67DE9CCEu, 0xC1A9977Au,
+                0xF0418DE7u, 0x56368653u, 0x9391B8DDu, 0x35E6B369u, 0x040EA9F4u, 0xA279A240u,
+                0x5431D2A9u, 0xF246D91Du, 0xC3AEC380u, 0x65D9C834u, 0xA07EF6BAu, 0x0609FD0Eu,
+                0x37E1E793u, 0x9196EC27u, 0xCFBD399Cu, 0x69CA3228u, 0x582228B5u, 0xFE552301u,
+                0x3BF21D8Fu, 0x9D85163Bu, 0xAC6D0CA6u, 0x0A1A0712u, 0xFC5277FBu, 0x5A257C4Fu,
+                0x6BCD66D2u, 0xCDBA6D66u, 0x081D53E8u, 0xAE6A585Cu, 0x9F8242C1u, 0x39F54975u,
+                0xA863A552u, 0x0E14AEE6u, 0x3FFCB47Bu, 0x998BBFCFu, 0x5C2C8141u, 0xFA5B8AF5u,
+                0xCBB39068u, 0x6DC49BDCu, 0x9B8CEB35u, 0x3DFBE081u, 0x0C13FA1Cu, 0xAA64F1A8u,
+                0x6FC3CF26u, 0xC9B4C492u, 0xF85CDE0Fu, 0x5E2BD5BBu, 0x440B7579u, 0xE27C7ECDu,
+                0xD3946450u, 0x75E36FE4u, 0xB044516Au, 0x16335ADEu, 0x27DB4043u, 0x81AC4BF7u,
+                0x77E43B1Eu, 0xD19330AAu, 0xE07B2A37u, 0x460C2183u, 0x83AB1F0Du, 0x25DC14B9u,
+                0x14340E24u, 0xB2430590u, 0x23D5E9B7u, 0x85A2E203u, 0xB44AF89Eu, 0x123DF32Au,
+                0xD79ACDA4u, 0x71EDC610u, 0x4005DC8Du, 0xE672D739u, 0x103AA7D0u, 0xB64DAC64u,
+                0x87A5B6F9u, 0x21D2BD4Du, 0xE47583C3u, 0x42028877u, 0x73EA92EAu, 0xD59D995Eu,
+                0x8BB64CE5u, 0x2DC14751u, 0x1C295DCCu, 0xBA5E5678u, 0x7FF968F6u, 0xD98E6342u,
+                0xE86679DFu, 0x4E11726Bu, 0xB8590282u, 0x1E2E0936u, 0x2FC613ABu, 0x89B1181Fu,
+                0x4C162691u, 0xEA612D25u, 0xDB8937B8u, 0x7DFE3C0Cu, 0xEC68D02Bu, 0x4A1FDB9Fu,
+                0x7BF7C102u, 0xDD80CAB6u, 0x1827F438u, 0xBE50FF8Cu, 0x8FB8E511u, 0x29CFEEA5u,
+                0xDF879E4Cu, 0x79F095F8u, 0x48188F65u, 0xEE6F84D1u, 0x2BC8BA5Fu, 0x8DBFB1EBu,
+                0xBC57AB76u, 0x1A20A0C2u, 0x8816EAF2u, 0x2E61E146u, 0x1F89FBDBu, 0xB9FEF06Fu,
+                0x7C59CEE1u, 0xDA2EC555u, 0xEBC6DFC8u, 0x4DB1D47Cu, 0xBBF9A495u, 0x1D8EAF21u,
+                0x2C66B5BCu, 0x8A11BE08u, 0x4FB68086u, 0xE9C18B32u, 0xD82991AFu, 0x7E5E9A1Bu,
+                0xEFC8763Cu, 0x49BF7D88u, 0x78576715u, 0xDE206CA1u, 0x1B87522Fu, 0xBDF0599Bu,
+                0x8C184306u, 0x2A6F48B2u, 0xDC27385Bu, 0x7A5033EFu, 0x4BB82972u, 0xEDCF22C6u,
+                0x28681C48u, 0x8E1F17FCu, 0xBFF70D61u, 0x198006D5u, 0x47ABD36Eu, 0xE1DCD8DAu,
+                0xD034C247u, 0x7643C9F3u, 0xB3E4F77Du, 0x1593FCC9u, 0x247BE654u, 0x820CEDE0u,
+                0x74449D09u, 0xD23396BDu, 0xE3DB8C20u, 0x45AC8794u, 0x800BB91Au, 0x267CB2AEu,
+                0x1794A833u, 0xB1E3A387u, 0x20754FA0u, 0x86024414u, 0xB7EA5E89u, 0x119D553Du,
+                0xD43A6BB3u, 0x724D6007u, 0x43A57A9Au, 0xE5D2712Eu, 0x139A01C7u, 0xB5ED0A73u,
+                0x840510EEu, 0x22721B5Au, 0xE7D525D4u, 0x41A22E60u, 0x704A34FDu, 0xD63D3F49u,
+                0xCC1D9F8Bu, 0x6A6A943Fu, 0x5B828EA2u, 0xFDF58516u, 0x3852BB98u, 0x9E25B02Cu,
+                0xAFCDAAB1u, 0x09BAA105u, 0xFFF2D1ECu, 0x5985DA58u, 0x686DC0C5u, 0xCE1ACB71u,
+                0x0BBDF5FFu, 0xADCAFE4Bu, 0x9C22E4D6u, 0x3A55EF62u, 0xABC30345u, 0x0DB408F1u,
+                0x3C5C126Cu, 0x9A2B19D8u, 0x5F8C2756u, 0xF9FB2CE2u, 0xC813367Fu, 0x6E643DCBu,
+                0x982C4D22u, 0x3E5B4696u, 0x0FB35C0Bu, 0xA9C457BFu, 0x6C636931u, 0xCA146285u,
+                0xFBFC7818u, 0x5D8B73ACu, 0x03A0A617u, 0xA5D7ADA3u, 0x943FB73Eu, 0x3248BC8Au,
+                0xF7EF8204u, 0x519889B0u, 0x6070932Du, 0xC6079899u, 0x304FE870u, 0x9638E3C4u,
+                0xA7D0F959u, 0x01A7F2EDu, 0xC400CC63u, 0x6277C7D7u, 0x539FDD4Au, 0xF5E8D6FEu,
+                0x647E3AD9u, 0xC209316Du, 0xF3E12BF0u, 0x55962044u, 0x90311ECAu, 0x3646157Eu,
+                0x07AE0FE3u, 0xA1D90457u, 0x579174BEu, 0xF1E67F0Au, 0xC00E6597u, 0x66796E23u,
+                0xA3DE50ADu, 0x05A95B19u, 0x34414184u, 0x92364A30u
+        },
+        {
+                0x00000000u, 0xCCAA009Eu, 0x4225077Du, 0x8E8F07E3u, 0x844A0EFAu, 0x48E00E64u,
+                0xC66F0987u, 0x0AC50919u, 0xD3E51BB5u, 0x1F4F1B2Bu, 0x91C01CC8u, 0x5D6A1C56u,
+                0x57AF154Fu, 0x9B0515D1u, 0x158A1232u, 0xD92012ACu, 0x7CBB312Bu, 0xB01131B5u,
+                0x3E9E3656u, 0xF23436C8u, 0xF8F13FD1u, 0x345B3F4Fu, 0xBAD438ACu, 0x767E3832u,
+                0xAF5E2A9Eu, 0x63F42A00u, 0xED7B2DE3u, 0x21D12D7Du, 0x2B142464u, 0xE7BE24FAu,
+                0x69312319u, 0xA59B2387u, 0xF9766256u, 0x35DC62C8u, 0xBB53652Bu, 0x77F965B5u,
+                0x7D3C6CACu, 0xB1966C32u, 0x3F196BD1u, 0xF3B36B4Fu, 0x2A9379E3u, 0xE639797Du,
+                0x68B67E9Eu, 0xA41C7E00u, 0xAED97719u, 0x62737787u, 0xECFC7064u, 0x205670FAu,
+                0x85CD537Du, 0x496753E3u, 0xC7E85400u, 0x0B42549Eu, 0x01875D87u, 0xCD2D5D19u,
+                0x43A25AFAu, 0x8F085A64u, 0x562848C8u, 0x9A824856u, 0x140D4FB5u, 0xD8A74F2Bu,
+                0xD2624632u, 0x1EC846ACu, 0x9047414Fu, 0x5CED41D1u, 0x299DC2EDu, 0xE537C273u,
+                0x6BB8C590u, 0xA712C50Eu, 0xADD7CC17u, 0x617DCC89u, 0xEFF2CB6Au, 0x2358CBF4u,
+                0xFA78D958u, 0x36D2D9C6u, 0xB85DDE25u, 0x74F7DEBBu, 0x7E32D7A2u, 0xB298D73Cu,
+                0x3C17D0DFu, 0xF0BDD041u, 0x5526F3C6u, 0x998CF358u, 0x1703F4BBu, 0xDBA9F425u,
+                0xD16CFD3Cu, 0x1DC6FDA2u, 0x9349FA41u, 0x5FE3FADFu, 0x86C3E873u, 0x4A69E8EDu,
+                0xC4E6EF0Eu, 0x084CEF90u, 0x0289E689u, 0xCE23E617u, 0x40ACE1F4u, 0x8C06E16Au,
+                0xD0EBA0BBu, 0x1C41A025u, 0x92CEA7C6u, 0x5E64A758u, 0x54A1AE41u, 0x980BAEDFu,
+                0x1684A93Cu, 0xDA2EA9A2u, 0x030EBB0Eu, 0xCFA4BB90u, 0x412BBC73u, 0x8D81BCEDu,
+                0x8744B5F4u, 0x4BEEB56Au, 0xC561B289u, 0x09CBB217u, 0xAC509190u, 0x60FA910Eu,
+                0xEE7596EDu, 0x22DF9673u, 0x281A9F6Au, 0xE4B09FF4u, 0x6A3F9817u, 0xA6959889u,
+                0x7FB58A25u, 0xB31F8ABBu, 0x3D908D58u, 0xF13A8DC6u, 0xFBFF84DFu, 0x37558441u,
+                0xB9DA83A2u, 0x7570833Cu, 0x533B85DAu, 0x9F918544u, 0x111E82A7u, 0xDDB48239u,
+                0xD7718B20u, 0x1BDB8BBEu, 0x95548C5Du, 0x59FE8CC3u, 0x80DE9E6Fu, 0x4C749EF1u,
+                0xC2FB9912u, 0x0E51998Cu, 0x04949095u, 0xC83E900Bu, 0x46B197E8u, 0x8A1B9776u,
+                0x2F80B4F1u, 0xE32AB46Fu, 0x6DA5B38Cu, 0xA10FB312u, 0xABCABA0Bu, 0x6760BA95u,
+                0xE9EFBD76u, 0x2545BDE8u, 0xFC65AF44u, 0x30CFAFDAu, 0xBE40A839u, 0x72EAA8A7u,
+                0x782FA1BEu, 0xB485A120u, 0x3A0AA6C3u, 0xF6A0A65Du, 0xAA4DE78Cu, 0x66E7E712u,
+                0xE868E0F1u, 0x24C2E06Fu, 0x2E07E976u, 0xE2ADE9E8u, 0x6C22EE0Bu, 0xA088EE95u,
+                0x79A8FC39u, 0xB502FCA7u, 0x3B8DFB44u, 0xF727FBDAu, 0xFDE2F2C3u, 0x3148F25Du,
+                0xBFC7F5BEu, 0x736DF520u, 0xD6F6D6A7u, 0x1A5CD639u, 0x94D3D1DAu, 0x5879D144u,
+                0x52BCD85Du, 0x9E16D8C3u, 0x1099DF20u, 0xDC33DFBEu, 0x0513CD12u, 0xC9B9CD8Cu,
+                0x4736CA6Fu, 0x8B9CCAF1u, 0x8159C3E8u, 0x4DF3C376u, 0xC37CC495u, 0x0FD6C40Bu,
+                0x7AA64737u, 0xB60C47A9u, 0x3883404Au, 0xF42940D4u, 0xFEEC49CDu, 0x32464953u,
+                0xBCC94EB0u, 0x70634E2Eu, 0xA9435C82u, 0x65E95C1Cu, 0xEB665BFFu, 0x27CC5B61u,
+                0x2D095278u, 0xE1A352E6u, 0x6F2C5505u, 0xA386559Bu, 0x061D761Cu, 0xCAB77682u,
+                0x44387161u, 0x889271FFu, 0x825778E6u, 0x4EFD7878u, 0xC0727F9Bu, 0x0CD87F05u,
+                0xD5F86DA9u, 0x19526D37u, 0x97DD6AD4u, 0x5B776A4Au, 0x51B26353u, 0x9D1863CDu,
+                0x1397642Eu, 0xDF3D64B0u, 0x83D02561u, 0x4F7A25FFu, 0xC1F5221Cu, 0x0D5F2282u,
+                0x079A2B9Bu, 0xCB302B05u, 0x45BF2CE6u, 0x89152C78u, 0x50353ED4u, 0x9C9F3E4Au,
+                0x121039A9u, 0xDEBA3937u, 0xD47F302Eu, 0x18D530B0u, 0x965A3753u, 0x5AF037CDu,
+                0xFF6B144Au, 0x33C114D4u, 0xBD4E1337u, 0x71E413A9u, 0x7B211AB0u, 0xB78B1A2Eu,
+                0x39041DCDu, 0xF5AE1D53u, 0x2C8E0FFFu, 0xE0240F61u, 0x6EAB0882u, 0xA201081Cu,
+                0xA8C40105u, 0x646E019Bu, 0xEAE10678u, 0x264B06E6u
+        }
+};
+#elif defined(CM_CRC32_TABLE)
+static const uint32_t crcTable[256] = {
+        0x00000000u, 0x77073096u, 0xEE0E612Cu, 0x990951BAu, 0x076DC419u, 0x706AF48Fu,
+        0xE963A535u, 0x9E6495A3u, 0x0EDB8832u, 0x79DCB8A4u, 0xE0D5E91Eu, 0x97D2D988u,
+        0x09B64C2Bu, 0x7EB17CBDu, 0xE7B82D07u, 0x90BF1D91u, 0x1DB71064u, 0x6AB020F2u,
+        0xF3B97148u, 0x84BE41DEu, 0x1ADAD47Du, 0x6DDDE4EBu, 0xF4D4B551u, 0x83D385C7u,
+        0x136C9856u, 0x646BA8C0u, 0xFD62F97Au, 0x8A65C9ECu, 0x14015C4Fu, 0x63066CD9u,
+        0xFA0F3D63u, 0x8D080DF5u, 0x3B6E20C8u, 0x4C69105Eu, 0xD56041E4u, 0xA2677172u,
+        0x3C03E4D1u, 0x4B04D447u, 0xD20D85FDu, 0xA50AB56Bu, 0x35B5A8FAu, 0x42B2986Cu,
+        0xDBBBC9D6u, 0xACBCF940u, 0x32D86CE3u, 0x45DF5C75u, 0xDCD60DCFu, 0xABD13D59u,
+        0x26D930ACu, 0x51DE003Au, 0xC8D75180u, 0xBFD06116u, 0x21B4F4B5u, 0x56B3C423u,
+        0xCFBA9599u, 0xB8BDA50Fu, 0x2802B89Eu, 0x5F058808u, 0xC60CD9B2u, 0xB10BE924u,
+        0x2F6F7C87u, 0x58684C11u, 0xC1611DABu, 0xB6662D3Du, 0x76DC4190u, 0x01DB7106u,
+        0x98D220BCu, 0xEFD5102Au, 0x71B18589u, 0x06B6B51Fu, 0x9FBFE4A5u, 0xE8B8D433u,
+        0x7807C9A2u, 0x0F00F934u, 0x9609A88Eu, 0xE10E9818u, 0x7F6A0DBBu, 0x086D3D2Du,
+        0x91646C97u, 0xE6635C01u, 0x6B6B51F4u, 0x1C6C6162u, 0x856530D8u, 0xF262004Eu,
+        0x6C0695EDu, 0x1B01A57Bu, 0x8208F4C1u, 0xF50FC457u, 0x65B0D9C6u, 0x12B7E950u,
+        0x8BBEB8EAu, 0xFCB9887Cu, 0x62DD1DDFu, 0x15DA2D49u, 0x8CD37CF3u, 0xFBD44C65u,
+        0x4DB26158u, 0x3AB551CEu, 0xA3BC0074u, 0xD4BB30E2u, 0x4ADFA541u, 0x3DD895D7u,
+        0xA4D1C46Du, 0xD3D6F4FBu, 0x4369E96Au, 0x346ED9FCu, 0xAD678846u, 0xDA60B8D0u,
+        0x44042D73u, 0x33031DE5u, 0xAA0A4C5Fu, 0xDD0D7CC9u, 0x5005713Cu, 0x270241AAu,
+        0xBE0B1010u, 0xC90C2086u, 0x5768B525u, 0x206F85B3u, 0xB966D409u, 0xCE61E49Fu,
+        0x5EDEF90Eu, 0x29D9C998u, 0xB0D09822u, 0xC7D7A8B4u, 0x59B33D17u, 0x2EB40D81u,
+        0xB7BD5C3Bu, 0xC0BA6CADu, 0xEDB88320u, 0x9ABFB3B6u, 0x03B6E20Cu, 0x74B1D29Au,
+        0xEAD54739u, 0x9DD277AFu, 0x04DB2615u, 0x73DC1683u, 0xE3630B12u, 0x94643B84u,
+        0x0D6D6A3Eu, 0x7A6A5AA8u, 0xE40ECF0Bu, 0x9309FF9Du, 0x0A00AE27u, 0x7D079EB1u,
+        0xF00F9344u, 0x8708A3D2u, 0x1E01F268u, 0x6906C2FEu, 0xF762575Du, 0x806567CBu,
+        0x196C3671u, 0x6E6B06E7u, 0xFED41B76u, 0x89D32BE0u, 0x10DA7A5Au, 0x67DD4ACCu,
+        0xF9B9DF6Fu, 0x8EBEEFF9u, 0x17B7BE43u, 0x60B08ED5u, 0xD6D6A3E8u, 0xA1D1937Eu,
+        0x38D8C2C4u, 0x4FDFF252u, 0xD1BB67F1u, 0xA6BC5767u, 0x3FB506DDu, 0x48B2364Bu,
+        0xD80D2BDAu, 0xAF0A1B4Cu, 0x36034AF6u, 0x41047A60u, 0xDF60EFC3u, 0xA867DF55u,
+        0x316E8EEFu, 0x4669BE79u, 0xCB61B38Cu, 0xBC66831Au, 0x256FD2A0u, 0x5268E236u,
+        0xCC0C7795u, 0xBB0B4703u, 0x220216B9u, 0x5505262Fu, 0xC5BA3BBEu, 0xB2BD0B28u,
+        0x2BB45A92u, 0x5CB36A04u, 0xC2D7FFA7u, 0xB5D0CF31u, 0x2CD99E8Bu, 0x5BDEAE1Du,
+        0x9B64C2B0u, 0xEC63F226u, 0x756AA39Cu, 0x026D930Au, 0x9C0906A9u, 0xEB0E363Fu,
+        0x72076785u, 0x05005713u, 0x95BF4A82u, 0xE2B87A14u, 0x7BB12BAEu, 0x0CB61B38u,
+        0x92D28E9Bu, 0xE5D5BE0Du, 0x7CDCEFB7u, 0x0BDBDF21u, 0x86D3D2D4u, 0xF1D4E242u,
+        0x68DDB3F8u, 0x1FDA836Eu, 0x81BE16CDu, 0xF6B9265Bu, 0x6FB077E1u, 0x18B74777u,
+        0x88085AE6u, 0xFF0F6A70u, 0x66063BCAu, 0x11010B5Cu, 0x8F659EFFu, 0xF862AE69u,
+        0x616BFFD3u, 0x166CCF45u, 0xA00AE278u, 0xD70DD2EEu, 0x4E048354u, 0x3903B3C2u,
+        0xA7672661u, 0xD06016F7u, 0x4969474Du, 0x3E6E77DBu, 0xAED16A4Au, 0xD9D65ADCu,
+        0x40DF0B66u, 0x37D83BF0u, 0xA9BCAE53u, 0xDEBB9EC5u, 0x47B2CF7Fu, 0x30B5FFE9u,
+        0xBDBDF21Cu, 0xCABAC28Au, 0x53B39330u, 0x24B4A3A6u, 0xBAD03605u, 0xCDD70693u,
+        0x54DE5729u, 0x23D967BFu, 0xB3667A2Eu, 0xC4614AB8u, 0x5D681B02u, 0x2A6F2B94u,
+        0xB40BBE37u, 0xC30C8EA1u, 0x5A05DF1Bu, 0x2D02EF8Du
+};
+#endif
+
+static uint32_t updateCrc32(uint32_t crc, const void *data, uint32_t size) {
+#if defined(CM_CRC32_UPDATE)
+    return CM_CRC32_UPDATE(crc, data, size);
+#else
+    const uint8_t *d = (const uint8_t *) data;
+#if defined(CM_CRC32_ARM)
+    for (; size >= 8; size -= 8, d += 8) {
+        uint64_t v;
+        memcpy(&v, d, sizeof(v));
+        crc = __crc32d(crc, v);
+    }
+    for (; size > 0; --size, ++d) {
+        crc = __crc32b(crc, *d);
+    }
+#elif defined(CM_CRC32_SLICING)
+    // bytes are combined manually, so the same code works on big-endian hosts
+    for (; size >= 8; size -= 8, d += 8) {
+        uint32_t lo = crc ^ ((uint32_t) d[0] | (uint32_t) d[1] << 8u |
+                             (uint32_t) d[2] << 16u | (uint32_t) d[3] << 24u);
+        uint32_t hi = (uint32_t) d[4] | (uint32_t) d[5] << 8u |
+                      (uint32_t) d[6] << 16u | (uint32_t) d[7] << 24u;
+        crc = crcTable[7][lo & 0xFFu] ^ crcTable[6][(lo >> 8u) & 0xFFu] ^
+              crcTable[5][(lo >> 16u) & 0xFFu] ^ crcTable[4][lo >> 24u] ^
+              crcTable[3][hi & 0xFFu] ^ crcTable[2][(hi >> 8u) & 0xFFu] ^
+              crcTable[1][(hi >> 16u) & 0xFFu] ^ crcTable[0][hi >> 24u];
+    }
+    for (; size > 0; --size, ++d) {
+        crc = crcTable[0][(crc ^ *d) & 0xFFu] ^ (crc >> 8u);
+    }
+#else
+    for (; size > 0; --size, ++d) {
+        crc = crcTable[(crc ^ *d) & 0xFFu] ^ (crc >> 8u);
+    }
+#endif
+    return crc;
+#endif
+}
+
+void cmInitLogWriter(CMLogWriter *log, CMLogEntry *entries, uint32_t maxEntries,
+                     CMFlushCallback write, void *context) {
+    log->write = write;
+    log->context = context;
+    log->entries = entries;
+    log->maxEntries = maxEntries;
+    log->entryCount = 0;
+    log->size = 0;
+    log->messageCount = 0;
+    log->lastIndex = 0;
+    log->indexCount = 0;
+    log->firstError = CM_ERROR_NONE;
+    if (maxEntries == 0 || write == NULL) {
+        log->firstError = CM_ERROR_INVALID_ARG;
+        return;
+    }
+
+    uint8_t header[CM_LOG_HEADER_SIZE] = {'C', 'M', 'L', 'G'};
+    uint16_t mark = ENDIAN_MARK;
+    uint16_t format = CM_LOG_FORMAT;
+    memcpy(&header[4], &mark, sizeof(mark));
+    memcpy(&header[6], &format, sizeof(format));
+    writeLogBytes(log, header, sizeof(header));
+}
+
+void cmAppendLog(CMLogWriter *log, const void *message, uint32_t size) {
+    if (log->firstError != CM_ERROR_NONE)
+        return;
+    uint16_t e = 0;
+    if (size >= 2) {
+        memcpy(&e, message, sizeof(e));
+    }
+    // size equal to tag of index can't be stored
+    if ((e != ENDIAN_MARK && e != ENDIAN_INV_MARK) || size == CM_LOG_INDEX_TAG) {
+        log->firstError = CM_ERROR_INVALID_ARG;
+        return;
+    }
+
+    // message is aligned to 8 bytes and is padded, so size of next one
+    // is placed right before the next aligned offset
+    static const uint8_t zeros[8] = {0};
+    uint64_t offset = log->size + sizeof(uint32_t);
+    uint32_t padding = (uint32_t) ((4u - (offset + size)) & 7u);
+    if (!writeLogBytes(log, &size, sizeof(size)) ||
+        !writeLogBytes(log, message, size) ||
+        !writeLogBytes(log, zeros, padding))
+        return;
+
+    CMLogEntry *entry = &log->entries[log->entryCount++];
+    entry->offset = offset;
+    entry->size = size;
+    entry->version = getLogVersion(message, size);
+    ++log->messageCount;
+    if (log->entryCount == log->maxEntries) {
+        cmWriteLogIndex(log);
+    }
+}
+
+void cmWriteLogIndex(CMLogWriter *log) {
+    if (log->firstError != CM_ERROR_NONE || log->entryCount == 0)
+        return;
+
+    uint64_t offset = log->size;
+    uint8_t header[CM_LOG_INDEX_HEADER_SIZE];
+    uint32_t tag = CM_LOG_INDEX_TAG;
+    uint64_t firstMessage = log->messageCount - log->entryCount;
+    memcpy(&header[0], &tag, sizeof(tag));
+    memcpy(&header[4], &log->entryCount, sizeof(log->entryCount));
+    memcpy(&header[8], &firstMessage, sizeof(firstMessage));
+    memcpy(&header[16], &log->lastIndex, sizeof(log->lastIndex));
+    if (!writeLogBytes(log, header, sizeof(header)))
+        return;
+
+    // entries are passed in groups, so callback is not called for each one
+    uint8_t group[16 * CM_LOG_ENTRY_SIZE];
+    uint32_t used = 0;
+    for (uint32_t i = 0; i < log->entryCount; ++i) {
+        const CMLogEntry *entry = &log->entries[i];
+        memcpy(&group[used], &entry->offset, sizeof(entry->offset));
+        memcpy(&group[used + 8], &entry->size, sizeof(entry->size));
+        memcpy(&group[used + 12], &entry->version, sizeof(entry->version));
+        used += CM_LOG_ENTRY_SIZE;
+        if (used == sizeof(group) || i + 1 == log->entryCount) {
+            if (!writeLogBytes(log, group, used))
+                return;
+            used = 0;
+        }
+    }
+
+    uint8_t trailer[CM_LOG_TRAILER_SIZE];
+    uint32_t indexCount = log->indexCount + 1;
+    memcpy(&trailer[0], &offset, sizeof(offset));
+    memcpy(&trailer[8], &indexCount, sizeof(indexCount));
+    memcpy(&trailer[12], "CMLI", 4);
+    if (!writeLogBytes(log, trailer, sizeof(trailer)))
+        return;
+    log->lastIndex = offset;
+    log->indexCount = indexCount;
+    log->entryCount = 0;
+}
+
+bool cmInitLogReader(CMLogReader *log, const void *data, uint64_t size,
+                     CMLogIndex *indexes, uint32_t maxIndexes) {
+    log->data = (const uint8_t *) data;
+    log->size = size;
+    log->mapped = false;
+    log->swapBytes = false;
+    log->indexes = indexes;
+    log->maxIndexes = maxIndexes;
+    log->indexCount = 0;
+    log->messageCount = 0;
+    log->tailOffset = CM_LOG_HEADER_SIZE;
+    log->tailCount = 0;
+    log->firstError = CM_ERROR_NONE;
+
+    uint16_t mark = 0;
+    uint16_t format = 0;
+    if (size >= CM_LOG_HEADER_SIZE && memcmp(data, "CMLG", 4) == 0) {
+        memcpy(&mark, &log->data[4], sizeof(mark));
+        memcpy(&format, &log->data[6], sizeof(format));
+    }
+    if (mark != ENDIAN_MARK && mark != ENDIAN_INV_MARK) {
+        log->firstError = CM_ERROR_MALFORMED;
         return false;
-    if (reader->totalSize - reader->readSize < len) {
-        reader->firstError = CM_ERROR_NO_VALUE;
+    }
+    log->swapBytes = mark != ENDIAN_MARK;
+    if (log->swapBytes) {
+        inverseByteOrder(&format, sizeof(format));
+    }
+    if (format != CM_LOG_FORMAT) {
+        log->firstError = CM_ERROR_MALFORMED;
         return false;
     }
-    uint8_t typeStored, lenStored;
-    splitTypeFlag(reader->message[reader->readSize], &typeStored, &lenStored);
 
-    if (typeStored != type || len != lenStored) {
-        reader->firstError = CM_ERROR_NO_VALUE;
+    if (readLogTrailer(log))
+        return true;
+    if (log->firstError != CM_ERROR_NONE)
         return false;
+    return scanLog(log);
+}
+
+bool cmOpenLog(CMLogReader *log, const char *path, CMLogIndex *indexes,
+               uint32_t maxIndexes) {
+#if defined(CM_LOG_MMAP)
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0 &&
+        (uint64_t) st.st_size <= SIZE_MAX) {
+        void *data = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        // mapping stays valid after file is closed
+        close(fd);
+        if (data != MAP_FAILED) {
+            bool result = cmInitLogReader(log, data, (uint64_t) st.st_size,
+                                          indexes, maxIndexes);
+            log->mapped = true;
+            return result;
+        }
+    } else if (fd >= 0) {
+        close(fd);
+    }
+    cmInitLogReader(log, NULL, 0, indexes, maxIndexes);
+    log->firstError = CM_ERROR_IO;
+    return false;
+#else
+    (void) path;
+    cmInitLogReader(log, NULL, 0, indexes, maxIndexes);
+    log->firstError = CM_ERROR_INVALID_ARG;
+    return false;
+#endif
+}
+
+void cmCloseLog(CMLogReader *log) {
+#if defined(CM_LOG_MMAP)
+    if (log->mapped) {
+        munmap((void *) log->data, (size_t) log->size);
     }
-    ++reader->readSize;
+#endif
+    log->data = NULL;
+    log->size = 0;
+    log->mapped = false;
+    log->indexCount = 0;
+    log->messageCount = 0;
+    log->tailCount = 0;
+}
 
-    memcpy(val, &reader->message[reader->readSize], len);
+bool cmReadLogMessage(CMLogReader *log, uint64_t n,
+                      CompositeMessageReader *reader) {
+    if (log->firstError != CM_ERROR_NONE || n >= log->messageCount)
+        return false;
 
-    reader->readSize += len;
+    uint64_t offset;
+    uint32_t size;
+    uint32_t version;
+    if (!findLogMessage(log, n, &offset, &size, &version))
+        return false;
+    cmInitConstReader(reader, &log->data[offset], size);
     return true;
 }
 
-static uint8_t getTypeFlag(uint8_t type, uint8_t len) {
-    uint8_t flag = type;
-    if (len == 2) {
-        flag |= 0x01u;
-    } else if (len == 4) {
-        flag |= 0x02u;
-    } else if (len == 8) {
-        flag |= 0x03u;
-    } else if (len != 1) {
-        return 0;
+uint64_t cmFindLogVersion(CMLogReader *log, uint32_t version) {
+    if (log->firstError != CM_ERROR_NONE)
+        return log->messageCount;
+
+    // the first index with first version that is not less than given one,
+    // so message is the first one of it or is in the previous index
+    uint32_t low = 0;
+    uint32_t high = log->indexCount;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        uint64_t entry = log->indexes[mid].offset + CM_LOG_INDEX_HEADER_SIZE;
+        if (readLogU32(log, entry + 12) < version) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    if (low > 0) {
+        const CMLogIndex *index = &log->indexes[low - 1];
+        uint64_t entries = index->offset + CM_LOG_INDEX_HEADER_SIZE;
+        uint32_t first = 1;
+        uint32_t last = index->entryCount;
+        while (first < last) {
+            uint32_t mid = first + (last - first) / 2;
+            if (readLogU32(log, entries + (uint64_t) mid * CM_LOG_ENTRY_SIZE + 12) < version) {
+                first = mid + 1;
+            } else {
+                last = mid;
+            }
+        }
+        if (first < index->entryCount)
+            return index->firstMessage + first;
     }
-    return flag;
+    if (low < log->indexCount)
+        return log->indexes[low].firstMessage;
+
+    // messages after the last index were checked by scanLog, so they are
+    // walked through without checks
+    uint64_t offset = log->tailOffset;
+    for (uint64_t n = log->messageCount - log->tailCount; n < log->messageCount; ++n) {
+        uint32_t size = readLogU32(log, offset);
+        offset += sizeof(uint32_t);
+        if (getLogVersion(&log->data[offset], size) >= version)
+            return n;
+        offset += size;
+        offset += (4u - offset) & 7u;
+    }
+    return log->messageCount;
 }
 
-static void splitTypeFlag(uint8_t flag, uint8_t *type, uint8_t *len) {
-    if (len != NULL) {
-        *len = 1u << (flag & CM_TYPE_LEN_MASK);
+void cmSetWriterProfileStats(CompositeMessageWriter *writer,
+                             CMProfileStats *stats) {
+    if (stats != NULL) {
+        startProfileCounter();
     }
-    if (type != NULL) {
-        *type = flag & CM_TYPE_MASK;
+    writer->profileStats = stats;
+}
+
+void cmSetReaderProfileStats(CompositeMessageReader *reader,
+                             CMProfileStats *stats) {
+    if (stats != NULL) {
+        startProfileCounter();
     }
+    reader->profileStats = stats;
 }
 
-static bool writeBytes(CompositeMessageWriter *writer,
-                       const void *data, uint32_t size) {
-    if (!ensureSpace(writer, size))
-        return false;
+static void startProfileCounter(void) {
+#if defined(CM_PROFILE_DWT)
+    // enable trace (TRCENA) and cycle counter (CYCCNTENA)
+    CM_DEMCR |= 1u << 24u;
+    CM_DWT_CTRL |= 1u;
+#endif
+}
 
-    memcpy(&writer->buffer[writer->usedSize], data, size);
-    writer->usedSize += size;
+#if defined(CM_PROFILE)
+static void recordProfile(CMProfileStats *stats, uint32_t op, uint32_t start,
+                          uint64_t bytes) {
+    if (stats == NULL)
+        return;
+    // difference is correct even if counter wrapped around
+    uint32_t cycles = (uint32_t) CM_PROFILE_COUNTER() - start;
+    stats->ops[op].count++;
+    stats->ops[op].bytes += bytes;
+    stats->ops[op].cycles += cycles;
+}
+
+#if defined(CM_PROFILE_CLOCK)
+static uint32_t getProfileTime(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint32_t) ((uint64_t) t.tv_sec * 1000000000u + (uint64_t) t.tv_nsec);
+}
+#endif
+#endif
+
+static bool writeLogBytes(CMLogWriter *log, const void *data, uint32_t size) {
+    if (size == 0)
+        return true;
+    if (!log->write(log->context, data, size)) {
+        log->firstError = CM_ERROR_IO;
+        return false;
+    }
+    log->size += size;
     return true;
 }
 
-static void inverseByteOrder(void *data, uint8_t size) {
-    uint8_t *d = (uint8_t *) data;
-    for (uint8_t i = 0; i < size / 2; ++i) {
-        uint8_t t = d[size - i - 1];
-        d[size - i - 1] = d[i];
-        d[i] = t;
+static uint32_t getLogVersion(const void *message, uint32_t size) {
+    CompositeMessageReader reader;
+    cmInitConstReader(&reader, message, size);
+    while (reader.firstError == CM_ERROR_NONE && reader.readSize < reader.totalSize) {
+        uint8_t flag = reader.message[reader.readSize];
+        if (flag == CM_VERSION) {
+            uint32_t version = cmReadVersion(&reader);
+            return reader.firstError == CM_ERROR_NONE ? version : 0;
+        } else if (flag == CM_METADATA_START) {
+            cmReadMetadataStart(&reader);
+        } else if (flag == CM_MARKER) {
+            cmSkip(&reader);
+        } else {
+            break;
+        }
     }
+    return 0;
 }
 
-static bool convertEndianness(void *message, uint32_t size) {
-    uint8_t *d = (uint8_t *) message;
-    while (size > 0) {
-        uint8_t flag = *d;
+static uint32_t readLogU32(const CMLogReader *log, uint64_t offset) {
+    uint32_t value;
+    memcpy(&value, &log->data[offset], sizeof(value));
+    if (log->swapBytes) {
+        inverseByteOrder(&value, sizeof(value));
+    }
+    return value;
+}
 
-        uint8_t itemLen = 1u << (flag & CM_TYPE_LEN_MASK);
-        uint32_t itemCount = 1;
+static uint64_t readLogU64(const CMLogReader *log, uint64_t offset) {
+    uint64_t value;
+    memcpy(&value, &log->data[offset], sizeof(value));
+    if (log->swapBytes) {
+        inverseByteOrder(&value, sizeof(value));
+    }
+    return value;
+}
 
-        --size;
-        ++d;
+static uint64_t getLogIndexSize(uint32_t entryCount) {
+    return CM_LOG_INDEX_HEADER_SIZE + (uint64_t) entryCount * CM_LOG_ENTRY_SIZE +
+           CM_LOG_TRAILER_SIZE;
+}
 
-        if (isArray(flag)) {
-            // length of each item
-            inverseByteOrder(d, sizeof(uint32_t));
-            itemCount = *(uint32_t *) d;
-            d += sizeof(uint32_t);
-            size -= sizeof(uint32_t);
-        } else if (isVersion(flag)) {
-            itemLen = sizeof(uint32_t);
-        } else if (!isSingleValue(flag)) {
-            // unknown flag
-            return false;
-        }
+static bool readLogTrailer(CMLogReader *log) {
+    if (log->size < CM_LOG_HEADER_SIZE + CM_LOG_TRAILER_SIZE)
+        return false;
+    uint64_t trailer = log->size - CM_LOG_TRAILER_SIZE;
+    if (memcmp(&log->data[trailer + 12], "CMLI", 4) != 0)
+        return false;
+    uint64_t offset = readLogU64(log, trailer);
+    uint32_t count = readLogU32(log, trailer + 8);
+    if (count == 0)
+        return false;
+    if (count > log->maxIndexes) {
+        log->firstError = CM_ERROR_NO_SPACE;
+        return false;
+    }
 
-        for (int i = 0; i < itemCount; ++i) {
-            inverseByteOrder(d, itemLen);
-            d += itemLen;
-            size -= itemLen;
+    // indexes are followed from the last one, each must end before the
+    // next one and must list messages right before messages of next one
+    uint64_t end = log->size;
+    uint64_t nextMessage = 0;
+    for (uint32_t i = count; i > 0; --i) {
+        if (offset < CM_LOG_HEADER_SIZE || offset > end ||
+            end - offset < getLogIndexSize(0) ||
+            readLogU32(log, offset) != CM_LOG_INDEX_TAG)
+            return false;
+        uint32_t entryCount = readLogU32(log, offset + 4);
+        uint64_t indexSize = getLogIndexSize(entryCount);
+        uint64_t firstMessage = readLogU64(log, offset + 8);
+        uint64_t previous = readLogU64(log, offset + 16);
+        uint64_t indexEnd = offset + indexSize - CM_LOG_TRAILER_SIZE;
+        if (entryCount == 0 || indexSize > end - offset ||
+            (i == count ? offset + indexSize != end :
+             firstMessage + entryCount != nextMessage) ||
+            readLogU64(log, indexEnd) != offset ||
+            readLogU32(log, indexEnd + 8) != i ||
+            (i == 1 ? firstMessage != 0 || previous != 0 : previous >= offset))
+            return false;
+        if (i == count) {
+            log->messageCount = firstMessage + entryCount;
         }
+        log->indexes[i - 1].offset = offset;
+        log->indexes[i - 1].firstMessage = firstMessage;
+        log->indexes[i - 1].entryCount = entryCount;
+        end = offset;
+        nextMessage = firstMessage;
+        offset = previous;
     }
+    log->indexCount = count;
+    log->tailOffset = log->size;
+    log->tailCount = 0;
     return true;
 }
 
-static bool isSingleValue(uint8_t flag) {
-    return (flag >> 5u) == 0 && flag > 0;
-}
+static bool scanLog(CMLogReader *log) {
+    uint64_t offset = CM_LOG_HEADER_SIZE;
+    uint64_t count = 0;
+    uint64_t indexed = 0;
+    log->indexCount = 0;
+    log->tailOffset = offset;
+    while (offset < log->size && log->size - offset >= sizeof(uint32_t)) {
+        uint32_t size = readLogU32(log, offset);
+        if (size != CM_LOG_INDEX_TAG) {
+            // incomplete message at the end of file is ignored
+            if (size > log->size - offset - sizeof(uint32_t))
+                break;
+            ++count;
+            offset += sizeof(uint32_t) + (uint64_t) size;
+            offset += (4u - offset) & 7u;
+            continue;
+        }
 
-static bool isArray(uint8_t flag) {
-    return (flag >> 5u) == 2;
+        if (log->size - offset < CM_LOG_INDEX_HEADER_SIZE)
+            break;
+        uint32_t entryCount = readLogU32(log, offset + 4);
+        uint64_t indexSize = getLogIndexSize(entryCount);
+        if (indexSize > log->size - offset)
+            break;
+        // index must list all messages after previous index
+        if (entryCount == 0 || readLogU64(log, offset + 8) != indexed ||
+            indexed + entryCount != count) {
+            log->firstError = CM_ERROR_MALFORMED;
+            return false;
+        }
+        if (log->indexCount == log->maxIndexes) {
+            log->firstError = CM_ERROR_NO_SPACE;
+            return false;
+        }
+        CMLogIndex *index = &log->indexes[log->indexCount++];
+        index->offset = offset;
+        index->firstMessage = indexed;
+        index->entryCount = entryCount;
+        indexed = count;
+        offset += indexSize;
+        log->tailOffset = offset;
+    }
+    log->messageCount = count;
+    log->tailCount = count - indexed;
+    return true;
 }
 
-static bool isVersion(uint8_t flag) {
-    return flag == CM_VERSION;
+static bool findLogMessage(CMLogReader *log, uint64_t n, uint64_t *offset,
+                           uint32_t *size, uint32_t *version) {
+    if (n < log->messageCount - log->tailCount) {
+        // the last index with first message that is not after n
+        uint32_t low = 0;
+        uint32_t high = log->indexCount;
+        while (high - low > 1) {
+            uint32_t mid = low + (high - low) / 2;
+            if (log->indexes[mid].firstMessage <= n) {
+                low = mid;
+            } else {
+                high = mid;
+            }
+        }
+        const CMLogIndex *index = &log->indexes[low];
+        uint64_t entry = index->offset + CM_LOG_INDEX_HEADER_SIZE +
+                         (n - index->firstMessage) * CM_LOG_ENTRY_SIZE;
+        *offset = readLogU64(log, entry);
+        *size = readLogU32(log, entry + 8);
+        *version = readLogU32(log, entry + 12);
+        if (*offset < CM_LOG_HEADER_SIZE || *offset > log->size ||
+            *size > log->size - *offset) {
+            log->firstError = CM_ERROR_MALFORMED;
+            return false;
+        }
+        return true;
+    }
+
+    // messages after the last index were checked by scanLog
+    uint64_t pos = log->tailOffset;
+    for (uint64_t i = log->messageCount - log->tailCount; i < n; ++i) {
+        pos += sizeof(uint32_t) + (uint64_t) readLogU32(log, pos);
+        pos += (4u - pos) & 7u;
+    }
+    *size = readLogU32(log, pos);
+    *offset = pos + sizeof(uint32_t);
+    *version = getLogVersion(&log->data[*offset], *size);
+    return true;
 }
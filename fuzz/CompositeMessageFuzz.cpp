@@ -0,0 +1,94 @@
+#include "composite_message.h"
+
+#include <cstring>
+#include <vector>
+
+namespace {
+    /**
+     * Walk through all fields of message, build its index and template, so each
+     * element is parsed at least twice. Compressed elements are walked up to
+     * a few levels deep, so crafted input can't exhaust stack
+     */
+    void walk(CompositeMessageReader &reader, int depth = 0) {
+        if (reader.firstError != CM_ERROR_NONE)
+            return;
+
+        CMIndexEntry table[64];
+        CompositeMessageReader copy = reader;
+        cmBuildIndex(&copy, table, 64);
+
+        // message is matched against template compiled from itself
+        uint8_t signature[256];
+        uint8_t mask[256];
+        CMTemplateField fields[16];
+        CMTemplate tmpl;
+        cmInitTemplate(&tmpl, signature, mask, sizeof(signature), fields, 16);
+        copy = reader;
+        if (cmCompileTemplate(&tmpl, &copy)) {
+            copy = reader;
+            cmMatchTemplate(&copy, &tmpl);
+        }
+
+        while (reader.firstError == CM_ERROR_NONE &&
+               reader.readSize < reader.totalSize) {
+            if (reader.dictionary != nullptr) {
+                // strings are resolved with dictionary before field is skipped
+                const char *str;
+                CompositeMessageReader name = reader;
+                cmReadNameView(&name, &str);
+                CompositeMessageReader string = reader;
+                cmReadStringView(&string, &str);
+            }
+            if (reader.message[reader.readSize] == 0x8F && depth < 4) {
+                // decompressed elements are walked as a separate stream
+                uint8_t buffer[1024];
+                CMCompressor lz4;
+                cmInitLz4Compressor(&lz4, nullptr, sizeof(buffer));
+                CompositeMessageReader output;
+                cmInitStreamReader(&output, buffer, sizeof(buffer));
+                CompositeMessageReader compressed = reader;
+                if (cmDecompress(&compressed, &lz4, &output) != 0) {
+                    walk(output, depth + 1);
+                }
+            }
+            cmSkip(&reader);
+        }
+    }
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    if (size > UINT32_MAX)
+        return 0;
+
+    // exact copy lets sanitizer catch any access outside of message
+    std::vector<uint8_t> message(data, data + size);
+    auto reader = cmGetReader(message.data(), (uint32_t) size);
+    walk(reader);
+
+    CompositeMessageReader constReader;
+    cmInitConstReader(&constReader, data, (uint32_t) size);
+    walk(constReader);
+
+    CMDictionaryEntry entries[16];
+    char chars[256];
+    CMDictionary dictionary;
+    cmInitDictionary(&dictionary, entries, 16, chars, sizeof(chars));
+    cmInitConstReader(&constReader, data, (uint32_t) size);
+    cmSetReaderDictionary(&constReader, &dictionary);
+    cmUpdateDictionary(&constReader);
+    walk(constReader);
+
+    // input is also read as log file, its messages are walked in place
+    CMLogIndex indexes[8];
+    CMLogReader log;
+    if (cmInitLogReader(&log, message.data(), size, indexes, 8)) {
+        for (uint64_t n = 0; n < log.messageCount && n < 16; ++n) {
+            CompositeMessageReader logReader;
+            if (cmReadLogMessage(&log, n, &logReader)) {
+                walk(logReader);
+            }
+        }
+        cmFindLogVersion(&log, 100);
+    }
+    return 0;
+}
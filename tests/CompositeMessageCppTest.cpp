@@ -0,0 +1,320 @@
+#include "composite_message.hpp"
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <vector>
+
+namespace {
+    enum class Mode : uint16_t {
+        IDLE = 1,
+        ACTIVE = 0x1234
+    };
+
+    struct Position {
+        float x;
+        float y;
+
+        CM_REFLECT(x, y)
+    };
+
+    struct Sample {
+        uint32_t id = 0;
+        int8_t i8 = 0;
+        int16_t i16 = 0;
+        int32_t i32 = 0;
+        int64_t i64 = 0;
+        uint64_t u64 = 0;
+        double value = 0;
+        bool valid = false;
+        char symbol = 0;
+        Mode mode = Mode::IDLE;
+        std::array<int16_t, 4> raw{};
+        uint8_t bytes[3] = {};
+        char name[16] = {};
+        Position position{};
+
+        CM_REFLECT(id, i8, i16, i32, i64, u64, value, valid, symbol, mode, raw,
+                   bytes, name, position)
+    };
+
+    struct Reading {
+        uint32_t id;
+        std::array<int16_t, 2> values;
+        Position position;
+
+        CM_REFLECT(id, values, position)
+    };
+
+    Sample getSample() {
+        Sample s;
+        s.id = 0xA1B2C3D4;
+        s.i8 = -5;
+        s.i16 = -1234;
+        s.i32 = -123456789;
+        s.i64 = -1234567890123LL;
+        s.u64 = 0x0102030405060708ULL;
+        s.value = 3.25;
+        s.valid = true;
+        s.symbol = 'q';
+        s.mode = Mode::ACTIVE;
+        s.raw = {1, -2, 300, -400};
+        s.bytes[0] = 7;
+        s.bytes[1] = 8;
+        s.bytes[2] = 9;
+        std::strcpy(s.name, "sensor");
+        s.position = {1.5f, -2.5f};
+        return s;
+    }
+
+    void writeSampleWithCApi(CompositeMessageWriter *writer, const Sample &s) {
+        cmWriteU32(writer, s.id);
+        cmWriteI8(writer, s.i8);
+        cmWriteI16(writer, s.i16);
+        cmWriteI32(writer, s.i32);
+        cmWriteI64(writer, s.i64);
+        cmWriteU64(writer, s.u64);
+        cmWriteD(writer, s.value);
+        cmWriteBool(writer, s.valid);
+        cmWriteChar(writer, s.symbol);
+        cmWriteU16(writer, (uint16_t) s.mode);
+        cmWriteIArray(writer, s.raw.data(), 4);
+        cmWriteUArray(writer, s.bytes, 3);
+        cmWriteString(writer, s.name, (uint32_t) std::strlen(s.name));
+        cmWriteBlockStart(writer);
+        cmWriteF(writer, s.position.x);
+        cmWriteF(writer, s.position.y);
+        cmWriteBlockEnd(writer);
+    }
+
+    void requireEqual(const Sample &a, const Sample &b) {
+        REQUIRE(a.id == b.id);
+        REQUIRE(a.i8 == b.i8);
+        REQUIRE(a.i16 == b.i16);
+        REQUIRE(a.i32 == b.i32);
+        REQUIRE(a.i64 == b.i64);
+        REQUIRE(a.u64 == b.u64);
+        REQUIRE(a.value == b.value);
+        REQUIRE(a.valid == b.valid);
+        REQUIRE(a.symbol == b.symbol);
+        REQUIRE(a.mode == b.mode);
+        REQUIRE(a.raw == b.raw);
+        REQUIRE(std::memcmp(a.bytes, b.bytes, sizeof(a.bytes)) == 0);
+        REQUIRE(std::strcmp(a.name, b.name) == 0);
+        REQUIRE(a.position.x == b.position.x);
+        REQUIRE(a.position.y == b.position.y);
+    }
+}
+
+SCENARIO("Struct encoding with reflection", "[cpp]") {
+    static_assert(cm::maxSize<Position>() == 10);
+    static_assert(cm::maxSize<Sample>() ==
+                  5 + 2 + 3 + 5 + 9 + 9 + 9 + 2 + 2 + 3 + 13 + 8 + 21 + 12);
+
+    GIVEN("Message written with C API") {
+        auto sample = getSample();
+        std::vector<uint8_t> expected(256);
+        auto writer = cmGetWriter(expected.data(), (uint32_t) expected.size());
+        writeSampleWithCApi(&writer, sample);
+        REQUIRE(writer.firstError == CM_ERROR_NONE);
+        expected.resize(writer.usedSize);
+
+        WHEN("Struct is encoded to large buffer") {
+            std::vector<uint8_t> buffer(cm::maxMessageSize<Sample>());
+            uint32_t size = cm::encode(sample, buffer.data(), (uint32_t) buffer.size());
+
+            THEN("Message is the same") {
+                REQUIRE(size == expected.size());
+                buffer.resize(size);
+                REQUIRE(buffer == expected);
+            }
+
+            AND_THEN("Struct is decoded back") {
+                Sample decoded;
+                REQUIRE(cm::decode(buffer.data(), size, decoded));
+                requireEqual(decoded, sample);
+            }
+        }
+
+        WHEN("Struct is encoded to buffer without space for maximum size") {
+            std::vector<uint8_t> buffer(expected.size());
+            uint32_t size = cm::encode(sample, buffer.data(), (uint32_t) buffer.size());
+
+            THEN("Fields are written one by one with the same result") {
+                REQUIRE(size == expected.size());
+                REQUIRE(buffer == expected);
+            }
+        }
+
+        WHEN("Struct is encoded to too small buffer") {
+            std::vector<uint8_t> buffer(expected.size() - 1);
+            uint32_t size = cm::encode(sample, buffer.data(), (uint32_t) buffer.size());
+
+            THEN("Space error") {
+                REQUIRE(size == 0);
+            }
+        }
+
+        WHEN("Struct is encoded with stream writer") {
+            std::vector<uint8_t> output;
+            std::vector<uint8_t> buffer(32);
+            auto stream = cmGetWriter(buffer.data(), (uint32_t) buffer.size());
+            cmSetFlushCallback(&stream, [](void *context, const void *data, uint32_t size) {
+                auto *out = (std::vector<uint8_t> *) context;
+                out->insert(out->end(), (const uint8_t *) data, (const uint8_t *) data + size);
+                return true;
+            }, &output);
+            cm::encode(stream, sample);
+            cmFlush(&stream);
+
+            THEN("Message is the same") {
+                REQUIRE(stream.firstError == CM_ERROR_NONE);
+                REQUIRE(output == expected);
+            }
+        }
+
+        WHEN("Struct is encoded with compact integers") {
+            std::vector<uint8_t> compact(256);
+            auto compactWriter = cmGetWriter(compact.data(), (uint32_t) compact.size());
+            cmSetCompactIntegers(&compactWriter, true);
+            writeSampleWithCApi(&compactWriter, sample);
+            compact.resize(compactWriter.usedSize);
+
+            std::vector<uint8_t> buffer(256);
+            auto w = cmGetWriter(buffer.data(), (uint32_t) buffer.size());
+            cmSetCompactIntegers(&w, true);
+            cm::encode(w, sample);
+            buffer.resize(w.usedSize);
+
+            THEN("Integers are compact as with C API") {
+                REQUIRE(w.firstError == CM_ERROR_NONE);
+                REQUIRE(buffer == compact);
+            }
+
+            AND_THEN("Struct is decoded back") {
+                Sample decoded;
+                REQUIRE(cm::decode(buffer.data(), (uint32_t) buffer.size(), decoded));
+                requireEqual(decoded, sample);
+            }
+        }
+
+        WHEN("Struct is decoded from stream") {
+            std::vector<uint8_t> buffer(256);
+            CompositeMessageReader reader;
+            cmInitStreamReader(&reader, buffer.data(), (uint32_t) buffer.size());
+            Sample decoded;
+            uint32_t fed = 0;
+            uint32_t attempts = 0;
+            while (!cm::decode(reader, decoded)) {
+                REQUIRE(reader.firstError == CM_ERROR_NEED_MORE);
+                cmFeed(&reader, expected.data() + fed, 5);
+                fed += 5;
+                ++attempts;
+            }
+
+            THEN("Struct is read after all bytes are received") {
+                REQUIRE(attempts > 1);
+                REQUIRE(fed >= expected.size());
+                requireEqual(decoded, sample);
+            }
+        }
+    }
+
+    GIVEN("Message with inverse endianness") {
+        Reading reading{0x01020304, {-2, 300}, {1.5f, -2.5f}};
+        std::vector<uint8_t> buffer(cm::maxMessageSize<Reading>());
+        uint32_t size = cm::encode(reading, buffer.data(), (uint32_t) buffer.size());
+        REQUIRE(size == 28);
+        buffer.resize(size);
+
+        std::swap(buffer[0], buffer[1]);
+        std::reverse(&buffer[3], &buffer[7]);
+        std::reverse(&buffer[8], &buffer[12]);
+        std::reverse(&buffer[12], &buffer[14]);
+        std::reverse(&buffer[14], &buffer[16]);
+        std::reverse(&buffer[18], &buffer[22]);
+        std::reverse(&buffer[23], &buffer[27]);
+
+        WHEN("Struct is decoded with const reader") {
+            Reading decoded{};
+            bool decodeResult = cm::decode(buffer.data(), size, decoded);
+
+            THEN("Values are converted") {
+                REQUIRE(decodeResult);
+                REQUIRE(decoded.id == reading.id);
+                REQUIRE(decoded.values == reading.values);
+                REQUIRE(decoded.position.x == reading.position.x);
+                REQUIRE(decoded.position.y == reading.position.y);
+            }
+        }
+
+        WHEN("Struct is decoded after message is converted") {
+            Reading decoded{};
+            auto reader = cmGetReader(buffer.data(), size);
+            bool decodeResult = cm::decode(reader, decoded);
+
+            THEN("Values are the same") {
+                REQUIRE(decodeResult);
+                REQUIRE(decoded.id == reading.id);
+                REQUIRE(decoded.values == reading.values);
+                REQUIRE(decoded.position.y == reading.position.y);
+            }
+        }
+    }
+
+    GIVEN("Struct with string without null terminator") {
+        auto sample = getSample();
+        std::memset(sample.name, 'a', sizeof(sample.name));
+
+        WHEN("Struct is encoded") {
+            std::vector<uint8_t> buffer(256);
+            auto writer = cmGetWriter(buffer.data(), (uint32_t) buffer.size());
+            cm::encode(writer, sample);
+
+            THEN("Invalid argument error") {
+                REQUIRE(writer.firstError == CM_ERROR_INVALID_ARG);
+                REQUIRE(writer.usedSize == 2);
+            }
+        }
+    }
+
+    GIVEN("Message with different layout") {
+        std::vector<uint8_t> buffer(64);
+        auto writer = cmGetWriter(buffer.data(), (uint32_t) buffer.size());
+        int16_t short_[3] = {1, 2, 3};
+
+        WHEN("Array has different size") {
+            cmWriteF(&writer, 1.f);
+            cmWriteIArray(&writer, short_, 3);
+
+            THEN("Value error") {
+                struct {
+                    float f;
+                    std::array<int16_t, 4> a;
+                    CM_REFLECT(f, a)
+                } value{};
+                auto reader = cmGetReader(buffer.data(), writer.usedSize);
+                REQUIRE_FALSE(cm::decode(reader, value));
+                REQUIRE(reader.firstError == CM_ERROR_NO_VALUE);
+            }
+        }
+
+        WHEN("Value has different type") {
+            cmWriteF(&writer, 1.f);
+            cmWriteF(&writer, 2.f);
+
+            THEN("Value error") {
+                struct {
+                    float f;
+                    uint32_t u;
+                    CM_REFLECT(f, u)
+                } value{};
+                auto reader = cmGetReader(buffer.data(), writer.usedSize);
+                REQUIRE_FALSE(cm::decode(reader, value));
+                REQUIRE(reader.firstError == CM_ERROR_NO_VALUE);
+            }
+        }
+    }
+}
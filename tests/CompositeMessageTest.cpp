@@ -4,8 +4,14 @@
 #include <catch2/matchers/catch_matchers_all.hpp>
 #include <catch2/generators/catch_generators_all.hpp>
 
+#include <algorithm>
 #include <vector>
 #include <cfloat>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
 
 SCENARIO("Reader and writer creation", "[create]") {
     GIVEN("Non empty buffer") {
@@ -52,6 +58,50 @@ SCENARIO("Reader and writer creation", "[create]") {
     }
 }
 
+SCENARIO("Reader and writer creation from multiple threads", "[create]") {
+    GIVEN("Several threads with their own buffers") {
+        const int threadCount = 8;
+        const int iterations = 2000;
+        std::vector<int> failures(threadCount, 0);
+
+        WHEN("Each thread writes and reads messages") {
+            std::vector<std::thread> threads;
+            for (int t = 0; t < threadCount; ++t) {
+                threads.emplace_back([t, &failures]() {
+                    std::vector<uint8_t> buffer(64);
+                    for (int i = 0; i < iterations; ++i) {
+                        CompositeMessageWriter writer;
+                        cmInitWriter(&writer, buffer.data(), buffer.size());
+                        cmWriteI32(&writer, t * iterations + i);
+                        cmWriteU8(&writer, (uint8_t) t);
+
+                        CompositeMessageReader reader;
+                        cmInitReader(&reader, writer.buffer, writer.usedSize);
+                        int32_t r1 = cmReadI32(&reader);
+                        uint8_t r2 = cmReadU8(&reader);
+
+                        if (writer.buffer != buffer.data() ||
+                            reader.message != buffer.data() ||
+                            reader.firstError != CM_ERROR_NONE ||
+                            r1 != t * iterations + i || r2 != t) {
+                            ++failures[t];
+                        }
+                    }
+                });
+            }
+            for (auto &thread: threads) {
+                thread.join();
+            }
+
+            THEN("Each thread sees only its own state") {
+                for (int f: failures) {
+                    REQUIRE(f == 0);
+                }
+            }
+        }
+    }
+}
+
 SCENARIO("Write message", "[write]") {
     GIVEN("Writer with enough space") {
         std::vector<uint8_t> buffer(1024);
@@ -93,6 +143,93 @@ SCENARIO("Write message", "[write]") {
         }
     }
 
+    GIVEN("Array filled in place") {
+        std::vector<uint8_t> buffer(1024);
+        auto writer = cmGetWriter(buffer.data(), buffer.size());
+        std::vector<uint16_t> data{3, 1234, 17, UINT16_MAX};
+        auto *items = (uint8_t *) cmBeginArray(&writer, CM_TYPE_UINT, 2, 10);
+
+        WHEN("Array is committed") {
+            for (size_t i = 0; i < data.size(); ++i) {
+                memcpy(&items[i * 2], &data[i], 2);
+            }
+            cmCommitArray(&writer, data.size());
+            cmWriteU8(&writer, 5);
+
+            THEN("Message is the same as written from separate buffer") {
+                std::vector<uint8_t> expected(1024);
+                auto expectedWriter = cmGetWriter(expected.data(), expected.size());
+                cmWriteUArray(&expectedWriter, data.data(), data.size());
+                cmWriteU8(&expectedWriter, 5);
+
+                REQUIRE(writer.firstError == CM_ERROR_NONE);
+                REQUIRE(writer.usedSize == expectedWriter.usedSize);
+                buffer.resize(writer.usedSize);
+                expected.resize(expectedWriter.usedSize);
+                REQUIRE_THAT(buffer, Catch::Matchers::Equals(expected));
+            }
+        }
+
+        WHEN("Too many items are committed") {
+            cmCommitArray(&writer, 11);
+
+            THEN("Invalid arg error") {
+                REQUIRE(writer.firstError == CM_ERROR_INVALID_ARG);
+            }
+        }
+
+        WHEN("Value is written before commit") {
+            cmWriteU8(&writer, 5);
+
+            THEN("Invalid arg error") {
+                REQUIRE(writer.firstError == CM_ERROR_INVALID_ARG);
+            }
+        }
+    }
+
+    GIVEN("String filled in place") {
+        std::vector<uint8_t> buffer(1024);
+        auto writer = cmGetWriter(buffer.data(), buffer.size());
+        auto *str = (char *) cmBeginArray(&writer, CM_TYPE_CHAR, 1, 16);
+        memcpy(str, "abc", 3);
+        cmCommitArray(&writer, 3);
+        auto reader = cmGetReader(writer.buffer, writer.usedSize);
+
+        WHEN("String is read") {
+            std::vector<char> r(32, 'A');
+            auto length = cmPeekStringLength(&reader);
+            r.resize(cmReadString(&reader, r.data(), r.size()));
+
+            THEN("String is null terminated") {
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+                REQUIRE(length == 3);
+                REQUIRE_THAT(r.data(), Catch::Matchers::Equals("abc"));
+            }
+        }
+    }
+
+    GIVEN("Array that doesn't fit") {
+        std::vector<uint8_t> buffer(1024);
+        auto writer = cmGetWriter(buffer.data(), buffer.size());
+        void *items = cmBeginArray(&writer, CM_TYPE_UINT, 4, 1000);
+
+        THEN("No space error") {
+            REQUIRE(items == nullptr);
+            REQUIRE(writer.firstError == CM_ERROR_NO_SPACE);
+        }
+    }
+
+    GIVEN("Array with invalid item size") {
+        std::vector<uint8_t> buffer(1024);
+        auto writer = cmGetWriter(buffer.data(), buffer.size());
+        uint8_t data[6] = {0};
+        cmWriteTypedArray(&writer, CM_TYPE_UINT, 3, data, 2);
+
+        THEN("Invalid arg error") {
+            REQUIRE(writer.firstError == CM_ERROR_INVALID_ARG);
+        }
+    }
+
     GIVEN("Writer with not enough space") {
         std::vector<uint8_t> buffer(3);
         auto writer = cmGetWriter(buffer.data(), buffer.size());
@@ -107,6 +244,202 @@ SCENARIO("Write message", "[write]") {
     }
 }
 
+SCENARIO("Write message in gather mode", "[write]") {
+    GIVEN("Writer in gather mode") {
+        std::vector<uint8_t> buffer(64);
+        std::vector<CMSegment> segments(GENERATE(4, 8));
+        auto writer = cmGetWriter(buffer.data(), buffer.size());
+        cmSetGatherMode(&writer, segments.data(), segments.size(), 16);
+
+        std::vector<uint32_t> large(100);
+        for (size_t i = 0; i < large.size(); ++i) {
+            large[i] = (uint32_t) (i * 7);
+        }
+        std::vector<uint8_t> small{1, 2, 3};
+        std::string str(20, 'x');
+
+        WHEN("Large and small arrays are written") {
+            cmWriteU8(&writer, 5);
+            cmWriteUArray(&writer, large.data(), large.size());
+            cmWriteUArray(&writer, small.data(), small.size());
+            cmWriteString(&writer, str.c_str(), str.size());
+            cmWriteU8(&writer, 7);
+            auto count = cmFinishSegments(&writer);
+
+            THEN("Segments form the same message as contiguous writer") {
+                std::vector<uint8_t> expected(1024);
+                auto expectedWriter = cmGetWriter(expected.data(), expected.size());
+                cmWriteU8(&expectedWriter, 5);
+                cmWriteUArray(&expectedWriter, large.data(), large.size());
+                cmWriteUArray(&expectedWriter, small.data(), small.size());
+                cmWriteString(&expectedWriter, str.c_str(), str.size());
+                cmWriteU8(&expectedWriter, 7);
+                expected.resize(expectedWriter.usedSize);
+
+                std::vector<uint8_t> gathered;
+                for (uint32_t i = 0; i < count; ++i) {
+                    auto *d = (const uint8_t *) segments[i].data;
+                    gathered.insert(gathered.end(), d, d + segments[i].size);
+                }
+
+                REQUIRE(writer.firstError == CM_ERROR_NONE);
+                REQUIRE(writer.usedSize + writer.externalSize == expected.size());
+                REQUIRE_THAT(gathered, Catch::Matchers::Equals(expected));
+            }
+
+            AND_THEN("Large payload is referenced, not copied") {
+                REQUIRE(segments[1].data == (const void *) large.data());
+                REQUIRE(segments[1].size == large.size() * sizeof(uint32_t));
+            }
+        }
+
+        WHEN("Array with payload larger than message limit is written") {
+            // item count is not checked before payload is referenced
+            cmWriteTypedArray(&writer, CM_TYPE_UINT, 8, large.data(), 0x20000001);
+
+            THEN("No space error") {
+                REQUIRE(writer.firstError == CM_ERROR_NO_SPACE);
+                REQUIRE(writer.segmentCount == 0);
+                REQUIRE(writer.usedSize == CM_SIZEOF_MARK);
+            }
+        }
+    }
+}
+
+static bool appendToVector(void *context, const void *data, uint32_t size) {
+    auto *out = (std::vector<uint8_t> *) context;
+    auto *d = (const uint8_t *) data;
+    out->insert(out->end(), d, d + size);
+    return true;
+}
+
+static bool failFlush(void *, const void *, uint32_t) {
+    return false;
+}
+
+SCENARIO("Write message in stream mode", "[write][stream]") {
+    GIVEN("Stream writer with small buffer") {
+        std::vector<uint8_t> buffer(16);
+        std::vector<uint8_t> output;
+        auto writer = cmGetWriter(buffer.data(), buffer.size());
+        cmSetFlushCallback(&writer, appendToVector, &output);
+
+        std::vector<uint32_t> large(1000);
+        for (size_t i = 0; i < large.size(); ++i) {
+            large[i] = (uint32_t) (i * 13);
+        }
+        std::vector<uint16_t> small{1, 2, 3};
+
+        WHEN("Message larger than buffer is written") {
+            for (int i = 0; i < 20; ++i) {
+                cmWriteI32(&writer, i);
+            }
+            cmWriteUArray(&writer, small.data(), small.size());
+            cmWriteUArray(&writer, large.data(), large.size());
+            cmWriteString(&writer, "abcdef", 6);
+            cmWriteVersion(&writer, 157);
+            cmFlush(&writer);
+
+            THEN("Flushed bytes form the same message as contiguous writer") {
+                std::vector<uint8_t> expected(8192);
+                auto expectedWriter = cmGetWriter(expected.data(), expected.size());
+                for (int i = 0; i < 20; ++i) {
+                    cmWriteI32(&expectedWriter, i);
+                }
+                cmWriteUArray(&expectedWriter, small.data(), small.size());
+                cmWriteUArray(&expectedWriter, large.data(), large.size());
+                cmWriteString(&expectedWriter, "abcdef", 6);
+                cmWriteVersion(&expectedWriter, 157);
+                expected.resize(expectedWriter.usedSize);
+
+                REQUIRE(writer.firstError == CM_ERROR_NONE);
+                REQUIRE(writer.usedSize == 0);
+                REQUIRE(writer.flushedSize == expected.size());
+                REQUIRE_THAT(output, Catch::Matchers::Equals(expected));
+            }
+        }
+
+        WHEN("Array with payload larger than message limit is written") {
+            cmWriteTypedArray(&writer, CM_TYPE_UINT, 8, large.data(), 0x20000001);
+
+            THEN("No space error") {
+                REQUIRE(writer.firstError == CM_ERROR_NO_SPACE);
+                REQUIRE(writer.usedSize == CM_SIZEOF_MARK);
+                REQUIRE(output.empty());
+            }
+        }
+
+        WHEN("String with too many chars for null terminator is written") {
+            cmWriteTypedArray(&writer, CM_TYPE_CHAR, 1, "", UINT32_MAX);
+
+            THEN("No space error") {
+                REQUIRE(writer.firstError == CM_ERROR_NO_SPACE);
+                REQUIRE(output.empty());
+            }
+        }
+    }
+
+    GIVEN("Stream writer with array filled in place after flush") {
+        std::vector<uint8_t> buffer(32);
+        std::vector<uint8_t> output;
+        auto writer = cmGetWriter(buffer.data(), buffer.size());
+        cmSetFlushCallback(&writer, appendToVector, &output);
+        std::vector<uint32_t> data{7, 1234, 17, 0, UINT32_MAX};
+        for (int i = 0; i < 5; ++i) {
+            cmWriteI32(&writer, i);
+        }
+        // array doesn't fit after written values, so buffer is flushed
+        auto *items = (uint8_t *) cmBeginArray(&writer, CM_TYPE_UINT, 4, data.size());
+        REQUIRE(items != nullptr);
+        REQUIRE(writer.arrayStart == 0);
+
+        WHEN("Array is committed") {
+            memcpy(items, data.data(), data.size() * sizeof(uint32_t));
+            cmCommitArray(&writer, data.size());
+            cmWriteU8(&writer, 5);
+            cmFlush(&writer);
+
+            THEN("Flushed bytes form the same message as contiguous writer") {
+                std::vector<uint8_t> expected(1024);
+                auto expectedWriter = cmGetWriter(expected.data(), expected.size());
+                for (int i = 0; i < 5; ++i) {
+                    cmWriteI32(&expectedWriter, i);
+                }
+                cmWriteUArray(&expectedWriter, data.data(), data.size());
+                cmWriteU8(&expectedWriter, 5);
+                expected.resize(expectedWriter.usedSize);
+
+                REQUIRE(writer.firstError == CM_ERROR_NONE);
+                REQUIRE_THAT(output, Catch::Matchers::Equals(expected));
+            }
+        }
+
+        WHEN("Value is written before commit") {
+            cmWriteU8(&writer, 5);
+
+            THEN("Invalid arg error") {
+                REQUIRE(writer.firstError == CM_ERROR_INVALID_ARG);
+            }
+        }
+    }
+
+    GIVEN("Stream writer with failing callback") {
+        std::vector<uint8_t> buffer(16);
+        auto writer = cmGetWriter(buffer.data(), buffer.size());
+        cmSetFlushCallback(&writer, failFlush, nullptr);
+
+        WHEN("Message larger than buffer is written") {
+            for (int i = 0; i < 5; ++i) {
+                cmWriteI32(&writer, i);
+            }
+
+            THEN("IO error") {
+                REQUIRE(writer.firstError == CM_ERROR_IO);
+            }
+        }
+    }
+}
+
 SCENARIO("Read message", "[read]") {
     std::vector<uint8_t> buffer(1024);
     auto writer = cmGetWriter(buffer.data(), buffer.size());
@@ -247,6 +580,44 @@ SCENARIO("Read message", "[read]") {
             }
         }
 
+        WHEN("Array views are read") {
+            const uint8_t *viewU8;
+            const uint32_t *viewU32;
+            const uint64_t *viewU64;
+
+            auto sizeU8 = cmReadUArrayView(&reader, &viewU8);
+            auto sizeU32 = cmReadUArrayView(&reader, &viewU32);
+            auto sizeU64 = cmReadUArrayView(&reader, &viewU64);
+
+            THEN("No errors") {
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+                REQUIRE(reader.readSize == writer.usedSize);
+            }
+
+            AND_THEN("Views point into message") {
+                REQUIRE((const uint8_t *) viewU8 == &buffer[7]);
+                REQUIRE(sizeU8 == dataU8.size());
+                REQUIRE(sizeU32 == dataU32.size());
+                REQUIRE(sizeU64 == dataU64.size());
+                for (size_t i = 0; i < dataU32.size(); ++i) {
+                    uint32_t item;
+                    memcpy(&item, &viewU32[i], sizeof(item));
+                    REQUIRE(item == dataU32[i]);
+                }
+            }
+        }
+
+        WHEN("Array view of wrong type is read") {
+            const int8_t *view;
+            auto size = cmReadIArrayView(&reader, &view);
+
+            THEN("No value error") {
+                REQUIRE(reader.firstError == CM_ERROR_NO_VALUE);
+                REQUIRE(size == 0);
+                REQUIRE(view == nullptr);
+            }
+        }
+
         WHEN("Arrays are read") {
             std::vector<uint8_t> readU8(32);
             std::vector<uint32_t> readU32(32);
@@ -294,6 +665,26 @@ SCENARIO("Read message", "[read]") {
             }
         }
 
+        WHEN("String views are read") {
+            const char *v1, *v2, *v3;
+            auto l1 = cmReadStringView(&reader, &v1);
+            auto l2 = cmReadStringView(&reader, &v2);
+            auto l3 = cmReadStringView(&reader, &v3);
+
+            THEN("No errors") {
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+            }
+
+            AND_THEN("Read strings are correct") {
+                REQUIRE(l1 == str1.size());
+                REQUIRE(l2 == str2.size());
+                REQUIRE(l3 == str1.size());
+                REQUIRE_THAT(v1, Catch::Matchers::Equals(str1));
+                REQUIRE_THAT(v2, Catch::Matchers::Equals(str2));
+                REQUIRE_THAT(v3, Catch::Matchers::Equals(str1));
+            }
+        }
+
         WHEN("Strings are read") {
             std::vector<char> r1(32, 'A');
             std::vector<char> r2(32, 'A');
@@ -400,6 +791,132 @@ SCENARIO("Read message", "[read]") {
         }
     }
 
+    GIVEN("Message in inverse endian mode and const reader") {
+        int32_t i = GENERATE(INT32_MIN, 0, INT32_MAX);
+        std::vector<uint16_t> dataU16{0, 123, 17, UINT16_MAX};
+        cmWriteI32(&writer, i);
+        cmWriteUArray(&writer, dataU16.data(), dataU16.size());
+        cmWriteVersion(&writer, 157157);
+
+        // message as it would be written by machine with other endianness
+        std::swap(buffer[0], buffer[1]);
+        std::swap(buffer[3], buffer[6]);
+        std::swap(buffer[4], buffer[5]);
+        std::swap(buffer[8], buffer[11]);
+        std::swap(buffer[9], buffer[10]);
+        for (size_t j = 0; j < dataU16.size(); ++j) {
+            std::swap(buffer[12 + 2 * j], buffer[13 + 2 * j]);
+        }
+        std::swap(buffer[21], buffer[24]);
+        std::swap(buffer[22], buffer[23]);
+        std::vector<uint8_t> original(buffer.begin(),
+                                      buffer.begin() + writer.usedSize);
+
+        CompositeMessageReader reader;
+        cmInitConstReader(&reader, writer.buffer, writer.usedSize);
+
+        WHEN("Array view is read") {
+            const uint16_t *view;
+            cmReadI32(&reader);
+            cmReadUArrayView(&reader, &view);
+
+            THEN("View can't be provided") {
+                REQUIRE(reader.firstError == CM_ERROR_NO_ENDIAN);
+            }
+        }
+
+        WHEN("Values are read") {
+            std::vector<uint16_t> readU16(32);
+            auto r1 = cmReadI32(&reader);
+            auto size = cmPeekArraySize(&reader);
+            readU16.resize(cmReadUArray(&reader, readU16.data(), readU16.size()));
+            auto r2 = cmReadVersion(&reader);
+
+            THEN("No errors") {
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+            }
+
+            AND_THEN("Read values are correct") {
+                REQUIRE(i == r1);
+                REQUIRE(size == dataU16.size());
+                REQUIRE_THAT(readU16, Catch::Matchers::Equals(dataU16));
+                REQUIRE(r2 == 157157);
+            }
+
+            AND_THEN("Message is not modified") {
+                buffer.resize(original.size());
+                REQUIRE_THAT(buffer, Catch::Matchers::Equals(original));
+            }
+        }
+    }
+
+    GIVEN("Message with long arrays in inverse endian mode") {
+        int mode = GENERATE(0, 1);
+        std::vector<uint16_t> dataU16(45);
+        std::vector<uint32_t> dataU32(45);
+        std::vector<uint64_t> dataU64(45);
+        for (size_t j = 0; j < dataU16.size(); ++j) {
+            dataU16[j] = (uint16_t) (j * 0x0103u);
+            dataU32[j] = (uint32_t) (j * 0x01020305u);
+            dataU64[j] = (uint64_t) j * 0x0102030507090B0Dull;
+        }
+        auto inversed = [](auto data) {
+            for (auto &i: data) {
+                auto *d = (uint8_t *) &i;
+                std::reverse(d, d + sizeof(i));
+            }
+            return data;
+        };
+        cmWriteUArray(&writer, inversed(dataU16).data(), dataU16.size());
+        cmWriteUArray(&writer, inversed(dataU32).data(), dataU32.size());
+        cmWriteUArray(&writer, inversed(dataU64).data(), dataU64.size());
+
+        std::swap(buffer[0], buffer[1]);
+        uint32_t offset = 2;
+        for (uint32_t itemSize: {2, 4, 8}) {
+            std::reverse(&buffer[offset + 1], &buffer[offset + 5]);
+            offset += 5 + itemSize * 45;
+        }
+
+        CompositeMessageReader reader;
+        if (mode == 0) {
+            cmInitReader(&reader, writer.buffer, writer.usedSize);
+        } else {
+            cmInitConstReader(&reader, writer.buffer, writer.usedSize);
+        }
+
+        WHEN("Arrays are read") {
+            std::vector<uint16_t> readU16(100);
+            std::vector<uint32_t> readU32(100);
+            std::vector<uint64_t> readU64(100);
+            readU16.resize(cmReadUArray(&reader, readU16.data(), readU16.size()));
+            readU32.resize(cmReadUArray(&reader, readU32.data(), readU32.size()));
+            readU64.resize(cmReadUArray(&reader, readU64.data(), readU64.size()));
+
+            THEN("Read arrays are correct") {
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+                REQUIRE_THAT(readU16, Catch::Matchers::Equals(dataU16));
+                REQUIRE_THAT(readU32, Catch::Matchers::Equals(dataU32));
+                REQUIRE_THAT(readU64, Catch::Matchers::Equals(dataU64));
+            }
+        }
+    }
+
+    GIVEN("Message with truncated array") {
+        std::vector<uint32_t> dataU32{0, 123, 17, UINT32_MAX, 234};
+        cmWriteUArray(&writer, dataU32.data(), dataU32.size());
+        auto reader = cmGetReader(writer.buffer, writer.usedSize - 1);
+
+        WHEN("Array is read") {
+            std::vector<uint32_t> readU32(32);
+            cmReadUArray(&reader, readU32.data(), readU32.size());
+
+            THEN("No value error") {
+                REQUIRE(reader.firstError == CM_ERROR_NO_VALUE);
+            }
+        }
+    }
+
     GIVEN("Message without data") {
         buffer.resize(2);
         writer = cmGetWriter(buffer.data(), buffer.size());
@@ -415,6 +932,102 @@ SCENARIO("Read message", "[read]") {
     }
 }
 
+SCENARIO("Read message in parts", "[read][stream]") {
+    std::vector<uint8_t> buffer(1024);
+    auto writer = cmGetWriter(buffer.data(), buffer.size());
+    std::vector<uint16_t> dataU16{1, 2, 3, 4, 5, 6, 7, 8};
+    cmWriteI32(&writer, -12345);
+    cmWriteUArray(&writer, dataU16.data(), dataU16.size());
+    cmWriteU8(&writer, 17);
+    cmWriteString(&writer, "abc", 3);
+
+    GIVEN("Stream reader with small buffer") {
+        std::vector<uint8_t> streamBuffer(32);
+        CompositeMessageReader reader;
+        cmInitStreamReader(&reader, streamBuffer.data(), streamBuffer.size());
+
+        WHEN("Value is read before anything is fed") {
+            cmReadI32(&reader);
+
+            THEN("More bytes are needed") {
+                REQUIRE(reader.firstError == CM_ERROR_NEED_MORE);
+            }
+        }
+
+        WHEN("Message is fed byte by byte") {
+            int32_t r1 = 0;
+            std::vector<uint16_t> r2(16);
+            uint32_t size2 = 0;
+            uint8_t r3 = 0;
+            std::vector<char> r4(16);
+            int step = 0;
+            uint32_t fed = 0;
+            while (step < 4 && fed < writer.usedSize) {
+                auto accepted = cmFeed(&reader, &buffer[fed], 1);
+                REQUIRE(accepted == 1);
+                fed += accepted;
+                while (step < 4 && reader.firstError == CM_ERROR_NONE) {
+                    if (step == 0) {
+                        r1 = cmReadI32(&reader);
+                    } else if (step == 1) {
+                        size2 = cmReadUArray(&reader, r2.data(), r2.size());
+                    } else if (step == 2) {
+                        r3 = cmReadU8(&reader);
+                    } else {
+                        cmReadString(&reader, r4.data(), r4.size());
+                    }
+                    if (reader.firstError == CM_ERROR_NONE) {
+                        ++step;
+                    }
+                }
+            }
+
+            THEN("All values are read") {
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+                REQUIRE(step == 4);
+                REQUIRE(fed == writer.usedSize);
+                REQUIRE(r1 == -12345);
+                r2.resize(size2);
+                REQUIRE_THAT(r2, Catch::Matchers::Equals(dataU16));
+                REQUIRE(r3 == 17);
+                REQUIRE_THAT(r4.data(), Catch::Matchers::Equals("abc"));
+            }
+        }
+
+        WHEN("Value of wrong type is read from partial message") {
+            cmFeed(&reader, buffer.data(), 3);
+            cmReadU8(&reader);
+
+            THEN("No value error") {
+                REQUIRE(reader.firstError == CM_ERROR_NO_VALUE);
+            }
+        }
+    }
+
+    GIVEN("Stream reader with buffer smaller than array") {
+        std::vector<uint8_t> streamBuffer(16);
+        CompositeMessageReader reader;
+        cmInitStreamReader(&reader, streamBuffer.data(), streamBuffer.size());
+
+        WHEN("Message is fed") {
+            cmFeed(&reader, buffer.data(), 16);
+            cmReadI32(&reader);
+            std::vector<uint16_t> r(16);
+            cmReadUArray(&reader, r.data(), r.size());
+            auto accepted = cmFeed(&reader, &buffer[16], writer.usedSize - 16);
+
+            THEN("No space error") {
+                REQUIRE(accepted == 5);
+                std::vector<uint16_t> r(16);
+                cmReadUArray(&reader, r.data(), r.size());
+                REQUIRE(reader.firstError == CM_ERROR_NEED_MORE);
+                cmFeed(&reader, &buffer[16 + accepted], 1);
+                REQUIRE(reader.firstError == CM_ERROR_NO_SPACE);
+            }
+        }
+    }
+}
+
 SCENARIO("Read message with extras", "[read]") {
 
     GIVEN("Non-empty message with version") {
@@ -435,3 +1048,3233 @@ SCENARIO("Read message with extras", "[read]") {
         }
     }
 }
+
+SCENARIO("Named fields and blocks", "[read][names]") {
+    std::vector<uint8_t> buffer(1024);
+    auto writer = cmGetWriter(buffer.data(), buffer.size());
+
+    const uint8_t marker[] = {'C', 'M', 1};
+    cmWriteMetadataStart(&writer);
+    cmWriteMarker(&writer, marker, sizeof(marker));
+    cmWriteMetadataEnd(&writer);
+    cmWriteName(&writer, "id");
+    cmWriteU32(&writer, 42);
+    cmWriteName(&writer, "sensor");
+    cmWriteBlockStart(&writer);
+    cmWriteName(&writer, "temperature");
+    cmWriteF(&writer, 36.6f);
+    cmWriteName(&writer, "id");
+    cmWriteU8(&writer, 7);
+    cmWriteBlockEnd(&writer);
+    cmWriteName(&writer, "temperature");
+    cmWriteI16(&writer, -40);
+
+    GIVEN("Message with names, blocks and metadata") {
+        REQUIRE(writer.firstError == CM_ERROR_NONE);
+        auto reader = cmGetReader(writer.buffer, writer.usedSize);
+
+        WHEN("Message is read sequentially") {
+            uint8_t readMarker[8];
+            char name[16];
+            const char *nameView;
+
+            cmReadMetadataStart(&reader);
+            auto markerSize = cmReadMarker(&reader, readMarker, sizeof(readMarker));
+            cmReadMetadataEnd(&reader);
+            auto l1 = cmReadName(&reader, name, sizeof(name));
+            std::string n1 = name;
+            auto id = cmReadU32(&reader);
+            auto l2 = cmReadNameView(&reader, &nameView);
+            std::string n2 = nameView;
+            cmReadBlockStart(&reader);
+
+            THEN("Read values are correct") {
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+                REQUIRE(markerSize == sizeof(marker));
+                REQUIRE(memcmp(readMarker, marker, sizeof(marker)) == 0);
+                REQUIRE(l1 == 2);
+                REQUIRE(n1 == "id");
+                REQUIRE(id == 42);
+                REQUIRE(l2 == 6);
+                REQUIRE(n2 == "sensor");
+            }
+        }
+
+        WHEN("Marker is read into too small buffer") {
+            cmReadMetadataStart(&reader);
+            cmReadMarker(&reader, nullptr, 0);
+
+            THEN("No space error") {
+                REQUIRE(reader.firstError == CM_ERROR_NO_SPACE);
+            }
+        }
+
+        WHEN("Block end is read instead of start") {
+            cmReadBlockEnd(&reader);
+
+            THEN("No value error") {
+                REQUIRE(reader.firstError == CM_ERROR_NO_VALUE);
+            }
+        }
+
+        WHEN("Fields are indexed") {
+            std::vector<CMFieldSlot> slots(8);
+            cmIndexFields(&reader, slots.data(), slots.size());
+
+            THEN("Fields can be found in any order") {
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+
+                REQUIRE(cmFindField(&reader, "temperature"));
+                REQUIRE(cmReadI16(&reader) == -40);
+                REQUIRE(cmFindField(&reader, "id"));
+                REQUIRE(cmReadU32(&reader) == 42);
+                REQUIRE_FALSE(cmFindField(&reader, "missing"));
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+            }
+
+            AND_THEN("Nested block can be indexed separately") {
+                REQUIRE(cmFindField(&reader, "sensor"));
+                cmReadBlockStart(&reader);
+                std::vector<CMFieldSlot> nested(4);
+                cmIndexFields(&reader, nested.data(), nested.size());
+
+                REQUIRE(cmFindField(&reader, "temperature"));
+                REQUIRE(cmReadF(&reader) == 36.6f);
+                REQUIRE(cmFindField(&reader, "id"));
+                REQUIRE(cmReadU8(&reader) == 7);
+                cmReadBlockEnd(&reader);
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+            }
+        }
+
+        WHEN("Index has too few slots") {
+            std::vector<CMFieldSlot> slots(2);
+            cmIndexFields(&reader, slots.data(), slots.size());
+
+            THEN("No space error") {
+                REQUIRE(reader.firstError == CM_ERROR_NO_SPACE);
+            }
+        }
+    }
+
+    GIVEN("Message with names in inverse endian mode") {
+        std::vector<uint8_t> inversed(writer.buffer, writer.buffer + writer.usedSize);
+        std::swap(inversed[0], inversed[1]);
+        // reverse bytes of id (42) stored after its name
+        auto idOffset = 2 + 1 + 5 + 1 + 5;
+        std::reverse(&inversed[idOffset + 1], &inversed[idOffset + 5]);
+        auto reader = cmGetReader(inversed.data(), inversed.size());
+
+        WHEN("Fields are indexed") {
+            std::vector<CMFieldSlot> slots(4);
+            cmIndexFields(&reader, slots.data(), slots.size());
+
+            THEN("Values are converted") {
+                REQUIRE(cmFindField(&reader, "id"));
+                REQUIRE(cmReadU32(&reader) == 42);
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+            }
+        }
+    }
+
+    GIVEN("Message with unterminated name") {
+        std::vector<uint8_t> corrupted(writer.buffer, writer.buffer + writer.usedSize);
+        // replace null terminator of "id" with character
+        uint32_t idOffset = 2 + 1 + 5 + 1;
+        REQUIRE(corrupted[idOffset + 4] == 0);
+        corrupted[idOffset + 4] = 'X';
+        auto reader = cmGetReader(corrupted.data(), corrupted.size());
+        cmSkip(&reader);
+
+        WHEN("Name view is read") {
+            const char *name = nullptr;
+            auto length = cmReadNameView(&reader, &name);
+
+            THEN("No value error") {
+                REQUIRE(length == 0);
+                REQUIRE(name == nullptr);
+                REQUIRE(reader.firstError == CM_ERROR_NO_VALUE);
+                REQUIRE(reader.readSize == idOffset);
+            }
+        }
+
+        WHEN("Name is read into buffer") {
+            char name[16];
+            auto length = cmReadName(&reader, name, sizeof(name));
+
+            THEN("No value error") {
+                REQUIRE(length == 0);
+                REQUIRE(reader.firstError == CM_ERROR_NO_VALUE);
+            }
+        }
+    }
+}
+
+SCENARIO("Skip and seek", "[read][skip]") {
+    std::vector<uint8_t> buffer(1024);
+    auto writer = cmGetWriter(buffer.data(), buffer.size());
+    std::vector<uint64_t> dataU64{1, 2, 3};
+
+    cmWriteU8(&writer, 1);
+    cmWriteUArray(&writer, dataU64.data(), dataU64.size());
+    cmWriteName(&writer, "block");
+    cmWriteBlockStart(&writer);
+    cmWriteI32(&writer, 2);
+    cmWriteBlockStart(&writer);
+    cmWriteString(&writer, "nested", 6);
+    cmWriteBlockEnd(&writer);
+    cmWriteBlockEnd(&writer);
+    cmWriteVersion(&writer, 3);
+    cmWriteD(&writer, 4.0);
+
+    GIVEN("Message with different fields") {
+        auto reader = cmGetReader(writer.buffer, writer.usedSize);
+
+        WHEN("Fields are skipped one by one") {
+            cmSkip(&reader);
+            auto afterValue = cmTell(&reader);
+            cmSkip(&reader);
+            auto afterArray = cmTell(&reader);
+            cmSkip(&reader);
+            auto version = cmReadVersion(&reader);
+
+            THEN("Whole fields are skipped") {
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+                REQUIRE(afterValue == 4);
+                REQUIRE(afterArray == 4 + 5 + 3 * 8);
+                REQUIRE(version == 3);
+            }
+        }
+
+        WHEN("Several fields are skipped") {
+            cmSkipN(&reader, 4);
+            auto d = cmReadD(&reader);
+
+            THEN("Next value is read") {
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+                REQUIRE(d == 4.0);
+            }
+        }
+
+        WHEN("Position is restored") {
+            cmSkipN(&reader, 2);
+            auto offset = cmTell(&reader);
+            cmSkipN(&reader, 2);
+            cmSeek(&reader, offset);
+            char name[8];
+            cmReadName(&reader, name, sizeof(name));
+            cmReadBlockStart(&reader);
+            auto i = cmReadI32(&reader);
+            cmSkip(&reader);
+            cmReadBlockEnd(&reader);
+
+            THEN("Reading continues from restored position") {
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+                REQUIRE(i == 2);
+                REQUIRE(cmReadVersion(&reader) == 3);
+            }
+        }
+
+        WHEN("Field is skipped at the end of block") {
+            // position of block start after name
+            cmSeek(&reader, 4 + 5 + 3 * 8 + 8);
+            cmReadBlockStart(&reader);
+            cmSkipN(&reader, 2);
+            cmSkip(&reader);
+
+            THEN("No value error") {
+                REQUIRE(reader.firstError == CM_ERROR_NO_VALUE);
+            }
+        }
+
+        WHEN("Too many fields are skipped") {
+            cmSkipN(&reader, 6);
+
+            THEN("No value error") {
+                REQUIRE(reader.firstError == CM_ERROR_NO_VALUE);
+            }
+        }
+
+        WHEN("Position outside of message is set") {
+            cmSeek(&reader, writer.usedSize + 1);
+
+            THEN("Invalid arg error") {
+                REQUIRE(reader.firstError == CM_ERROR_INVALID_ARG);
+            }
+        }
+    }
+}
+
+static uint32_t referenceCrc32(const uint8_t *data, size_t size) {
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < size; ++i) {
+        crc ^= data[i];
+        for (int k = 0; k < 8; ++k) {
+            crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+        }
+    }
+    return ~crc;
+}
+
+static void writeCrcTestContent(CompositeMessageWriter *writer,
+                                const std::vector<uint32_t> &large) {
+    cmWriteI32(writer, -5);
+    cmWriteUArray(writer, large.data(), large.size());
+    cmWriteName(writer, "value");
+    cmWriteD(writer, 1.5);
+    cmWriteCrc32(writer);
+    cmWriteString(writer, "abc", 3);
+    cmWriteCrc32(writer);
+}
+
+SCENARIO("CRC32 of message", "[crc]") {
+    std::vector<uint32_t> large(300);
+    for (size_t i = 0; i < large.size(); ++i) {
+        large[i] = (uint32_t) (i * 7919);
+    }
+    std::vector<uint8_t> expected(2048);
+    auto expectedWriter = cmGetWriter(expected.data(), expected.size());
+    cmEnableCrc32(&expectedWriter);
+    writeCrcTestContent(&expectedWriter, large);
+    expected.resize(expectedWriter.usedSize);
+
+    GIVEN("Message with CRCs") {
+        REQUIRE(expectedWriter.firstError == CM_ERROR_NONE);
+
+        THEN("Each CRC covers everything before it") {
+            // second CRC is at the end of message, first one is before string
+            size_t second = expected.size() - 5;
+            size_t first = second - 9 - 5;
+            uint32_t crc1, crc2;
+            memcpy(&crc1, &expected[first + 1], sizeof(crc1));
+            memcpy(&crc2, &expected[second + 1], sizeof(crc2));
+            REQUIRE(expected[first] == 0x88);
+            REQUIRE(expected[second] == 0x88);
+            REQUIRE(crc1 == referenceCrc32(&expected[2], first - 2));
+            REQUIRE(crc2 == referenceCrc32(&expected[2], second - 2));
+        }
+
+        WHEN("CRCs are verified after skipping fields") {
+            auto reader = cmGetReader(expected.data(), expected.size());
+            cmSkipN(&reader, 3);
+            bool valid1 = cmVerifyCrc32(&reader);
+            cmSkip(&reader);
+            bool valid2 = cmVerifyCrc32(&reader);
+
+            THEN("CRCs match") {
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+                REQUIRE(valid1);
+                REQUIRE(valid2);
+                REQUIRE(reader.readSize == expected.size());
+            }
+        }
+
+        WHEN("Message is corrupted") {
+            expected[20] ^= 0x01;
+            auto reader = cmGetReader(expected.data(), expected.size());
+            cmSkipN(&reader, 3);
+            bool valid = cmVerifyCrc32(&reader);
+
+            THEN("CRC error") {
+                REQUIRE_FALSE(valid);
+                REQUIRE(reader.firstError == CM_ERROR_CRC);
+            }
+        }
+
+        WHEN("CRC is verified where there is no CRC") {
+            auto reader = cmGetReader(expected.data(), expected.size());
+            bool valid = cmVerifyCrc32(&reader);
+
+            THEN("No value error") {
+                REQUIRE_FALSE(valid);
+                REQUIRE(reader.firstError == CM_ERROR_NO_VALUE);
+            }
+        }
+    }
+
+    GIVEN("Small message with CRCs and stream reader") {
+        std::vector<uint32_t> small(10, 42);
+        std::vector<uint8_t> message(256);
+        auto writer = cmGetWriter(message.data(), message.size());
+        cmEnableCrc32(&writer);
+        writeCrcTestContent(&writer, small);
+        message.resize(writer.usedSize);
+
+        std::vector<uint8_t> buffer(64);
+        CompositeMessageReader reader;
+        cmInitStreamReader(&reader, buffer.data(), buffer.size());
+
+        WHEN("Message is fed in small chunks") {
+            size_t fed = 0;
+            int verified = 0;
+            for (;;) {
+                if (reader.firstError == CM_ERROR_NEED_MORE) {
+                    if (fed == message.size())
+                        break;
+                    size_t size = std::min<size_t>(7, message.size() - fed);
+                    fed += cmFeed(&reader, &message[fed], (uint32_t) size);
+                    continue;
+                }
+                if (reader.firstError != CM_ERROR_NONE ||
+                    (reader.readSize == reader.totalSize && fed == message.size()))
+                    break;
+                if (reader.message[reader.readSize] == 0x88) {
+                    verified += cmVerifyCrc32(&reader) ? 1 : 0;
+                } else {
+                    cmSkip(&reader);
+                }
+            }
+
+            THEN("CRCs match after buffer was compacted") {
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+                REQUIRE(message.size() > buffer.size());
+                REQUIRE(verified == 2);
+            }
+        }
+    }
+
+    GIVEN("Stream writer with CRC") {
+        std::vector<uint8_t> buffer(32);
+        std::vector<uint8_t> output;
+        auto writer = cmGetWriter(buffer.data(), buffer.size());
+        cmSetFlushCallback(&writer, appendToVector, &output);
+        cmEnableCrc32(&writer);
+        writeCrcTestContent(&writer, large);
+        cmFlush(&writer);
+
+        THEN("Flushed bytes contain the same CRCs") {
+            REQUIRE(writer.firstError == CM_ERROR_NONE);
+            REQUIRE_THAT(output, Catch::Matchers::Equals(expected));
+        }
+    }
+
+    GIVEN("Writer in gather mode with CRC") {
+        std::vector<uint8_t> buffer(128);
+        CMSegment segments[8];
+        auto writer = cmGetWriter(buffer.data(), buffer.size());
+        cmSetGatherMode(&writer, segments, 8, 64);
+        cmEnableCrc32(&writer);
+        writeCrcTestContent(&writer, large);
+        uint32_t count = cmFinishSegments(&writer);
+
+        THEN("Gathered segments contain the same CRCs") {
+            std::vector<uint8_t> output;
+            for (uint32_t i = 0; i < count; ++i) {
+                auto *d = (const uint8_t *) segments[i].data;
+                output.insert(output.end(), d, d + segments[i].size);
+            }
+            REQUIRE(writer.firstError == CM_ERROR_NONE);
+            REQUIRE(writer.externalSize == large.size() * sizeof(uint32_t));
+            REQUIRE_THAT(output, Catch::Matchers::Equals(expected));
+        }
+    }
+
+    GIVEN("Writer without enabled CRC") {
+        std::vector<uint8_t> buffer(32);
+        auto writer = cmGetWriter(buffer.data(), buffer.size());
+        cmWriteCrc32(&writer);
+
+        THEN("Invalid arg error") {
+            REQUIRE(writer.firstError == CM_ERROR_INVALID_ARG);
+        }
+    }
+
+    GIVEN("Message with CRC in inverse endian mode") {
+        std::vector<uint8_t> buffer(64);
+        std::vector<uint16_t> data{1, 2, 3};
+        auto writer = cmGetWriter(buffer.data(), buffer.size());
+        cmWriteI32(&writer, 12345);
+        cmWriteUArray(&writer, data.data(), data.size());
+        cmWriteName(&writer, "ab");
+        cmWriteBool(&writer, true);
+
+        // message as it would be written by machine with other endianness
+        std::swap(buffer[0], buffer[1]);
+        std::reverse(&buffer[3], &buffer[7]);
+        std::reverse(&buffer[8], &buffer[12]);
+        for (size_t j = 0; j < data.size(); ++j) {
+            std::swap(buffer[12 + 2 * j], buffer[13 + 2 * j]);
+        }
+        uint32_t crc = referenceCrc32(&buffer[2], writer.usedSize - 2);
+        buffer[writer.usedSize] = 0x88;
+        memcpy(&buffer[writer.usedSize + 1], &crc, sizeof(crc));
+        std::reverse(&buffer[writer.usedSize + 1], &buffer[writer.usedSize + 5]);
+        buffer.resize(writer.usedSize + 5);
+
+        WHEN("Message is converted by reader") {
+            auto reader = cmGetReader(buffer.data(), buffer.size());
+            auto i = cmReadI32(&reader);
+            cmSkipN(&reader, 2);
+            bool valid = cmVerifyCrc32(&reader);
+
+            THEN("CRC matches") {
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+                REQUIRE(i == 12345);
+                REQUIRE(valid);
+            }
+        }
+
+        WHEN("Message is read by const reader") {
+            CompositeMessageReader reader;
+            cmInitConstReader(&reader, buffer.data(), buffer.size());
+            cmSkipN(&reader, 3);
+            bool valid = cmVerifyCrc32(&reader);
+
+            THEN("CRC matches") {
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+                REQUIRE(valid);
+            }
+        }
+    }
+}
+
+SCENARIO("Compact integers", "[varint]") {
+    std::vector<uint8_t> buffer(1024);
+    auto writer = cmGetWriter(buffer.data(), buffer.size());
+    cmSetCompactIntegers(&writer, true);
+
+    GIVEN("Message with compact integers") {
+        uint64_t u = GENERATE(0ull, 1ull, 127ull, 128ull, 300ull,
+                              0xFFFFFFFFull, 1ull << 56u, UINT64_MAX);
+        int64_t i = GENERATE(0ll, -1ll, 1ll, -64ll, 64ll, INT64_MIN, INT64_MAX);
+        cmWriteU16(&writer, (uint16_t) u);
+        cmWriteU32(&writer, (uint32_t) u);
+        cmWriteU64(&writer, u);
+        cmWriteI16(&writer, (int16_t) i);
+        cmWriteI32(&writer, (int32_t) i);
+        cmWriteI64(&writer, i);
+        cmWriteU8(&writer, 200);
+        cmWriteVersion(&writer, 157);
+
+        auto reader = cmGetReader(buffer.data(), writer.usedSize);
+
+        WHEN("Values are read") {
+            auto u16 = cmReadU16(&reader);
+            auto u32 = cmReadU32(&reader);
+            auto u64 = cmReadU64(&reader);
+            auto i16 = cmReadI16(&reader);
+            auto i32 = cmReadI32(&reader);
+            auto i64 = cmReadI64(&reader);
+            auto u8 = cmReadU8(&reader);
+            auto ver = cmReadVersion(&reader);
+
+            THEN("Values are correct") {
+                REQUIRE(writer.firstError == CM_ERROR_NONE);
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+                REQUIRE(u16 == (uint16_t) u);
+                REQUIRE(u32 == (uint32_t) u);
+                REQUIRE(u64 == u);
+                REQUIRE(i16 == (int16_t) i);
+                REQUIRE(i32 == (int32_t) i);
+                REQUIRE(i64 == i);
+                REQUIRE(u8 == 200);
+                REQUIRE(ver == 157);
+                REQUIRE(reader.readSize == writer.usedSize);
+            }
+        }
+
+        WHEN("Values are skipped") {
+            cmSkipN(&reader, 6);
+
+            THEN("Next value is read") {
+                REQUIRE(cmReadU8(&reader) == 200);
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+            }
+        }
+
+        WHEN("Value is read as different type") {
+            cmReadI16(&reader);
+
+            THEN("No value error") {
+                REQUIRE(reader.firstError == CM_ERROR_NO_VALUE);
+            }
+        }
+    }
+
+    GIVEN("Small values") {
+        cmWriteU32(&writer, 5);
+        cmWriteI64(&writer, -3);
+
+        THEN("Each value takes 2 bytes") {
+            REQUIRE(writer.usedSize == 2 + 2 + 2);
+            REQUIRE(buffer[2] == 0x66);
+            REQUIRE(buffer[3] == 5);
+            REQUIRE(buffer[4] == 0x6B);
+            REQUIRE(buffer[5] == 5);
+        }
+    }
+
+    GIVEN("Message with compact arrays") {
+        std::vector<uint32_t> dataU32{0, 1, 1000, 70000, UINT32_MAX};
+        std::vector<int16_t> dataI16{0, -1, 1, INT16_MIN, INT16_MAX};
+        std::vector<uint8_t> dataU8{1, 2, 3};
+        cmWriteUArray(&writer, dataU32.data(), dataU32.size());
+        cmWriteIArray(&writer, dataI16.data(), dataI16.size());
+        cmWriteUArray(&writer, dataU8.data(), dataU8.size());
+
+        auto reader = cmGetReader(buffer.data(), writer.usedSize);
+
+        WHEN("Arrays are read") {
+            std::vector<uint32_t> readU32(8);
+            std::vector<int16_t> readI16(8);
+            std::vector<uint8_t> readU8(8);
+            auto size = cmPeekArraySize(&reader);
+            readU32.resize(cmReadUArray(&reader, readU32.data(), readU32.size()));
+            readI16.resize(cmReadIArray(&reader, readI16.data(), readI16.size()));
+            readU8.resize(cmReadUArray(&reader, readU8.data(), readU8.size()));
+
+            THEN("Arrays are correct") {
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+                REQUIRE(size == dataU32.size());
+                REQUIRE_THAT(readU32, Catch::Matchers::Equals(dataU32));
+                REQUIRE_THAT(readI16, Catch::Matchers::Equals(dataI16));
+                REQUIRE_THAT(readU8, Catch::Matchers::Equals(dataU8));
+            }
+        }
+
+        WHEN("Array is skipped") {
+            cmSkipN(&reader, 2);
+            std::vector<uint8_t> readU8(8);
+            readU8.resize(cmReadUArray(&reader, readU8.data(), readU8.size()));
+
+            THEN("Next array is read") {
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+                REQUIRE_THAT(readU8, Catch::Matchers::Equals(dataU8));
+            }
+        }
+
+        WHEN("Array is read to small buffer") {
+            std::vector<uint32_t> readU32(4);
+            cmReadUArray(&reader, readU32.data(), readU32.size());
+
+            THEN("No space error") {
+                REQUIRE(reader.firstError == CM_ERROR_NO_SPACE);
+            }
+        }
+
+        WHEN("View of compact array is read") {
+            const uint32_t *view;
+            cmReadUArrayView(&reader, &view);
+
+            THEN("No value error") {
+                REQUIRE(reader.firstError == CM_ERROR_NO_VALUE);
+            }
+        }
+    }
+
+    GIVEN("Compact array written by stream writer") {
+        std::vector<uint64_t> data(200);
+        for (size_t j = 0; j < data.size(); ++j) {
+            data[j] = j * j * j;
+        }
+        cmWriteUArray(&writer, data.data(), data.size());
+        std::vector<uint8_t> expected(buffer.begin(), buffer.begin() + writer.usedSize);
+
+        std::vector<uint8_t> small(16);
+        std::vector<uint8_t> output;
+        auto streamWriter = cmGetWriter(small.data(), small.size());
+        cmSetFlushCallback(&streamWriter, appendToVector, &output);
+        cmSetCompactIntegers(&streamWriter, true);
+        cmWriteUArray(&streamWriter, data.data(), data.size());
+        cmFlush(&streamWriter);
+
+        THEN("Flushed bytes are the same as in contiguous writer") {
+            REQUIRE(writer.firstError == CM_ERROR_NONE);
+            REQUIRE(streamWriter.firstError == CM_ERROR_NONE);
+            REQUIRE(expected.size() < data.size() * sizeof(uint64_t));
+            REQUIRE_THAT(output, Catch::Matchers::Equals(expected));
+        }
+    }
+
+    GIVEN("Malformed varints") {
+        WHEN("Value doesn't fit in its type") {
+            // uint16 varint with value 0x10000
+            std::vector<uint8_t> message{0x09, 0x07, 0x65, 0x80, 0x80, 0x04};
+            memcpy(message.data(), writer.buffer, 2);
+            auto reader = cmGetReader(message.data(), message.size());
+            cmReadU16(&reader);
+
+            THEN("No value error") {
+                REQUIRE(reader.firstError == CM_ERROR_NO_VALUE);
+            }
+        }
+
+        WHEN("Varint is truncated") {
+            std::vector<uint8_t> message{0x09, 0x07, 0x66, 0x80, 0x80};
+            memcpy(message.data(), writer.buffer, 2);
+            auto reader = cmGetReader(message.data(), message.size());
+            cmReadU32(&reader);
+
+            THEN("No value error") {
+                REQUIRE(reader.firstError == CM_ERROR_NO_VALUE);
+            }
+        }
+
+        WHEN("Encoded array has extra bytes") {
+            // array of 1 uint32 with 2 bytes of payload
+            std::vector<uint8_t> message{0x09, 0x07, 0x90, 0x01, 0x06, 0x01, 0x02, 0x05, 0x05};
+            memcpy(message.data(), writer.buffer, 2);
+            auto reader = cmGetReader(message.data(), message.size());
+            uint32_t item;
+            cmReadUArray(&reader, &item, 1);
+
+            THEN("No value error") {
+                REQUIRE(reader.firstError == CM_ERROR_NO_VALUE);
+            }
+        }
+    }
+}
+
+SCENARIO("Encoded arrays", "[codec]") {
+    std::vector<uint8_t> buffer(16384);
+    auto writer = cmGetWriter(buffer.data(), buffer.size());
+
+    GIVEN("Monotonic timestamps") {
+        std::vector<uint64_t> timestamps(1000);
+        for (size_t i = 0; i < timestamps.size(); ++i) {
+            timestamps[i] = 1700000000000ull + i * 100 + (i % 7);
+        }
+        cmWriteEncodedUArray(&writer, CM_CODEC_DELTA, timestamps.data(),
+                             timestamps.size());
+        auto reader = cmGetReader(buffer.data(), writer.usedSize);
+        std::vector<uint64_t> read(timestamps.size());
+        read.resize(cmReadUArray(&reader, read.data(), read.size()));
+
+        THEN("Array is much smaller than raw items and is decoded back") {
+            REQUIRE(writer.firstError == CM_ERROR_NONE);
+            REQUIRE(reader.firstError == CM_ERROR_NONE);
+            REQUIRE(writer.usedSize * 3 < timestamps.size() * sizeof(uint64_t));
+            REQUIRE_THAT(read, Catch::Matchers::Equals(timestamps));
+        }
+    }
+
+    GIVEN("Slowly changing sensor values") {
+        std::vector<int32_t> values(1000);
+        for (size_t i = 0; i < values.size(); ++i) {
+            values[i] = -1000 + (int32_t) ((i * 37) % 50);
+        }
+        cmWriteEncodedIArray(&writer, CM_CODEC_FOR, values.data(), values.size());
+        auto reader = cmGetReader(buffer.data(), writer.usedSize);
+        std::vector<int32_t> read(values.size());
+        read.resize(cmReadIArray(&reader, read.data(), read.size()));
+
+        THEN("Items are packed with minimal bit width") {
+            REQUIRE(writer.firstError == CM_ERROR_NONE);
+            REQUIRE(reader.firstError == CM_ERROR_NONE);
+            // 6 bits per item
+            REQUIRE(writer.usedSize < 2 + 10 + 3 + values.size() * 6 / 8 + 1);
+            REQUIRE_THAT(read, Catch::Matchers::Equals(values));
+        }
+    }
+
+    GIVEN("Bools with long runs") {
+        bool flags[300] = {};
+        for (size_t i = 100; i < 250; ++i) {
+            flags[i] = true;
+        }
+        flags[299] = true;
+        cmWriteEncodedBoolArray(&writer, flags, 300);
+        auto reader = cmGetReader(buffer.data(), writer.usedSize);
+        bool read[300];
+        auto count = cmReadBoolArray(&reader, read, 300);
+
+        THEN("Runs are decoded back") {
+            REQUIRE(writer.firstError == CM_ERROR_NONE);
+            REQUIRE(reader.firstError == CM_ERROR_NONE);
+            REQUIRE(writer.usedSize < 20);
+            REQUIRE(count == 300);
+            REQUIRE(memcmp(flags, read, sizeof(flags)) == 0);
+        }
+    }
+
+    GIVEN("Integers with extreme values") {
+        uint8_t codec = GENERATE(CM_CODEC_VARINT, CM_CODEC_DELTA, CM_CODEC_FOR);
+        std::vector<int64_t> i64{0, INT64_MIN, INT64_MAX, -1, 1, INT64_MIN, 5};
+        std::vector<uint16_t> u16{UINT16_MAX, 0, 1, UINT16_MAX, 7};
+        std::vector<int8_t> i8{INT8_MIN, INT8_MAX, 0, -1};
+        std::vector<uint32_t> empty;
+        cmWriteEncodedIArray(&writer, codec, i64.data(), i64.size());
+        cmWriteEncodedUArray(&writer, codec, u16.data(), u16.size());
+        cmWriteEncodedIArray(&writer, codec, i8.data(), i8.size());
+        cmWriteEncodedUArray(&writer, codec, empty.data(), empty.size());
+        auto reader = cmGetReader(buffer.data(), writer.usedSize);
+
+        WHEN("Arrays are read") {
+            std::vector<int64_t> readI64(16);
+            std::vector<uint16_t> readU16(16);
+            std::vector<int8_t> readI8(16);
+            std::vector<uint32_t> readEmpty(16);
+            readI64.resize(cmReadIArray(&reader, readI64.data(), readI64.size()));
+            readU16.resize(cmReadUArray(&reader, readU16.data(), readU16.size()));
+            readI8.resize(cmReadIArray(&reader, readI8.data(), readI8.size()));
+            readEmpty.resize(cmReadUArray(&reader, readEmpty.data(), readEmpty.size()));
+
+            THEN("Values are correct") {
+                REQUIRE(writer.firstError == CM_ERROR_NONE);
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+                REQUIRE_THAT(readI64, Catch::Matchers::Equals(i64));
+                REQUIRE_THAT(readU16, Catch::Matchers::Equals(u16));
+                REQUIRE_THAT(readI8, Catch::Matchers::Equals(i8));
+                REQUIRE(readEmpty.empty());
+                REQUIRE(reader.readSize == writer.usedSize);
+            }
+        }
+
+        WHEN("Arrays are skipped") {
+            cmSkipN(&reader, 4);
+
+            THEN("Whole message is skipped") {
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+                REQUIRE(reader.readSize == writer.usedSize);
+            }
+        }
+
+        WHEN("Array is read with different type") {
+            std::vector<uint64_t> readU64(16);
+            cmReadUArray(&reader, readU64.data(), readU64.size());
+
+            THEN("No value error") {
+                REQUIRE(reader.firstError == CM_ERROR_NO_VALUE);
+            }
+        }
+    }
+
+    GIVEN("Encoded array written by stream writer") {
+        std::vector<uint32_t> values(400);
+        for (size_t i = 0; i < values.size(); ++i) {
+            values[i] = (uint32_t) (i * 1000 + i % 3);
+        }
+        uint8_t codec = GENERATE(CM_CODEC_DELTA, CM_CODEC_FOR);
+        cmWriteEncodedUArray(&writer, codec, values.data(), values.size());
+        std::vector<uint8_t> expected(buffer.begin(), buffer.begin() + writer.usedSize);
+
+        std::vector<uint8_t> small(16);
+        std::vector<uint8_t> output;
+        auto streamWriter = cmGetWriter(small.data(), small.size());
+        cmSetFlushCallback(&streamWriter, appendToVector, &output);
+        cmWriteEncodedUArray(&streamWriter, codec, values.data(), values.size());
+        cmFlush(&streamWriter);
+
+        THEN("Flushed bytes are the same as in contiguous writer") {
+            REQUIRE(streamWriter.firstError == CM_ERROR_NONE);
+            REQUIRE_THAT(output, Catch::Matchers::Equals(expected));
+        }
+    }
+
+    GIVEN("Codec that doesn't support items") {
+        float values[2] = {1.0f, 2.0f};
+        bool flags[2] = {true, false};
+        WHEN("Float array is encoded") {
+            cmWriteEncodedArray(&writer, CM_CODEC_DELTA, CM_TYPE_FLOAT,
+                                sizeof(float), values, 2);
+
+            THEN("Invalid arg error") {
+                REQUIRE(writer.firstError == CM_ERROR_INVALID_ARG);
+            }
+        }
+
+        WHEN("Bool array is encoded with varints") {
+            cmWriteEncodedArray(&writer, CM_CODEC_VARINT, CM_TYPE_BOOL,
+                                sizeof(bool), flags, 2);
+
+            THEN("Invalid arg error") {
+                REQUIRE(writer.firstError == CM_ERROR_INVALID_ARG);
+            }
+        }
+    }
+
+    GIVEN("Malformed frame of reference array") {
+        // 3 uint8 items of width 4 need 2 bytes, but only 1 is present
+        std::vector<uint8_t> message{0x09, 0x07, 0x90, 0x03, 0x04, 0x03, 0x03, 0x00, 0x04, 0xFF};
+        memcpy(message.data(), writer.buffer, 2);
+        auto reader = cmGetReader(message.data(), message.size());
+        uint8_t items[3];
+        cmReadUArray(&reader, items, 3);
+
+        THEN("No value error") {
+            REQUIRE(reader.firstError == CM_ERROR_NO_VALUE);
+        }
+    }
+}
+
+SCENARIO("Packed bool arrays", "[codec][bits]") {
+    std::vector<uint8_t> buffer(8192);
+    auto writer = cmGetWriter(buffer.data(), buffer.size());
+    size_t count = GENERATE(0, 1, 7, 8, 15, 16, 17, 100, 4096);
+    std::unique_ptr<bool[]> flags(new bool[count + 1]);
+    std::vector<uint8_t> bitmap((count + 7) / 8);
+    for (size_t i = 0; i < count; ++i) {
+        flags[i] = (i * 7919) % 5 < 2;
+        if (flags[i]) {
+            bitmap[i / 8] |= (uint8_t) (1u << (i % 8));
+        }
+    }
+
+    GIVEN("Bool array written as packed array") {
+        cmWritePackedBoolArray(&writer, flags.get(), count);
+        auto reader = cmGetReader(buffer.data(), writer.usedSize);
+
+        THEN("Each byte holds 8 values") {
+            REQUIRE(writer.firstError == CM_ERROR_NONE);
+            REQUIRE(writer.usedSize <= 2 + 3 + 5 + 3 + (count + 7) / 8);
+        }
+
+        WHEN("It is read as bool array") {
+            std::unique_ptr<bool[]> read(new bool[count + 1]);
+            auto size = cmReadBoolArray(&reader, read.get(), count);
+
+            THEN("Values are unpacked") {
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+                REQUIRE(size == count);
+                REQUIRE(std::equal(flags.get(), flags.get() + count, read.get()));
+            }
+        }
+
+        WHEN("It is read as bitmap") {
+            std::vector<uint8_t> read((count + 7) / 8);
+            auto size = cmReadBitmap(&reader, read.data(), count);
+
+            THEN("Bits are the same as in bitmap") {
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+                REQUIRE(size == count);
+                REQUIRE_THAT(read, Catch::Matchers::Equals(bitmap));
+            }
+        }
+    }
+
+    GIVEN("Bitmap with garbage in unused bits") {
+        if (!bitmap.empty() && count % 8 != 0) {
+            bitmap.back() |= 0x80;
+        }
+        cmWriteBitmap(&writer, bitmap.data(), count);
+        auto reader = cmGetReader(buffer.data(), writer.usedSize);
+
+        WHEN("It is read as bool array") {
+            std::unique_ptr<bool[]> read(new bool[count + 1]);
+            auto size = cmReadBoolArray(&reader, read.get(), count);
+
+            THEN("Only used bits are unpacked") {
+                REQUIRE(writer.firstError == CM_ERROR_NONE);
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+                REQUIRE(size == count);
+                REQUIRE(std::equal(flags.get(), flags.get() + count, read.get()));
+            }
+        }
+    }
+
+    GIVEN("Plain bool array") {
+        cmWriteBoolArray(&writer, flags.get(), count);
+        auto reader = cmGetReader(buffer.data(), writer.usedSize);
+
+        WHEN("It is read as bitmap") {
+            std::vector<uint8_t> read((count + 7) / 8);
+            auto size = cmReadBitmap(&reader, read.data(), count);
+
+            THEN("Values are packed") {
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+                REQUIRE(size == count);
+                REQUIRE_THAT(read, Catch::Matchers::Equals(bitmap));
+            }
+        }
+
+        WHEN("It is read to small bitmap") {
+            uint8_t read[1024];
+            cmReadBitmap(&reader, read, count == 0 ? 0 : (uint32_t) count - 1);
+
+            THEN("No space error unless array is empty") {
+                REQUIRE(reader.firstError == (count == 0 ? CM_ERROR_NONE : CM_ERROR_NO_SPACE));
+            }
+        }
+    }
+}
+
+SCENARIO("Random access with message index", "[read][index]") {
+    std::vector<uint8_t> buffer(256);
+    auto writer = cmGetWriter(buffer.data(), buffer.size());
+    std::vector<uint16_t> data{1, 2, 3};
+    cmWriteVersion(&writer, 7);
+    cmWriteU32(&writer, 100);
+    cmWriteName(&writer, "temp");
+    cmWriteD(&writer, 36.6);
+    cmWriteBlockStart(&writer);
+    cmWriteUArray(&writer, data.data(), data.size());
+    cmWriteI8(&writer, -3);
+    cmWriteBlockEnd(&writer);
+    cmWriteString(&writer, "abc", 3);
+
+    auto reader = cmGetReader(buffer.data(), writer.usedSize);
+
+    GIVEN("Index of all elements") {
+        CMIndexEntry table[16];
+        auto count = cmBuildIndex(&reader, table, 16);
+
+        THEN("Each element is recorded") {
+            REQUIRE(reader.firstError == CM_ERROR_NONE);
+            REQUIRE(count == 9);
+            REQUIRE(reader.readSize == 2);
+            REQUIRE(table[0].offset == 2);
+            REQUIRE(table[0].size == 5);
+            REQUIRE(table[2].flag == 0x80);
+            REQUIRE(table[4].flag == 0x81);
+            REQUIRE(table[5].size == 1 + 4 + 3 * 2);
+            REQUIRE(table[8].offset + table[8].size == writer.usedSize);
+        }
+
+        WHEN("Values are read in arbitrary order") {
+            auto i8 = cmReadI8At(&reader, table, 6);
+            auto d = cmReadDAt(&reader, table, 3);
+            auto u32 = cmReadU32At(&reader, table, 1);
+            std::vector<uint16_t> array(8);
+            array.resize(cmReadUArrayAt(&reader, table, 5, array.data(), array.size()));
+            char str[8];
+            cmReadStringAt(&reader, table, 8, str, sizeof(str));
+
+            THEN("Values are correct and read position is not changed") {
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+                REQUIRE(i8 == -3);
+                REQUIRE(d == 36.6);
+                REQUIRE(u32 == 100);
+                REQUIRE_THAT(array, Catch::Matchers::Equals(data));
+                REQUIRE(std::string(str) == "abc");
+                REQUIRE(reader.readSize == 2);
+                REQUIRE(cmReadVersion(&reader) == 7);
+            }
+        }
+
+        WHEN("Value is read with different type") {
+            cmReadU16At(&reader, table, 1);
+
+            THEN("No value error") {
+                REQUIRE(reader.firstError == CM_ERROR_NO_VALUE);
+            }
+        }
+    }
+
+    GIVEN("Table that is too small") {
+        CMIndexEntry table[4];
+        cmBuildIndex(&reader, table, 4);
+
+        THEN("No space error") {
+            REQUIRE(reader.firstError == CM_ERROR_NO_SPACE);
+        }
+    }
+
+    GIVEN("Truncated message") {
+        auto truncated = cmGetReader(buffer.data(), writer.usedSize - 1);
+        CMIndexEntry table[16];
+        cmBuildIndex(&truncated, table, 16);
+
+        THEN("No value error") {
+            REQUIRE(truncated.firstError == CM_ERROR_NO_VALUE);
+        }
+    }
+}
+
+static void writeSizeTestContent(CompositeMessageWriter *writer,
+                                 const std::vector<uint32_t> &data) {
+    cmWriteVersion(writer, 3);
+    cmWriteMarker(writer, "mark", 4);
+    cmWriteMetadataStart(writer);
+    cmWriteName(writer, "values");
+    cmWriteMetadataEnd(writer);
+    cmWriteBlockStart(writer);
+    cmWriteI8(writer, -1);
+    cmWriteU8(writer, 1);
+    cmWriteI16(writer, INT16_MIN);
+    cmWriteU16(writer, UINT16_MAX);
+    cmWriteI32(writer, INT32_MIN);
+    cmWriteU32(writer, UINT32_MAX);
+    cmWriteI64(writer, INT64_MIN);
+    cmWriteU64(writer, UINT64_MAX);
+    cmWriteF(writer, 1.5f);
+    cmWriteD(writer, 2.5);
+    cmWriteBool(writer, true);
+    cmWriteChar(writer, 'c');
+    cmWriteBlockEnd(writer);
+    cmWriteUArray(writer, data.data(), data.size());
+    cmWriteString(writer, "hello", 5);
+    cmWritePackedBoolArray(writer, (const bool *) data.data(), 20);
+    cmWriteCrc32(writer);
+}
+
+SCENARIO("Message size calculation", "[size]") {
+    std::vector<uint32_t> data(1000);
+    for (uint32_t i = 0; i < data.size(); ++i) {
+        data[i] = i % 3 == 0 ? UINT32_MAX - i : i;
+    }
+    // bytes of items are used as bools, so they must be 0 or 1
+    std::vector<uint8_t> bools(20);
+    for (uint32_t i = 0; i < bools.size(); ++i) {
+        bools[i] = i % 3 == 0;
+    }
+    std::memcpy(data.data(), bools.data(), bools.size());
+
+    uint32_t commonSize = CM_SIZEOF_MARK + CM_SIZEOF_VERSION + cmSizeofMarker(4) +
+                          CM_SIZEOF_METADATA_START + cmSizeofName(6) +
+                          CM_SIZEOF_METADATA_END + CM_SIZEOF_BLOCK_START +
+                          CM_SIZEOF_I8 + CM_SIZEOF_U8 + CM_SIZEOF_F +
+                          CM_SIZEOF_D + CM_SIZEOF_BOOL + CM_SIZEOF_CHAR +
+                          CM_SIZEOF_BLOCK_END + cmSizeofString(5) +
+                          cmSizeofPackedBoolArray(20) + CM_SIZEOF_CRC32;
+    uint32_t maxSize = commonSize + CM_SIZEOF_I16 + CM_SIZEOF_U16 +
+                       CM_SIZEOF_I32 + CM_SIZEOF_U32 + CM_SIZEOF_I64 +
+                       CM_SIZEOF_U64 +
+                       cmSizeofArray(sizeof(uint32_t), data.size());
+    uint32_t compactMaxSize = commonSize + 2 * cmSizeofVarint(2) +
+                              2 * cmSizeofVarint(4) + 2 * cmSizeofVarint(8) +
+                              cmSizeofVarintArray(sizeof(uint32_t), data.size());
+    bool compact = GENERATE(false, true);
+
+    GIVEN("Message size counted with counting writer") {
+        std::vector<uint8_t> scratch(CM_COUNTING_BUFFER_SIZE);
+        CompositeMessageWriter counter;
+        cmInitCountingWriter(&counter, scratch.data(), scratch.size());
+        cmSetCompactIntegers(&counter, compact);
+        cmEnableCrc32(&counter);
+        writeSizeTestContent(&counter, data);
+        REQUIRE(counter.firstError == CM_ERROR_NONE);
+        uint32_t size = cmGetMessageSize(&counter);
+
+        WHEN("Message is written to buffer of counted size") {
+            std::vector<uint8_t> buffer(size);
+            auto writer = cmGetWriter(buffer.data(), buffer.size());
+            cmSetCompactIntegers(&writer, compact);
+            cmEnableCrc32(&writer);
+            writeSizeTestContent(&writer, data);
+
+            THEN("Message fills the whole buffer") {
+                REQUIRE(writer.firstError == CM_ERROR_NONE);
+                REQUIRE(writer.usedSize == size);
+                REQUIRE(cmGetMessageSize(&writer) == size);
+            }
+
+            AND_THEN("Size is not larger than sum of element sizes") {
+                REQUIRE(size <= (compact ? compactMaxSize : maxSize));
+            }
+        }
+
+        WHEN("Buffer is smaller than counted size") {
+            std::vector<uint8_t> buffer(size - 1);
+            auto writer = cmGetWriter(buffer.data(), buffer.size());
+            cmSetCompactIntegers(&writer, compact);
+            cmEnableCrc32(&writer);
+            writeSizeTestContent(&writer, data);
+
+            THEN("Space error") {
+                REQUIRE(writer.firstError == CM_ERROR_NO_SPACE);
+            }
+        }
+    }
+
+    GIVEN("Counting writer with small scratch buffer") {
+        std::vector<uint8_t> scratch(16);
+        CompositeMessageWriter counter;
+        cmInitCountingWriter(&counter, scratch.data(), scratch.size());
+
+        WHEN("Large array is written") {
+            cmWriteUArray(&counter, data.data(), data.size());
+
+            THEN("Payload is counted without copying") {
+                REQUIRE(counter.firstError == CM_ERROR_NONE);
+                REQUIRE(cmGetMessageSize(&counter) ==
+                        CM_SIZEOF_MARK + cmSizeofArray(4, data.size()));
+            }
+        }
+
+        WHEN("Long name is written") {
+            cmWriteName(&counter, "name that is longer than scratch buffer");
+
+            THEN("Space error") {
+                REQUIRE(counter.firstError == CM_ERROR_NO_SPACE);
+            }
+        }
+    }
+
+    GIVEN("Counting writer with array filled in place") {
+        std::vector<uint8_t> scratch(CM_COUNTING_BUFFER_SIZE);
+        CompositeMessageWriter counter;
+        cmInitCountingWriter(&counter, scratch.data(), scratch.size());
+        std::vector<uint32_t> items(60, 3);
+        auto writeContent = [&items](CompositeMessageWriter *writer) {
+            for (int i = 0; i < 10; ++i) {
+                cmWriteI32(writer, i);
+            }
+            // array doesn't fit in scratch buffer after written values
+            void *data = cmBeginArray(writer, CM_TYPE_UINT, 4, items.size());
+            if (data != nullptr) {
+                memcpy(data, items.data(), items.size() * sizeof(uint32_t));
+            }
+            cmCommitArray(writer, items.size());
+            cmWriteU8(writer, 5);
+        };
+
+        WHEN("Array is committed") {
+            writeContent(&counter);
+
+            THEN("Size matches message written to buffer") {
+                REQUIRE(counter.firstError == CM_ERROR_NONE);
+                std::vector<uint8_t> buffer(1024);
+                auto writer = cmGetWriter(buffer.data(), buffer.size());
+                writeContent(&writer);
+                REQUIRE(writer.firstError == CM_ERROR_NONE);
+                REQUIRE(cmGetMessageSize(&counter) == writer.usedSize);
+            }
+        }
+    }
+
+    GIVEN("Counting writer with dictionary") {
+        std::string longestName(255, 'n');
+        std::string longestString(255, 's');
+        auto writeLongest = [&](CompositeMessageWriter *writer) {
+            for (int i = 0; i < 2; ++i) {
+                cmWriteName(writer, longestName.c_str());
+                cmWriteString(writer, longestString.c_str(), longestString.size());
+            }
+        };
+        std::vector<CMDictionaryEntry> entries(4);
+        std::vector<char> chars(1024);
+        CMDictionary dictionary;
+        cmInitDictionary(&dictionary, entries.data(), entries.size(), chars.data(),
+                         chars.size());
+        std::vector<uint8_t> scratch(CM_COUNTING_BUFFER_SIZE);
+        CompositeMessageWriter counter;
+        cmInitCountingWriter(&counter, scratch.data(), scratch.size());
+        cmSetWriterDictionary(&counter, &dictionary);
+
+        WHEN("Longest names and strings are defined") {
+            writeLongest(&counter);
+            REQUIRE(counter.firstError == CM_ERROR_NONE);
+            uint32_t size = cmGetMessageSize(&counter);
+
+            THEN("Definitions fit in scratch buffer") {
+                REQUIRE(size == CM_SIZEOF_MARK + cmSizeofNameDefinition(255) +
+                        cmSizeofStringDefinition(255) + 2 * 2);
+            }
+
+            AND_THEN("Size matches message written with dictionary") {
+                cmResetDictionary(&dictionary);
+                std::vector<uint8_t> buffer(size);
+                auto writer = cmGetWriter(buffer.data(), buffer.size());
+                cmSetWriterDictionary(&writer, &dictionary);
+                writeLongest(&writer);
+                REQUIRE(writer.firstError == CM_ERROR_NONE);
+                REQUIRE(writer.usedSize == size);
+            }
+        }
+    }
+}
+
+static void writeEmbeddedTestContent(CompositeMessageWriter *writer, uint32_t i) {
+    cmWriteU32(writer, i);
+    cmWriteString(writer, "part", 4);
+    cmWriteD(writer, i * 0.5);
+}
+
+static void requireEmbeddedTestContent(CompositeMessageReader *reader, uint32_t i) {
+    char str[8];
+    REQUIRE(cmReadU32(reader) == i);
+    REQUIRE(cmReadString(reader, str, sizeof(str)) == 5);
+    REQUIRE(std::string(str) == "part");
+    REQUIRE(cmReadD(reader) == i * 0.5);
+    REQUIRE(reader->firstError == CM_ERROR_NONE);
+    REQUIRE(cmTell(reader) == reader->totalSize);
+}
+
+SCENARIO("Embedded messages", "[message]") {
+    std::vector<uint8_t> buffer(512);
+    auto writer = cmGetWriter(buffer.data(), buffer.size());
+
+    GIVEN("Batch of messages") {
+        cmEnableCrc32(&writer);
+        for (uint32_t i = 0; i < 3; ++i) {
+            cmBeginMessage(&writer);
+            writeEmbeddedTestContent(&writer, i);
+            cmEndMessage(&writer);
+        }
+        cmWriteCrc32(&writer);
+        REQUIRE(writer.firstError == CM_ERROR_NONE);
+
+        WHEN("Messages are read") {
+            auto reader = cmGetReader(buffer.data(), writer.usedSize);
+            CompositeMessageReader message;
+
+            THEN("Each message has its own reader") {
+                for (uint32_t i = 0; i < 3; ++i) {
+                    REQUIRE(cmReadMessage(&reader, &message));
+                    requireEmbeddedTestContent(&message, i);
+                }
+                REQUIRE(cmVerifyCrc32(&reader));
+                REQUIRE_FALSE(cmReadMessage(&reader, &message));
+                REQUIRE(reader.firstError == CM_ERROR_NO_VALUE);
+            }
+        }
+
+        WHEN("Messages are skipped") {
+            auto reader = cmGetReader(buffer.data(), writer.usedSize);
+            cmSkipN(&reader, 3);
+
+            THEN("CRC is read") {
+                REQUIRE(cmVerifyCrc32(&reader));
+            }
+        }
+
+        WHEN("Complete messages are embedded") {
+            std::vector<uint8_t> batch(512);
+            auto batchWriter = cmGetWriter(batch.data(), batch.size());
+            cmEnableCrc32(&batchWriter);
+            for (uint32_t i = 0; i < 3; ++i) {
+                std::vector<uint8_t> part(64);
+                auto partWriter = cmGetWriter(part.data(), part.size());
+                writeEmbeddedTestContent(&partWriter, i);
+                cmWriteMessage(&batchWriter, part.data(), partWriter.usedSize);
+            }
+            cmWriteCrc32(&batchWriter);
+
+            THEN("Batch is the same") {
+                REQUIRE(batchWriter.firstError == CM_ERROR_NONE);
+                batch.resize(batchWriter.usedSize);
+                buffer.resize(writer.usedSize);
+                REQUIRE(batch == buffer);
+            }
+        }
+
+        WHEN("Batch is counted") {
+            std::vector<uint8_t> scratch(CM_COUNTING_BUFFER_SIZE);
+            CompositeMessageWriter counter;
+            cmInitCountingWriter(&counter, scratch.data(), scratch.size());
+            cmEnableCrc32(&counter);
+            for (uint32_t i = 0; i < 3; ++i) {
+                cmBeginMessage(&counter);
+                writeEmbeddedTestContent(&counter, i);
+                cmEndMessage(&counter);
+            }
+            cmWriteCrc32(&counter);
+
+            THEN("Size is the same") {
+                REQUIRE(counter.firstError == CM_ERROR_NONE);
+                REQUIRE(cmGetMessageSize(&counter) == writer.usedSize);
+            }
+        }
+
+        WHEN("Batch is received in parts") {
+            std::vector<uint8_t> streamBuffer(128);
+            CompositeMessageReader reader;
+            cmInitStreamReader(&reader, streamBuffer.data(), streamBuffer.size());
+            CompositeMessageReader message;
+            uint32_t fed = 0;
+            uint32_t count = 0;
+            while (count < 3) {
+                if (cmReadMessage(&reader, &message)) {
+                    requireEmbeddedTestContent(&message, count);
+                    ++count;
+                    continue;
+                }
+                REQUIRE(reader.firstError == CM_ERROR_NEED_MORE);
+                uint32_t part = std::min<uint32_t>(7, writer.usedSize - fed);
+                cmFeed(&reader, buffer.data() + fed, part);
+                fed += part;
+            }
+
+            THEN("All messages are read") {
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+            }
+        }
+    }
+
+    GIVEN("Message with embedded message in inverse endian mode") {
+        uint32_t value = 0x01020304;
+        uint32_t inverse = 0x04030201;
+        cmBeginMessage(&writer);
+        cmWriteU32(&writer, inverse);
+        cmEndMessage(&writer);
+        cmWriteU16(&writer, 0x0201);
+        std::swap(buffer[0], buffer[1]);
+        std::reverse(&buffer[3], &buffer[7]);
+
+        WHEN("Message is read with converting reader") {
+            auto reader = cmGetReader(buffer.data(), writer.usedSize);
+            CompositeMessageReader message;
+            REQUIRE(cmReadMessage(&reader, &message));
+
+            THEN("Values are converted") {
+                REQUIRE(cmReadU32(&message) == value);
+                REQUIRE(cmReadU16(&reader) == 0x0102);
+                REQUIRE(message.firstError == CM_ERROR_NONE);
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+            }
+        }
+
+        WHEN("Message is read with const reader") {
+            CompositeMessageReader reader;
+            cmInitConstReader(&reader, buffer.data(), writer.usedSize);
+            CompositeMessageReader message;
+            REQUIRE(cmReadMessage(&reader, &message));
+
+            THEN("Values are converted") {
+                REQUIRE(cmReadU32(&message) == value);
+                REQUIRE(cmReadU16(&reader) == 0x0102);
+                REQUIRE(message.firstError == CM_ERROR_NONE);
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+            }
+        }
+    }
+
+    GIVEN("Invalid use of embedded messages") {
+        WHEN("Messages are nested") {
+            cmBeginMessage(&writer);
+            cmBeginMessage(&writer);
+
+            THEN("Invalid argument error") {
+                REQUIRE(writer.firstError == CM_ERROR_INVALID_ARG);
+            }
+        }
+
+        WHEN("Message is finished without start") {
+            cmEndMessage(&writer);
+
+            THEN("Invalid argument error") {
+                REQUIRE(writer.firstError == CM_ERROR_INVALID_ARG);
+            }
+        }
+
+        WHEN("CRC is written inside of message") {
+            cmEnableCrc32(&writer);
+            cmBeginMessage(&writer);
+            cmWriteCrc32(&writer);
+
+            THEN("Invalid argument error") {
+                REQUIRE(writer.firstError == CM_ERROR_INVALID_ARG);
+            }
+        }
+
+        WHEN("Message is started in stream writer") {
+            std::vector<uint8_t> output;
+            cmSetFlushCallback(&writer, appendToVector, &output);
+            cmBeginMessage(&writer);
+
+            THEN("Invalid argument error") {
+                REQUIRE(writer.firstError == CM_ERROR_INVALID_ARG);
+            }
+        }
+
+        WHEN("Message without endianness mark is embedded") {
+            uint8_t part[3] = {0x01, 0x02, 0x03};
+            cmWriteMessage(&writer, part, sizeof(part));
+
+            THEN("Invalid argument error") {
+                REQUIRE(writer.firstError == CM_ERROR_INVALID_ARG);
+            }
+        }
+
+        WHEN("Embedded message is truncated") {
+            cmBeginMessage(&writer);
+            writeEmbeddedTestContent(&writer, 1);
+            cmEndMessage(&writer);
+            auto reader = cmGetReader(buffer.data(), writer.usedSize - 1);
+            CompositeMessageReader message;
+
+            THEN("No value error") {
+                REQUIRE_FALSE(cmReadMessage(&reader, &message));
+                REQUIRE(reader.firstError == CM_ERROR_NO_VALUE);
+            }
+        }
+    }
+}
+
+SCENARIO("Malformed messages with inverse endianness", "[read][malformed]") {
+    GIVEN("Valid message with inverse endianness") {
+        // u16 0x0102, empty u16 array, name "ab" and u32 0x01020304
+        std::vector<uint8_t> message{0x07, 0x09, 0x05, 0x01, 0x02,
+                                     0x45, 0x00, 0x00, 0x00, 0x00,
+                                     0x80, 0x02, 'a', 'b', 0x00,
+                                     0x06, 0x01, 0x02, 0x03, 0x04};
+
+        WHEN("Message is converted") {
+            auto reader = cmGetReader(message.data(), message.size());
+
+            THEN("Values are read") {
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+                REQUIRE(cmReadU16(&reader) == 0x0102);
+                uint16_t items[1];
+                REQUIRE(cmReadUArray(&reader, items, 1) == 0);
+                char name[4];
+                REQUIRE(cmReadName(&reader, name, sizeof(name)) == 2);
+                REQUIRE(std::string(name) == "ab");
+                REQUIRE(cmReadU32(&reader) == 0x01020304);
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+            }
+        }
+    }
+
+    GIVEN("Malformed message with inverse endianness") {
+        std::vector<uint8_t> message{0x07, 0x09, 0x05, 0x01, 0x02};
+        // malformed element that follows u16 value
+        auto tail = GENERATE(
+                // array is longer than message
+                std::vector<uint8_t>{0x45, 0x00, 0x00, 0x00, 0x02, 0x01, 0x02},
+                // array count is huge
+                std::vector<uint8_t>{0x45, 0xFF, 0xFF, 0xFF, 0xFF, 0x01, 0x02},
+                // array count is truncated
+                std::vector<uint8_t>{0x45, 0x00, 0x00},
+                // value is truncated
+                std::vector<uint8_t>{0x06, 0x01, 0x02},
+                // name is longer than message
+                std::vector<uint8_t>{0x80, 0x05, 'a', 'b'},
+                // name length is missing
+                std::vector<uint8_t>{0x80},
+                // embedded message is longer than message
+                std::vector<uint8_t>{0x89, 0x00, 0x00, 0x01, 0x00, 0x05, 0x01, 0x02},
+                // flag is unknown
+                std::vector<uint8_t>{0x20, 0x01, 0x02},
+                // varint is truncated
+                std::vector<uint8_t>{0x65, 0x80, 0x80});
+        message.insert(message.end(), tail.begin(), tail.end());
+
+        WHEN("Message is converted") {
+            // exact copy lets sanitizers detect access past the end
+            std::unique_ptr<uint8_t[]> copy(new uint8_t[message.size()]);
+            std::memcpy(copy.get(), message.data(), message.size());
+            auto reader = cmGetReader(copy.get(), message.size());
+
+            THEN("Message is reported as malformed") {
+                REQUIRE(reader.firstError == CM_ERROR_MALFORMED);
+            }
+
+            AND_THEN("Elements before malformed one are converted") {
+                REQUIRE(copy[3] == 0x02);
+                REQUIRE(copy[4] == 0x01);
+            }
+        }
+    }
+}
+
+SCENARIO("Validation and unchecked reads", "[read][validate]") {
+    GIVEN("Message with values, array and block") {
+        std::vector<uint8_t> buffer(128);
+        auto writer = cmGetWriter(buffer.data(), buffer.size());
+        uint16_t items[3] = {1, 2, 3};
+        cmWriteU8(&writer, 200);
+        cmWriteI16(&writer, -300);
+        cmWriteU32(&writer, 0x01020304);
+        cmWriteI64(&writer, INT64_MIN);
+        cmWriteName(&writer, "block");
+        cmWriteBlockStart(&writer);
+        cmWriteF(&writer, 1.5f);
+        cmWriteD(&writer, -2.25);
+        cmWriteBlockEnd(&writer);
+        cmWriteUArray(&writer, items, 3);
+        cmWriteBool(&writer, true);
+        cmWriteChar(&writer, 'c');
+        REQUIRE(writer.firstError == CM_ERROR_NONE);
+
+        WHEN("Message is validated") {
+            auto reader = cmGetReader(buffer.data(), writer.usedSize);
+            bool valid = cmValidate(&reader);
+
+            THEN("Reader is trusted") {
+                REQUIRE(valid);
+                REQUIRE(reader.trusted);
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+                REQUIRE(reader.readSize == 2);
+            }
+
+            AND_THEN("Values are read unchecked") {
+                REQUIRE(cmReadU8Unchecked(&reader) == 200);
+                REQUIRE(cmReadI16Unchecked(&reader) == -300);
+                REQUIRE(cmReadU32Unchecked(&reader) == 0x01020304);
+                REQUIRE(cmReadI64Unchecked(&reader) == INT64_MIN);
+                char name[8];
+                cmReadName(&reader, name, sizeof(name));
+                cmReadBlockStart(&reader);
+                REQUIRE(cmReadFUnchecked(&reader) == 1.5f);
+                REQUIRE(cmReadDUnchecked(&reader) == -2.25);
+                cmReadBlockEnd(&reader);
+                const void *view;
+                REQUIRE(cmReadArrayViewUnchecked(&reader, &view) == 3);
+                REQUIRE(std::memcmp(view, items, sizeof(items)) == 0);
+                REQUIRE(cmReadBoolUnchecked(&reader));
+                REQUIRE(cmReadCharUnchecked(&reader) == 'c');
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+                REQUIRE(reader.readSize == writer.usedSize);
+            }
+        }
+
+        WHEN("Message with inversed endianness is validated by const reader") {
+            std::vector<uint8_t> inversed(16);
+            auto inversedWriter = cmGetWriter(inversed.data(), inversed.size());
+            cmWriteU8(&inversedWriter, 200);
+            cmWriteU32(&inversedWriter, 0x01020304);
+            std::swap(inversed[0], inversed[1]);
+            std::reverse(&inversed[5], &inversed[9]);
+            CompositeMessageReader reader;
+            cmInitConstReader(&reader, inversed.data(), inversedWriter.usedSize);
+            bool valid = cmValidate(&reader);
+
+            THEN("Message is valid, but reader is not trusted") {
+                REQUIRE(reader.swapBytes);
+                REQUIRE(valid);
+                REQUIRE_FALSE(reader.trusted);
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+                REQUIRE(cmReadU8(&reader) == 200);
+                REQUIRE(cmReadU32(&reader) == 0x01020304);
+            }
+        }
+
+        WHEN("Message is truncated") {
+            auto reader = cmGetReader(buffer.data(), writer.usedSize - 1);
+            bool valid = cmValidate(&reader);
+
+            THEN("Message is malformed") {
+                REQUIRE_FALSE(valid);
+                REQUIRE_FALSE(reader.trusted);
+                REQUIRE(reader.firstError == CM_ERROR_MALFORMED);
+            }
+        }
+
+        WHEN("Block is not closed") {
+            cmWriteBlockStart(&writer);
+            auto reader = cmGetReader(buffer.data(), writer.usedSize);
+
+            THEN("Message is malformed") {
+                REQUIRE_FALSE(cmValidate(&reader));
+                REQUIRE(reader.firstError == CM_ERROR_MALFORMED);
+            }
+        }
+
+        WHEN("Block is closed twice") {
+            cmWriteBlockEnd(&writer);
+            auto reader = cmGetReader(buffer.data(), writer.usedSize);
+
+            THEN("Message is malformed") {
+                REQUIRE_FALSE(cmValidate(&reader));
+                REQUIRE(reader.firstError == CM_ERROR_MALFORMED);
+            }
+        }
+
+        WHEN("Message is validated by stream reader") {
+            std::vector<uint8_t> streamBuffer(64);
+            CompositeMessageReader reader;
+            cmInitStreamReader(&reader, streamBuffer.data(), streamBuffer.size());
+            cmFeed(&reader, buffer.data(), 32);
+
+            THEN("Invalid argument error") {
+                REQUIRE_FALSE(cmValidate(&reader));
+                REQUIRE(reader.firstError == CM_ERROR_INVALID_ARG);
+            }
+        }
+    }
+}
+
+namespace {
+    struct Telemetry {
+        uint32_t id;
+        int16_t temperature;
+        uint8_t flags;
+        int64_t time;
+        float voltage;
+        double position;
+        bool valid;
+        char unit;
+        uint16_t count;
+    };
+
+    const CMFieldDesc TELEMETRY_FIELDS[] = {
+            cmFieldDesc(Telemetry, id, CM_TYPE_UINT),
+            cmFieldDesc(Telemetry, temperature, CM_TYPE_INT),
+            cmFieldDesc(Telemetry, flags, CM_TYPE_UINT),
+            cmFieldDesc(Telemetry, time, CM_TYPE_INT),
+            cmFieldDesc(Telemetry, voltage, CM_TYPE_FLOAT),
+            cmFieldDesc(Telemetry, position, CM_TYPE_FLOAT),
+            cmFieldDesc(Telemetry, valid, CM_TYPE_BOOL),
+            cmFieldDesc(Telemetry, unit, CM_TYPE_CHAR),
+            cmFieldDesc(Telemetry, count, CM_TYPE_UINT),
+    };
+    const uint32_t TELEMETRY_FIELD_COUNT = 9;
+
+    void writeTelemetry(CompositeMessageWriter *writer, const Telemetry &t) {
+        cmWriteU32(writer, t.id);
+        cmWriteI16(writer, t.temperature);
+        cmWriteU8(writer, t.flags);
+        cmWriteI64(writer, t.time);
+        cmWriteF(writer, t.voltage);
+        cmWriteD(writer, t.position);
+        cmWriteBool(writer, t.valid);
+        cmWriteChar(writer, t.unit);
+        cmWriteU16(writer, t.count);
+    }
+
+    void requireEqual(const Telemetry &a, const Telemetry &b) {
+        REQUIRE(a.id == b.id);
+        REQUIRE(a.temperature == b.temperature);
+        REQUIRE(a.flags == b.flags);
+        REQUIRE(a.time == b.time);
+        REQUIRE(a.voltage == b.voltage);
+        REQUIRE(a.position == b.position);
+        REQUIRE(a.valid == b.valid);
+        REQUIRE(a.unit == b.unit);
+        REQUIRE(a.count == b.count);
+    }
+}
+
+SCENARIO("Batch read and write of struct fields", "[batch]") {
+    GIVEN("Struct and message written field by field") {
+        Telemetry t{0xA1B2C3D4, -1234, 0x81, INT64_MIN + 5, 3.5f, -0.125,
+                    true, 'C', 513};
+        std::vector<uint8_t> expected(128);
+        auto expectedWriter = cmGetWriter(expected.data(), expected.size());
+        writeTelemetry(&expectedWriter, t);
+        expected.resize(expectedWriter.usedSize);
+        std::vector<uint8_t> buffer(128);
+
+        WHEN("Struct is written in batch") {
+            auto writer = cmGetWriter(buffer.data(), buffer.size());
+            cmWriteBatch(&writer, TELEMETRY_FIELDS, &t, TELEMETRY_FIELD_COUNT);
+            buffer.resize(writer.usedSize);
+
+            THEN("Message is the same") {
+                REQUIRE(writer.firstError == CM_ERROR_NONE);
+                REQUIRE(buffer == expected);
+            }
+
+            AND_THEN("Struct is read in batch") {
+                Telemetry read{};
+                auto reader = cmGetReader(buffer.data(), buffer.size());
+                REQUIRE(cmReadBatch(&reader, TELEMETRY_FIELDS, &read,
+                                    TELEMETRY_FIELD_COUNT));
+                REQUIRE(reader.readSize == buffer.size());
+                requireEqual(read, t);
+            }
+        }
+
+        WHEN("Struct is written with compact integers") {
+            std::vector<uint8_t> compact(128);
+            auto compactWriter = cmGetWriter(compact.data(), compact.size());
+            cmSetCompactIntegers(&compactWriter, true);
+            writeTelemetry(&compactWriter, t);
+            compact.resize(compactWriter.usedSize);
+
+            auto writer = cmGetWriter(buffer.data(), buffer.size());
+            cmSetCompactIntegers(&writer, true);
+            cmWriteBatch(&writer, TELEMETRY_FIELDS, &t, TELEMETRY_FIELD_COUNT);
+            buffer.resize(writer.usedSize);
+
+            THEN("Integers are written as varints") {
+                REQUIRE(writer.firstError == CM_ERROR_NONE);
+                REQUIRE(buffer == compact);
+            }
+
+            AND_THEN("Struct is read in batch") {
+                Telemetry read{};
+                auto reader = cmGetReader(buffer.data(), buffer.size());
+                REQUIRE(cmReadBatch(&reader, TELEMETRY_FIELDS, &read,
+                                    TELEMETRY_FIELD_COUNT));
+                requireEqual(read, t);
+            }
+        }
+
+        WHEN("Struct is written by stream writer with small buffer") {
+            std::vector<uint8_t> output;
+            std::vector<uint8_t> streamBuffer(16);
+            auto writer = cmGetWriter(streamBuffer.data(), streamBuffer.size());
+            cmSetFlushCallback(&writer, [](void *context, const void *data, uint32_t size) {
+                auto *out = (std::vector<uint8_t> *) context;
+                out->insert(out->end(), (const uint8_t *) data, (const uint8_t *) data + size);
+                return true;
+            }, &output);
+            cmWriteBatch(&writer, TELEMETRY_FIELDS, &t, TELEMETRY_FIELD_COUNT);
+            cmFlush(&writer);
+
+            THEN("Message is the same") {
+                REQUIRE(writer.firstError == CM_ERROR_NONE);
+                REQUIRE(output == expected);
+            }
+        }
+
+        WHEN("Struct is written to too small buffer") {
+            auto writer = cmGetWriter(buffer.data(), expected.size() - 1);
+            cmWriteBatch(&writer, TELEMETRY_FIELDS, &t, TELEMETRY_FIELD_COUNT);
+
+            THEN("Nothing is written") {
+                REQUIRE(writer.firstError == CM_ERROR_NO_SPACE);
+                REQUIRE(writer.usedSize == 2);
+            }
+        }
+
+        WHEN("Description has invalid size") {
+            CMFieldDesc desc[2] = {TELEMETRY_FIELDS[0], {0, CM_TYPE_UINT, 3}};
+            auto writer = cmGetWriter(buffer.data(), buffer.size());
+            cmWriteBatch(&writer, desc, &t, 2);
+            Telemetry read{};
+            auto reader = cmGetReader(expected.data(), expected.size());
+            bool readResult = cmReadBatch(&reader, desc, &read, 2);
+
+            THEN("Invalid argument error") {
+                REQUIRE(writer.firstError == CM_ERROR_INVALID_ARG);
+                REQUIRE(writer.usedSize == 2);
+                REQUIRE_FALSE(readResult);
+                REQUIRE(reader.firstError == CM_ERROR_INVALID_ARG);
+            }
+        }
+
+        WHEN("Description has invalid type") {
+            // no type, array flag, type after CM_TYPE_CHAR and length bits
+            uint8_t type = GENERATE(0x00, 0x40, 0x18, CM_TYPE_UINT | 0x01);
+            CMFieldDesc desc[2] = {TELEMETRY_FIELDS[0], {0, type, 1}};
+            auto writer = cmGetWriter(buffer.data(), buffer.size());
+            cmWriteBatch(&writer, desc, &t, 2);
+            Telemetry read{};
+            auto reader = cmGetReader(expected.data(), expected.size());
+            bool readResult = cmReadBatch(&reader, desc, &read, 2);
+
+            THEN("Invalid argument error") {
+                REQUIRE(writer.firstError == CM_ERROR_INVALID_ARG);
+                REQUIRE(writer.usedSize == 2);
+                REQUIRE_FALSE(readResult);
+                REQUIRE(reader.firstError == CM_ERROR_INVALID_ARG);
+            }
+        }
+
+        WHEN("Struct with different fields is read") {
+            CMFieldDesc desc[2] = {TELEMETRY_FIELDS[0], TELEMETRY_FIELDS[2]};
+            Telemetry read{};
+            auto reader = cmGetReader(expected.data(), expected.size());
+            bool readResult = cmReadBatch(&reader, desc, &read, 2);
+
+            THEN("Value error and read position is restored") {
+                REQUIRE_FALSE(readResult);
+                REQUIRE(reader.firstError == CM_ERROR_NO_VALUE);
+                REQUIRE(reader.readSize == 2);
+            }
+        }
+
+        WHEN("Struct is read from stream") {
+            std::vector<uint8_t> streamBuffer(128);
+            CompositeMessageReader reader;
+            cmInitStreamReader(&reader, streamBuffer.data(), streamBuffer.size());
+            Telemetry read{};
+            uint32_t fed = 0;
+            while (!cmReadBatch(&reader, TELEMETRY_FIELDS, &read,
+                                TELEMETRY_FIELD_COUNT)) {
+                REQUIRE(reader.firstError == CM_ERROR_NEED_MORE);
+                cmFeed(&reader, &expected[fed], 7);
+                fed += 7;
+            }
+
+            THEN("Struct is read after all bytes are received") {
+                REQUIRE(fed >= expected.size());
+                requireEqual(read, t);
+            }
+        }
+    }
+}
+
+SCENARIO("Record tables", "[table]") {
+    GIVEN("Array of structs") {
+        std::vector<Telemetry> records{
+                {1, -10, 0x01, 1000, 1.5f, 0.5, true, 'A', 10},
+                {2, -20, 0x02, 2000, 2.5f, 1.5, false, 'B', 20},
+                {3, -30, 0x03, 3000, 3.5f, 2.5, true, 'C', 30},
+        };
+        uint32_t recordSize = 4 + 2 + 1 + 8 + 4 + 8 + 1 + 1 + 2;
+        std::vector<uint8_t> buffer(256);
+
+        WHEN("Records are written as table") {
+            auto writer = cmGetWriter(buffer.data(), buffer.size());
+            cmWriteRecordTable(&writer, TELEMETRY_FIELDS, TELEMETRY_FIELD_COUNT,
+                               records.data(), sizeof(Telemetry), records.size());
+            cmWriteU8(&writer, 42);
+            REQUIRE(writer.firstError == CM_ERROR_NONE);
+            std::vector<uint8_t> message(buffer.begin(), buffer.begin() + writer.usedSize);
+
+            THEN("There is one flag for whole table") {
+                REQUIRE(message.size() == CM_SIZEOF_MARK + CM_SIZEOF_U8 +
+                        cmSizeofRecordTable(TELEMETRY_FIELD_COUNT, recordSize, 3));
+                REQUIRE(message[2] == 0x8A);
+            }
+
+            AND_THEN("Records are read back") {
+                std::vector<Telemetry> read(3);
+                auto reader = cmGetReader(message.data(), message.size());
+                REQUIRE(cmPeekRecordCount(&reader) == 3);
+                REQUIRE(cmReadRecordTable(&reader, TELEMETRY_FIELDS, TELEMETRY_FIELD_COUNT,
+                                          read.data(), sizeof(Telemetry), 3) == 3);
+                REQUIRE(cmReadU8(&reader) == 42);
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+                for (size_t i = 0; i < records.size(); ++i) {
+                    requireEqual(read[i], records[i]);
+                }
+            }
+
+            AND_THEN("Columns are read separately") {
+                int16_t temperatures[3];
+                double positions[3];
+                auto reader = cmGetReader(message.data(), message.size());
+                REQUIRE(cmReadIColumn(&reader, 1, temperatures, 3) == 3);
+                REQUIRE(cmReadFloatColumn(&reader, 5, positions, 3) == 3);
+                REQUIRE(reader.readSize == 2);
+                cmSkip(&reader);
+                REQUIRE(cmReadU8(&reader) == 42);
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+                REQUIRE(temperatures[0] == -10);
+                REQUIRE(temperatures[2] == -30);
+                REQUIRE(positions[1] == 1.5);
+            }
+
+            AND_THEN("Column with different type can't be read") {
+                uint16_t temperatures[3];
+                auto reader = cmGetReader(message.data(), message.size());
+                REQUIRE(cmReadUColumn(&reader, 1, temperatures, 3) == 0);
+                REQUIRE(reader.firstError == CM_ERROR_NO_VALUE);
+            }
+
+            AND_THEN("Missing column can't be read") {
+                int16_t values[3];
+                auto reader = cmGetReader(message.data(), message.size());
+                REQUIRE(cmReadIColumn(&reader, 9, values, 3) == 0);
+                REQUIRE(reader.firstError == CM_ERROR_NO_VALUE);
+            }
+
+            AND_THEN("Records don't fit in small buffer") {
+                std::vector<Telemetry> read(2);
+                auto reader = cmGetReader(message.data(), message.size());
+                cmReadRecordTable(&reader, TELEMETRY_FIELDS, TELEMETRY_FIELD_COUNT,
+                                  read.data(), sizeof(Telemetry), 2);
+                REQUIRE(reader.firstError == CM_ERROR_NO_SPACE);
+                REQUIRE(reader.readSize == 2);
+            }
+
+            AND_THEN("Records with other columns can't be read") {
+                std::vector<Telemetry> read(3);
+                auto reader = cmGetReader(message.data(), message.size());
+                cmReadRecordTable(&reader, TELEMETRY_FIELDS, TELEMETRY_FIELD_COUNT - 1,
+                                  read.data(), sizeof(Telemetry), 3);
+                REQUIRE(reader.firstError == CM_ERROR_NO_VALUE);
+            }
+
+            AND_THEN("Table is truncated") {
+                auto reader = cmGetReader(message.data(), message.size() - 3);
+                cmPeekRecordCount(&reader);
+                REQUIRE(reader.firstError == CM_ERROR_NO_VALUE);
+            }
+        }
+
+        WHEN("Records are written by stream writer with small buffer") {
+            std::vector<uint8_t> expected(256);
+            auto expectedWriter = cmGetWriter(expected.data(), expected.size());
+            cmWriteRecordTable(&expectedWriter, TELEMETRY_FIELDS, TELEMETRY_FIELD_COUNT,
+                               records.data(), sizeof(Telemetry), records.size());
+            expected.resize(expectedWriter.usedSize);
+
+            std::vector<uint8_t> output;
+            auto writer = cmGetWriter(buffer.data(), 32);
+            cmSetFlushCallback(&writer, [](void *context, const void *data, uint32_t size) {
+                auto *out = (std::vector<uint8_t> *) context;
+                out->insert(out->end(), (const uint8_t *) data, (const uint8_t *) data + size);
+                return true;
+            }, &output);
+            cmWriteRecordTable(&writer, TELEMETRY_FIELDS, TELEMETRY_FIELD_COUNT,
+                               records.data(), sizeof(Telemetry), records.size());
+            cmFlush(&writer);
+
+            THEN("Message is the same") {
+                REQUIRE(writer.firstError == CM_ERROR_NONE);
+                REQUIRE(output == expected);
+            }
+        }
+
+        WHEN("Records are written to too small buffer") {
+            auto writer = cmGetWriter(buffer.data(), 32);
+            cmWriteRecordTable(&writer, TELEMETRY_FIELDS, TELEMETRY_FIELD_COUNT,
+                               records.data(), sizeof(Telemetry), records.size());
+
+            THEN("Nothing is written") {
+                REQUIRE(writer.firstError == CM_ERROR_NO_SPACE);
+                REQUIRE(writer.usedSize == 2);
+            }
+        }
+
+        WHEN("Column description has invalid type") {
+            uint8_t type = GENERATE(0x00, 0x40, 0x18, CM_TYPE_UINT | 0x01);
+            CMFieldDesc validDesc[2] = {TELEMETRY_FIELDS[0], TELEMETRY_FIELDS[2]};
+            CMFieldDesc desc[2] = {TELEMETRY_FIELDS[0], {TELEMETRY_FIELDS[2].offset, type, 1}};
+            auto writer = cmGetWriter(buffer.data(), buffer.size());
+            cmWriteRecordTable(&writer, desc, 2, records.data(), sizeof(Telemetry),
+                               records.size());
+
+            std::vector<uint8_t> message(256);
+            auto valid = cmGetWriter(message.data(), message.size());
+            cmWriteRecordTable(&valid, validDesc, 2, records.data(), sizeof(Telemetry),
+                               records.size());
+            REQUIRE(valid.firstError == CM_ERROR_NONE);
+            std::vector<Telemetry> read(3);
+            auto tableReader = cmGetReader(message.data(), valid.usedSize);
+            cmReadRecordTable(&tableReader, desc, 2, read.data(), sizeof(Telemetry), 3);
+            uint8_t column[3];
+            auto columnReader = cmGetReader(message.data(), valid.usedSize);
+            cmReadColumn(&columnReader, 1, type, 1, column, 3);
+
+            THEN("Invalid argument error") {
+                REQUIRE(writer.firstError == CM_ERROR_INVALID_ARG);
+                REQUIRE(writer.usedSize == 2);
+                REQUIRE(tableReader.firstError == CM_ERROR_INVALID_ARG);
+                REQUIRE(columnReader.firstError == CM_ERROR_INVALID_ARG);
+            }
+        }
+
+        WHEN("Table has no columns") {
+            auto writer = cmGetWriter(buffer.data(), buffer.size());
+            cmWriteRecordTable(&writer, TELEMETRY_FIELDS, 0,
+                               records.data(), sizeof(Telemetry), records.size());
+
+            THEN("Invalid argument error") {
+                REQUIRE(writer.firstError == CM_ERROR_INVALID_ARG);
+            }
+        }
+    }
+
+    GIVEN("Record table with CRC in inverse endian mode") {
+        // two records of u16 and u32 columns
+        std::vector<uint8_t> buffer{0x07, 0x09, 0x8A, 0x00, 0x00, 0x00, 0x02,
+                                    0x02, 0x05, 0x06,
+                                    0x01, 0x02, 0x03, 0x04,
+                                    0x0A, 0x0B, 0x0C, 0x0D, 0x00, 0x00, 0x00, 0x01};
+        uint32_t crc = referenceCrc32(&buffer[2], buffer.size() - 2);
+        buffer.push_back(0x88);
+        buffer.resize(buffer.size() + 4);
+        memcpy(&buffer[buffer.size() - 4], &crc, sizeof(crc));
+        std::reverse(buffer.end() - 4, buffer.end());
+        std::vector<uint8_t> original = buffer;
+
+        WHEN("Message is converted by reader") {
+            auto reader = cmGetReader(buffer.data(), buffer.size());
+            uint16_t u16[2];
+            uint32_t u32[2];
+            cmReadUColumn(&reader, 0, u16, 2);
+            cmReadUColumn(&reader, 1, u32, 2);
+            cmSkip(&reader);
+            bool valid = cmVerifyCrc32(&reader);
+
+            THEN("Columns and CRC are converted") {
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+                REQUIRE(u16[0] == 0x0102);
+                REQUIRE(u16[1] == 0x0304);
+                REQUIRE(u32[0] == 0x0A0B0C0D);
+                REQUIRE(u32[1] == 1);
+                REQUIRE(valid);
+            }
+        }
+
+        WHEN("Message is read by const reader") {
+            CompositeMessageReader reader;
+            cmInitConstReader(&reader, buffer.data(), buffer.size());
+            uint16_t u16[2];
+            uint32_t u32[2];
+            REQUIRE(cmPeekRecordCount(&reader) == 2);
+            cmReadUColumn(&reader, 0, u16, 2);
+            cmReadUColumn(&reader, 1, u32, 2);
+            cmSkip(&reader);
+            bool valid = cmVerifyCrc32(&reader);
+
+            THEN("Values are swapped and message is not changed") {
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+                REQUIRE(u16[1] == 0x0304);
+                REQUIRE(u32[0] == 0x0A0B0C0D);
+                REQUIRE(valid);
+                REQUIRE(buffer == original);
+            }
+        }
+
+        WHEN("Columns are longer than message") {
+            buffer[6] = 0x03;
+            auto reader = cmGetReader(buffer.data(), buffer.size());
+
+            THEN("Message is malformed") {
+                REQUIRE(reader.firstError == CM_ERROR_MALFORMED);
+            }
+        }
+    }
+}
+
+SCENARIO("String dictionary", "[dictionary]") {
+    GIVEN("Records with repeated names and strings") {
+        std::vector<uint8_t> buffer(256);
+        std::vector<CMDictionaryEntry> entries(8);
+        std::vector<char> chars(64);
+        CMDictionary dictionary;
+        cmInitDictionary(&dictionary, entries.data(), entries.size(), chars.data(),
+                         chars.size());
+        const char *unit = "celsius";
+        auto writeRecords = [unit](CompositeMessageWriter *writer) {
+            for (uint8_t i = 0; i < 3; ++i) {
+                cmWriteName(writer, "temperature");
+                cmWriteU8(writer, i);
+                cmWriteName(writer, "unit");
+                cmWriteString(writer, unit, strlen(unit));
+            }
+        };
+
+        std::vector<uint8_t> plain(256);
+        auto plainWriter = cmGetWriter(plain.data(), plain.size());
+        writeRecords(&plainWriter);
+        REQUIRE(plainWriter.firstError == CM_ERROR_NONE);
+
+        WHEN("Records are written with dictionary") {
+            auto writer = cmGetWriter(buffer.data(), buffer.size());
+            cmSetWriterDictionary(&writer, &dictionary);
+            writeRecords(&writer);
+            REQUIRE(writer.firstError == CM_ERROR_NONE);
+
+            THEN("Repeated strings are written as indexes") {
+                // definitions take one more byte, references take 2 bytes
+                REQUIRE(writer.usedSize == CM_SIZEOF_MARK + 3 * CM_SIZEOF_U8 +
+                        (3 + 11 + 1) + (3 + 4 + 1) + (3 + 7 + 1) + 6 * 2);
+                REQUIRE(writer.usedSize < plainWriter.usedSize);
+                REQUIRE(buffer[2] == 0x8B);
+                REQUIRE(buffer[3] == 0);
+                REQUIRE(dictionary.count == 3);
+            }
+
+            AND_THEN("Records are read with dictionary") {
+                std::vector<CMDictionaryEntry> readEntries(8);
+                std::vector<char> readChars(64);
+                CMDictionary readDictionary;
+                cmInitDictionary(&readDictionary, readEntries.data(), readEntries.size(),
+                                 readChars.data(), readChars.size());
+                auto reader = cmGetReader(buffer.data(), writer.usedSize);
+                cmSetReaderDictionary(&reader, &readDictionary);
+
+                for (uint8_t i = 0; i < 3; ++i) {
+                    char name[16];
+                    char str[16];
+                    REQUIRE(cmReadName(&reader, name, sizeof(name)) == 11);
+                    REQUIRE(std::string(name) == "temperature");
+                    REQUIRE(cmReadU8(&reader) == i);
+                    const char *view;
+                    REQUIRE(cmReadNameView(&reader, &view) == 4);
+                    REQUIRE(std::string(view) == "unit");
+                    REQUIRE(cmPeekStringLength(&reader) == 7);
+                    REQUIRE(cmReadString(&reader, str, sizeof(str)) == 8);
+                    REQUIRE(std::string(str) == unit);
+                }
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+                REQUIRE(reader.readSize == writer.usedSize);
+            }
+
+            AND_THEN("Skipped definitions are resolved when fields are found") {
+                std::vector<CMDictionaryEntry> readEntries(8);
+                std::vector<char> readChars(64);
+                CMDictionary readDictionary;
+                cmInitDictionary(&readDictionary, readEntries.data(), readEntries.size(),
+                                 readChars.data(), readChars.size());
+                auto reader = cmGetReader(buffer.data(), writer.usedSize);
+                cmSetReaderDictionary(&reader, &readDictionary);
+                // names are skipped with values
+                cmSkipN(&reader, 4);
+
+                const char *str;
+                char name[16];
+                REQUIRE(cmReadName(&reader, name, sizeof(name)) == 11);
+                REQUIRE(cmReadU8(&reader) == 2);
+                REQUIRE(cmReadNameView(&reader, &str) == 4);
+                REQUIRE(cmReadStringView(&reader, &str) == 7);
+                REQUIRE(std::string(str) == unit);
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+            }
+
+            AND_THEN("Records are read from stream with small buffer") {
+                std::vector<CMDictionaryEntry> readEntries(8);
+                std::vector<char> readChars(64);
+                CMDictionary readDictionary;
+                cmInitDictionary(&readDictionary, readEntries.data(), readEntries.size(),
+                                 readChars.data(), readChars.size());
+                std::vector<uint8_t> streamBuffer(24);
+                CompositeMessageReader reader;
+                cmInitStreamReader(&reader, streamBuffer.data(), streamBuffer.size());
+                cmSetReaderDictionary(&reader, &readDictionary);
+                uint32_t fed = 0;
+                auto feed = [&]() {
+                    uint32_t size = std::min(4u, writer.usedSize - fed);
+                    fed += cmFeed(&reader, &buffer[fed], size);
+                };
+
+                for (uint8_t i = 0; i < 3; ++i) {
+                    char name[16];
+                    char str[16];
+                    while (cmReadName(&reader, name, sizeof(name)) == 0) {
+                        REQUIRE(reader.firstError == CM_ERROR_NEED_MORE);
+                        feed();
+                    }
+                    REQUIRE(std::string(name) == "temperature");
+                    uint8_t value = cmReadU8(&reader);
+                    while (reader.firstError == CM_ERROR_NEED_MORE) {
+                        feed();
+                        value = cmReadU8(&reader);
+                    }
+                    REQUIRE(value == i);
+                    while (cmReadName(&reader, name, sizeof(name)) == 0) {
+                        REQUIRE(reader.firstError == CM_ERROR_NEED_MORE);
+                        feed();
+                    }
+                    REQUIRE(std::string(name) == "unit");
+                    while (cmReadString(&reader, str, sizeof(str)) == 0) {
+                        REQUIRE(reader.firstError == CM_ERROR_NEED_MORE);
+                        feed();
+                    }
+                    REQUIRE(std::string(str) == unit);
+                }
+                REQUIRE(fed == writer.usedSize);
+            }
+
+            AND_THEN("Unterminated definitions are rejected") {
+                std::vector<CMDictionaryEntry> readEntries(8);
+                std::vector<char> readChars(64);
+                CMDictionary readDictionary;
+                cmInitDictionary(&readDictionary, readEntries.data(), readEntries.size(),
+                                 readChars.data(), readChars.size());
+                std::vector<uint8_t> corrupted(buffer.begin(), buffer.begin() + writer.usedSize);
+                // terminators of "temperature" name and "celsius" string
+                REQUIRE(corrupted[16] == 0);
+                REQUIRE(corrupted[37] == 0);
+
+                corrupted[16] = 'X';
+                auto reader = cmGetReader(corrupted.data(), corrupted.size());
+                cmSetReaderDictionary(&reader, &readDictionary);
+                const char *view = nullptr;
+                REQUIRE(cmReadNameView(&reader, &view) == 0);
+                REQUIRE(view == nullptr);
+                REQUIRE(reader.firstError == CM_ERROR_NO_VALUE);
+                REQUIRE(reader.readSize == CM_SIZEOF_MARK);
+                REQUIRE(readDictionary.count == 0);
+
+                corrupted[16] = 0;
+                corrupted[37] = 'X';
+                cmResetDictionary(&readDictionary);
+                reader = cmGetReader(corrupted.data(), corrupted.size());
+                cmSetReaderDictionary(&reader, &readDictionary);
+                REQUIRE(cmReadNameView(&reader, &view) == 11);
+                REQUIRE(cmReadU8(&reader) == 0);
+                REQUIRE(cmReadNameView(&reader, &view) == 4);
+                REQUIRE(cmReadStringView(&reader, &view) == 0);
+                REQUIRE(reader.firstError == CM_ERROR_NO_VALUE);
+            }
+
+            AND_THEN("References can't be read without dictionary") {
+                auto reader = cmGetReader(buffer.data(), writer.usedSize);
+                char name[16];
+                REQUIRE(cmReadName(&reader, name, sizeof(name)) == 11);
+                cmSkipN(&reader, 3);
+                REQUIRE(cmReadName(&reader, name, sizeof(name)) == 0);
+                REQUIRE(reader.firstError == CM_ERROR_NO_VALUE);
+            }
+        }
+
+        WHEN("Message with dictionary is converted from inverse endianness") {
+            auto writer = cmGetWriter(buffer.data(), buffer.size());
+            cmSetWriterDictionary(&writer, &dictionary);
+            cmWriteName(&writer, "id");
+            cmWriteU16(&writer, 0x0102);
+            cmWriteName(&writer, "id");
+            cmWriteU16(&writer, 0x0304);
+            buffer.resize(writer.usedSize);
+            std::swap(buffer[0], buffer[1]);
+            std::swap(buffer[9], buffer[10]);
+            std::swap(buffer[14], buffer[15]);
+
+            auto reader = cmGetReader(buffer.data(), buffer.size());
+            cmSetReaderDictionary(&reader, &dictionary);
+
+            THEN("Values are converted and names are not changed") {
+                const char *name;
+                REQUIRE(cmReadNameView(&reader, &name) == 2);
+                REQUIRE(cmReadU16(&reader) == 0x0102);
+                REQUIRE(cmReadNameView(&reader, &name) == 2);
+                REQUIRE(std::string(name) == "id");
+                REQUIRE(cmReadU16(&reader) == 0x0304);
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+            }
+        }
+
+        WHEN("Long string is written by stream writer with small buffer") {
+            std::vector<uint8_t> streamBuffer(128);
+            std::vector<uint8_t> output;
+            auto writer = cmGetWriter(streamBuffer.data(), streamBuffer.size());
+            cmSetFlushCallback(&writer, appendToVector, &output);
+            cmSetWriterDictionary(&writer, &dictionary);
+            std::string longString(200, 'x');
+            cmWriteString(&writer, longString.c_str(), longString.size());
+            cmWriteString(&writer, unit, strlen(unit));
+            cmFlush(&writer);
+
+            THEN("String that doesn't fit is written in regular way") {
+                REQUIRE(writer.firstError == CM_ERROR_NONE);
+                REQUIRE(output.size() == CM_SIZEOF_MARK + cmSizeofString(200) +
+                        cmSizeofStringDefinition(7));
+                REQUIRE(dictionary.count == 1);
+
+                auto reader = cmGetReader(output.data(), output.size());
+                std::vector<CMDictionaryEntry> readEntries(8);
+                std::vector<char> readChars(64);
+                CMDictionary readDictionary;
+                cmInitDictionary(&readDictionary, readEntries.data(), readEntries.size(),
+                                 readChars.data(), readChars.size());
+                cmSetReaderDictionary(&reader, &readDictionary);
+                const char *str;
+                REQUIRE(cmReadStringView(&reader, &str) == 200);
+                REQUIRE(cmReadStringView(&reader, &str) == 7);
+                REQUIRE(std::string(str) == unit);
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+            }
+        }
+
+        WHEN("Dictionary is full") {
+            std::vector<CMDictionaryEntry> small(1);
+            CMDictionary full;
+            cmInitDictionary(&full, small.data(), small.size(), chars.data(), chars.size());
+            auto writer = cmGetWriter(buffer.data(), buffer.size());
+            cmSetWriterDictionary(&writer, &full);
+            writeRecords(&writer);
+
+            THEN("Other strings are written in regular way") {
+                REQUIRE(writer.firstError == CM_ERROR_NONE);
+                REQUIRE(full.count == 1);
+                REQUIRE(buffer[2] == 0x8B);
+                REQUIRE(buffer[19] == 0x80);
+                std::vector<CMDictionaryEntry> readEntries(1);
+                std::vector<char> readChars(16);
+                CMDictionary readDictionary;
+                cmInitDictionary(&readDictionary, readEntries.data(), readEntries.size(),
+                                 readChars.data(), readChars.size());
+                auto reader = cmGetReader(buffer.data(), writer.usedSize);
+                cmSetReaderDictionary(&reader, &readDictionary);
+                const char *str;
+                cmSkipN(&reader, 5);
+                REQUIRE(cmReadNameView(&reader, &str) == 4);
+                REQUIRE(cmReadStringView(&reader, &str) == 7);
+                REQUIRE(std::string(str) == unit);
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+            }
+        }
+
+        WHEN("Fields are indexed") {
+            auto writer = cmGetWriter(buffer.data(), buffer.size());
+            cmSetWriterDictionary(&writer, &dictionary);
+            cmWriteName(&writer, "id");
+            cmWriteU32(&writer, 42);
+            cmWriteName(&writer, "unit");
+            cmWriteString(&writer, unit, strlen(unit));
+            REQUIRE(dictionary.count == 3);
+            // next message in the same session refers to strings of previous one
+            auto next = cmGetWriter(buffer.data() + writer.usedSize,
+                                    buffer.size() - writer.usedSize);
+            cmSetWriterDictionary(&next, &dictionary);
+            cmWriteName(&next, "unit");
+            cmWriteString(&next, unit, strlen(unit));
+            cmWriteName(&next, "id");
+            cmWriteU32(&next, 43);
+            REQUIRE(next.firstError == CM_ERROR_NONE);
+            REQUIRE(next.usedSize == CM_SIZEOF_MARK + 3 * 2 + CM_SIZEOF_U32);
+
+            CMDictionary session;
+            std::vector<CMDictionaryEntry> sessionEntries(8);
+            std::vector<char> sessionChars(64);
+            cmInitDictionary(&session, sessionEntries.data(), sessionEntries.size(),
+                             sessionChars.data(), sessionChars.size());
+            auto first = cmGetReader(buffer.data(), writer.usedSize);
+            cmSetReaderDictionary(&first, &session);
+            std::vector<CMFieldSlot> slots(4);
+            cmIndexFields(&first, slots.data(), slots.size());
+            cmUpdateDictionary(&first);
+            REQUIRE(first.firstError == CM_ERROR_NONE);
+            auto second = cmGetReader(buffer.data() + writer.usedSize, next.usedSize);
+            cmSetReaderDictionary(&second, &session);
+            std::vector<CMFieldSlot> nextSlots(4);
+            cmIndexFields(&second, nextSlots.data(), nextSlots.size());
+
+            THEN("Fields are found by names from dictionary") {
+                const char *str;
+                REQUIRE(second.firstError == CM_ERROR_NONE);
+                REQUIRE(cmFindField(&second, "id"));
+                REQUIRE(cmReadU32(&second) == 43);
+                REQUIRE(cmFindField(&second, "unit"));
+                REQUIRE(cmReadStringView(&second, &str) == 7);
+                REQUIRE(std::string(str) == unit);
+                REQUIRE_FALSE(cmFindField(&second, "time"));
+                cmSeek(&second, CM_SIZEOF_MARK);
+                REQUIRE(cmValidate(&second));
+            }
+        }
+    }
+}
+
+namespace {
+    void writeSensorLog(CompositeMessageWriter *writer) {
+        std::vector<int16_t> samples(64);
+        for (size_t i = 0; i < samples.size(); ++i) {
+            samples[i] = (int16_t) (i % 8);
+        }
+        for (uint32_t i = 0; i < 16; ++i) {
+            cmWriteName(writer, "sensor");
+            cmWriteBlockStart(writer);
+            cmWriteName(writer, "id");
+            cmWriteU32(writer, i);
+            cmWriteName(writer, "samples");
+            cmWriteIArray(writer, samples.data(), samples.size());
+            cmWriteBlockEnd(writer);
+        }
+    }
+
+    /**
+     * Decompress all compressed elements of reader and collect decompressed
+     * bytes (without endianness mark)
+     */
+    std::vector<uint8_t> decompressAll(CompositeMessageReader *reader,
+                                       const CMCompressor *compressor,
+                                       uint32_t capacity) {
+        std::vector<uint8_t> result;
+        std::vector<uint8_t> buffer(capacity);
+        CompositeMessageReader output;
+        cmInitStreamReader(&output, buffer.data(), buffer.size());
+        while (reader->firstError == CM_ERROR_NONE && reader->readSize < reader->totalSize) {
+            if (cmDecompress(reader, compressor, &output) == 0)
+                break;
+            result.insert(result.end(), buffer.begin() + output.readSize,
+                          buffer.begin() + output.totalSize);
+            cmSeek(&output, output.totalSize);
+        }
+        return result;
+    }
+
+    /**
+     * Codec provided by application: run of zero bytes is stored as 0x00 and
+     * length of run, other bytes are stored as is
+     */
+    uint32_t compressZeros(void *context, const void *data, uint32_t size, void *output,
+                           uint32_t capacity) {
+        ++*(int *) context;
+        auto *d = (const uint8_t *) data;
+        auto *out = (uint8_t *) output;
+        uint32_t used = 0;
+        for (uint32_t i = 0; i < size; ++i) {
+            if (used + 2 > capacity)
+                return 0;
+            out[used++] = d[i];
+            if (d[i] == 0) {
+                uint8_t run = 1;
+                while (i + 1 < size && d[i + 1] == 0 && run < 255) {
+                    ++run;
+                    ++i;
+                }
+                out[used++] = run;
+            }
+        }
+        return used;
+    }
+
+    bool decompressZeros(void *context, const void *data, uint32_t size, void *output,
+                         uint32_t outputSize) {
+        ++*(int *) context;
+        auto *d = (const uint8_t *) data;
+        auto *out = (uint8_t *) output;
+        uint32_t produced = 0;
+        for (uint32_t i = 0; i < size; ++i) {
+            uint32_t count = d[i] == 0 && i + 1 < size ? d[++i] : 1;
+            if (count > outputSize - produced)
+                return false;
+            std::memset(&out[produced], d[i] == 0 || count > 1 ? 0 : d[i], count);
+            produced += count;
+        }
+        return produced == outputSize;
+    }
+}
+
+SCENARIO("Compressed messages", "[compression]") {
+    std::vector<uint8_t> original(4096);
+    auto originalWriter = cmGetWriter(original.data(), original.size());
+    writeSensorLog(&originalWriter);
+    REQUIRE(originalWriter.firstError == CM_ERROR_NONE);
+    original.resize(originalWriter.usedSize);
+    std::vector<uint8_t> elements(original.begin() + 2, original.end());
+
+    CMLz4WorkBuffer work;
+    CMCompressor lz4;
+    cmInitLz4Compressor(&lz4, &work, 512);
+
+    GIVEN("Message compressed with LZ4") {
+        std::vector<uint8_t> buffer(cmSizeofCompressed(original.size(), 512) + 2);
+        auto writer = cmGetWriter(buffer.data(), buffer.size());
+        cmWriteCompressed(&writer, &lz4, original.data(), original.size());
+        REQUIRE(writer.firstError == CM_ERROR_NONE);
+        buffer.resize(writer.usedSize);
+
+        THEN("Message is smaller and consists of compressed blocks") {
+            REQUIRE(buffer.size() * 4 < original.size());
+            REQUIRE(buffer[2] == 0x8F);
+            REQUIRE(buffer[7] == CM_COMPRESSION_LZ4);
+        }
+
+        WHEN("Message is decompressed") {
+            auto reader = cmGetReader(buffer.data(), buffer.size());
+            auto decompressed = decompressAll(&reader, &lz4, 512 + 2);
+
+            THEN("Elements are the same") {
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+                REQUIRE(decompressed == elements);
+            }
+        }
+
+        WHEN("Elements are read from stream reader with small buffer") {
+            auto reader = cmGetReader(buffer.data(), buffer.size());
+            std::vector<uint8_t> streamBuffer(600);
+            CompositeMessageReader output;
+            cmInitStreamReader(&output, streamBuffer.data(), streamBuffer.size());
+            std::vector<int16_t> samples(64);
+            uint32_t blocks = 0;
+            for (uint32_t i = 0; i < 16; ++i) {
+                for (;;) {
+                    uint32_t start = output.readSize;
+                    char name[16];
+                    cmReadName(&output, name, sizeof(name));
+                    cmReadBlockStart(&output);
+                    cmReadName(&output, name, sizeof(name));
+                    uint32_t id = cmReadU32(&output);
+                    cmReadName(&output, name, sizeof(name));
+                    cmReadIArray(&output, samples.data(), samples.size());
+                    cmReadBlockEnd(&output);
+                    if (output.firstError == CM_ERROR_NONE) {
+                        REQUIRE(id == i);
+                        REQUIRE(samples[63] == 7);
+                        break;
+                    }
+                    // record is read again when next block is received
+                    REQUIRE(output.firstError == CM_ERROR_NEED_MORE);
+                    output.readSize = start;
+                    REQUIRE(cmDecompress(&reader, &lz4, &output) > 0);
+                    ++blocks;
+                }
+            }
+
+            THEN("Blocks are decompressed in place of read elements") {
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+                REQUIRE(reader.readSize == reader.totalSize);
+                REQUIRE(blocks == (elements.size() + 511) / 512);
+            }
+        }
+
+        WHEN("Decompression buffer has no space for unread elements") {
+            auto reader = cmGetReader(buffer.data(), buffer.size());
+            std::vector<uint8_t> streamBuffer(600);
+            CompositeMessageReader output;
+            cmInitStreamReader(&output, streamBuffer.data(), streamBuffer.size());
+            uint32_t first = cmDecompress(&reader, &lz4, &output);
+            uint32_t offset = reader.readSize;
+            uint32_t second = cmDecompress(&reader, &lz4, &output);
+
+            THEN("Block is decompressed after elements are read") {
+                REQUIRE(first == 512);
+                REQUIRE(second == 0);
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+                REQUIRE(reader.readSize == offset);
+                cmSkipN(&output, 3);
+                REQUIRE(cmDecompress(&reader, &lz4, &output) == 512);
+            }
+        }
+
+        WHEN("Decompression buffer is smaller than block") {
+            auto reader = cmGetReader(buffer.data(), buffer.size());
+            auto decompressed = decompressAll(&reader, &lz4, 256);
+
+            THEN("Space error") {
+                REQUIRE(decompressed.empty());
+                REQUIRE(reader.firstError == CM_ERROR_NO_SPACE);
+            }
+        }
+
+        WHEN("Compressed block is corrupted") {
+            // size of decompressed block is changed from 512 to 511
+            REQUIRE(buffer[8] == 0x80);
+            buffer[8] = 0xFF;
+            buffer[9] = 0x03;
+            auto reader = cmGetReader(buffer.data(), buffer.size());
+            decompressAll(&reader, &lz4, 600);
+
+            THEN("Message is malformed") {
+                REQUIRE(reader.firstError == CM_ERROR_MALFORMED);
+            }
+        }
+
+        WHEN("Message is decompressed with other codec") {
+            int calls = 0;
+            CMCompressor other{CM_COMPRESSION_HEATSHRINK, 512, compressZeros,
+                               decompressZeros, &calls};
+            auto reader = cmGetReader(buffer.data(), buffer.size());
+            decompressAll(&reader, &other, 600);
+
+            THEN("Invalid argument error") {
+                REQUIRE(reader.firstError == CM_ERROR_INVALID_ARG);
+                REQUIRE(calls == 0);
+            }
+        }
+    }
+
+    GIVEN("Message compressed as it is written by stream writer") {
+        std::vector<uint8_t> output;
+        std::vector<uint8_t> outputBuffer(300);
+        auto outputWriter = cmGetWriter(outputBuffer.data(), outputBuffer.size());
+        cmSetFlushCallback(&outputWriter, appendToVector, &output);
+        CMCompressingStream stream{&outputWriter, &lz4, 0};
+
+        std::vector<uint8_t> buffer(200);
+        auto writer = cmGetWriter(buffer.data(), buffer.size());
+        cmSetFlushCallback(&writer, cmFlushCompressed, &stream);
+        writeSensorLog(&writer);
+        cmFlush(&writer);
+        cmFlush(&outputWriter);
+
+        THEN("Blocks fit in buffers of both writers") {
+            REQUIRE(writer.firstError == CM_ERROR_NONE);
+            REQUIRE(outputWriter.firstError == CM_ERROR_NONE);
+            REQUIRE(output.size() < original.size() / 2);
+
+            auto reader = cmGetReader(output.data(), output.size());
+            REQUIRE(decompressAll(&reader, &lz4, 256) == elements);
+            REQUIRE(reader.firstError == CM_ERROR_NONE);
+        }
+    }
+
+    GIVEN("Message that can't be compressed") {
+        std::vector<uint8_t> noise(1000);
+        uint32_t x = 12345;
+        for (auto &b : noise) {
+            x = x * 1103515245u + 12345u;
+            b = (uint8_t) (x >> 24);
+        }
+        std::vector<uint8_t> message(1024);
+        auto messageWriter = cmGetWriter(message.data(), message.size());
+        cmWriteUArray(&messageWriter, noise.data(), noise.size());
+        message.resize(messageWriter.usedSize);
+
+        std::vector<uint8_t> buffer(cmSizeofCompressed(message.size(), 512) + 2);
+        auto writer = cmGetWriter(buffer.data(), buffer.size());
+        cmWriteCompressed(&writer, &lz4, message.data(), message.size());
+
+        THEN("Blocks are stored as is") {
+            REQUIRE(writer.firstError == CM_ERROR_NONE);
+            REQUIRE(writer.usedSize == message.size() + 2 * (1 + 4 + 1 + 2));
+            REQUIRE(buffer[7] == CM_COMPRESSION_STORED);
+
+            auto reader = cmGetReader(buffer.data(), writer.usedSize);
+            auto decompressed = decompressAll(&reader, &lz4, 600);
+            REQUIRE(decompressed == std::vector<uint8_t>(message.begin() + 2, message.end()));
+        }
+    }
+
+    GIVEN("Codec provided by application") {
+        int calls = 0;
+        CMCompressor custom{CM_COMPRESSION_HEATSHRINK, 1024, compressZeros,
+                            decompressZeros, &calls};
+        std::vector<uint8_t> zeros(3000);
+        std::vector<uint8_t> message(4096);
+        auto messageWriter = cmGetWriter(message.data(), message.size());
+        cmWriteU32(&messageWriter, 42);
+        cmWriteUArray(&messageWriter, zeros.data(), zeros.size());
+        message.resize(messageWriter.usedSize);
+
+        std::vector<uint8_t> buffer(4096);
+        auto writer = cmGetWriter(buffer.data(), buffer.size());
+        cmWriteCompressed(&writer, &custom, message.data(), message.size());
+        REQUIRE(writer.firstError == CM_ERROR_NONE);
+
+        WHEN("Message is decompressed with the same codec") {
+            auto reader = cmGetReader(buffer.data(), writer.usedSize);
+            auto decompressed = decompressAll(&reader, &custom, 1100);
+
+            THEN("Callbacks are used for each block") {
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+                REQUIRE(decompressed == std::vector<uint8_t>(message.begin() + 2, message.end()));
+                REQUIRE(writer.usedSize < 100);
+                REQUIRE(buffer[7] == CM_COMPRESSION_HEATSHRINK);
+                REQUIRE(calls == 2 * 3);
+            }
+        }
+    }
+
+    GIVEN("Stored block with inverse endianness") {
+        std::vector<uint8_t> buffer{0x07, 0x09, 0x8F, 0x00, 0x00, 0x00, 0x05,
+                                    CM_COMPRESSION_STORED, 0x03, 0x05, 0x01, 0x02};
+
+        WHEN("Block is decompressed") {
+            auto reader = cmGetReader(buffer.data(), buffer.size());
+            std::vector<uint8_t> streamBuffer(16);
+            CompositeMessageReader output;
+            cmInitStreamReader(&output, streamBuffer.data(), streamBuffer.size());
+            uint32_t size = cmDecompress(&reader, &lz4, &output);
+
+            THEN("Elements keep endianness of compressed message") {
+                REQUIRE(size == 3);
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+                REQUIRE(output.swapBytes);
+                REQUIRE(cmReadU16(&output) == 0x0102);
+            }
+        }
+    }
+}
+
+namespace {
+    const double alignedDoubles[3] = {1.5, -2.5, 4.0};
+    const int16_t alignedShorts[3] = {-1, 2, -3};
+    const uint64_t alignedLongs[2] = {0x0102030405060708ULL, 9};
+
+    void writeMixedArrays(CompositeMessageWriter *writer) {
+        cmWriteU8(writer, 1);
+        cmWriteName(writer, "d");
+        cmWriteFloatArray(writer, alignedDoubles, 3);
+        cmWriteIArray(writer, alignedShorts, 3);
+        auto *items = (uint32_t *) cmBeginArray(writer, CM_TYPE_UINT, 4, 2);
+        if (items != nullptr) {
+            uint32_t values[2] = {7, 8};
+            std::memcpy(items, values, sizeof(values));
+            cmCommitArray(writer, 2);
+        }
+        cmWriteString(writer, "abc", 3);
+        cmWriteU16(writer, 5);
+        cmWriteUArray(writer, alignedLongs, 2);
+    }
+}
+
+SCENARIO("Aligned arrays", "[aligned]") {
+    // messages are placed in buffers aligned to 8 bytes
+    std::vector<uint64_t> plainStorage(32);
+    auto *plain = (uint8_t *) plainStorage.data();
+    auto plainWriter = cmGetWriter(plain, 256);
+    writeMixedArrays(&plainWriter);
+    REQUIRE(plainWriter.firstError == CM_ERROR_NONE);
+
+    GIVEN("Message written with aligned arrays") {
+        std::vector<uint64_t> storage(32);
+        auto *buffer = (uint8_t *) storage.data();
+        auto writer = cmGetWriter(buffer, 256);
+        cmSetAlignedArrays(&writer, true);
+        writeMixedArrays(&writer);
+        REQUIRE(writer.firstError == CM_ERROR_NONE);
+
+        THEN("Padding is added only before arrays") {
+            REQUIRE(writer.usedSize > plainWriter.usedSize);
+            REQUIRE(writer.usedSize - plainWriter.usedSize < 4 * 8);
+            // u8 value and name are not padded
+            REQUIRE(std::memcmp(buffer, plain, 8) == 0);
+            // 3 padding flags place items of double array at offset 16
+            REQUIRE(buffer[8] == 0x87);
+            REQUIRE(buffer[10] == 0x87);
+            REQUIRE(buffer[11] == plain[8]);
+        }
+
+        WHEN("Arrays are read as views") {
+            auto reader = cmGetReader(buffer, writer.usedSize);
+            REQUIRE(cmReadU8(&reader) == 1);
+            char name[4];
+            cmReadName(&reader, name, sizeof(name));
+            const double *doubles;
+            const int16_t *shorts;
+            const uint32_t *ints;
+            const char *str;
+            const uint64_t *longs;
+            uint32_t doubleCount = cmReadFloatArrayView(&reader, &doubles);
+            uint32_t shortCount = cmReadIArrayView(&reader, &shorts);
+            uint32_t intCount = cmReadUArrayView(&reader, &ints);
+            uint32_t strLength = cmReadStringView(&reader, &str);
+            uint16_t u16 = cmReadU16(&reader);
+            uint32_t longCount = cmReadUArrayView(&reader, &longs);
+
+            THEN("Items are aligned to their size") {
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+                REQUIRE(reader.readSize == writer.usedSize);
+                REQUIRE(doubleCount == 3);
+                REQUIRE(shortCount == 3);
+                REQUIRE(intCount == 2);
+                REQUIRE(longCount == 2);
+                REQUIRE((uintptr_t) doubles % 8 == 0);
+                REQUIRE((uintptr_t) shorts % 2 == 0);
+                REQUIRE((uintptr_t) ints % 4 == 0);
+                REQUIRE((uintptr_t) longs % 8 == 0);
+            }
+
+            AND_THEN("Items are accessed directly") {
+                REQUIRE(doubles[1] == -2.5);
+                REQUIRE(shorts[2] == -3);
+                REQUIRE(ints[1] == 8);
+                REQUIRE(longs[0] == alignedLongs[0]);
+                REQUIRE(strLength == 3);
+                REQUIRE(std::strcmp(str, "abc") == 0);
+                REQUIRE(u16 == 5);
+            }
+        }
+
+        WHEN("Arrays are copied") {
+            auto reader = cmGetReader(buffer, writer.usedSize);
+            cmSkipN(&reader, 2);
+            int16_t shorts[3];
+            uint32_t count = cmReadIArray(&reader, shorts, 3);
+
+            THEN("Padding is skipped as part of arrays") {
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+                REQUIRE(count == 3);
+                REQUIRE(std::memcmp(shorts, alignedShorts, sizeof(shorts)) == 0);
+            }
+        }
+
+        WHEN("Fields are skipped and indexed") {
+            auto reader = cmGetReader(buffer, writer.usedSize);
+            cmSkipN(&reader, 7);
+            CMIndexEntry entries[16];
+            CMIndexEntry plainEntries[16];
+            auto indexReader = cmGetReader(buffer, writer.usedSize);
+            uint32_t entryCount = cmBuildIndex(&indexReader, entries, 16);
+            auto plainReader = cmGetReader(plain, plainWriter.usedSize);
+            uint32_t plainCount = cmBuildIndex(&plainReader, plainEntries, 16);
+
+            THEN("Padding is not counted as field or entry") {
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+                REQUIRE(reader.readSize == writer.usedSize);
+                REQUIRE(entryCount == plainCount);
+                for (uint32_t i = 0; i < entryCount; ++i) {
+                    REQUIRE(entries[i].flag == plainEntries[i].flag);
+                    REQUIRE(entries[i].size == plainEntries[i].size);
+                }
+                uint64_t longs[2];
+                REQUIRE(cmReadTypedArrayAt(&indexReader, entries, 7, CM_TYPE_UINT,
+                                           8, longs, 2) == 2);
+                REQUIRE(longs[1] == 9);
+            }
+        }
+
+        WHEN("Message is validated") {
+            auto reader = cmGetReader(buffer, writer.usedSize);
+            REQUIRE(cmValidate(&reader));
+            cmSkipN(&reader, 2);
+            const void *view;
+            uint32_t count = cmReadArrayViewUnchecked(&reader, &view);
+
+            THEN("Unchecked view is aligned") {
+                REQUIRE(count == 3);
+                REQUIRE((uintptr_t) view % 2 == 0);
+                REQUIRE(((const int16_t *) view)[1] == 2);
+            }
+        }
+
+        WHEN("Message is written by stream writer") {
+            std::vector<uint8_t> output;
+            uint8_t streamBuffer[40];
+            auto stream = cmGetWriter(streamBuffer, sizeof(streamBuffer));
+            cmSetFlushCallback(&stream, appendToVector, &output);
+            cmSetAlignedArrays(&stream, true);
+            writeMixedArrays(&stream);
+            cmFlush(&stream);
+
+            THEN("Padding depends on offset in message, not in buffer") {
+                REQUIRE(stream.firstError == CM_ERROR_NONE);
+                REQUIRE(output == std::vector<uint8_t>(buffer, buffer + writer.usedSize));
+            }
+        }
+    }
+}
+
+namespace {
+    void writeReading(CompositeMessageWriter *writer, uint32_t id, double value,
+                      const int16_t *samples) {
+        cmWriteName(writer, "id");
+        cmWriteU32(writer, id);
+        cmWriteName(writer, "value");
+        cmWriteD(writer, value);
+        cmWriteName(writer, "samples");
+        cmWriteIArray(writer, samples, 4);
+        cmWriteBlockStart(writer);
+        cmWriteBool(writer, id % 2 == 0);
+        cmWriteBlockEnd(writer);
+    }
+}
+
+SCENARIO("Message templates", "[template]") {
+    const int16_t zeros[4] = {};
+    std::vector<uint8_t> sampleBuffer(128);
+    auto sampleWriter = cmGetWriter(sampleBuffer.data(), sampleBuffer.size());
+    writeReading(&sampleWriter, 0, 0, zeros);
+    REQUIRE(sampleWriter.firstError == CM_ERROR_NONE);
+
+    uint8_t signature[64];
+    uint8_t mask[64];
+    CMTemplateField fields[8];
+    CMTemplate tmpl;
+    cmInitTemplate(&tmpl, signature, mask, sizeof(signature), fields, 8);
+
+    GIVEN("Template compiled from sample message") {
+        auto sample = cmGetReader(sampleBuffer.data(), sampleWriter.usedSize);
+        REQUIRE(cmCompileTemplate(&tmpl, &sample));
+        REQUIRE(sample.readSize == 2);
+        REQUIRE(tmpl.size == sampleWriter.usedSize - 2);
+        REQUIRE(tmpl.fieldCount == 4);
+        REQUIRE(tmpl.fields[0].flag == 0x06);
+        REQUIRE(tmpl.fields[2].size == 8);
+
+        const int16_t samples[4] = {1, -2, 3, -4};
+        std::vector<uint8_t> buffer(256);
+        auto writer = cmGetWriter(buffer.data(), buffer.size());
+
+        WHEN("Message with the same layout is matched") {
+            writeReading(&writer, 42, -1.5, samples);
+            auto reader = cmGetReader(buffer.data(), writer.usedSize);
+            const uint8_t *data = cmMatchTemplate(&reader, &tmpl);
+
+            THEN("Values are read at fixed offsets") {
+                REQUIRE(data == &buffer[2]);
+                REQUIRE(reader.readSize == writer.usedSize);
+                uint32_t id;
+                double value;
+                int16_t items[4];
+                std::memcpy(&id, data + tmpl.fields[0].offset, sizeof(id));
+                std::memcpy(&value, data + tmpl.fields[1].offset, sizeof(value));
+                std::memcpy(items, data + tmpl.fields[2].offset, tmpl.fields[2].size);
+                REQUIRE(id == 42);
+                REQUIRE(value == -1.5);
+                REQUIRE(std::memcmp(items, samples, sizeof(items)) == 0);
+                REQUIRE(data[tmpl.fields[3].offset] == 1);
+            }
+        }
+
+        WHEN("Layouts are repeated in message") {
+            for (uint32_t i = 0; i < 3; ++i) {
+                writeReading(&writer, i, i, samples);
+            }
+            auto reader = cmGetReader(buffer.data(), writer.usedSize);
+            uint32_t matched = 0;
+            while (cmMatchTemplate(&reader, &tmpl) != nullptr) {
+                ++matched;
+            }
+
+            THEN("Each layout is matched") {
+                REQUIRE(matched == 3);
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+                REQUIRE(reader.readSize == writer.usedSize);
+            }
+        }
+
+        WHEN("Array has different number of items") {
+            cmWriteName(&writer, "id");
+            cmWriteU32(&writer, 42);
+            cmWriteName(&writer, "value");
+            cmWriteD(&writer, -1.5);
+            cmWriteName(&writer, "samples");
+            cmWriteIArray(&writer, samples, 3);
+            auto reader = cmGetReader(buffer.data(), writer.usedSize);
+
+            THEN("Template doesn't match and message is read as usual") {
+                REQUIRE(cmMatchTemplate(&reader, &tmpl) == nullptr);
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+                REQUIRE(reader.readSize == 2);
+                cmSkipN(&reader, 2);
+                char name[8];
+                cmReadName(&reader, name, sizeof(name));
+                int16_t items[4];
+                REQUIRE(cmReadIArray(&reader, items, 4) == 3);
+            }
+        }
+
+        WHEN("Value has different type") {
+            cmWriteName(&writer, "id");
+            cmWriteU16(&writer, 42);
+            auto reader = cmGetReader(buffer.data(), writer.usedSize);
+
+            THEN("Template doesn't match") {
+                REQUIRE(cmMatchTemplate(&reader, &tmpl) == nullptr);
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+                REQUIRE(reader.readSize == 2);
+            }
+        }
+
+        WHEN("Message is received by stream reader") {
+            writeReading(&writer, 7, 2.5, samples);
+            std::vector<uint8_t> streamBuffer(64);
+            CompositeMessageReader reader;
+            cmInitStreamReader(&reader, streamBuffer.data(), streamBuffer.size());
+            cmFeed(&reader, buffer.data(), 16);
+            const uint8_t *partial = cmMatchTemplate(&reader, &tmpl);
+            uint8_t partialError = reader.firstError;
+            cmFeed(&reader, &buffer[16], writer.usedSize - 16);
+            const uint8_t *data = cmMatchTemplate(&reader, &tmpl);
+
+            THEN("Template is matched after the rest is received") {
+                REQUIRE(partial == nullptr);
+                REQUIRE(partialError == CM_ERROR_NEED_MORE);
+                REQUIRE(data != nullptr);
+                uint32_t id;
+                std::memcpy(&id, data + tmpl.fields[0].offset, sizeof(id));
+                REQUIRE(id == 7);
+            }
+        }
+    }
+
+    GIVEN("Sample with compact integers") {
+        std::vector<uint8_t> buffer(128);
+        auto writer = cmGetWriter(buffer.data(), buffer.size());
+        cmSetCompactIntegers(&writer, true);
+        writeReading(&writer, 0, 0, zeros);
+        auto sample = cmGetReader(buffer.data(), writer.usedSize);
+
+        WHEN("Template is compiled") {
+            bool compiled = cmCompileTemplate(&tmpl, &sample);
+
+            THEN("Invalid argument error") {
+                REQUIRE_FALSE(compiled);
+                REQUIRE(sample.firstError == CM_ERROR_INVALID_ARG);
+            }
+        }
+    }
+
+    GIVEN("Template without space for layout") {
+        CMTemplate small;
+        cmInitTemplate(&small, signature, mask, sizeof(signature), fields, 3);
+        auto sample = cmGetReader(sampleBuffer.data(), sampleWriter.usedSize);
+
+        WHEN("Template is compiled") {
+            bool compiled = cmCompileTemplate(&small, &sample);
+
+            THEN("Space error") {
+                REQUIRE_FALSE(compiled);
+                REQUIRE(sample.firstError == CM_ERROR_NO_SPACE);
+            }
+        }
+    }
+}
+
+namespace {
+    /**
+     * Append messages with version 10 * i and value i to log
+     */
+    void appendReadings(CMLogWriter *log, uint32_t count) {
+        for (uint32_t i = 0; i < count; ++i) {
+            uint8_t buffer[32];
+            auto writer = cmGetWriter(buffer, sizeof(buffer));
+            cmWriteMetadataStart(&writer);
+            cmWriteVersion(&writer, 10 * i);
+            cmWriteMetadataEnd(&writer);
+            cmWriteU32(&writer, i);
+            // messages have different sizes, so they need different padding
+            cmWriteString(&writer, "abcdefg", i % 8);
+            cmAppendLog(log, buffer, writer.usedSize);
+        }
+    }
+
+    uint32_t readLogValue(CMLogReader *log, uint64_t n) {
+        CompositeMessageReader reader;
+        if (!cmReadLogMessage(log, n, &reader))
+            return UINT32_MAX;
+        cmReadMetadataStart(&reader);
+        cmReadVersion(&reader);
+        cmReadMetadataEnd(&reader);
+        return cmReadU32(&reader);
+    }
+}
+
+SCENARIO("Log files", "[log]") {
+    std::vector<uint8_t> file;
+    CMLogEntry entries[4];
+    CMLogWriter log;
+    cmInitLogWriter(&log, entries, 4, appendToVector, &file);
+    CMLogIndex indexes[4];
+    CMLogReader reader;
+
+    GIVEN("Log with 10 messages and index after each 4 of them") {
+        appendReadings(&log, 10);
+        cmWriteLogIndex(&log);
+        REQUIRE(log.firstError == CM_ERROR_NONE);
+        REQUIRE(log.size == file.size());
+        // file is stored in memory aligned to 8 bytes as mapped file would be
+        std::vector<uint64_t> aligned(file.size() / 8 + 1);
+        std::memcpy(aligned.data(), file.data(), file.size());
+        auto *data = (const uint8_t *) aligned.data();
+
+        WHEN("Log is read") {
+            bool opened = cmInitLogReader(&reader, data, file.size(), indexes, 4);
+
+            THEN("Indexes are found through trailer") {
+                REQUIRE(opened);
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+                REQUIRE(reader.indexCount == 3);
+                REQUIRE(reader.messageCount == 10);
+                REQUIRE(reader.tailCount == 0);
+                REQUIRE(reader.indexes[2].firstMessage == 8);
+                REQUIRE(reader.indexes[2].entryCount == 2);
+            }
+
+            AND_THEN("Messages are read in place") {
+                for (uint32_t i = 0; i < 10; ++i) {
+                    REQUIRE(readLogValue(&reader, i) == i);
+                }
+                CompositeMessageReader message;
+                REQUIRE(cmReadLogMessage(&reader, 7, &message));
+                REQUIRE((message.message - data) % 8 == 0);
+                REQUIRE_FALSE(cmReadLogMessage(&reader, 10, &message));
+                REQUIRE(reader.firstError == CM_ERROR_NONE);
+            }
+
+            AND_THEN("Messages are found by version") {
+                REQUIRE(cmFindLogVersion(&reader, 0) == 0);
+                REQUIRE(cmFindLogVersion(&reader, 45) == 5);
+                REQUIRE(cmFindLogVersion(&reader, 80) == 8);
+                REQUIRE(cmFindLogVersion(&reader, 91) == 10);
+            }
+        }
+
+        WHEN("Reader has no space for all indexes") {
+            bool opened = cmInitLogReader(&reader, data, file.size(), indexes, 2);
+
+            THEN("Space error") {
+                REQUIRE_FALSE(opened);
+                REQUIRE(reader.firstError == CM_ERROR_NO_SPACE);
+            }
+        }
+
+        WHEN("Log is mapped from file") {
+            const char *path = "composite_message_test.log";
+            FILE *f = std::fopen(path, "wb");
+            REQUIRE(f != nullptr);
+            std::fwrite(file.data(), 1, file.size(), f);
+            std::fclose(f);
+            bool opened = cmOpenLog(&reader, path, indexes, 4);
+            uint32_t value = readLogValue(&reader, 9);
+            uint64_t found = cmFindLogVersion(&reader, 30);
+            cmCloseLog(&reader);
+            std::remove(path);
+
+#if defined(__unix__) || defined(__APPLE__)
+            THEN("Messages are read from mapped file") {
+                REQUIRE(opened);
+                REQUIRE(value == 9);
+                REQUIRE(found == 3);
+            }
+#else
+            THEN("Mapping is not supported") {
+                REQUIRE_FALSE(opened);
+                REQUIRE(reader.firstError == CM_ERROR_INVALID_ARG);
+            }
+#endif
+        }
+    }
+
+    GIVEN("Log that was not finished") {
+        appendReadings(&log, 10);
+        // the last two messages are not indexed
+        uint32_t size = (uint32_t) file.size();
+
+        WHEN("Log is read") {
+            bool opened = cmInitLogReader(&reader, file.data(), size, indexes, 4);
+
+            THEN("Messages after the last index are found by walking through file") {
+                REQUIRE(opened);
+                REQUIRE(reader.indexCount == 2);
+                REQUIRE(reader.messageCount == 10);
+                REQUIRE(reader.tailCount == 2);
+                REQUIRE(readLogValue(&reader, 7) == 7);
+                REQUIRE(readLogValue(&reader, 9) == 9);
+                REQUIRE(cmFindLogVersion(&reader, 75) == 8);
+                REQUIRE(cmFindLogVersion(&reader, 85) == 9);
+                REQUIRE(cmFindLogVersion(&reader, 95) == 10);
+            }
+        }
+
+        WHEN("Last message is truncated") {
+            // last message (21 bytes) is followed by 7 bytes of padding
+            bool opened = cmInitLogReader(&reader, file.data(), size - 10, indexes, 4);
+
+            THEN("It is ignored") {
+                REQUIRE(opened);
+                REQUIRE(reader.messageCount == 9);
+                REQUIRE(reader.tailCount == 1);
+                REQUIRE(readLogValue(&reader, 8) == 8);
+            }
+        }
+    }
+
+    GIVEN("File that is not a log") {
+        std::vector<uint8_t> buffer(64);
+        auto writer = cmGetWriter(buffer.data(), buffer.size());
+        cmWriteU32(&writer, 1);
+
+        WHEN("Log is read") {
+            bool opened = cmInitLogReader(&reader, buffer.data(), writer.usedSize,
+                                          indexes, 4);
+
+            THEN("Log is malformed") {
+                REQUIRE_FALSE(opened);
+                REQUIRE(reader.firstError == CM_ERROR_MALFORMED);
+            }
+        }
+
+        WHEN("It is appended as message") {
+            cmAppendLog(&log, &buffer[2], writer.usedSize - 2);
+
+            THEN("Invalid argument error") {
+                REQUIRE(log.firstError == CM_ERROR_INVALID_ARG);
+            }
+        }
+
+        WHEN("Missing file is opened") {
+            bool opened = cmOpenLog(&reader, "missing/composite_message.log", indexes, 4);
+
+            THEN("Error is set") {
+                REQUIRE_FALSE(opened);
+                REQUIRE(reader.firstError != CM_ERROR_NONE);
+            }
+        }
+    }
+}
+
+#if defined(CM_PROFILE)
+SCENARIO("Profiling of operations", "[profile]") {
+    std::vector<uint8_t> buffer(256);
+    CMProfileStats stats;
+    std::memset(&stats, 0, sizeof(stats));
+
+    GIVEN("Message with array and values in inverse endian mode") {
+        uint16_t data[4] = {0x0100, 0x0200, 0x0300, 0x0400};
+        auto writer = cmGetWriter(buffer.data(), buffer.size());
+        cmSetWriterProfileStats(&writer, &stats);
+        cmWriteUArray(&writer, data, 4);
+        cmWriteU16(&writer, 0x0505);
+        cmWriteU16(&writer, 0x0606);
+        std::swap(buffer[0], buffer[1]);
+        std::reverse(&buffer[3], &buffer[7]);
+
+        WHEN("Message is read") {
+            CompositeMessageReader reader;
+            cmInitProfiledReader(&reader, buffer.data(), writer.usedSize, &stats);
+            uint16_t read[4];
+            cmReadUArray(&reader, read, 4);
+            REQUIRE(cmReadU16(&reader) == 0x0505);
+            REQUIRE(cmReadU16(&reader) == 0x0606);
+            cmReadU32(&reader);
+            cmSetWriterProfileStats(&writer, nullptr);
+            cmWriteUArray(&writer, data, 4);
+            // readers and writers without stats are not measured
+            auto other = cmGetReader(buffer.data(), writer.usedSize);
+            cmReadU16(&other);
+
+            THEN("Operations are counted") {
+                auto &write = stats.ops[CM_PROFILE_WRITE_ARRAY];
+                REQUIRE(write.count == 1);
+                REQUIRE(write.bytes == 13);
+                auto &get = stats.ops[CM_PROFILE_GET_READER];
+                REQUIRE(get.count == 1);
+                REQUIRE(get.bytes == 2 + 13 + 6);
+                auto &convert = stats.ops[CM_PROFILE_CONVERT];
+                REQUIRE(convert.count == 1);
+                REQUIRE(convert.bytes == 13 + 6);
+                REQUIRE(get.cycles >= convert.cycles);
+                // failed read is counted as well, but it doesn't move data
+                auto &value = stats.ops[CM_PROFILE_READ_VALUE];
+                REQUIRE(value.count == 3);
+                REQUIRE(value.bytes == 6);
+            }
+        }
+    }
+}
+#endif